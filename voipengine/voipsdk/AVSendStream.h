@@ -30,6 +30,8 @@
 @property(assign, nonatomic)int videoChannel;
 
 @property (assign, nonatomic)BOOL hasVideo;
+//VP8 temporal layers, 0 or 1 for a single layer.
+@property (assign, nonatomic)int temporalLayers;
 
 -(void)sendKeyFrame;
 -(BOOL)start;
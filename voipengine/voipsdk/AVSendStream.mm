@@ -261,6 +261,11 @@
                 videoCodec.startBitrate = startBitrate;
                 videoCodec.maxBitrate = startBitrate * 3;
             }
+            if (videoCodec.codecType == webrtc::kVideoCodecVP8 &&
+                self.temporalLayers > 1) {
+                videoCodec.codecSpecific.VP8.numberOfTemporalLayers =
+                    MIN(self.temporalLayers, webrtc::kMaxTemporalStreams);
+            }
             EXPECT_EQ(0, rtc.codec->SetSendCodec(self.videoChannel, videoCodec));
             sendCodecSet = true;
         }
@@ -0,0 +1,394 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include "AudioFec.h"
+
+#include <string.h>
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VOIP_HAS_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define VOIP_HAS_SSE2
+#endif
+
+static const size_t kRtpHeaderSize = 12;
+//Span of sequence numbers a parity mask can describe.
+static const uint16_t kMaxMaskSpan = 16;
+
+static inline uint16_t ReadUint16(const uint8_t* p) {
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+static inline void WriteUint16(uint16_t v, uint8_t* p) {
+    p[0] = static_cast<uint8_t>(v >> 8);
+    p[1] = static_cast<uint8_t>(v);
+}
+
+static inline uint16_t RtpSequenceNumber(const uint8_t* packet) {
+    return ReadUint16(packet + 2);
+}
+
+static inline bool IsNewerSequenceNumber(uint16_t seq, uint16_t prev) {
+    return seq != prev && static_cast<uint16_t>(seq - prev) < 0x8000;
+}
+
+static void XorInto(uint8_t* dst, const uint8_t* src, size_t length) {
+    size_t i = 0;
+#if defined(VOIP_HAS_NEON)
+    for (; i + 32 <= length; i += 32) {
+        vst1q_u8(dst + i, veorq_u8(vld1q_u8(dst + i), vld1q_u8(src + i)));
+        vst1q_u8(dst + i + 16,
+                 veorq_u8(vld1q_u8(dst + i + 16), vld1q_u8(src + i + 16)));
+    }
+#elif defined(VOIP_HAS_SSE2)
+    for (; i + 32 <= length; i += 32) {
+        __m128i* d = reinterpret_cast<__m128i*>(dst + i);
+        const __m128i* s = reinterpret_cast<const __m128i*>(src + i);
+        _mm_storeu_si128(d, _mm_xor_si128(_mm_loadu_si128(d),
+                                          _mm_loadu_si128(s)));
+        _mm_storeu_si128(d + 1, _mm_xor_si128(_mm_loadu_si128(d + 1),
+                                              _mm_loadu_si128(s + 1)));
+    }
+#endif
+    for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+        uint64_t a, b;
+        memcpy(&a, dst + i, sizeof(a));
+        memcpy(&b, src + i, sizeof(b));
+        a ^= b;
+        memcpy(dst + i, &a, sizeof(a));
+    }
+    for (; i < length; i++) {
+        dst[i] ^= src[i];
+    }
+}
+
+AudioFecEncoder::AudioFecEncoder()
+: media_bytes_(0),
+  fec_bytes_(0) {
+    protection_.group_size = 0;
+    protection_.stride = 1;
+    ResetGroups();
+}
+
+void AudioFecEncoder::ResetGroups() {
+    for (int i = 0; i < kAudioFecMaxStride; i++) {
+        groups_[i].active = false;
+    }
+}
+
+void AudioFecEncoder::SetProtection(const AudioFecProtection& protection) {
+    AudioFecProtection p = protection;
+    if (p.group_size < 2) {
+        p.group_size = 0;
+    } else if (p.group_size > kAudioFecMaxGroupSize) {
+        p.group_size = kAudioFecMaxGroupSize;
+    }
+    if (p.stride < 1) {
+        p.stride = 1;
+    } else if (p.stride > kAudioFecMaxStride) {
+        p.stride = kAudioFecMaxStride;
+    }
+    if (p.group_size != protection_.group_size ||
+        p.stride != protection_.stride) {
+        protection_ = p;
+        ResetGroups();
+    }
+}
+
+size_t AudioFecEncoder::AddMediaPacket(const uint8_t* packet, size_t length,
+                                       uint8_t* fec_packet, size_t capacity) {
+    media_bytes_ += length;
+    if (protection_.group_size == 0 || length < kRtpHeaderSize ||
+        length > kAudioFecMaxPacketSize) {
+        return 0;
+    }
+
+    uint16_t seq = RtpSequenceNumber(packet);
+    Group& group = groups_[seq % protection_.stride];
+    if (group.active) {
+        uint16_t offset = seq - group.seq_base;
+        //Sequence jump or reordering, start over with this packet.
+        if (offset >= kMaxMaskSpan || (group.mask & (1 << offset))) {
+            group.active = false;
+        }
+    }
+    if (!group.active) {
+        group.active = true;
+        group.seq_base = seq;
+        group.mask = 0;
+        group.length_xor = 0;
+        group.count = 0;
+        group.max_length = 0;
+    }
+
+    uint16_t offset = seq - group.seq_base;
+    group.mask |= (1 << offset);
+    group.length_xor ^= static_cast<uint16_t>(length);
+    if (length > group.max_length) {
+        memset(group.payload + group.max_length, 0, length - group.max_length);
+        group.max_length = length;
+    }
+    XorInto(group.payload, packet, length);
+    group.count++;
+
+    if (group.count < protection_.group_size) {
+        return 0;
+    }
+    group.active = false;
+
+    size_t fec_length = kAudioFecHeaderSize + group.max_length;
+    if (fec_length > capacity) {
+        return 0;
+    }
+    WriteUint16(group.seq_base, fec_packet);
+    WriteUint16(group.mask, fec_packet + 2);
+    WriteUint16(group.length_xor, fec_packet + 4);
+    memcpy(fec_packet + kAudioFecHeaderSize, group.payload, group.max_length);
+    fec_bytes_ += fec_length;
+    return fec_length;
+}
+
+AudioFecDecoder::AudioFecDecoder(Callback* callback)
+: callback_(callback),
+  has_highest_seq_(false),
+  highest_seq_(0),
+  interval_received_(0),
+  interval_lost_(0),
+  interval_loss_events_(0),
+  total_lost_(0),
+  total_recovered_(0) {
+    for (int i = 0; i < kHistorySize; i++) {
+        history_[i].valid = false;
+    }
+    for (int i = 0; i < kPendingRingSize; i++) {
+        pending_[i].valid = false;
+    }
+}
+
+void AudioFecDecoder::Store(uint16_t seq, const uint8_t* packet,
+                            size_t length) {
+    StoredPacket& stored = history_[seq % kHistorySize];
+    stored.valid = true;
+    stored.seq = seq;
+    stored.length = length;
+    memcpy(stored.data, packet, length);
+}
+
+const AudioFecDecoder::StoredPacket* AudioFecDecoder::Find(
+    uint16_t seq) const {
+    const StoredPacket& stored = history_[seq % kHistorySize];
+    if (stored.valid && stored.seq == seq) {
+        return &stored;
+    }
+    return NULL;
+}
+
+void AudioFecDecoder::UpdateLossStatistics(uint16_t seq) {
+    interval_received_++;
+    if (!has_highest_seq_) {
+        has_highest_seq_ = true;
+        highest_seq_ = seq;
+        return;
+    }
+    if (!IsNewerSequenceNumber(seq, highest_seq_)) {
+        return;
+    }
+    uint16_t gap = seq - highest_seq_ - 1;
+    if (gap > 0) {
+        interval_lost_ += gap;
+        total_lost_ += gap;
+        interval_loss_events_++;
+    }
+    highest_seq_ = seq;
+}
+
+void AudioFecDecoder::OnMediaPacket(const uint8_t* packet, size_t length) {
+    if (length < kRtpHeaderSize || length > kAudioFecMaxPacketSize) {
+        return;
+    }
+    uint16_t seq = RtpSequenceNumber(packet);
+    UpdateLossStatistics(seq);
+    Store(seq, packet, length);
+    RecoverCovering(seq);
+}
+
+void AudioFecDecoder::OnFecPacket(const uint8_t* packet, size_t length) {
+    if (length <= kAudioFecHeaderSize ||
+        length > kAudioFecHeaderSize + kAudioFecMaxPacketSize) {
+        return;
+    }
+
+    //A slot still taken belongs to a parity packet at least a ring size
+    //older, or to a duplicate.
+    uint16_t seq_base = ReadUint16(packet);
+    PendingFec& fec = pending_[seq_base % kPendingRingSize];
+    fec.valid = true;
+    fec.seq_base = seq_base;
+    fec.mask = ReadUint16(packet + 2);
+    fec.length_xor = ReadUint16(packet + 4);
+    fec.payload_length = length - kAudioFecHeaderSize;
+    memcpy(fec.payload, packet + kAudioFecHeaderSize, fec.payload_length);
+
+    uint16_t recovered_seq = 0;
+    RecoverResult result = TryRecover(fec, &recovered_seq);
+    if (result == kKeep) {
+        return;
+    }
+    fec.valid = false;
+    if (result == kRecovered) {
+        RecoverCovering(recovered_seq);
+    }
+}
+
+AudioFecDecoder::RecoverResult AudioFecDecoder::TryRecover(
+    const PendingFec& fec, uint16_t* seq) {
+    if (has_highest_seq_ &&
+        static_cast<uint16_t>(highest_seq_ - fec.seq_base) >= kHistorySize &&
+        IsNewerSequenceNumber(highest_seq_, fec.seq_base)) {
+        //The covered packets left the history.
+        return kDone;
+    }
+
+    int missing = 0;
+    uint16_t missing_seq = 0;
+    for (uint16_t i = 0; i < kMaxMaskSpan; i++) {
+        if (!(fec.mask & (1 << i))) {
+            continue;
+        }
+        uint16_t seq = fec.seq_base + i;
+        if (Find(seq) == NULL) {
+            missing++;
+            missing_seq = seq;
+        }
+    }
+    if (missing == 0) {
+        return kDone;
+    }
+    if (missing > 1) {
+        return kKeep;
+    }
+
+    uint8_t recovered[kAudioFecMaxPacketSize];
+    uint16_t length = fec.length_xor;
+    memcpy(recovered, fec.payload, fec.payload_length);
+    for (uint16_t i = 0; i < kMaxMaskSpan; i++) {
+        if (!(fec.mask & (1 << i))) {
+            continue;
+        }
+        const StoredPacket* stored = Find(fec.seq_base + i);
+        if (stored == NULL) {
+            continue;
+        }
+        if (stored->length > fec.payload_length) {
+            return kDone;
+        }
+        length ^= static_cast<uint16_t>(stored->length);
+        XorInto(recovered, stored->data, stored->length);
+    }
+
+    //A corrupt or mismatched parity packet shows up as a bad length or a
+    //header that is not the missing RTP packet.
+    if (length < kRtpHeaderSize || length > fec.payload_length ||
+        (recovered[0] & 0xc0) != 0x80 ||
+        RtpSequenceNumber(recovered) != missing_seq) {
+        return kDone;
+    }
+
+    Store(missing_seq, recovered, length);
+    total_recovered_++;
+    if (callback_) {
+        callback_->OnRecoveredPacket(recovered, length);
+    }
+    *seq = missing_seq;
+    return kRecovered;
+}
+
+void AudioFecDecoder::RecoverCovering(uint16_t seq) {
+    //Every recovery stores one more packet, so the work list never holds
+    //more than the history.
+    uint16_t work[kHistorySize];
+    int count = 0;
+    work[count++] = seq;
+    while (count > 0) {
+        uint16_t arrived = work[--count];
+        for (uint16_t offset = 0; offset < kMaxMaskSpan; offset++) {
+            uint16_t seq_base = arrived - offset;
+            PendingFec& fec = pending_[seq_base % kPendingRingSize];
+            if (!fec.valid || fec.seq_base != seq_base ||
+                !(fec.mask & (1 << offset))) {
+                continue;
+            }
+            uint16_t recovered_seq = 0;
+            RecoverResult result = TryRecover(fec, &recovered_seq);
+            if (result == kKeep) {
+                continue;
+            }
+            fec.valid = false;
+            if (result == kRecovered && count < kHistorySize) {
+                work[count++] = recovered_seq;
+            }
+        }
+    }
+}
+
+void AudioFecDecoder::GetLossReport(uint8_t* fraction_lost,
+                                    uint8_t* mean_burst_x10) {
+    uint32_t expected = interval_received_ + interval_lost_;
+    *fraction_lost = 0;
+    *mean_burst_x10 = 0;
+    if (expected > 0) {
+        uint32_t fraction = (interval_lost_ << 8) / expected;
+        *fraction_lost = static_cast<uint8_t>(fraction > 255 ? 255 : fraction);
+    }
+    if (interval_loss_events_ > 0) {
+        uint32_t burst = interval_lost_ * 10 / interval_loss_events_;
+        *mean_burst_x10 = static_cast<uint8_t>(burst > 255 ? 255 : burst);
+    }
+    interval_received_ = 0;
+    interval_lost_ = 0;
+    interval_loss_events_ = 0;
+}
+
+AudioFecController::AudioFecController()
+: smoothed_loss_(0),
+  smoothed_burst_(1.0f) {
+    protection_.group_size = 0;
+    protection_.stride = 1;
+}
+
+bool AudioFecController::OnLossReport(uint8_t fraction_lost,
+                                      uint8_t mean_burst_x10) {
+    static const float kAlpha = 0.3f;
+    float loss = fraction_lost / 256.0f;
+    smoothed_loss_ += kAlpha * (loss - smoothed_loss_);
+    if (mean_burst_x10 > 0) {
+        smoothed_burst_ += kAlpha * (mean_burst_x10 / 10.0f - smoothed_burst_);
+    }
+
+    AudioFecProtection p;
+    if (smoothed_loss_ < 0.01f) {
+        p.group_size = 0;
+    } else if (smoothed_loss_ < 0.03f) {
+        p.group_size = 5;
+    } else if (smoothed_loss_ < 0.06f) {
+        p.group_size = 4;
+    } else if (smoothed_loss_ < 0.10f) {
+        p.group_size = 3;
+    } else {
+        p.group_size = 2;
+    }
+    p.stride = smoothed_burst_ >= 1.5f ? 2 : 1;
+
+    if (p.group_size == protection_.group_size &&
+        (p.group_size == 0 || p.stride == protection_.stride)) {
+        return false;
+    }
+    protection_ = p;
+    return true;
+}
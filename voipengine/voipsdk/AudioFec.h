@@ -0,0 +1,166 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#ifndef VOIP_AUDIO_FEC_H
+#define VOIP_AUDIO_FEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//XOR parity protection for the voice RTP stream, carried next to the media
+//in the VOIP framing.
+//
+//A parity packet covers up to 16 consecutive sequence numbers selected by
+//a mask. Whole RTP packets (header included) are XOR:ed, zero padded to the
+//longest one, so a single missing packet of a group is rebuilt byte exact
+//and handed to the voice engine like any other RTP packet, before NetEq
+//gives up on it.
+//
+//Parity packet layout, big endian:
+//  0  sequence number base
+//  2  mask, bit i covers base + i
+//  4  XOR of the covered packet lengths
+//  6  XOR of the covered packets
+enum {
+    kAudioFecHeaderSize = 6,
+    kAudioFecMaxPacketSize = 1500,
+    kAudioFecMaxGroupSize = 8,
+    kAudioFecMaxStride = 2,
+};
+
+struct AudioFecProtection {
+    //Media packets per parity packet, 0 disables protection.
+    int group_size;
+    //1 protects runs of consecutive packets, 2 interleaves two groups so a
+    //burst of two losses still leaves one loss per group.
+    int stride;
+};
+
+class AudioFecEncoder {
+public:
+    AudioFecEncoder();
+
+    void SetProtection(const AudioFecProtection& protection);
+    AudioFecProtection protection() const { return protection_; }
+
+    //Adds an outgoing RTP packet. Returns the size of the parity packet
+    //written to |fec_packet| when the packet closes a group, otherwise 0.
+    size_t AddMediaPacket(const uint8_t* packet, size_t length,
+                          uint8_t* fec_packet, size_t capacity);
+
+    uint64_t media_bytes() const { return media_bytes_; }
+    uint64_t fec_bytes() const { return fec_bytes_; }
+
+private:
+    struct Group {
+        bool active;
+        uint16_t seq_base;
+        uint16_t mask;
+        uint16_t length_xor;
+        int count;
+        size_t max_length;
+        uint8_t payload[kAudioFecMaxPacketSize];
+    };
+
+    void ResetGroups();
+
+    AudioFecProtection protection_;
+    Group groups_[kAudioFecMaxStride];
+    uint64_t media_bytes_;
+    uint64_t fec_bytes_;
+};
+
+class AudioFecDecoder {
+public:
+    class Callback {
+    public:
+        virtual void OnRecoveredPacket(const uint8_t* packet,
+                                       size_t length) = 0;
+    protected:
+        virtual ~Callback() {}
+    };
+
+    explicit AudioFecDecoder(Callback* callback);
+
+    //Every received media packet must go through here, it may complete a
+    //pending parity packet.
+    void OnMediaPacket(const uint8_t* packet, size_t length);
+    void OnFecPacket(const uint8_t* packet, size_t length);
+
+    //Loss seen on the network since the previous call, recovered packets
+    //still count as lost. |fraction_lost| is in 1/256, |mean_burst_x10| is
+    //the mean number of packets per loss event times ten.
+    void GetLossReport(uint8_t* fraction_lost, uint8_t* mean_burst_x10);
+
+    uint32_t packets_lost() const { return total_lost_; }
+    uint32_t packets_recovered() const { return total_recovered_; }
+
+private:
+    enum { kHistorySize = 64 };
+    //Parity packets waiting for more media, indexed by base % size.
+    enum { kPendingRingSize = 32 };
+    enum RecoverResult { kKeep, kDone, kRecovered };
+
+    struct StoredPacket {
+        bool valid;
+        uint16_t seq;
+        size_t length;
+        uint8_t data[kAudioFecMaxPacketSize];
+    };
+
+    struct PendingFec {
+        bool valid;
+        uint16_t seq_base;
+        uint16_t mask;
+        uint16_t length_xor;
+        size_t payload_length;
+        uint8_t payload[kAudioFecMaxPacketSize];
+    };
+
+    void Store(uint16_t seq, const uint8_t* packet, size_t length);
+    const StoredPacket* Find(uint16_t seq) const;
+    //kDone means the parity packet is used up, nothing is missing any more
+    //or it can never recover anything. kRecovered also sets |seq|.
+    RecoverResult TryRecover(const PendingFec& fec, uint16_t* seq);
+    //Retries the parity packets covering |seq| after it arrived, and those
+    //covering every packet recovered on the way.
+    void RecoverCovering(uint16_t seq);
+    void UpdateLossStatistics(uint16_t seq);
+
+    Callback* callback_;
+    StoredPacket history_[kHistorySize];
+    PendingFec pending_[kPendingRingSize];
+
+    bool has_highest_seq_;
+    uint16_t highest_seq_;
+    uint32_t interval_received_;
+    uint32_t interval_lost_;
+    uint32_t interval_loss_events_;
+    uint32_t total_lost_;
+    uint32_t total_recovered_;
+};
+
+//Picks the protection from the peer's loss reports. Loss is smoothed over
+//reports, more loss means smaller groups, bursty loss switches to the
+//interleaved layout.
+class AudioFecController {
+public:
+    AudioFecController();
+
+    //Returns true if the protection changed.
+    bool OnLossReport(uint8_t fraction_lost, uint8_t mean_burst_x10);
+
+    AudioFecProtection protection() const { return protection_; }
+
+private:
+    float smoothed_loss_;
+    float smoothed_burst_;
+    AudioFecProtection protection_;
+};
+
+#endif
@@ -0,0 +1,307 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include "AudioFrameOps.h"
+
+#include <string.h>
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VOIP_HAS_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define VOIP_HAS_SSE2
+#endif
+#include "webrtc/modules/interface/module_common_types.h"
+
+static inline int16_t SaturateS16(int32_t v) {
+    if (v > 32767) return 32767;
+    if (v < -32768) return -32768;
+    return static_cast<int16_t>(v);
+}
+
+#if defined(VOIP_HAS_NEON)
+//scale * v truncated toward zero, in two int32 halves.
+static inline int32x4_t ScaleLow(int16x8_t v, float32x4_t scale) {
+    return vcvtq_s32_f32(vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))),
+                                   scale));
+}
+static inline int32x4_t ScaleHigh(int16x8_t v, float32x4_t scale) {
+    return vcvtq_s32_f32(vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))),
+                                   scale));
+}
+#elif defined(VOIP_HAS_SSE2)
+static inline __m128i ScaleLow(__m128i v, __m128 scale) {
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+    return _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+}
+static inline __m128i ScaleHigh(__m128i v, __m128 scale) {
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+    return _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+}
+//Keeps the low 16 bits of every int32 lane, i.e. a wrapping narrow.
+static inline __m128i WrapToS16(__m128i lo, __m128i hi) {
+    lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+    hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+    return _mm_packs_epi32(lo, hi);
+}
+#endif
+
+void AudioFrameOps::MonoToStereo(const int16_t* src_audio,
+                                 int samples_per_channel,
+                                 int16_t* dst_audio) {
+    int i = 0;
+#if defined(VOIP_HAS_NEON)
+    for (; i + 8 <= samples_per_channel; i += 8) {
+        int16x8x2_t v;
+        v.val[0] = vld1q_s16(src_audio + i);
+        v.val[1] = v.val[0];
+        vst2q_s16(dst_audio + 2 * i, v);
+    }
+#elif defined(VOIP_HAS_SSE2)
+    for (; i + 8 <= samples_per_channel; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src_audio + i));
+        __m128i* d = reinterpret_cast<__m128i*>(dst_audio + 2 * i);
+        _mm_storeu_si128(d, _mm_unpacklo_epi16(v, v));
+        _mm_storeu_si128(d + 1, _mm_unpackhi_epi16(v, v));
+    }
+#endif
+    for (; i < samples_per_channel; i++) {
+        dst_audio[2 * i] = src_audio[i];
+        dst_audio[2 * i + 1] = src_audio[i];
+    }
+}
+
+int AudioFrameOps::MonoToStereo(webrtc::AudioFrame* frame) {
+    if (frame->num_channels_ != 1) {
+        return -1;
+    }
+    if ((frame->samples_per_channel_ * 2) >=
+        webrtc::AudioFrame::kMaxDataSizeSamples) {
+        return -1;
+    }
+
+    int16_t data_copy[webrtc::AudioFrame::kMaxDataSizeSamples];
+    memcpy(data_copy, frame->data_,
+           sizeof(int16_t) * frame->samples_per_channel_);
+    MonoToStereo(data_copy, frame->samples_per_channel_, frame->data_);
+    frame->num_channels_ = 2;
+    return 0;
+}
+
+void AudioFrameOps::StereoToMono(const int16_t* src_audio,
+                                 int samples_per_channel,
+                                 int16_t* dst_audio) {
+    int i = 0;
+    //Each vector iteration reads 16 samples before writing 8, so running in
+    //place is safe.
+#if defined(VOIP_HAS_NEON)
+    for (; i + 8 <= samples_per_channel; i += 8) {
+        int16x8x2_t v = vld2q_s16(src_audio + 2 * i);
+        int32x4_t lo = vaddl_s16(vget_low_s16(v.val[0]), vget_low_s16(v.val[1]));
+        int32x4_t hi = vaddl_s16(vget_high_s16(v.val[0]), vget_high_s16(v.val[1]));
+        vst1q_s16(dst_audio + i, vcombine_s16(vshrn_n_s32(lo, 1),
+                                              vshrn_n_s32(hi, 1)));
+    }
+#elif defined(VOIP_HAS_SSE2)
+    const __m128i ones = _mm_set1_epi16(1);
+    for (; i + 8 <= samples_per_channel; i += 8) {
+        const __m128i* s = reinterpret_cast<const __m128i*>(src_audio + 2 * i);
+        //madd sums each left/right pair into 32 bits.
+        __m128i lo = _mm_srai_epi32(_mm_madd_epi16(_mm_loadu_si128(s), ones), 1);
+        __m128i hi = _mm_srai_epi32(_mm_madd_epi16(_mm_loadu_si128(s + 1), ones), 1);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst_audio + i),
+                         _mm_packs_epi32(lo, hi));
+    }
+#endif
+    for (; i < samples_per_channel; i++) {
+        dst_audio[i] = (src_audio[2 * i] + src_audio[2 * i + 1]) >> 1;
+    }
+}
+
+int AudioFrameOps::StereoToMono(webrtc::AudioFrame* frame) {
+    if (frame->num_channels_ != 2) {
+        return -1;
+    }
+    StereoToMono(frame->data_, frame->samples_per_channel_, frame->data_);
+    frame->num_channels_ = 1;
+    return 0;
+}
+
+void AudioFrameOps::SwapStereoChannels(webrtc::AudioFrame* frame) {
+    if (frame->num_channels_ != 2) {
+        return;
+    }
+    int16_t* data = frame->data_;
+    const int length = frame->samples_per_channel_ * 2;
+    int i = 0;
+#if defined(VOIP_HAS_NEON)
+    for (; i + 8 <= length; i += 8) {
+        vst1q_s16(data + i, vrev32q_s16(vld1q_s16(data + i)));
+    }
+#elif defined(VOIP_HAS_SSE2)
+    for (; i + 8 <= length; i += 8) {
+        __m128i* d = reinterpret_cast<__m128i*>(data + i);
+        __m128i v = _mm_loadu_si128(d);
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        _mm_storeu_si128(d, v);
+    }
+#endif
+    for (; i < length; i += 2) {
+        int16_t temp = data[i];
+        data[i] = data[i + 1];
+        data[i + 1] = temp;
+    }
+}
+
+void AudioFrameOps::Mute(webrtc::AudioFrame* frame) {
+    memset(frame->data_, 0, sizeof(int16_t) *
+           frame->samples_per_channel_ * frame->num_channels_);
+    frame->energy_ = 0;
+}
+
+int AudioFrameOps::Scale(float left, float right, webrtc::AudioFrame* frame) {
+    if (frame->num_channels_ != 2) {
+        return -1;
+    }
+    int16_t* data = frame->data_;
+    const int length = frame->samples_per_channel_ * 2;
+    int i = 0;
+#if defined(VOIP_HAS_NEON)
+    const float gains[4] = { left, right, left, right };
+    float32x4_t scale = vld1q_f32(gains);
+    for (; i + 8 <= length; i += 8) {
+        int16x8_t v = vld1q_s16(data + i);
+        vst1q_s16(data + i, vcombine_s16(vmovn_s32(ScaleLow(v, scale)),
+                                         vmovn_s32(ScaleHigh(v, scale))));
+    }
+#elif defined(VOIP_HAS_SSE2)
+    __m128 scale = _mm_setr_ps(left, right, left, right);
+    for (; i + 8 <= length; i += 8) {
+        __m128i* d = reinterpret_cast<__m128i*>(data + i);
+        __m128i v = _mm_loadu_si128(d);
+        _mm_storeu_si128(d, WrapToS16(ScaleLow(v, scale), ScaleHigh(v, scale)));
+    }
+#endif
+    for (; i < length; i += 2) {
+        data[i] = static_cast<int16_t>(static_cast<int32_t>(left * data[i]));
+        data[i + 1] =
+            static_cast<int16_t>(static_cast<int32_t>(right * data[i + 1]));
+    }
+    return 0;
+}
+
+void AudioFrameOps::ScaleWithSat(float scale, int16_t* audio, int length) {
+    int i = 0;
+#if defined(VOIP_HAS_NEON)
+    float32x4_t gain = vdupq_n_f32(scale);
+    for (; i + 8 <= length; i += 8) {
+        int16x8_t v = vld1q_s16(audio + i);
+        vst1q_s16(audio + i, vcombine_s16(vqmovn_s32(ScaleLow(v, gain)),
+                                          vqmovn_s32(ScaleHigh(v, gain))));
+    }
+#elif defined(VOIP_HAS_SSE2)
+    __m128 gain = _mm_set1_ps(scale);
+    for (; i + 8 <= length; i += 8) {
+        __m128i* d = reinterpret_cast<__m128i*>(audio + i);
+        __m128i v = _mm_loadu_si128(d);
+        _mm_storeu_si128(d, _mm_packs_epi32(ScaleLow(v, gain),
+                                            ScaleHigh(v, gain)));
+    }
+#endif
+    for (; i < length; i++) {
+        audio[i] = SaturateS16(static_cast<int32_t>(scale * audio[i]));
+    }
+}
+
+int AudioFrameOps::ScaleWithSat(float scale, webrtc::AudioFrame* frame) {
+    ScaleWithSat(scale, frame->data_,
+                 frame->samples_per_channel_ * frame->num_channels_);
+    return 0;
+}
+
+void AudioFrameOps::ScaleAndAddWithSat(const int16_t* src, float scale,
+                                       int length, int16_t* dst) {
+    int i = 0;
+#if defined(VOIP_HAS_NEON)
+    float32x4_t gain = vdupq_n_f32(scale);
+    for (; i + 8 <= length; i += 8) {
+        int16x8_t v = vld1q_s16(src + i);
+        int16x8_t d = vld1q_s16(dst + i);
+        int32x4_t lo = vaddw_s16(ScaleLow(v, gain), vget_low_s16(d));
+        int32x4_t hi = vaddw_s16(ScaleHigh(v, gain), vget_high_s16(d));
+        vst1q_s16(dst + i, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+    }
+#elif defined(VOIP_HAS_SSE2)
+    __m128 gain = _mm_set1_ps(scale);
+    for (; i + 8 <= length; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i* d = reinterpret_cast<__m128i*>(dst + i);
+        __m128i dv = _mm_loadu_si128(d);
+        __m128i lo = _mm_add_epi32(ScaleLow(v, gain),
+                                   _mm_srai_epi32(_mm_unpacklo_epi16(dv, dv), 16));
+        __m128i hi = _mm_add_epi32(ScaleHigh(v, gain),
+                                   _mm_srai_epi32(_mm_unpackhi_epi16(dv, dv), 16));
+        _mm_storeu_si128(d, _mm_packs_epi32(lo, hi));
+    }
+#endif
+    for (; i < length; i++) {
+        dst[i] = SaturateS16(dst[i] + static_cast<int32_t>(scale * src[i]));
+    }
+}
+
+int AudioFrameOps::ScaleAndAddWithSat(const webrtc::AudioFrame& src,
+                                      float scale, webrtc::AudioFrame* dst) {
+    if (src.num_channels_ != dst->num_channels_ ||
+        src.samples_per_channel_ != dst->samples_per_channel_) {
+        return -1;
+    }
+    ScaleAndAddWithSat(src.data_, scale,
+                       src.samples_per_channel_ * src.num_channels_,
+                       dst->data_);
+    return 0;
+}
+
+void AudioFrameOps::MonoToStereoScaled(const int16_t* src_audio,
+                                       int samples_per_channel,
+                                       float left, float right,
+                                       int16_t* dst_audio) {
+    int i = 0;
+#if defined(VOIP_HAS_NEON)
+    float32x4_t left_gain = vdupq_n_f32(left);
+    float32x4_t right_gain = vdupq_n_f32(right);
+    for (; i + 8 <= samples_per_channel; i += 8) {
+        int16x8_t v = vld1q_s16(src_audio + i);
+        int16x8x2_t out;
+        out.val[0] = vcombine_s16(vqmovn_s32(ScaleLow(v, left_gain)),
+                                  vqmovn_s32(ScaleHigh(v, left_gain)));
+        out.val[1] = vcombine_s16(vqmovn_s32(ScaleLow(v, right_gain)),
+                                  vqmovn_s32(ScaleHigh(v, right_gain)));
+        vst2q_s16(dst_audio + 2 * i, out);
+    }
+#elif defined(VOIP_HAS_SSE2)
+    __m128 left_gain = _mm_set1_ps(left);
+    __m128 right_gain = _mm_set1_ps(right);
+    for (; i + 8 <= samples_per_channel; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src_audio + i));
+        __m128i l = _mm_packs_epi32(ScaleLow(v, left_gain),
+                                    ScaleHigh(v, left_gain));
+        __m128i r = _mm_packs_epi32(ScaleLow(v, right_gain),
+                                    ScaleHigh(v, right_gain));
+        __m128i* d = reinterpret_cast<__m128i*>(dst_audio + 2 * i);
+        _mm_storeu_si128(d, _mm_unpacklo_epi16(l, r));
+        _mm_storeu_si128(d + 1, _mm_unpackhi_epi16(l, r));
+    }
+#endif
+    for (; i < samples_per_channel; i++) {
+        dst_audio[2 * i] =
+            SaturateS16(static_cast<int32_t>(left * src_audio[i]));
+        dst_audio[2 * i + 1] =
+            SaturateS16(static_cast<int32_t>(right * src_audio[i]));
+    }
+}
@@ -0,0 +1,59 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#ifndef VOIP_AUDIO_FRAME_OPS_H
+#define VOIP_AUDIO_FRAME_OPS_H
+
+#include "webrtc/typedefs.h"
+
+namespace webrtc {
+class AudioFrame;
+}
+
+//Vectorized counterpart of webrtc::AudioFrameOperations with the same
+//results, NEON on device and SSE2 on the simulator, plus fused operations
+//that save a pass over the frame. The kernel is picked at compile time,
+//every supported iOS device has NEON.
+class AudioFrameOps {
+public:
+    //Out of place, |dst_audio| holds 2 * |samples_per_channel| samples.
+    static void MonoToStereo(const int16_t* src_audio, int samples_per_channel,
+                             int16_t* dst_audio);
+    static int MonoToStereo(webrtc::AudioFrame* frame);
+
+    //May be in place.
+    static void StereoToMono(const int16_t* src_audio, int samples_per_channel,
+                             int16_t* dst_audio);
+    static int StereoToMono(webrtc::AudioFrame* frame);
+
+    static void SwapStereoChannels(webrtc::AudioFrame* frame);
+
+    static void Mute(webrtc::AudioFrame* frame);
+
+    //Truncates like webrtc::AudioFrameOperations::Scale, out of range
+    //results wrap.
+    static int Scale(float left, float right, webrtc::AudioFrame* frame);
+    static int ScaleWithSat(float scale, webrtc::AudioFrame* frame);
+    static void ScaleWithSat(float scale, int16_t* audio, int length);
+
+    //dst = saturate(dst + scale * src), mixing a gain adjusted source in
+    //one pass instead of ScaleWithSat followed by an add.
+    static void ScaleAndAddWithSat(const int16_t* src, float scale, int length,
+                                   int16_t* dst);
+    static int ScaleAndAddWithSat(const webrtc::AudioFrame& src, float scale,
+                                  webrtc::AudioFrame* dst);
+
+    //Upmixes with a separate gain per output channel, i.e. panning a mono
+    //source, out of place.
+    static void MonoToStereoScaled(const int16_t* src_audio,
+                                   int samples_per_channel,
+                                   float left, float right,
+                                   int16_t* dst_audio);
+};
+
+#endif
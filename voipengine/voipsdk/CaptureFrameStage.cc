@@ -0,0 +1,174 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include "CaptureFrameStage.h"
+
+#include <string.h>
+#include "libyuv/scale.h"
+#include "webrtc/system_wrappers/interface/tick_util.h"
+#include "VideoFrameOps.h"
+
+CaptureFrameStage::CaptureFrameStage(I420BufferPool* pool)
+: pool_(pool),
+  crit_(webrtc::CriticalSectionWrapper::CreateCriticalSection()),
+  width_(0),
+  height_(0),
+  rotation_(webrtc::kRotateNone) {
+    memset(&stats_, 0, sizeof(stats_));
+}
+
+void CaptureFrameStage::SetOutput(int width, int height,
+                                  webrtc::VideoRotationMode rotation) {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    width_ = width;
+    height_ = height;
+    rotation_ = rotation;
+}
+
+webrtc::scoped_refptr<I420Buffer> CaptureFrameStage::IncomingFrame(
+    const uint8_t* frame, size_t length, int width, int height,
+    webrtc::VideoType type, int64_t capture_time_ms) {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    if (width <= 0 || height <= 0) {
+        return NULL;
+    }
+    bool turned = rotation_ == webrtc::kRotate90 ||
+                  rotation_ == webrtc::kRotate270;
+    int output_width = width_ > 0 ? width_ : (turned ? height : width);
+    int output_height = height_ > 0 ? height_ : (turned ? width : height);
+    webrtc::scoped_refptr<I420Buffer> buffer =
+        pool_->CreateBuffer(output_width, output_height);
+    if (buffer.get() == NULL) {
+        return NULL;
+    }
+
+    int64_t start_us = webrtc::TickTime::MicrosecondTimestamp();
+    bool fused = ConvertFused(frame, length, width, height, type,
+                              buffer.get());
+    if (!fused && !ConvertFallback(frame, length, width, height, type,
+                                   buffer.get())) {
+        return NULL;
+    }
+    stats_.sum_convert_time_us +=
+        webrtc::TickTime::MicrosecondTimestamp() - start_us;
+    stats_.frames++;
+    if (fused) {
+        stats_.frames_fused++;
+    }
+    stats_.bytes_moved += length + buffer->size();
+
+    buffer->set_timestamp(static_cast<uint32_t>(90 * capture_time_ms));
+    buffer->set_render_time_ms(capture_time_ms);
+    return buffer;
+}
+
+bool CaptureFrameStage::ConvertFused(const uint8_t* frame, size_t length,
+                                     int width, int height,
+                                     webrtc::VideoType type,
+                                     I420Buffer* dst) {
+    if (rotation_ != webrtc::kRotateNone && rotation_ != webrtc::kRotate90) {
+        return false;
+    }
+    if (length < webrtc::CalcBufferSize(type, width, height)) {
+        return false;
+    }
+    int chroma_width = (width + 1) / 2;
+    int chroma_height = (height + 1) / 2;
+    const uint8_t* chroma = frame + width * height;
+    const uint8_t* u;
+    const uint8_t* v;
+    int chroma_stride;
+    int pixel_stride;
+    switch (type) {
+    case webrtc::kNV12:
+    case webrtc::kNV21:
+        //One interleaved plane, V first in NV21.
+        chroma_stride = 2 * chroma_width;
+        pixel_stride = 2;
+        u = type == webrtc::kNV12 ? chroma : chroma + 1;
+        v = type == webrtc::kNV12 ? chroma + 1 : chroma;
+        break;
+    case webrtc::kI420:
+    case webrtc::kYV12:
+        //V first in YV12.
+        chroma_stride = chroma_width;
+        pixel_stride = 1;
+        u = chroma;
+        v = chroma + chroma_width * chroma_height;
+        if (type == webrtc::kYV12) {
+            const uint8_t* t = u;
+            u = v;
+            v = t;
+        }
+        break;
+    default:
+        return false;
+    }
+    return VideoFrameOps::ScaleRotateToI420(
+        frame, width, u, chroma_stride, v, chroma_stride, pixel_stride,
+        width, height,
+        dst->MutableData(webrtc::kYPlane), dst->stride(webrtc::kYPlane),
+        dst->MutableData(webrtc::kUPlane), dst->stride(webrtc::kUPlane),
+        dst->MutableData(webrtc::kVPlane), dst->stride(webrtc::kVPlane),
+        dst->width(), dst->height(), rotation_);
+}
+
+bool CaptureFrameStage::ConvertFallback(const uint8_t* frame, size_t length,
+                                        int width, int height,
+                                        webrtc::VideoType type,
+                                        I420Buffer* dst) {
+    bool turned = rotation_ == webrtc::kRotate90 ||
+                  rotation_ == webrtc::kRotate270;
+    int rotated_width = turned ? height : width;
+    int rotated_height = turned ? width : height;
+    int half_width = (rotated_width + 1) / 2;
+    if (rotated_.CreateEmptyFrame(rotated_width, rotated_height, rotated_width,
+                                  half_width, half_width) < 0) {
+        return false;
+    }
+    if (webrtc::ConvertToI420(type, frame, 0, 0, width, height, length,
+                              rotation_, &rotated_) < 0) {
+        return false;
+    }
+    for (int i = 0; i < I420Buffer::kNumPlanes; i++) {
+        webrtc::PlaneType plane = I420Buffer::kPlanes[i];
+        int shift = plane == webrtc::kYPlane ? 0 : 1;
+        libyuv::ScalePlane(rotated_.buffer(plane), rotated_.stride(plane),
+                           (rotated_width + shift) >> shift,
+                           (rotated_height + shift) >> shift,
+                           dst->MutableData(plane), dst->stride(plane),
+                           (dst->width() + shift) >> shift,
+                           (dst->height() + shift) >> shift,
+                           libyuv::kFilterBox);
+    }
+    stats_.bytes_moved += 2 * webrtc::CalcBufferSize(webrtc::kI420,
+                                                     rotated_width,
+                                                     rotated_height);
+    return true;
+}
+
+CaptureStageStatistics CaptureFrameStage::GetStatistics() {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    return stats_;
+}
+
+int CaptureFrameStage::DeliverFrame(const I420Buffer& frame,
+                                    webrtc::ViEExternalCapture* capture,
+                                    uint64_t ntp_time_ms) {
+    //IncomingFrameI420 only reads the planes.
+    webrtc::ViEVideoFrameI420 video_frame;
+    video_frame.y_plane = const_cast<uint8_t*>(frame.data(webrtc::kYPlane));
+    video_frame.u_plane = const_cast<uint8_t*>(frame.data(webrtc::kUPlane));
+    video_frame.v_plane = const_cast<uint8_t*>(frame.data(webrtc::kVPlane));
+    video_frame.y_pitch = frame.stride(webrtc::kYPlane);
+    video_frame.u_pitch = frame.stride(webrtc::kUPlane);
+    video_frame.v_pitch = frame.stride(webrtc::kVPlane);
+    video_frame.width = static_cast<unsigned short>(frame.width());
+    video_frame.height = static_cast<unsigned short>(frame.height());
+    return capture->IncomingFrameI420(video_frame, ntp_time_ms);
+}
@@ -0,0 +1,90 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#ifndef VOIP_CAPTURE_FRAME_STAGE_H
+#define VOIP_CAPTURE_FRAME_STAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "webrtc/common_video/libyuv/include/webrtc_libyuv.h"
+#include "webrtc/video_engine/include/vie_capture.h"
+#include "webrtc/system_wrappers/interface/critical_section_wrapper.h"
+#include "webrtc/system_wrappers/interface/scoped_ptr.h"
+#include "I420BufferPool.h"
+
+struct CaptureStageStatistics {
+    uint64_t frames;
+    //Converted by VideoFrameOps::ScaleRotateToI420.
+    uint64_t frames_fused;
+    int64_t sum_convert_time_us;
+    //Estimated memory traffic: the capture read, the output written and,
+    //on the fallback, the full size frame written and read again.
+    uint64_t bytes_moved;
+};
+
+//Turns a captured frame into the I420 frame that is sent, rotated and
+//scaled to the send size.
+//
+//VideoCaptureImpl::IncomingFrame converts and rotates the capture with
+//ConvertToI420 into a full size frame, and VPMSimpleSpatialResampler
+//scales that frame again to the send size, so the full picture goes
+//through memory once per pass. Here NV12, NV21, I420 and YV12 captures
+//turned by 0 or 90 degrees are converted, rotated and scaled in one pass
+//by VideoFrameOps::ScaleRotateToI420, straight into a pooled buffer. Other
+//formats and rotations fall back to ConvertToI420 followed by scaling.
+//
+//AVSendStream does not use it, its camera is captured inside the prebuilt
+//VideoCaptureImpl. It is for an application that captures the camera
+//itself and feeds VideoEngine through an external capture device, see
+//DeliverFrame.
+//
+//Thread safe.
+class CaptureFrameStage {
+public:
+    explicit CaptureFrameStage(I420BufferPool* pool);
+
+    //The size after the rotation, 0 keeps the rotated capture size.
+    void SetOutput(int width, int height, webrtc::VideoRotationMode rotation);
+
+    //|frame| and |length| as for ViEExternalCapture::IncomingFrame, the
+    //capture time on the TickTime clock. NULL if the frame can't be
+    //converted.
+    webrtc::scoped_refptr<I420Buffer> IncomingFrame(const uint8_t* frame,
+                                                    size_t length,
+                                                    int width, int height,
+                                                    webrtc::VideoType type,
+                                                    int64_t capture_time_ms);
+
+    CaptureStageStatistics GetStatistics();
+
+    //Hands |frame| to VideoEngine through an external capture device,
+    //which copies it. |ntp_time_ms| 0 stamps the frame on arrival.
+    static int DeliverFrame(const I420Buffer& frame,
+                            webrtc::ViEExternalCapture* capture,
+                            uint64_t ntp_time_ms);
+
+private:
+    bool ConvertFused(const uint8_t* frame, size_t length, int width,
+                      int height, webrtc::VideoType type, I420Buffer* dst);
+    bool ConvertFallback(const uint8_t* frame, size_t length, int width,
+                         int height, webrtc::VideoType type, I420Buffer* dst);
+
+    I420BufferPool* pool_;
+    webrtc::scoped_ptr<webrtc::CriticalSectionWrapper> crit_;
+    int width_;
+    int height_;
+    webrtc::VideoRotationMode rotation_;
+    //Full size frame of the fallback, reused.
+    webrtc::I420VideoFrame rotated_;
+    CaptureStageStatistics stats_;
+
+    CaptureFrameStage(const CaptureFrameStage&);
+    CaptureFrameStage& operator=(const CaptureFrameStage&);
+};
+
+#endif
@@ -0,0 +1,501 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include "ConferenceMixer.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VOIP_HAS_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define VOIP_HAS_SSE2
+#endif
+#include <dispatch/dispatch.h>
+#include "webrtc/system_wrappers/interface/tick_util.h"
+#include "AudioFrameOps.h"
+#include "ResamplerCache.h"
+
+static const size_t kAlignment = 16;
+static const int64_t kFrameDurationUs = 10000;
+//Per 1ms subframe the gain closes this part of its distance to 1, a
+//release time constant of about 64ms.
+static const float kLimiterRelease = 1.0f / 64;
+
+static void AddToHistogram(uint32_t* histogram, int64_t duration_us) {
+    int bucket = 0;
+    int64_t bound = 64;
+    while (duration_us >= bound &&
+           bucket < ConferenceMixerStatistics::kHistogramBuckets - 1) {
+        bound <<= 1;
+        bucket++;
+    }
+    histogram[bucket]++;
+}
+
+static uint64_t FrameEnergy(const int16_t* src, int length) {
+    uint64_t energy = 0;
+    int i = 0;
+#if defined(VOIP_HAS_NEON)
+    uint64x2_t acc = vdupq_n_u64(0);
+    for (; i + 8 <= length; i += 8) {
+        int16x8_t v = vld1q_s16(src + i);
+        //Each square fits in 31 bits, widen pairwise into 64 bits.
+        acc = vpadalq_u32(acc, vreinterpretq_u32_s32(
+            vmull_s16(vget_low_s16(v), vget_low_s16(v))));
+        acc = vpadalq_u32(acc, vreinterpretq_u32_s32(
+            vmull_s16(vget_high_s16(v), vget_high_s16(v))));
+    }
+    energy = vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1);
+#endif
+    for (; i < length; i++) {
+        energy += src[i] * src[i];
+    }
+    return energy;
+}
+
+static void AccumulateS16(const int16_t* src, int length, int32_t* sum) {
+    int i = 0;
+#if defined(VOIP_HAS_NEON)
+    for (; i + 8 <= length; i += 8) {
+        int16x8_t v = vld1q_s16(src + i);
+        vst1q_s32(sum + i, vaddw_s16(vld1q_s32(sum + i), vget_low_s16(v)));
+        vst1q_s32(sum + i + 4,
+                  vaddw_s16(vld1q_s32(sum + i + 4), vget_high_s16(v)));
+    }
+#elif defined(VOIP_HAS_SSE2)
+    for (; i + 8 <= length; i += 8) {
+        __m128i v = _mm_load_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        __m128i* s = reinterpret_cast<__m128i*>(sum + i);
+        _mm_store_si128(s, _mm_add_epi32(_mm_load_si128(s), lo));
+        _mm_store_si128(s + 1, _mm_add_epi32(_mm_load_si128(s + 1), hi));
+    }
+#endif
+    for (; i < length; i++) {
+        sum[i] += src[i];
+    }
+}
+
+static inline int16_t SaturateS16(int32_t v) {
+    if (v > 32767) return 32767;
+    if (v < -32768) return -32768;
+    return static_cast<int16_t>(v);
+}
+
+//dst = saturate(sum - own), |own| may be NULL.
+static void SumToS16(const int32_t* sum, const int16_t* own, int length,
+                     int16_t* dst) {
+    int i = 0;
+#if defined(VOIP_HAS_NEON)
+    if (own) {
+        for (; i + 8 <= length; i += 8) {
+            int16x8_t v = vld1q_s16(own + i);
+            int32x4_t lo = vsubw_s16(vld1q_s32(sum + i), vget_low_s16(v));
+            int32x4_t hi = vsubw_s16(vld1q_s32(sum + i + 4), vget_high_s16(v));
+            vst1q_s16(dst + i, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+        }
+    } else {
+        for (; i + 8 <= length; i += 8) {
+            vst1q_s16(dst + i, vcombine_s16(vqmovn_s32(vld1q_s32(sum + i)),
+                                            vqmovn_s32(vld1q_s32(sum + i + 4))));
+        }
+    }
+#elif defined(VOIP_HAS_SSE2)
+    for (; i + 8 <= length; i += 8) {
+        const __m128i* s = reinterpret_cast<const __m128i*>(sum + i);
+        __m128i lo = _mm_load_si128(s);
+        __m128i hi = _mm_load_si128(s + 1);
+        if (own) {
+            __m128i v = _mm_load_si128(reinterpret_cast<const __m128i*>(own + i));
+            lo = _mm_sub_epi32(lo, _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+            hi = _mm_sub_epi32(hi, _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                         _mm_packs_epi32(lo, hi));
+    }
+#endif
+    for (; i < length; i++) {
+        dst[i] = SaturateS16(sum[i] - (own ? own[i] : 0));
+    }
+}
+
+//Copies |frame| into |dst| converting to |num_channels|.
+static void RemixInto(const webrtc::AudioFrame& frame, int num_channels,
+                      int16_t* dst) {
+    const int samples = frame.samples_per_channel_;
+    const int16_t* src = frame.data_;
+    if (frame.num_channels_ == num_channels) {
+        memcpy(dst, src, samples * num_channels * sizeof(int16_t));
+    } else if (frame.num_channels_ == 1 && num_channels == 2) {
+        AudioFrameOps::MonoToStereo(src, samples, dst);
+    } else if (frame.num_channels_ == 2 && num_channels == 1) {
+        AudioFrameOps::StereoToMono(src, samples, dst);
+    } else {
+        memset(dst, 0, samples * num_channels * sizeof(int16_t));
+    }
+}
+
+ConferenceMixer::ConferenceMixer(int id, int sample_rate_hz, int num_channels,
+                                 int max_participants)
+: id_(id),
+  sample_rate_hz_(sample_rate_hz),
+  num_channels_(num_channels),
+  samples_per_channel_(sample_rate_hz / 100),
+  max_participants_(max_participants),
+  max_mixed_(kDefaultMaxMixedParticipants),
+  crit_(webrtc::CriticalSectionWrapper::CreateCriticalSection()),
+  arena_(webrtc::AlignedMalloc<int16_t>(
+      max_participants * kMaxFrameSamples * sizeof(int16_t), kAlignment)),
+  sum_(webrtc::AlignedMalloc<int32_t>(kMaxFrameSamples * sizeof(int32_t),
+                                      kAlignment)),
+  frame_pool_(kFramePoolSize),
+  slots_(max_participants),
+  timestamp_(0),
+  limiting_(false),
+  mix_vad_active_(false),
+  parallel_fetch_(true),
+  fetch_tasks_(0) {
+    assert(samples_per_channel_ * num_channels_ <= kMaxFrameSamples);
+    memset(sum_.get(), 0, kMaxFrameSamples * sizeof(int32_t));
+    memset(&stats_, 0, sizeof(stats_));
+    for (int i = 0; i <= kLimiterSubframes; i++) {
+        gains_[i] = 1.0f;
+    }
+    order_.reserve(max_participants);
+    active_.reserve(max_participants);
+    for (int i = 0; i < max_participants_; i++) {
+        Slot& slot = slots_[i];
+        memset(&slot, 0, sizeof(Slot));
+        slot.samples = arena_.get() + i * kMaxFrameSamples;
+    }
+}
+
+ConferenceMixer::~ConferenceMixer() {
+    for (size_t i = 0; i < slots_.size(); i++) {
+        delete slots_[i].resampler;
+    }
+}
+
+int ConferenceMixer::FindSlot(webrtc::MixerParticipant* participant) const {
+    for (int i = 0; i < max_participants_; i++) {
+        if (slots_[i].participant == participant) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int ConferenceMixer::AddParticipant(webrtc::MixerParticipant* participant) {
+    if (participant == NULL) {
+        return -1;
+    }
+    webrtc::CriticalSectionScoped lock(crit_.get());
+    if (FindSlot(participant) != -1) {
+        return -1;
+    }
+    int index = FindSlot(NULL);
+    if (index == -1) {
+        return -1;
+    }
+    Slot& slot = slots_[index];
+    slot.participant = participant;
+    slot.energy = 0;
+    slot.vad_active = false;
+    slot.valid = false;
+    slot.mixed = false;
+    return 0;
+}
+
+int ConferenceMixer::RemoveParticipant(webrtc::MixerParticipant* participant) {
+    webrtc::CriticalSectionScoped lock(crit_.get());
+    int index = FindSlot(participant);
+    if (index == -1 || participant == NULL) {
+        return -1;
+    }
+    Slot& slot = slots_[index];
+    delete slot.resampler;
+    slot.resampler = NULL;
+    slot.resampler_rate_hz = 0;
+    slot.resampler_channels = 0;
+    slot.participant = NULL;
+    slot.valid = false;
+    slot.mixed = false;
+    return 0;
+}
+
+int ConferenceMixer::NumberOfParticipants() const {
+    webrtc::CriticalSectionScoped lock(crit_.get());
+    int count = 0;
+    for (int i = 0; i < max_participants_; i++) {
+        if (slots_[i].participant) {
+            count++;
+        }
+    }
+    return count;
+}
+
+void ConferenceMixer::SetMaximumMixedParticipants(int count) {
+    webrtc::CriticalSectionScoped lock(crit_.get());
+    max_mixed_ = std::max(1, std::min(count, max_participants_));
+}
+
+int ConferenceMixer::MaximumMixedParticipants() const {
+    webrtc::CriticalSectionScoped lock(crit_.get());
+    return max_mixed_;
+}
+
+void ConferenceMixer::FetchFrame(Slot* slot, webrtc::AudioFrame* frame) {
+    slot->valid = false;
+    slot->mixed = false;
+
+    frame->sample_rate_hz_ = sample_rate_hz_;
+    frame->num_channels_ = num_channels_;
+    if (slot->participant->GetAudioFrame(id_, *frame) != 0) {
+        return;
+    }
+    if (frame->num_channels_ < 1 || frame->num_channels_ > 2 ||
+        frame->samples_per_channel_ * 100 != frame->sample_rate_hz_) {
+        return;
+    }
+
+    if (frame->sample_rate_hz_ != sample_rate_hz_) {
+        if (slot->resampler == NULL ||
+            slot->resampler_rate_hz != frame->sample_rate_hz_ ||
+            slot->resampler_channels != frame->num_channels_) {
+            delete slot->resampler;
+            slot->resampler = new InterleavedResampler(frame->sample_rate_hz_,
+                                                       sample_rate_hz_,
+                                                       frame->num_channels_);
+            slot->resampler_rate_hz = frame->sample_rate_hz_;
+            slot->resampler_channels = frame->num_channels_;
+        }
+        int16_t resampled[kMaxFrameSamples];
+        int length = slot->resampler->Resample(
+            frame->data_, frame->samples_per_channel_ * frame->num_channels_,
+            resampled, kMaxFrameSamples);
+        if (length < 0) {
+            return;
+        }
+        memcpy(frame->data_, resampled, length * sizeof(int16_t));
+        frame->samples_per_channel_ = samples_per_channel_;
+        frame->sample_rate_hz_ = sample_rate_hz_;
+    }
+
+    const int length = samples_per_channel_ * num_channels_;
+    RemixInto(*frame, num_channels_, slot->samples);
+    slot->energy = FrameEnergy(slot->samples, length);
+    slot->vad_active = frame->vad_activity_ != webrtc::AudioFrame::kVadPassive;
+    slot->valid = true;
+}
+
+int ConferenceMixer::SelectSpeakers() {
+    order_.clear();
+    for (int i = 0; i < max_participants_; i++) {
+        if (slots_[i].participant && slots_[i].valid) {
+            order_.push_back(i);
+        }
+    }
+
+    int count = static_cast<int>(order_.size());
+    if (count > max_mixed_) {
+        //Voice active participants first, then by energy. Only the boundary
+        //of the N loudest matters, nth_element finds it in linear time.
+        const std::vector<Slot>& slots = slots_;
+        std::nth_element(order_.begin(), order_.begin() + (max_mixed_ - 1),
+                         order_.end(), [&slots](int a, int b) {
+            if (slots[a].vad_active != slots[b].vad_active) {
+                return slots[a].vad_active;
+            }
+            return slots[a].energy > slots[b].energy;
+        });
+        count = max_mixed_;
+    }
+
+    mix_vad_active_ = false;
+    for (int i = 0; i < count; i++) {
+        Slot& slot = slots_[order_[i]];
+        slot.mixed = true;
+        mix_vad_active_ = mix_vad_active_ || slot.vad_active;
+    }
+    return count;
+}
+
+void ConferenceMixer::FetchFrames(size_t task, size_t num_tasks) {
+    size_t begin = active_.size() * task / num_tasks;
+    size_t end = active_.size() * (task + 1) / num_tasks;
+    //The pool holds one frame per task.
+    ScopedPoolItem<webrtc::AudioFrame> frame(&frame_pool_);
+    assert(frame.get());
+    for (size_t i = begin; i < end; i++) {
+        FetchFrame(&slots_[active_[i]], frame.get());
+    }
+}
+
+void ConferenceMixer::FetchTask(void* context, size_t task) {
+    ConferenceMixer* mixer = static_cast<ConferenceMixer*>(context);
+    mixer->FetchFrames(task, mixer->fetch_tasks_);
+}
+
+int ConferenceMixer::Process() {
+    webrtc::CriticalSectionScoped lock(crit_.get());
+    int64_t start_us = webrtc::TickTime::MicrosecondTimestamp();
+
+    active_.clear();
+    for (int i = 0; i < max_participants_; i++) {
+        if (slots_[i].participant) {
+            active_.push_back(i);
+        }
+    }
+
+    if (parallel_fetch_ && active_.size() >= kParallelFetchThreshold) {
+        fetch_tasks_ = std::min<size_t>(kFramePoolSize, active_.size());
+        dispatch_apply_f(fetch_tasks_,
+                         dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0),
+                         this, &ConferenceMixer::FetchTask);
+    } else {
+        FetchFrames(0, 1);
+    }
+    int64_t fetched_us = webrtc::TickTime::MicrosecondTimestamp();
+
+    int mixed = SelectSpeakers();
+
+    const int length = samples_per_channel_ * num_channels_;
+    memset(sum_.get(), 0, length * sizeof(int32_t));
+    for (int i = 0; i < mixed; i++) {
+        AccumulateS16(slots_[order_[i]].samples, length, sum_.get());
+    }
+    limiting_ = UpdateLimiter(length);
+    timestamp_ += samples_per_channel_;
+
+    int64_t done_us = webrtc::TickTime::MicrosecondTimestamp();
+    stats_.process_count++;
+    if (done_us - start_us > kFrameDurationUs) {
+        stats_.deadline_misses++;
+    }
+    stats_.max_process_time_us = std::max(stats_.max_process_time_us,
+                                          done_us - start_us);
+    AddToHistogram(stats_.fetch_histogram, fetched_us - start_us);
+    AddToHistogram(stats_.mix_histogram, done_us - fetched_us);
+    if (limiting_) {
+        stats_.limited_frames++;
+    }
+    return mixed;
+}
+
+bool ConferenceMixer::UpdateLimiter(int length) {
+    const int32_t* sum = sum_.get();
+    float targets[kLimiterSubframes];
+    for (int k = 0; k < kLimiterSubframes; k++) {
+        int begin = samples_per_channel_ * k / kLimiterSubframes * num_channels_;
+        int end = samples_per_channel_ * (k + 1) / kLimiterSubframes *
+                  num_channels_;
+        int32_t peak = 0;
+        for (int i = begin; i < end && i < length; i++) {
+            peak = std::max(peak, abs(sum[i]));
+        }
+        targets[k] = peak > kLimiterThreshold ?
+                     static_cast<float>(kLimiterThreshold) / peak : 1.0f;
+    }
+    //Each subframe is interpolated between its two boundaries, so both
+    //must be at or below its target. Without lookahead the first boundary
+    //drops at once when the frame starts loud.
+    gains_[0] = std::min(gains_[kLimiterSubframes], targets[0]);
+    bool limiting = gains_[0] < 1.0f;
+    for (int k = 1; k <= kLimiterSubframes; k++) {
+        float gain = gains_[k - 1] + (1.0f - gains_[k - 1]) * kLimiterRelease;
+        gain = std::min(gain, targets[k - 1]);
+        if (k < kLimiterSubframes) {
+            gain = std::min(gain, targets[k]);
+        }
+        //Snap to unity so the fast path comes back.
+        gains_[k] = gain > 0.999f ? 1.0f : gain;
+        limiting = limiting || gains_[k] < 1.0f;
+    }
+    return limiting;
+}
+
+void ConferenceMixer::WriteOutput(const int16_t* own, int16_t* dst) const {
+    const int32_t* sum = sum_.get();
+    if (!limiting_) {
+        SumToS16(sum, own, samples_per_channel_ * num_channels_, dst);
+        return;
+    }
+    for (int k = 0; k < kLimiterSubframes; k++) {
+        int begin = samples_per_channel_ * k / kLimiterSubframes;
+        int end = samples_per_channel_ * (k + 1) / kLimiterSubframes;
+        float step = (gains_[k + 1] - gains_[k]) / std::max(1, end - begin);
+        float gain = gains_[k];
+        for (int n = begin; n < end; n++) {
+            for (int c = 0; c < num_channels_; c++) {
+                int i = n * num_channels_ + c;
+                float v = static_cast<float>(sum[i] - (own ? own[i] : 0)) * gain;
+                dst[i] = SaturateS16(static_cast<int32_t>(lrintf(v)));
+            }
+            gain += step;
+        }
+    }
+}
+
+void ConferenceMixer::SetParallelFetch(bool enable) {
+    webrtc::CriticalSectionScoped lock(crit_.get());
+    parallel_fetch_ = enable;
+}
+
+void ConferenceMixer::GetStatistics(ConferenceMixerStatistics* stats) const {
+    webrtc::CriticalSectionScoped lock(crit_.get());
+    *stats = stats_;
+}
+
+void ConferenceMixer::ResetStatistics() {
+    webrtc::CriticalSectionScoped lock(crit_.get());
+    memset(&stats_, 0, sizeof(stats_));
+}
+
+void ConferenceMixer::FillFrame(webrtc::AudioFrame* frame,
+                                bool vad_active) const {
+    frame->UpdateFrame(id_, timestamp_, NULL, samples_per_channel_,
+                       sample_rate_hz_, webrtc::AudioFrame::kNormalSpeech,
+                       vad_active ? webrtc::AudioFrame::kVadActive :
+                                    webrtc::AudioFrame::kVadPassive,
+                       num_channels_);
+}
+
+int ConferenceMixer::GetMixedAudio(webrtc::AudioFrame* frame) const {
+    webrtc::CriticalSectionScoped lock(crit_.get());
+    FillFrame(frame, mix_vad_active_);
+    WriteOutput(NULL, frame->data_);
+    return 0;
+}
+
+int ConferenceMixer::GetMixMinusAudio(webrtc::MixerParticipant* participant,
+                                      webrtc::AudioFrame* frame) const {
+    webrtc::CriticalSectionScoped lock(crit_.get());
+    int index = FindSlot(participant);
+    if (index == -1 || participant == NULL) {
+        return -1;
+    }
+    const Slot& slot = slots_[index];
+    FillFrame(frame, mix_vad_active_);
+    WriteOutput(slot.mixed ? slot.samples : NULL, frame->data_);
+    return 0;
+}
+
+bool ConferenceMixer::IsMixed(webrtc::MixerParticipant* participant) const {
+    webrtc::CriticalSectionScoped lock(crit_.get());
+    int index = FindSlot(participant);
+    if (index == -1 || participant == NULL) {
+        return false;
+    }
+    return slots_[index].mixed;
+}
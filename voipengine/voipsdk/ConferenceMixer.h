@@ -0,0 +1,160 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#ifndef VOIP_CONFERENCE_MIXER_H
+#define VOIP_CONFERENCE_MIXER_H
+
+#include <vector>
+#include "webrtc/modules/audio_conference_mixer/interface/audio_conference_mixer_defines.h"
+#include "webrtc/modules/interface/module_common_types.h"
+#include "webrtc/system_wrappers/interface/aligned_malloc.h"
+#include "webrtc/system_wrappers/interface/critical_section_wrapper.h"
+#include "webrtc/system_wrappers/interface/scoped_ptr.h"
+#include "LockFreePool.h"
+
+class InterleavedResampler;
+
+//Timing of ConferenceMixer::Process(). Histogram bucket 0 counts
+//durations below 64us, every following bucket doubles the bound and the
+//last one collects everything above.
+struct ConferenceMixerStatistics {
+    enum { kHistogramBuckets = 12 };
+
+    uint32_t process_count;
+    //Process() calls that took longer than the 10ms frame.
+    uint32_t deadline_misses;
+    int64_t max_process_time_us;
+    //Participant fetch, resampling and energy.
+    uint32_t fetch_histogram[kHistogramBuckets];
+    //Speaker selection, accumulation and the limiter.
+    uint32_t mix_histogram[kHistogramBuckets];
+    //Process() calls in which the limiter lowered the gain.
+    uint32_t limited_frames;
+};
+
+//Mixes the N loudest of up to |max_participants| webrtc::MixerParticipant.
+//Unlike webrtc::AudioConferenceMixer, which mixes at most three speakers
+//out of linked lists, every participant owns a fixed slot in one aligned
+//sample arena, the speakers are picked with a partial sort over frame
+//energy and the selected frames are accumulated into a shared 32 bit sum.
+//The sum also yields a mix-minus output for every participant.
+//
+//webrtc::AudioConferenceMixerImpl runs the mix through an AudioProcessing
+//in fixed digital mode with the limiter on. Here the limiter works on the
+//32 bit sum: the gain is set at every 1ms boundary so that no sample of
+//the mix goes above kLimiterThreshold, interpolated between boundaries and
+//released slowly. The mixed and every mix-minus output are scaled by the
+//same gain, so a participant hears the others at the level they have in
+//the full mix.
+class ConferenceMixer {
+public:
+    //10ms of 48kHz stereo.
+    enum { kMaxFrameSamples = 960 };
+    enum { kDefaultMaxMixedParticipants = 3 };
+    //Scratch frames handed to MixerParticipant::GetAudioFrame, one per
+    //concurrent fetch task.
+    enum { kFramePoolSize = 8 };
+    //Below this many participants the fetch stays on the calling thread.
+    enum { kParallelFetchThreshold = 8 };
+    //-1 dBFS.
+    enum { kLimiterThreshold = 29204 };
+    //Gain boundaries per 10ms frame.
+    enum { kLimiterSubframes = 10 };
+
+    ConferenceMixer(int id, int sample_rate_hz, int num_channels,
+                    int max_participants);
+    ~ConferenceMixer();
+
+    //Returns 0 on success, -1 if the participant is already added or the
+    //mixer is full.
+    int AddParticipant(webrtc::MixerParticipant* participant);
+    int RemoveParticipant(webrtc::MixerParticipant* participant);
+    int NumberOfParticipants() const;
+
+    void SetMaximumMixedParticipants(int count);
+    int MaximumMixedParticipants() const;
+
+    //Pulls one 10ms frame from every participant and mixes the loudest.
+    //Returns the number of mixed participants.
+    //
+    //With parallel fetch enabled and enough participants, the frames are
+    //pulled, resampled and measured on the global dispatch queue, so
+    //GetAudioFrame must be safe to call for different participants at the
+    //same time. Selection and mixing stay on the calling thread.
+    int Process();
+
+    void SetParallelFetch(bool enable);
+
+    void GetStatistics(ConferenceMixerStatistics* stats) const;
+    void ResetStatistics();
+
+    //Sum of every mixed participant of the last Process().
+    int GetMixedAudio(webrtc::AudioFrame* frame) const;
+    //Mix without the participant's own contribution, for sending back to it.
+    int GetMixMinusAudio(webrtc::MixerParticipant* participant,
+                         webrtc::AudioFrame* frame) const;
+    bool IsMixed(webrtc::MixerParticipant* participant) const;
+
+    int sample_rate_hz() const { return sample_rate_hz_; }
+    int num_channels() const { return num_channels_; }
+    int samples_per_channel() const { return samples_per_channel_; }
+
+private:
+    struct Slot {
+        webrtc::MixerParticipant* participant;
+        //Points into |arena_|, kMaxFrameSamples samples.
+        int16_t* samples;
+        uint64_t energy;
+        bool vad_active;
+        bool valid;
+        bool mixed;
+        InterleavedResampler* resampler;
+        int resampler_rate_hz;
+        int resampler_channels;
+    };
+
+    void FetchFrame(Slot* slot, webrtc::AudioFrame* frame);
+    void FetchFrames(size_t task, size_t num_tasks);
+    static void FetchTask(void* context, size_t task);
+    int SelectSpeakers();
+    //Sets |gains_| from the peaks of |sum_|, returns true if any is below 1.
+    bool UpdateLimiter(int length);
+    //The limited sum less |own|, which may be NULL.
+    void WriteOutput(const int16_t* own, int16_t* dst) const;
+    void FillFrame(webrtc::AudioFrame* frame, bool vad_active) const;
+    int FindSlot(webrtc::MixerParticipant* participant) const;
+
+    const int id_;
+    const int sample_rate_hz_;
+    const int num_channels_;
+    const int samples_per_channel_;
+    const int max_participants_;
+    int max_mixed_;
+
+    webrtc::scoped_ptr<webrtc::CriticalSectionWrapper> crit_;
+    webrtc::scoped_ptr<int16_t, webrtc::AlignedFreeDeleter> arena_;
+    webrtc::scoped_ptr<int32_t, webrtc::AlignedFreeDeleter> sum_;
+    LockFreePool<webrtc::AudioFrame> frame_pool_;
+    std::vector<Slot> slots_;
+    std::vector<int> order_;
+    uint32_t timestamp_;
+    //Limiter gain at each subframe boundary of the last Process().
+    float gains_[kLimiterSubframes + 1];
+    bool limiting_;
+    bool mix_vad_active_;
+    //Slots with a participant, fetch order of the current Process().
+    std::vector<int> active_;
+    bool parallel_fetch_;
+    size_t fetch_tasks_;
+    ConferenceMixerStatistics stats_;
+
+    ConferenceMixer(const ConferenceMixer&);
+    ConferenceMixer& operator=(const ConferenceMixer&);
+};
+
+#endif
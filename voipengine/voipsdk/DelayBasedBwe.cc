@@ -0,0 +1,339 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include "DelayBasedBwe.h"
+
+#include <math.h>
+#include <algorithm>
+#include "TransportFeedback.h"
+
+static const int64_t kBurstDeltaUs = 5000;
+static const double kTrendSmoothing = 0.9;
+static const double kThresholdGain = 4.0;
+static const int kMaxTrendDeltas = 60;
+static const double kInitialThresholdMs = 12.5;
+static const double kMinThresholdMs = 6.0;
+static const double kMaxThresholdMs = 600.0;
+static const double kThresholdUp = 0.0087;
+static const double kThresholdDown = 0.039;
+static const double kMaxAdaptOffsetMs = 15.0;
+static const double kOverusingTimeThresholdMs = 10.0;
+static const int64_t kAckedWindowMs = 1000;
+//A burst filling the ring is not measured over less than this.
+static const int64_t kMinAckedSpanMs = 100;
+static const double kIncreasePerSecond = 1.08;
+static const double kMinIncreaseBps = 1000.0;
+static const double kDecreaseFactor = 0.85;
+//Decreases closer than this react to the same congestion event.
+static const int64_t kMinDecreaseIntervalMs = 300;
+
+DelayBasedBwe::InterArrival::InterArrival() {
+    current_.valid = false;
+    previous_.valid = false;
+}
+
+bool DelayBasedBwe::InterArrival::ComputeDeltas(int64_t send_time_us,
+                                                int64_t arrival_time_us,
+                                                double* send_delta_ms,
+                                                double* arrival_delta_ms) {
+    if (current_.valid) {
+        if (send_time_us < current_.first_send_us) {
+            //Reordered, belongs to a group already done.
+            return false;
+        }
+        if (send_time_us - current_.first_send_us <= kBurstDeltaUs) {
+            current_.send_us = std::max(current_.send_us, send_time_us);
+            current_.arrival_us = std::max(current_.arrival_us,
+                                           arrival_time_us);
+            return false;
+        }
+    }
+
+    bool ready = false;
+    if (current_.valid && previous_.valid) {
+        *send_delta_ms = (current_.send_us - previous_.send_us) / 1000.0;
+        *arrival_delta_ms = (current_.arrival_us - previous_.arrival_us) /
+                            1000.0;
+        ready = true;
+    }
+    previous_ = current_;
+    current_.valid = true;
+    current_.first_send_us = send_time_us;
+    current_.send_us = send_time_us;
+    current_.arrival_us = arrival_time_us;
+    return ready;
+}
+
+DelayBasedBwe::Trendline::Trendline()
+: accumulated_delay_ms_(0),
+  smoothed_delay_ms_(0),
+  first_arrival_ms_(-1),
+  num_deltas_(0),
+  head_(0),
+  size_(0),
+  slope_(0) {
+}
+
+void DelayBasedBwe::Trendline::Update(double delta_ms,
+                                      int64_t arrival_time_ms) {
+    num_deltas_ = std::min(num_deltas_ + 1, 1000);
+    if (first_arrival_ms_ < 0) {
+        first_arrival_ms_ = arrival_time_ms;
+    }
+    accumulated_delay_ms_ += delta_ms;
+    smoothed_delay_ms_ = kTrendSmoothing * smoothed_delay_ms_ +
+                         (1 - kTrendSmoothing) * accumulated_delay_ms_;
+
+    //Overwrites the oldest point once the window is full.
+    int index = (head_ + size_) % kWindowSize;
+    if (size_ == kWindowSize) {
+        head_ = (head_ + 1) % kWindowSize;
+    } else {
+        size_++;
+    }
+    x_[index] = static_cast<double>(arrival_time_ms - first_arrival_ms_);
+    y_[index] = smoothed_delay_ms_;
+    if (size_ < kWindowSize) {
+        return;
+    }
+
+    double x_mean = 0;
+    double y_mean = 0;
+    for (int i = 0; i < kWindowSize; i++) {
+        x_mean += x_[i];
+        y_mean += y_[i];
+    }
+    x_mean /= kWindowSize;
+    y_mean /= kWindowSize;
+    double numerator = 0;
+    double denominator = 0;
+    for (int i = 0; i < kWindowSize; i++) {
+        double dx = x_[i] - x_mean;
+        numerator += dx * (y_[i] - y_mean);
+        denominator += dx * dx;
+    }
+    if (denominator != 0) {
+        slope_ = numerator / denominator;
+    }
+}
+
+DelayBasedBwe::AckedRate::AckedRate()
+: head_(0),
+  size_(0),
+  bytes_(0),
+  first_arrival_ms_(-1) {
+}
+
+void DelayBasedBwe::AckedRate::Update(int64_t arrival_time_ms, size_t size) {
+    if (first_arrival_ms_ < 0) {
+        first_arrival_ms_ = arrival_time_ms;
+    }
+    if (size_ == kHistorySize) {
+        bytes_ -= entries_[head_].size;
+        head_ = (head_ + 1) % kHistorySize;
+        size_--;
+    }
+    Entry& entry = entries_[(head_ + size_) % kHistorySize];
+    entry.arrival_time_ms = arrival_time_ms;
+    entry.size = size;
+    size_++;
+    bytes_ += size;
+
+    while (size_ > 1 &&
+           arrival_time_ms - entries_[head_].arrival_time_ms > kAckedWindowMs) {
+        bytes_ -= entries_[head_].size;
+        head_ = (head_ + 1) % kHistorySize;
+        size_--;
+    }
+}
+
+int DelayBasedBwe::AckedRate::bitrate_bps() const {
+    if (size_ < 2) {
+        return 0;
+    }
+    const Entry& newest = entries_[(head_ + size_ - 1) % kHistorySize];
+    if (newest.arrival_time_ms - first_arrival_ms_ < kAckedWindowMs) {
+        return 0;
+    }
+    int64_t bytes = static_cast<int64_t>(bytes_);
+    int64_t span_ms = kAckedWindowMs;
+    if (size_ == kHistorySize) {
+        //At high packet rates the ring holds less than the window, the
+        //oldest packet only opens the interval.
+        bytes -= entries_[head_].size;
+        span_ms = std::max(newest.arrival_time_ms -
+                           entries_[head_].arrival_time_ms, kMinAckedSpanMs);
+    }
+    return static_cast<int>(bytes * 8 * 1000 / span_ms);
+}
+
+DelayBasedBwe::DelayBasedBwe(int start_bitrate_bps, int min_bitrate_bps,
+                             int max_bitrate_bps)
+: threshold_(kInitialThresholdMs),
+  last_threshold_update_ms_(-1),
+  time_over_using_ms_(-1),
+  overuse_counter_(0),
+  prev_trend_(0),
+  usage_(kBweNormal),
+  rate_state_(kRateHold),
+  last_rate_update_ms_(-1),
+  last_decrease_ms_(-1),
+  min_bitrate_bps_(min_bitrate_bps),
+  max_bitrate_bps_(max_bitrate_bps),
+  target_bitrate_bps_(start_bitrate_bps),
+  acked_bitrate_bps_(0) {
+    for (int i = 0; i < kSendHistorySize; i++) {
+        sent_[i].valid = false;
+    }
+}
+
+void DelayBasedBwe::OnPacketSent(uint16_t sequence_number, size_t size,
+                                 int64_t send_time_ms) {
+    SentPacket& sent = sent_[sequence_number % kSendHistorySize];
+    sent.valid = true;
+    sent.seq = sequence_number;
+    sent.send_time_ms = send_time_ms;
+    sent.size = size;
+}
+
+const DelayBasedBwe::SentPacket* DelayBasedBwe::FindSent(uint16_t seq) const {
+    const SentPacket& sent = sent_[seq % kSendHistorySize];
+    if (sent.valid && sent.seq == seq) {
+        return &sent;
+    }
+    return NULL;
+}
+
+bool DelayBasedBwe::OnTransportFeedback(const TransportFeedback& feedback,
+                                        int64_t now_ms) {
+    int prev_target = target_bitrate_bps_;
+    uint16_t base = feedback.base_sequence_number();
+    for (int i = 0; i < feedback.packet_status_count(); i++) {
+        if (!feedback.IsReceived(i)) {
+            continue;
+        }
+        const SentPacket* sent = FindSent(base + i);
+        if (sent == NULL) {
+            continue;
+        }
+        int64_t arrival_time_us = feedback.ArrivalTimeUs(i);
+        acked_rate_.Update(arrival_time_us / 1000, sent->size);
+
+        double send_delta_ms = 0;
+        double arrival_delta_ms = 0;
+        if (inter_arrival_.ComputeDeltas(sent->send_time_ms * 1000,
+                                         arrival_time_us, &send_delta_ms,
+                                         &arrival_delta_ms)) {
+            trend_.Update(arrival_delta_ms - send_delta_ms,
+                          arrival_time_us / 1000);
+            Detect(send_delta_ms, now_ms);
+        }
+    }
+    acked_bitrate_bps_ = acked_rate_.bitrate_bps();
+    UpdateRate(now_ms);
+    return target_bitrate_bps_ != prev_target;
+}
+
+void DelayBasedBwe::Detect(double send_delta_ms, int64_t now_ms) {
+    if (trend_.num_deltas() < 2) {
+        usage_ = kBweNormal;
+        return;
+    }
+    double trend = trend_.slope();
+    double modified_trend = std::min(trend_.num_deltas(), kMaxTrendDeltas) *
+                            trend * kThresholdGain;
+    if (modified_trend > threshold_) {
+        if (time_over_using_ms_ < 0) {
+            //Assume the overuse started halfway between the samples.
+            time_over_using_ms_ = send_delta_ms / 2;
+        } else {
+            time_over_using_ms_ += send_delta_ms;
+        }
+        overuse_counter_++;
+        if (time_over_using_ms_ > kOverusingTimeThresholdMs &&
+            overuse_counter_ > 1 && trend >= prev_trend_) {
+            time_over_using_ms_ = 0;
+            overuse_counter_ = 0;
+            usage_ = kBweOverusing;
+        }
+    } else if (modified_trend < -threshold_) {
+        time_over_using_ms_ = -1;
+        overuse_counter_ = 0;
+        usage_ = kBweUnderusing;
+    } else {
+        time_over_using_ms_ = -1;
+        overuse_counter_ = 0;
+        usage_ = kBweNormal;
+    }
+    prev_trend_ = trend;
+    UpdateThreshold(modified_trend, now_ms);
+}
+
+void DelayBasedBwe::UpdateThreshold(double modified_trend, int64_t now_ms) {
+    if (last_threshold_update_ms_ < 0) {
+        last_threshold_update_ms_ = now_ms;
+    }
+    double abs_trend = fabs(modified_trend);
+    if (abs_trend > threshold_ + kMaxAdaptOffsetMs) {
+        //A spike, e.g. a handover, must not drag the threshold along.
+        last_threshold_update_ms_ = now_ms;
+        return;
+    }
+    double k = abs_trend < threshold_ ? kThresholdDown : kThresholdUp;
+    int64_t time_delta_ms = std::min<int64_t>(
+        now_ms - last_threshold_update_ms_, 100);
+    threshold_ += k * (abs_trend - threshold_) * time_delta_ms;
+    threshold_ = std::max(kMinThresholdMs, std::min(threshold_,
+                                                    kMaxThresholdMs));
+    last_threshold_update_ms_ = now_ms;
+}
+
+void DelayBasedBwe::UpdateRate(int64_t now_ms) {
+    switch (usage_) {
+        case kBweNormal:
+            if (rate_state_ == kRateHold) {
+                rate_state_ = kRateIncrease;
+            }
+            break;
+        case kBweOverusing:
+            rate_state_ = kRateDecrease;
+            break;
+        case kBweUnderusing:
+            rate_state_ = kRateHold;
+            break;
+    }
+
+    double target = target_bitrate_bps_;
+    if (rate_state_ == kRateIncrease) {
+        int64_t elapsed_ms = last_rate_update_ms_ < 0 ? 0 :
+            std::min<int64_t>(now_ms - last_rate_update_ms_, 1000);
+        double alpha = pow(kIncreasePerSecond, elapsed_ms / 1000.0);
+        double increased = target + std::max(target * (alpha - 1),
+                                             elapsed_ms > 0 ? kMinIncreaseBps :
+                                             0.0);
+        //Do not run away from what the link actually delivered.
+        if (acked_bitrate_bps_ > 0) {
+            double limit = 1.5 * acked_bitrate_bps_ + 10000;
+            increased = std::min(increased, std::max(target, limit));
+        }
+        target = increased;
+    } else if (rate_state_ == kRateDecrease) {
+        if (last_decrease_ms_ < 0 ||
+            now_ms - last_decrease_ms_ >= kMinDecreaseIntervalMs) {
+            double base = acked_bitrate_bps_ > 0 ? acked_bitrate_bps_ : target;
+            target = std::min(target, kDecreaseFactor * base);
+            last_decrease_ms_ = now_ms;
+        }
+        rate_state_ = kRateHold;
+    }
+
+    target = std::max<double>(min_bitrate_bps_,
+                              std::min<double>(target, max_bitrate_bps_));
+    target_bitrate_bps_ = static_cast<int>(target);
+    last_rate_update_ms_ = now_ms;
+}
@@ -0,0 +1,152 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#ifndef VOIP_DELAY_BASED_BWE_H
+#define VOIP_DELAY_BASED_BWE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+class TransportFeedback;
+
+enum BweUsage {
+    kBweNormal,
+    kBweUnderusing,
+    kBweOverusing,
+};
+
+//Send side delay based bandwidth estimation. The sender remembers when
+//each packet left, the receiver reports when it arrived (TransportFeedback)
+//and the growth of the one way delay tells whether the link queue fills.
+//On asymmetric mobile links the uplink is the one that congests and only
+//the sender sees its own packets in full, so it decides the rate itself
+//instead of waiting for REMB.
+//
+//The pieces follow webrtc's remote_bitrate_estimator: packets are grouped
+//into 5 ms bursts, the delay variation between groups feeds a trendline
+//over the last 20 groups, an adaptive threshold detects overuse and an
+//AIMD controller moves the rate. All history is kept in fixed rings.
+class DelayBasedBwe {
+public:
+    DelayBasedBwe(int start_bitrate_bps, int min_bitrate_bps,
+                  int max_bitrate_bps);
+
+    void OnPacketSent(uint16_t sequence_number, size_t size,
+                      int64_t send_time_ms);
+
+    //Returns true if the target bitrate changed.
+    bool OnTransportFeedback(const TransportFeedback& feedback,
+                             int64_t now_ms);
+
+    int target_bitrate_bps() const { return target_bitrate_bps_; }
+    //Throughput the receiver acknowledged over the last second, 0 until
+    //known.
+    int acked_bitrate_bps() const { return acked_bitrate_bps_; }
+    BweUsage usage() const { return usage_; }
+    double trend() const { return trend_.slope(); }
+
+private:
+    struct SentPacket {
+        bool valid;
+        uint16_t seq;
+        int64_t send_time_ms;
+        size_t size;
+    };
+
+    //Groups packets sent within 5 ms of each other and produces the send and
+    //arrival time deltas between consecutive groups.
+    class InterArrival {
+    public:
+        InterArrival();
+        //Returns true when a group completed and the deltas are set.
+        bool ComputeDeltas(int64_t send_time_us, int64_t arrival_time_us,
+                           double* send_delta_ms, double* arrival_delta_ms);
+    private:
+        struct Group {
+            bool valid;
+            int64_t first_send_us;
+            int64_t send_us;
+            int64_t arrival_us;
+        };
+        Group current_;
+        Group previous_;
+    };
+
+    //Least squares slope of the smoothed accumulated delay over the last
+    //kWindowSize groups.
+    class Trendline {
+    public:
+        Trendline();
+        void Update(double delta_ms, int64_t arrival_time_ms);
+        double slope() const { return slope_; }
+        int num_deltas() const { return num_deltas_; }
+    private:
+        enum { kWindowSize = 20 };
+        double accumulated_delay_ms_;
+        double smoothed_delay_ms_;
+        int64_t first_arrival_ms_;
+        int num_deltas_;
+        double x_[kWindowSize];
+        double y_[kWindowSize];
+        int head_;
+        int size_;
+        double slope_;
+    };
+
+    //Throughput from the acknowledged bytes over a sliding window.
+    class AckedRate {
+    public:
+        AckedRate();
+        void Update(int64_t arrival_time_ms, size_t size);
+        //0 until a full window has been seen.
+        int bitrate_bps() const;
+    private:
+        enum { kHistorySize = 512 };
+        struct Entry {
+            int64_t arrival_time_ms;
+            size_t size;
+        };
+        Entry entries_[kHistorySize];
+        int head_;
+        int size_;
+        size_t bytes_;
+        int64_t first_arrival_ms_;
+    };
+
+    enum { kSendHistorySize = 1024 };
+    enum RateState { kRateHold, kRateIncrease, kRateDecrease };
+
+    const SentPacket* FindSent(uint16_t seq) const;
+    void Detect(double send_delta_ms, int64_t now_ms);
+    void UpdateThreshold(double modified_trend, int64_t now_ms);
+    void UpdateRate(int64_t now_ms);
+
+    SentPacket sent_[kSendHistorySize];
+    InterArrival inter_arrival_;
+    Trendline trend_;
+    AckedRate acked_rate_;
+
+    //Overuse detector.
+    double threshold_;
+    int64_t last_threshold_update_ms_;
+    double time_over_using_ms_;
+    int overuse_counter_;
+    double prev_trend_;
+    BweUsage usage_;
+
+    //AIMD rate control.
+    RateState rate_state_;
+    int64_t last_rate_update_ms_;
+    int64_t last_decrease_ms_;
+    int min_bitrate_bps_;
+    int max_bitrate_bps_;
+    int target_bitrate_bps_;
+    int acked_bitrate_bps_;
+};
+
+#endif
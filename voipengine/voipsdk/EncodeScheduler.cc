@@ -0,0 +1,249 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include "EncodeScheduler.h"
+
+#include <string.h>
+#include <algorithm>
+
+//Latest predicted end of an encode, in capture intervals after capture.
+static const int kMaxLatencyFrames = 2;
+//Skipped in a row before a frame is encoded regardless.
+static const int kMaxSkippedInRow = 4;
+//Unused budget kept, in frames.
+static const int kMaxBudgetFrames = 2;
+static const int kAdaptIntervalMs = 1000;
+//Overloaded intervals in a row before the size goes down.
+static const int kScaleDownWindows = 2;
+static const int kScaleDownDelayMs = 2000;
+//Going up waits longer than going down.
+static const int kScaleUpDelayMs = 3000;
+static const int kMaxSkipPercent = 10;
+//A smaller size is picked to fit in this part of the share.
+static const int kScaleDownUsagePercent = 90;
+//The larger size must fit in this part of the share.
+static const int kScaleUpUsagePercent = 70;
+
+EncodeScheduler::EncodeScheduler(I420BufferPool* pool, int cores,
+                                 int target_usage_percent)
+: pool_(pool),
+  cores_(std::max(1, cores)),
+  target_usage_percent_(target_usage_percent),
+  crit_(webrtc::CriticalSectionWrapper::CreateCriticalSection()),
+  num_streams_(0) {
+    memset(streams_, 0, sizeof(streams_));
+}
+
+int EncodeScheduler::AddStream(int framerate) {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    for (int i = 0; i < kMaxStreams; i++) {
+        Stream* s = &streams_[i];
+        if (s->used) {
+            continue;
+        }
+        memset(s, 0, sizeof(*s));
+        s->used = true;
+        s->frame_interval_ms = 1000 / std::max(1, framerate);
+        s->capture_interval_ms = s->frame_interval_ms;
+        s->last_capture_ms = -1;
+        s->last_budget_ms = -1;
+        s->window_start_ms = -1;
+        s->scale = kFullScale;
+        num_streams_++;
+        return i;
+    }
+    return -1;
+}
+
+void EncodeScheduler::RemoveStream(int stream) {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    if (stream >= 0 && stream < kMaxStreams && streams_[stream].used) {
+        streams_[stream].used = false;
+        num_streams_--;
+    }
+}
+
+int EncodeScheduler::SharePercent() const {
+    return cores_ * target_usage_percent_ / std::max(1, num_streams_);
+}
+
+void EncodeScheduler::Adapt(Stream* s, int64_t now_ms) {
+    int usage = s->encode_time_us / 10 / std::max(1, s->capture_interval_ms);
+    int share = SharePercent();
+    bool skipping = s->window_skipped * 100 > s->window_frames * kMaxSkipPercent;
+    bool overloaded = skipping || usage > share;
+    s->overloaded_windows = overloaded ? s->overloaded_windows + 1 : 0;
+    int scale = s->scale;
+    if (overloaded) {
+        //One bad interval, such as the key frame after a change, is not
+        //worth another re-initialization.
+        if (s->overloaded_windows >= kScaleDownWindows &&
+            now_ms - s->last_adapt_ms >= kScaleDownDelayMs &&
+            scale > kMinScale) {
+            scale--;
+            while (scale > kMinScale &&
+                   usage * scale * scale * 100 >
+                       share * kScaleDownUsagePercent * s->scale * s->scale) {
+                scale--;
+            }
+        }
+    } else if (scale < kFullScale &&
+               now_ms - s->last_adapt_ms >= kScaleUpDelayMs) {
+        //Encode time follows the pixel count.
+        int up_usage = usage * (scale + 1) * (scale + 1) / (scale * scale);
+        if (up_usage * 100 < share * kScaleUpUsagePercent) {
+            scale++;
+        }
+    }
+    if (scale != s->scale) {
+        s->encode_time_us = s->encode_time_us * scale * scale /
+                            (s->scale * s->scale);
+        s->scale = scale;
+        s->last_adapt_ms = now_ms;
+        s->overloaded_windows = 0;
+        s->scale_changes++;
+    }
+    s->window_start_ms = now_ms;
+    s->window_frames = 0;
+    s->window_skipped = 0;
+}
+
+webrtc::scoped_refptr<I420Buffer> EncodeScheduler::ScheduleFrame(
+    int stream, const webrtc::scoped_refptr<I420Buffer>& frame,
+    int64_t capture_time_ms, int64_t now_ms) {
+    int scale;
+    {
+        webrtc::CriticalSectionScoped cs(crit_.get());
+        if (stream < 0 || stream >= kMaxStreams || !streams_[stream].used) {
+            return frame;
+        }
+        Stream* s = &streams_[stream];
+        s->frames++;
+        s->window_frames++;
+        if (s->last_capture_ms >= 0) {
+            int interval = static_cast<int>(capture_time_ms - s->last_capture_ms);
+            s->capture_interval_ms += (interval - s->capture_interval_ms) / 4;
+        }
+        s->last_capture_ms = capture_time_ms;
+
+        int64_t share_us_per_ms = SharePercent() * 10;
+        int64_t max_budget_us = share_us_per_ms * s->frame_interval_ms *
+                                kMaxBudgetFrames;
+        if (s->last_budget_ms >= 0) {
+            s->budget_us += (now_ms - s->last_budget_ms) * share_us_per_ms;
+        } else {
+            s->budget_us = max_budget_us;
+        }
+        s->last_budget_ms = now_ms;
+        s->budget_us = std::min(s->budget_us, max_budget_us);
+
+        //Nothing is skipped before the first encode time is known, and a
+        //prediction that keeps skipping is measured again.
+        int64_t predicted_us = s->encode_time_us;
+        int64_t start_ms = std::max(now_ms, s->busy_until_ms);
+        int64_t end_ms = start_ms + predicted_us / 1000;
+        bool skip = s->skipped_in_row < kMaxSkippedInRow &&
+                    (end_ms - capture_time_ms >
+                         s->frame_interval_ms * kMaxLatencyFrames ||
+                     s->budget_us < predicted_us * (s->in_flight + 1));
+        s->skipped_in_row = skip ? s->skipped_in_row + 1 : 0;
+
+        if (s->window_start_ms < 0) {
+            s->window_start_ms = now_ms;
+        }
+        if (skip) {
+            s->frames_skipped++;
+            s->window_skipped++;
+        }
+        if (now_ms - s->window_start_ms >= kAdaptIntervalMs) {
+            Adapt(s, now_ms);
+        }
+        if (skip) {
+            return NULL;
+        }
+        s->busy_until_ms = end_ms;
+        s->in_flight++;
+        scale = s->scale;
+    }
+
+    if (scale == kFullScale) {
+        return frame;
+    }
+    //Even sizes keep the chroma planes exact.
+    int width = (frame->width() * scale / kFullScale) & ~1;
+    int height = (frame->height() * scale / kFullScale) & ~1;
+    webrtc::scoped_refptr<I420Buffer> scaled = pool_->CreateBuffer(width, height);
+    if (scaled.get() == NULL) {
+        return frame;
+    }
+    ScaleI420Buffer(*frame, scaled.get());
+    return scaled;
+}
+
+void EncodeScheduler::OnEncodeStarted(int stream, int64_t capture_time_ms,
+                                      int64_t now_ms) {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    if (stream < 0 || stream >= kMaxStreams || !streams_[stream].used) {
+        return;
+    }
+    Stream* s = &streams_[stream];
+    int delay = static_cast<int>(now_ms - capture_time_ms);
+    s->queue_delay_ms += (delay - s->queue_delay_ms) / 4;
+}
+
+void EncodeScheduler::OnFrameEncoded(int stream, int encode_time_us,
+                                     bool key_frame, int64_t now_ms) {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    if (stream < 0 || stream >= kMaxStreams || !streams_[stream].used) {
+        return;
+    }
+    Stream* s = &streams_[stream];
+    if (!key_frame) {
+        if (s->encode_time_us == 0) {
+            s->encode_time_us = encode_time_us;
+        } else {
+            s->encode_time_us += (encode_time_us - s->encode_time_us) / 4;
+        }
+    }
+    s->budget_us -= encode_time_us;
+    if (s->in_flight > 0) {
+        s->in_flight--;
+    }
+    if (s->in_flight == 0) {
+        s->busy_until_ms = now_ms;
+    }
+}
+
+void EncodeScheduler::OnFrameDropped(int stream) {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    if (stream < 0 || stream >= kMaxStreams || !streams_[stream].used) {
+        return;
+    }
+    if (streams_[stream].in_flight > 0) {
+        streams_[stream].in_flight--;
+    }
+}
+
+bool EncodeScheduler::GetStatistics(int stream,
+                                    EncodeSchedulerStatistics* stats) {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    if (stream < 0 || stream >= kMaxStreams || !streams_[stream].used) {
+        return false;
+    }
+    const Stream& s = streams_[stream];
+    stats->frames = s.frames;
+    stats->frames_skipped = s.frames_skipped;
+    stats->encode_time_avg_us = s.encode_time_us;
+    stats->usage_percent = s.encode_time_us / 10 /
+                           std::max(1, s.capture_interval_ms);
+    stats->capture_queue_delay_ms = s.queue_delay_ms;
+    stats->budget_percent = SharePercent();
+    stats->scale = s.scale;
+    stats->scale_changes = s.scale_changes;
+    return true;
+}
@@ -0,0 +1,125 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#ifndef VOIP_ENCODE_SCHEDULER_H
+#define VOIP_ENCODE_SCHEDULER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "webrtc/system_wrappers/interface/critical_section_wrapper.h"
+#include "webrtc/system_wrappers/interface/scoped_ptr.h"
+#include "I420BufferPool.h"
+
+struct EncodeSchedulerStatistics {
+    uint64_t frames;
+    uint64_t frames_skipped;
+    //As webrtc::OveruseFrameDetector: average encode time, encode time per
+    //capture interval, and the wait from capture to the encoder.
+    int encode_time_avg_us;
+    int usage_percent;
+    int capture_queue_delay_ms;
+    //This stream's share of the CPU budget, percent of one core.
+    int budget_percent;
+    //In eighths of the capture size.
+    int scale;
+    int scale_changes;
+};
+
+//Decides per captured frame whether and at which size it is encoded, so
+//the encoders keep up with the capture without queueing.
+//
+//webrtc::OveruseFrameDetector measures the same encode time, usage and
+//capture queue delay, but only reports overuse or normal use to a
+//CpuOveruseObserver and leaves the reaction to the application. Here the
+//measurements are used per frame: a frame is skipped when its predicted
+//encode would end more than two frame intervals after its capture, or when
+//the stream has used up its CPU budget, before any queue builds up. After
+//a few skips in a row a frame is encoded anyway, so a stale prediction is
+//measured again instead of freezing the stream. Each
+//stream gets an equal share of |cores| at |target_usage_percent|, so
+//several channels share the cores fairly. The resolution moves in eighths,
+//replacing VPMFramePreprocessor's coarse 3/4 and 1/2 steps. Every change
+//re-initializes the encoder and costs a key frame, so it is held for a
+//while: the size goes down after two seconds in a row of skipped frames
+//or usage over the share, straight to the size that fits, and one eighth
+//back up when the larger size would use less than 70% of the share and
+//the last change is three seconds old.
+//
+//Thread safe.
+class EncodeScheduler {
+public:
+    enum { kMaxStreams = 8 };
+    //Eighths of the capture size.
+    enum { kFullScale = 8, kMinScale = 4 };
+
+    EncodeScheduler(I420BufferPool* pool, int cores, int target_usage_percent);
+
+    //Returns the stream id, -1 if there are too many.
+    int AddStream(int framerate);
+    void RemoveStream(int stream);
+
+    //NULL if |frame| is to be skipped, otherwise |frame| or a scaled copy.
+    //Times are on the TickTime clock.
+    webrtc::scoped_refptr<I420Buffer> ScheduleFrame(
+        int stream, const webrtc::scoped_refptr<I420Buffer>& frame,
+        int64_t capture_time_ms, int64_t now_ms);
+
+    //From the encoder, for each frame ScheduleFrame returned.
+    void OnEncodeStarted(int stream, int64_t capture_time_ms, int64_t now_ms);
+    //Key frames are charged to the budget but not averaged, they take
+    //several times a delta frame.
+    void OnFrameEncoded(int stream, int encode_time_us, bool key_frame,
+                        int64_t now_ms);
+    void OnFrameDropped(int stream);
+
+    bool GetStatistics(int stream, EncodeSchedulerStatistics* stats);
+
+private:
+    struct Stream {
+        bool used;
+        int frame_interval_ms;
+        //Exponential averages.
+        int encode_time_us;
+        int capture_interval_ms;
+        int queue_delay_ms;
+        int64_t last_capture_ms;
+        //Predicted end of the frames handed to the encoder.
+        int64_t busy_until_ms;
+        int in_flight;
+        int skipped_in_row;
+        //CPU time the stream may still use, refilled at its share.
+        int64_t budget_us;
+        int64_t last_budget_ms;
+        int scale;
+        int64_t window_start_ms;
+        int64_t last_adapt_ms;
+        //Adapt intervals in a row over the share.
+        int overloaded_windows;
+        int scale_changes;
+        int window_frames;
+        int window_skipped;
+        uint64_t frames;
+        uint64_t frames_skipped;
+    };
+
+    //Caller holds crit_.
+    int SharePercent() const;
+    void Adapt(Stream* s, int64_t now_ms);
+
+    I420BufferPool* pool_;
+    const int cores_;
+    const int target_usage_percent_;
+    webrtc::scoped_ptr<webrtc::CriticalSectionWrapper> crit_;
+    Stream streams_[kMaxStreams];
+    int num_streams_;
+
+    EncodeScheduler(const EncodeScheduler&);
+    EncodeScheduler& operator=(const EncodeScheduler&);
+};
+
+#endif
@@ -0,0 +1,423 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include "I420BufferPool.h"
+
+#include <string.h>
+#include <algorithm>
+#include "libyuv/scale.h"
+#include "webrtc/system_wrappers/interface/aligned_malloc.h"
+#include "webrtc/system_wrappers/interface/sleep.h"
+
+//Sizes are rounded up to this, so frames that differ by a few rows share
+//a bucket.
+static const size_t kBucketGranularity = 4096;
+
+static inline int AlignStride(int width) {
+    return (width + I420Buffer::kAlignment - 1) & ~(I420Buffer::kAlignment - 1);
+}
+
+static inline size_t BufferSize(int width, int height) {
+    size_t y = static_cast<size_t>(AlignStride(width)) * height;
+    size_t uv = static_cast<size_t>(AlignStride((width + 1) / 2)) *
+                ((height + 1) / 2);
+    return y + 2 * uv;
+}
+
+static void CopyPlane(const uint8_t* src, int src_stride, uint8_t* dst,
+                      int dst_stride, int width, int height) {
+    if (src_stride == dst_stride) {
+        memcpy(dst, src, static_cast<size_t>(src_stride) * height);
+        return;
+    }
+    for (int i = 0; i < height; i++) {
+        memcpy(dst, src, width);
+        src += src_stride;
+        dst += dst_stride;
+    }
+}
+
+//Shared by the pool and its outstanding buffers, freed with the last of
+//them.
+class I420BufferPoolCore {
+public:
+    I420BufferPoolCore()
+    : crit_(webrtc::CriticalSectionWrapper::CreateCriticalSection()),
+      ref_count_(1),
+      closed_(false),
+      use_count_(0),
+      requests_(0),
+      pool_hits_(0),
+      bytes_allocated_(0),
+      bytes_copied_(0),
+      outstanding_(0) {
+    }
+
+    I420Buffer* Get(int width, int height);
+    void Return(I420Buffer* buffer);
+    void Close();
+
+    void AddRef() { ref_count_.fetch_add(1, std::memory_order_relaxed); }
+    void Release() {
+        if (ref_count_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+    void AddBytesCopied(size_t bytes) {
+        bytes_copied_.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    I420BufferPoolStatistics GetStatistics() const;
+
+private:
+    struct Bucket {
+        size_t size;
+        uint64_t last_use;
+        std::vector<I420Buffer*> free;
+    };
+
+    ~I420BufferPoolCore();
+    //Caller holds crit_.
+    Bucket* FindBucket(size_t size);
+    void FreeBucket(Bucket* bucket);
+
+    webrtc::scoped_ptr<webrtc::CriticalSectionWrapper> crit_;
+    std::atomic<int32_t> ref_count_;
+    bool closed_;
+    uint64_t use_count_;
+    std::vector<Bucket> buckets_;
+
+    std::atomic<uint64_t> requests_;
+    std::atomic<uint64_t> pool_hits_;
+    std::atomic<uint64_t> bytes_allocated_;
+    std::atomic<uint64_t> bytes_copied_;
+    std::atomic<uint32_t> outstanding_;
+};
+
+const webrtc::PlaneType I420Buffer::kPlanes[I420Buffer::kNumPlanes] = {
+    webrtc::kYPlane, webrtc::kUPlane, webrtc::kVPlane
+};
+
+I420Buffer::I420Buffer(I420BufferPoolCore* core, size_t capacity)
+: core_(core),
+  memory_(static_cast<uint8_t*>(webrtc::AlignedMalloc(capacity, kAlignment))),
+  capacity_(capacity),
+  ref_count_(0),
+  width_(0),
+  height_(0),
+  size_(0),
+  timestamp_(0),
+  render_time_ms_(0) {
+    memset(planes_, 0, sizeof(planes_));
+    memset(strides_, 0, sizeof(strides_));
+}
+
+I420Buffer::~I420Buffer() {
+    webrtc::AlignedFree(memory_);
+}
+
+void I420Buffer::Reset(int width, int height) {
+    width_ = width;
+    height_ = height;
+    strides_[webrtc::kYPlane] = AlignStride(width);
+    strides_[webrtc::kUPlane] = AlignStride((width + 1) / 2);
+    strides_[webrtc::kVPlane] = strides_[webrtc::kUPlane];
+    size_t y_size = static_cast<size_t>(strides_[webrtc::kYPlane]) * height;
+    size_t uv_size = static_cast<size_t>(strides_[webrtc::kUPlane]) *
+                     ((height + 1) / 2);
+    planes_[webrtc::kYPlane] = memory_;
+    planes_[webrtc::kUPlane] = memory_ + y_size;
+    planes_[webrtc::kVPlane] = memory_ + y_size + uv_size;
+    size_ = y_size + 2 * uv_size;
+    timestamp_ = 0;
+    render_time_ms_ = 0;
+}
+
+int32_t I420Buffer::AddRef() const {
+    return ref_count_.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+int32_t I420Buffer::Release() const {
+    int32_t count = ref_count_.fetch_sub(1, std::memory_order_acq_rel) - 1;
+    if (count == 0) {
+        core_->Return(const_cast<I420Buffer*>(this));
+    }
+    return count;
+}
+
+int I420Buffer::CopyTo(webrtc::I420VideoFrame* frame) const {
+    int half_height = (height_ + 1) / 2;
+    core_->AddBytesCopied(size_);
+    int ret = frame->CreateFrame(
+        strides_[webrtc::kYPlane] * height_, planes_[webrtc::kYPlane],
+        strides_[webrtc::kUPlane] * half_height, planes_[webrtc::kUPlane],
+        strides_[webrtc::kVPlane] * half_height, planes_[webrtc::kVPlane],
+        width_, height_, strides_[webrtc::kYPlane],
+        strides_[webrtc::kUPlane], strides_[webrtc::kVPlane]);
+    frame->set_timestamp(timestamp_);
+    frame->set_render_time_ms(render_time_ms_);
+    return ret;
+}
+
+I420BufferPoolCore::~I420BufferPoolCore() {
+    for (size_t i = 0; i < buckets_.size(); i++) {
+        FreeBucket(&buckets_[i]);
+    }
+}
+
+I420BufferPoolCore::Bucket* I420BufferPoolCore::FindBucket(size_t size) {
+    for (size_t i = 0; i < buckets_.size(); i++) {
+        if (buckets_[i].size == size) {
+            return &buckets_[i];
+        }
+    }
+    return NULL;
+}
+
+void I420BufferPoolCore::FreeBucket(Bucket* bucket) {
+    for (size_t i = 0; i < bucket->free.size(); i++) {
+        delete bucket->free[i];
+    }
+    bucket->free.clear();
+}
+
+I420Buffer* I420BufferPoolCore::Get(int width, int height) {
+    size_t size = (BufferSize(width, height) + kBucketGranularity - 1) &
+                  ~(kBucketGranularity - 1);
+    requests_.fetch_add(1, std::memory_order_relaxed);
+    outstanding_.fetch_add(1, std::memory_order_relaxed);
+    AddRef();
+
+    I420Buffer* buffer = NULL;
+    {
+        webrtc::CriticalSectionScoped cs(crit_.get());
+        Bucket* bucket = FindBucket(size);
+        if (bucket) {
+            bucket->last_use = ++use_count_;
+            if (!bucket->free.empty()) {
+                buffer = bucket->free.back();
+                bucket->free.pop_back();
+            }
+        }
+    }
+    if (buffer) {
+        pool_hits_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        buffer = new I420Buffer(this, size);
+        bytes_allocated_.fetch_add(size, std::memory_order_relaxed);
+    }
+    buffer->Reset(width, height);
+    return buffer;
+}
+
+void I420BufferPoolCore::Return(I420Buffer* buffer) {
+    bool keep = false;
+    {
+        webrtc::CriticalSectionScoped cs(crit_.get());
+        if (!closed_) {
+            Bucket* bucket = FindBucket(buffer->capacity_);
+            if (bucket == NULL) {
+                //A new resolution evicts the one unused longest.
+                if (buckets_.size() == I420BufferPool::kMaxBuckets) {
+                    std::vector<Bucket>::iterator oldest = buckets_.begin();
+                    for (std::vector<Bucket>::iterator it = buckets_.begin();
+                         it != buckets_.end(); ++it) {
+                        if (it->last_use < oldest->last_use) {
+                            oldest = it;
+                        }
+                    }
+                    FreeBucket(&*oldest);
+                    buckets_.erase(oldest);
+                }
+                Bucket empty;
+                empty.size = buffer->capacity_;
+                empty.last_use = ++use_count_;
+                buckets_.push_back(empty);
+                bucket = &buckets_.back();
+            }
+            if (bucket->free.size() <
+                static_cast<size_t>(I420BufferPool::kMaxFreeBuffersPerBucket)) {
+                bucket->free.push_back(buffer);
+                keep = true;
+            }
+        }
+    }
+    if (!keep) {
+        delete buffer;
+    }
+    outstanding_.fetch_sub(1, std::memory_order_relaxed);
+    Release();
+}
+
+void I420BufferPoolCore::Close() {
+    {
+        webrtc::CriticalSectionScoped cs(crit_.get());
+        closed_ = true;
+        for (size_t i = 0; i < buckets_.size(); i++) {
+            FreeBucket(&buckets_[i]);
+        }
+        buckets_.clear();
+    }
+    Release();
+}
+
+I420BufferPoolStatistics I420BufferPoolCore::GetStatistics() const {
+    I420BufferPoolStatistics stats;
+    stats.requests = requests_.load(std::memory_order_relaxed);
+    stats.pool_hits = pool_hits_.load(std::memory_order_relaxed);
+    stats.bytes_allocated = bytes_allocated_.load(std::memory_order_relaxed);
+    stats.bytes_copied = bytes_copied_.load(std::memory_order_relaxed);
+    stats.buffers_outstanding = outstanding_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+I420BufferPool::I420BufferPool()
+: core_(new I420BufferPoolCore()) {
+}
+
+I420BufferPool::~I420BufferPool() {
+    core_->Close();
+}
+
+webrtc::scoped_refptr<I420Buffer> I420BufferPool::CreateBuffer(int width,
+                                                               int height) {
+    if (width <= 0 || height <= 0) {
+        return NULL;
+    }
+    return core_->Get(width, height);
+}
+
+webrtc::scoped_refptr<I420Buffer> I420BufferPool::MakeWritable(
+    const webrtc::scoped_refptr<I420Buffer>& buffer) {
+    if (buffer->HasOneRef()) {
+        return buffer;
+    }
+    webrtc::scoped_refptr<I420Buffer> copy =
+        core_->Get(buffer->width(), buffer->height());
+    //Same dimensions, so the same strides and one copy for all planes.
+    memcpy(copy->MutableData(webrtc::kYPlane), buffer->data(webrtc::kYPlane),
+           buffer->size());
+    copy->set_timestamp(buffer->timestamp());
+    copy->set_render_time_ms(buffer->render_time_ms());
+    core_->AddBytesCopied(buffer->size());
+    return copy;
+}
+
+webrtc::scoped_refptr<I420Buffer> I420BufferPool::CopyFrom(
+    const webrtc::I420VideoFrame& frame) {
+    if (frame.IsZeroSize()) {
+        return NULL;
+    }
+    int width = frame.width();
+    int height = frame.height();
+    webrtc::scoped_refptr<I420Buffer> buffer = core_->Get(width, height);
+    CopyPlane(frame.buffer(webrtc::kYPlane), frame.stride(webrtc::kYPlane),
+              buffer->MutableData(webrtc::kYPlane),
+              buffer->stride(webrtc::kYPlane), width, height);
+    CopyPlane(frame.buffer(webrtc::kUPlane), frame.stride(webrtc::kUPlane),
+              buffer->MutableData(webrtc::kUPlane),
+              buffer->stride(webrtc::kUPlane), (width + 1) / 2,
+              (height + 1) / 2);
+    CopyPlane(frame.buffer(webrtc::kVPlane), frame.stride(webrtc::kVPlane),
+              buffer->MutableData(webrtc::kVPlane),
+              buffer->stride(webrtc::kVPlane), (width + 1) / 2,
+              (height + 1) / 2);
+    buffer->set_timestamp(frame.timestamp());
+    buffer->set_render_time_ms(frame.render_time_ms());
+    core_->AddBytesCopied(buffer->size());
+    return buffer;
+}
+
+I420BufferPoolStatistics I420BufferPool::GetStatistics() const {
+    return core_->GetStatistics();
+}
+
+void ScaleI420Buffer(const I420Buffer& src, I420Buffer* dst) {
+    for (int i = 0; i < I420Buffer::kNumPlanes; i++) {
+        webrtc::PlaneType plane = I420Buffer::kPlanes[i];
+        int shift = plane == webrtc::kYPlane ? 0 : 1;
+        int src_width = (src.width() + shift) >> shift;
+        int src_height = (src.height() + shift) >> shift;
+        int dst_width = (dst->width() + shift) >> shift;
+        int dst_height = (dst->height() + shift) >> shift;
+        libyuv::ScalePlane(src.data(plane), src.stride(plane),
+                           src_width, src_height,
+                           dst->MutableData(plane), dst->stride(plane),
+                           dst_width, dst_height, libyuv::kFilterBox);
+    }
+    dst->set_timestamp(src.timestamp());
+    dst->set_render_time_ms(src.render_time_ms());
+}
+
+I420FrameFanout::I420FrameFanout()
+: crit_(webrtc::CriticalSectionWrapper::CreateCriticalSection()),
+  sinks_(new SinkList()),
+  epoch_(0),
+  remove_crit_(webrtc::CriticalSectionWrapper::CreateCriticalSection()) {
+    deliveries_[0].store(0, std::memory_order_relaxed);
+    deliveries_[1].store(0, std::memory_order_relaxed);
+}
+
+void I420FrameFanout::AddSink(I420FrameSink* sink) {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    const std::vector<I420FrameSink*>& sinks = sinks_->sinks;
+    if (std::find(sinks.begin(), sinks.end(), sink) != sinks.end()) {
+        return;
+    }
+    webrtc::scoped_refptr<SinkList> list(new SinkList());
+    list->sinks = sinks;
+    list->sinks.push_back(sink);
+    sinks_ = list;
+}
+
+void I420FrameFanout::RemoveSink(I420FrameSink* sink) {
+    webrtc::CriticalSectionScoped remove(remove_crit_.get());
+    int parity;
+    {
+        webrtc::CriticalSectionScoped cs(crit_.get());
+        const std::vector<I420FrameSink*>& sinks = sinks_->sinks;
+        std::vector<I420FrameSink*>::const_iterator it =
+            std::find(sinks.begin(), sinks.end(), sink);
+        if (it == sinks.end()) {
+            return;
+        }
+        webrtc::scoped_refptr<SinkList> list(new SinkList());
+        list->sinks.assign(sinks.begin(), it);
+        list->sinks.insert(list->sinks.end(), it + 1, sinks.end());
+        sinks_ = list;
+        parity = epoch_ & 1;
+        epoch_++;
+    }
+    //Every delivery that may still call |sink| started in the old epoch,
+    //so this ends within a frame.
+    while (deliveries_[parity].load(std::memory_order_acquire) != 0) {
+        webrtc::SleepMs(1);
+    }
+}
+
+int I420FrameFanout::num_sinks() const {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    return static_cast<int>(sinks_->sinks.size());
+}
+
+void I420FrameFanout::DeliverFrame(
+    const webrtc::scoped_refptr<I420Buffer>& frame) {
+    webrtc::scoped_refptr<SinkList> list;
+    int parity;
+    {
+        webrtc::CriticalSectionScoped cs(crit_.get());
+        list = sinks_;
+        parity = epoch_ & 1;
+        deliveries_[parity].fetch_add(1, std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < list->sinks.size(); i++) {
+        list->sinks[i]->OnFrame(frame);
+    }
+    deliveries_[parity].fetch_sub(1, std::memory_order_release);
+}
@@ -0,0 +1,205 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#ifndef VOIP_I420_BUFFER_POOL_H
+#define VOIP_I420_BUFFER_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include "webrtc/video_frame.h"
+#include "webrtc/system_wrappers/interface/critical_section_wrapper.h"
+#include "webrtc/system_wrappers/interface/scoped_ptr.h"
+#include "webrtc/system_wrappers/interface/scoped_refptr.h"
+
+//Reference counted I420 frames from a pool, shared read only between the
+//consumers of a frame.
+//
+//webrtc::I420VideoFrame owns its three planes and CopyFrame deep copies
+//them, and ViEFrameProviderBase hands every registered callback its own
+//frame, so the encoder, the renderer and an effect filter each copy the
+//whole picture. Here one buffer is handed to every sink by reference. A
+//sink that needs to change the picture asks the pool for a writable buffer
+//and gets a copy only while others still hold it.
+//
+//Planes are 32 byte aligned with 32 byte aligned strides, so row kernels
+//can use aligned loads. Released buffers go back to the pool in buckets by
+//size and are reused by the next frame of the same size.
+class I420BufferPoolCore;
+
+class I420Buffer {
+public:
+    enum { kAlignment = 32 };
+    enum { kNumPlanes = 3 };
+    //Y, U and V, for loops over the planes.
+    static const webrtc::PlaneType kPlanes[kNumPlanes];
+
+    //For webrtc::scoped_refptr.
+    int32_t AddRef() const;
+    int32_t Release() const;
+    bool HasOneRef() const {
+        return ref_count_.load(std::memory_order_acquire) == 1;
+    }
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    int stride(webrtc::PlaneType plane) const { return strides_[plane]; }
+    const uint8_t* data(webrtc::PlaneType plane) const {
+        return planes_[plane];
+    }
+    //Only for the sole owner, see I420BufferPool::MakeWritable.
+    uint8_t* MutableData(webrtc::PlaneType plane) { return planes_[plane]; }
+    //Bytes of the three planes.
+    size_t size() const { return size_; }
+
+    uint32_t timestamp() const { return timestamp_; }
+    void set_timestamp(uint32_t timestamp) { timestamp_ = timestamp; }
+    int64_t render_time_ms() const { return render_time_ms_; }
+    void set_render_time_ms(int64_t render_time_ms) {
+        render_time_ms_ = render_time_ms;
+    }
+
+    //Copies into a frame for the webrtc APIs, counted by the pool.
+    int CopyTo(webrtc::I420VideoFrame* frame) const;
+
+private:
+    friend class I420BufferPoolCore;
+
+    I420Buffer(I420BufferPoolCore* core, size_t capacity);
+    ~I420Buffer();
+    void Reset(int width, int height);
+
+    I420BufferPoolCore* core_;
+    uint8_t* memory_;
+    const size_t capacity_;
+    mutable std::atomic<int32_t> ref_count_;
+    int width_;
+    int height_;
+    size_t size_;
+    uint8_t* planes_[webrtc::kNumOfPlanes];
+    int strides_[webrtc::kNumOfPlanes];
+    uint32_t timestamp_;
+    int64_t render_time_ms_;
+
+    I420Buffer(const I420Buffer&);
+    I420Buffer& operator=(const I420Buffer&);
+};
+
+struct I420BufferPoolStatistics {
+    uint64_t requests;
+    //Requests served from a released buffer.
+    uint64_t pool_hits;
+    uint64_t bytes_allocated;
+    //Copy on write, import and export.
+    uint64_t bytes_copied;
+    uint32_t buffers_outstanding;
+};
+
+class I420BufferPool {
+public:
+    enum { kMaxBuckets = 4 };
+    enum { kMaxFreeBuffersPerBucket = 8 };
+
+    I420BufferPool();
+    //Outstanding buffers stay valid and are freed on their last release.
+    ~I420BufferPool();
+
+    //Thread safe. The content is undefined.
+    webrtc::scoped_refptr<I420Buffer> CreateBuffer(int width, int height);
+
+    //|buffer| itself when the caller holds the only reference, otherwise a
+    //copy the caller owns alone.
+    webrtc::scoped_refptr<I420Buffer> MakeWritable(
+        const webrtc::scoped_refptr<I420Buffer>& buffer);
+
+    webrtc::scoped_refptr<I420Buffer> CopyFrom(
+        const webrtc::I420VideoFrame& frame);
+
+    I420BufferPoolStatistics GetStatistics() const;
+
+private:
+    I420BufferPoolCore* core_;
+
+    I420BufferPool(const I420BufferPool&);
+    I420BufferPool& operator=(const I420BufferPool&);
+};
+
+//Box filtered scale of |src| into |dst|, which has the target size.
+void ScaleI420Buffer(const I420Buffer& src, I420Buffer* dst);
+
+class I420FrameSink {
+public:
+    //|frame| is shared with the other sinks, see I420BufferPool::MakeWritable.
+    virtual void OnFrame(const webrtc::scoped_refptr<I420Buffer>& frame) = 0;
+protected:
+    virtual ~I420FrameSink() {}
+};
+
+//Delivers each frame to every sink by reference.
+//
+//The sinks are called without the lock, on a snapshot of the sink list
+//taken by reference, so a slow sink does not hold up AddSink, RemoveSink
+//or deliveries on other threads, and a sink may add sinks from OnFrame.
+//
+//Nothing in the engine delivers through a fanout yet. The capture path
+//ends in ViEFrameProviderBase inside the prebuilt webrtc library, which
+//still copies the frame for each of its callbacks, so the sharing only
+//applies to sinks a capturer feeds through here itself.
+class I420FrameFanout {
+public:
+    I420FrameFanout();
+
+    void AddSink(I420FrameSink* sink);
+    //Returns once no delivery can call |sink| any more, so the sink may be
+    //destroyed then. Waits for the deliveries in progress, not to be called
+    //from OnFrame.
+    void RemoveSink(I420FrameSink* sink);
+    int num_sinks() const;
+
+    void DeliverFrame(const webrtc::scoped_refptr<I420Buffer>& frame);
+
+private:
+    //Never changed once published, replaced as a whole by AddSink and
+    //RemoveSink.
+    class SinkList {
+    public:
+        SinkList() : ref_count_(0) {}
+
+        int32_t AddRef() const {
+            return ref_count_.fetch_add(1, std::memory_order_relaxed) + 1;
+        }
+        int32_t Release() const {
+            int32_t count =
+                ref_count_.fetch_sub(1, std::memory_order_acq_rel) - 1;
+            if (count == 0) {
+                delete this;
+            }
+            return count;
+        }
+        std::vector<I420FrameSink*> sinks;
+
+    private:
+        mutable std::atomic<int32_t> ref_count_;
+    };
+
+    webrtc::scoped_ptr<webrtc::CriticalSectionWrapper> crit_;
+    webrtc::scoped_refptr<SinkList> sinks_;
+    //Deliveries in progress, counted by the parity of the epoch they
+    //started in. RemoveSink starts a new epoch and waits for the old one,
+    //the deliveries started after it do not keep it waiting.
+    int epoch_;
+    std::atomic<int> deliveries_[2];
+    //One RemoveSink at a time, so the epoch waited for is not reused.
+    webrtc::scoped_ptr<webrtc::CriticalSectionWrapper> remove_crit_;
+
+    I420FrameFanout(const I420FrameFanout&);
+    I420FrameFanout& operator=(const I420FrameFanout&);
+};
+
+#endif
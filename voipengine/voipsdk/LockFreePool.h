@@ -0,0 +1,145 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#ifndef VOIP_LOCK_FREE_POOL_H
+#define VOIP_LOCK_FREE_POOL_H
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+//Fixed capacity pool of preconstructed objects, a replacement for
+//webrtc::MemoryPoolImpl which takes a critical section and touches a
+//std::list on every PopMemory/PushMemory.
+//
+//The free objects form a Treiber stack. Objects live in one array, so the
+//stack links are array indices and the head packs the top index with a
+//modification tag into 64 bits. The tag makes a stale compare-and-swap
+//fail (ABA) and 64 bit atomics are lock free on both armv7 and arm64.
+//
+//Pop() and Push() may be called from any number of threads. Objects are
+//handed out as is, the caller resets whatever state it needs.
+template<class T>
+class LockFreePool {
+public:
+    explicit LockFreePool(uint32_t capacity)
+    : capacity_(capacity),
+      items_(new T[capacity]),
+      next_(new std::atomic<uint32_t>[capacity]),
+      head_(Pack(0, 0)) {
+        assert(capacity > 0 && capacity < kEmpty);
+        for (uint32_t i = 0; i < capacity; i++) {
+            next_[i].store(i + 1 < capacity ? i + 1 : kEmpty,
+                           std::memory_order_relaxed);
+        }
+    }
+
+    //All objects must have been pushed back.
+    ~LockFreePool() {
+        delete[] next_;
+        delete[] items_;
+    }
+
+    //Returns NULL when every object is in use.
+    T* Pop() {
+        uint64_t head = head_.load(std::memory_order_acquire);
+        for (;;) {
+            uint32_t index = Index(head);
+            if (index == kEmpty) {
+                return NULL;
+            }
+            uint32_t next = next_[index].load(std::memory_order_relaxed);
+            if (head_.compare_exchange_weak(head, Pack(next, Tag(head) + 1),
+                                            std::memory_order_acq_rel,
+                                            std::memory_order_acquire)) {
+                return &items_[index];
+            }
+        }
+    }
+
+    void Push(T* item) {
+        assert(Owns(item));
+        uint32_t index = static_cast<uint32_t>(item - items_);
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        for (;;) {
+            next_[index].store(Index(head), std::memory_order_relaxed);
+            if (head_.compare_exchange_weak(head, Pack(index, Tag(head) + 1),
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+                return;
+            }
+        }
+    }
+
+    //webrtc::MemoryPool compatible interface.
+    int32_t PopMemory(T*& memory) {
+        memory = Pop();
+        return memory ? 0 : -1;
+    }
+    int32_t PushMemory(T*& memory) {
+        if (memory == NULL) {
+            return -1;
+        }
+        Push(memory);
+        memory = NULL;
+        return 0;
+    }
+
+    bool Owns(const T* item) const {
+        return item >= items_ && item < items_ + capacity_;
+    }
+
+    uint32_t capacity() const { return capacity_; }
+
+private:
+    static const uint32_t kEmpty = 0xffffffff;
+
+    static uint64_t Pack(uint32_t index, uint32_t tag) {
+        return (static_cast<uint64_t>(tag) << 32) | index;
+    }
+    static uint32_t Index(uint64_t head) {
+        return static_cast<uint32_t>(head);
+    }
+    static uint32_t Tag(uint64_t head) {
+        return static_cast<uint32_t>(head >> 32);
+    }
+
+    const uint32_t capacity_;
+    T* items_;
+    std::atomic<uint32_t>* next_;
+    std::atomic<uint64_t> head_;
+
+    LockFreePool(const LockFreePool&);
+    LockFreePool& operator=(const LockFreePool&);
+};
+
+//Returns the object to its pool when going out of scope.
+template<class T>
+class ScopedPoolItem {
+public:
+    explicit ScopedPoolItem(LockFreePool<T>* pool)
+    : pool_(pool), item_(pool->Pop()) {
+    }
+    ~ScopedPoolItem() {
+        if (item_) {
+            pool_->Push(item_);
+        }
+    }
+    T* get() const { return item_; }
+    T* operator->() const { return item_; }
+
+private:
+    LockFreePool<T>* pool_;
+    T* item_;
+
+    ScopedPoolItem(const ScopedPoolItem&);
+    ScopedPoolItem& operator=(const ScopedPoolItem&);
+};
+
+#endif
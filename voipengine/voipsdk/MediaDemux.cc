@@ -0,0 +1,122 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include "MediaDemux.h"
+
+#include <string.h>
+
+MediaDemux::MediaDemux(Receiver* receiver, int video_queue_size)
+: receiver_(receiver),
+  pool_(video_queue_size > 0 ? video_queue_size : kDefaultVideoQueueSize),
+  incoming_(NULL),
+  scheduled_(false),
+  video_queue_(dispatch_queue_create("com.beetle.voip.video_receive",
+                                     DISPATCH_QUEUE_SERIAL)),
+  audio_packets_(0),
+  video_packets_(0),
+  video_dropped_(0),
+  max_video_batch_(0) {
+    //Below the audio path, which runs on the caller's queue.
+    dispatch_set_target_queue(video_queue_,
+        dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0));
+}
+
+MediaDemux::~MediaDemux() {
+    Flush();
+    dispatch_release(video_queue_);
+}
+
+bool MediaDemux::DeliverPacket(int media, bool rtp, const uint8_t* packet,
+                               size_t length) {
+    if (media == kMediaAudio) {
+        audio_packets_.fetch_add(1, std::memory_order_relaxed);
+        if (rtp) {
+            receiver_->OnRtpPacket(kMediaAudio, packet, length);
+        } else {
+            receiver_->OnRtcpPacket(kMediaAudio, packet, length);
+        }
+        return true;
+    }
+    if (media != kMediaVideo) {
+        return false;
+    }
+
+    QueuedPacket* queued = length <= kMaxPacketSize ? pool_.Pop() : NULL;
+    if (queued == NULL) {
+        video_dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    video_packets_.fetch_add(1, std::memory_order_relaxed);
+    queued->rtp = rtp;
+    queued->length = static_cast<uint32_t>(length);
+    memcpy(queued->data, packet, length);
+
+    QueuedPacket* head = incoming_.load(std::memory_order_relaxed);
+    do {
+        queued->next = head;
+    } while (!incoming_.compare_exchange_weak(head, queued,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed));
+    //One pending run drains everything pushed before it starts.
+    if (!scheduled_.exchange(true, std::memory_order_acq_rel)) {
+        dispatch_async_f(video_queue_, this, DeliverVideo);
+    }
+    return true;
+}
+
+void MediaDemux::DeliverVideo(void* context) {
+    static_cast<MediaDemux*>(context)->DeliverQueuedVideo();
+}
+
+void MediaDemux::DeliverQueuedVideo() {
+    //Cleared before taking the stack, a packet pushed after the exchange
+    //below schedules another run.
+    scheduled_.store(false, std::memory_order_release);
+    QueuedPacket* packet = incoming_.exchange(NULL,
+                                              std::memory_order_acquire);
+
+    //The stack is newest first.
+    QueuedPacket* ordered = NULL;
+    while (packet) {
+        QueuedPacket* next = packet->next;
+        packet->next = ordered;
+        ordered = packet;
+        packet = next;
+    }
+
+    uint32_t count = 0;
+    while (ordered) {
+        QueuedPacket* next = ordered->next;
+        if (ordered->rtp) {
+            receiver_->OnRtpPacket(kMediaVideo, ordered->data,
+                                   ordered->length);
+        } else {
+            receiver_->OnRtcpPacket(kMediaVideo, ordered->data,
+                                    ordered->length);
+        }
+        pool_.Push(ordered);
+        ordered = next;
+        count++;
+    }
+    if (count > max_video_batch_.load(std::memory_order_relaxed)) {
+        max_video_batch_.store(count, std::memory_order_relaxed);
+    }
+}
+
+void MediaDemux::Flush() {
+    dispatch_sync_f(video_queue_, NULL, FlushDone);
+}
+
+MediaDemuxStatistics MediaDemux::GetStatistics() const {
+    MediaDemuxStatistics stats;
+    stats.audio_packets = audio_packets_.load(std::memory_order_relaxed);
+    stats.video_packets = video_packets_.load(std::memory_order_relaxed);
+    stats.video_dropped = video_dropped_.load(std::memory_order_relaxed);
+    stats.max_video_batch = max_video_batch_.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,101 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#ifndef VOIP_MEDIA_DEMUX_H
+#define VOIP_MEDIA_DEMUX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <dispatch/dispatch.h>
+#include "LockFreePool.h"
+
+//Media type byte of the VOIP_DATA framing.
+enum MediaType {
+    kMediaAudio = 1,
+    kMediaVideo = 2,
+};
+
+struct MediaDemuxStatistics {
+    uint64_t audio_packets;
+    uint64_t video_packets;
+    //Video packets dropped because the queue was full.
+    uint64_t video_dropped;
+    //Most video packets delivered in one run of the video queue.
+    uint32_t max_video_batch;
+};
+
+//Routes the RTP and RTCP packets of one call to the voice and video
+//channels.
+//
+//Audio is delivered on the calling thread, the socket read handler, as
+//before. Video is copied into a preallocated queue and delivered on a
+//serial dispatch queue of its own, so a key frame arriving as a burst of
+//packets, each inserted into the ViE jitter buffer, does not hold up the
+//voice packets read after it. When the video queue is full video packets
+//are dropped and recovered by NACK, the read handler never waits.
+class MediaDemux {
+public:
+    enum { kMaxPacketSize = 1500 };
+    enum { kDefaultVideoQueueSize = 256 };
+
+    class Receiver {
+    public:
+        //Audio on the thread calling DeliverPacket, video on the video
+        //queue.
+        virtual void OnRtpPacket(MediaType media, const uint8_t* packet,
+                                 size_t length) = 0;
+        virtual void OnRtcpPacket(MediaType media, const uint8_t* packet,
+                                  size_t length) = 0;
+    protected:
+        virtual ~Receiver() {}
+    };
+
+    MediaDemux(Receiver* receiver, int video_queue_size);
+    //Waits until the queued video has been delivered.
+    ~MediaDemux();
+
+    //|media| is the type byte of the framing. Returns false for types the
+    //demux does not route and for dropped packets.
+    bool DeliverPacket(int media, bool rtp, const uint8_t* packet,
+                       size_t length);
+
+    //Waits until the video queued so far has been delivered.
+    void Flush();
+
+    MediaDemuxStatistics GetStatistics() const;
+
+private:
+    struct QueuedPacket {
+        bool rtp;
+        uint32_t length;
+        uint8_t data[kMaxPacketSize];
+        QueuedPacket* next;
+    };
+
+    static void DeliverVideo(void* context);
+    static void FlushDone(void* /*context*/) {}
+    void DeliverQueuedVideo();
+
+    Receiver* receiver_;
+    LockFreePool<QueuedPacket> pool_;
+    //Producers push, the video queue takes the whole stack.
+    std::atomic<QueuedPacket*> incoming_;
+    std::atomic<bool> scheduled_;
+    dispatch_queue_t video_queue_;
+
+    std::atomic<uint64_t> audio_packets_;
+    std::atomic<uint64_t> video_packets_;
+    std::atomic<uint64_t> video_dropped_;
+    std::atomic<uint32_t> max_video_batch_;
+
+    MediaDemux(const MediaDemux&);
+    MediaDemux& operator=(const MediaDemux&);
+};
+
+#endif
@@ -0,0 +1,200 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include "PacketPacer.h"
+
+#include <string.h>
+#include <algorithm>
+
+const float PacketPacer::kDefaultPaceMultiplier = 2.5f;
+
+PacketPacer::PacketPacer(Callback* callback, int target_bitrate_kbps,
+                         int capacity)
+: callback_(callback),
+  pool_(capacity),
+  incoming_(NULL),
+  next_order_(0),
+  queue_bytes_(0),
+  packets_dropped_(0),
+  pacing_bitrate_kbps_(
+      static_cast<int>(target_bitrate_kbps * kDefaultPaceMultiplier)),
+  max_queue_length_ms_(kDefaultMaxQueueLengthMs),
+  bytes_remaining_(0),
+  last_process_ms_(0),
+  has_processed_(false) {
+    queue_.reserve(capacity);
+    memset(&stats_, 0, sizeof(stats_));
+}
+
+PacketPacer::~PacketPacer() {
+    MoveIncoming();
+    for (size_t i = 0; i < queue_.size(); i++) {
+        pool_.Push(queue_[i]);
+    }
+}
+
+bool PacketPacer::InsertPacket(Priority priority, const uint8_t* data,
+                               size_t length, int64_t now_ms) {
+    PacedPacket* packet = NULL;
+    if (length <= PacedPacket::kMaxPacketSize) {
+        packet = pool_.Pop();
+    }
+    if (packet == NULL) {
+        packets_dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    packet->priority = priority;
+    packet->enqueue_time_ms = now_ms;
+    packet->length = static_cast<uint32_t>(length);
+    memcpy(packet->data, data, length);
+    packet->order = next_order_.fetch_add(1, std::memory_order_relaxed);
+    queue_bytes_.fetch_add(length, std::memory_order_relaxed);
+
+    //Only the consumer removes nodes and it always takes the whole stack,
+    //so a recycled head can not corrupt the list.
+    PacedPacket* head = incoming_.load(std::memory_order_relaxed);
+    do {
+        packet->next = head;
+    } while (!incoming_.compare_exchange_weak(head, packet,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed));
+    return true;
+}
+
+void PacketPacer::UpdateBitrate(int target_bitrate_kbps) {
+    pacing_bitrate_kbps_.store(
+        static_cast<int>(target_bitrate_kbps * kDefaultPaceMultiplier),
+        std::memory_order_relaxed);
+}
+
+void PacketPacer::SetMaxQueueLengthMs(int64_t max_queue_length_ms) {
+    max_queue_length_ms_ = max_queue_length_ms;
+}
+
+void PacketPacer::MoveIncoming() {
+    PacedPacket* packet = incoming_.exchange(NULL, std::memory_order_acquire);
+    while (packet) {
+        PacedPacket* next = packet->next;
+        queue_.push_back(packet);
+        std::push_heap(queue_.begin(), queue_.end(), LaterPacket());
+        packet = next;
+    }
+}
+
+void PacketPacer::IncreaseBudget(int64_t delta_ms) {
+    //Unused budget is not carried over, an idle period must not turn into
+    //a burst. Debt is paid back.
+    int64_t bytes = pacing_bitrate_kbps_.load(std::memory_order_relaxed) *
+                    delta_ms / 8;
+    if (bytes_remaining_ < 0) {
+        bytes_remaining_ += bytes;
+    } else {
+        bytes_remaining_ = bytes;
+    }
+}
+
+void PacketPacer::UseBudget(size_t bytes) {
+    int64_t max_debt = pacing_bitrate_kbps_.load(std::memory_order_relaxed) *
+                       kMaxDebtMs / 8;
+    bytes_remaining_ = std::max(bytes_remaining_ - static_cast<int64_t>(bytes),
+                                -max_debt);
+}
+
+bool PacketPacer::CanSend(const PacedPacket* packet, int64_t now_ms) const {
+    if (packet->priority == kHighPriority || bytes_remaining_ > 0) {
+        return true;
+    }
+    return now_ms - packet->enqueue_time_ms >= max_queue_length_ms_;
+}
+
+void PacketPacer::SendBatch(PacedPacket** batch, int count, int64_t now_ms) {
+    callback_->TimeToSendPackets(batch, count);
+
+    size_t bytes = 0;
+    for (int i = 0; i < count; i++) {
+        PacedPacket* packet = batch[i];
+        int64_t queue_time_ms = now_ms - packet->enqueue_time_ms;
+        stats_.total_queue_time_ms += queue_time_ms;
+        stats_.max_queue_time_ms = std::max(stats_.max_queue_time_ms,
+                                            queue_time_ms);
+        bytes += packet->length;
+        pool_.Push(packet);
+    }
+    queue_bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+    stats_.packets_sent += count;
+    stats_.bytes_sent += bytes;
+    stats_.batches++;
+}
+
+int64_t PacketPacer::TimeUntilNextProcess(int64_t now_ms) const {
+    if (!has_processed_) {
+        return 0;
+    }
+    return std::max<int64_t>(kMinPacketLimitMs - (now_ms - last_process_ms_),
+                             0);
+}
+
+int PacketPacer::Process(int64_t now_ms) {
+    MoveIncoming();
+
+    int64_t elapsed_ms = has_processed_ ? now_ms - last_process_ms_ : 0;
+    last_process_ms_ = now_ms;
+    has_processed_ = true;
+    if (elapsed_ms > 0) {
+        IncreaseBudget(std::min(elapsed_ms, kMaxIntervalTimeMs));
+    }
+
+    PacedPacket* batch[kMaxBatchSize];
+    int count = 0;
+    int sent = 0;
+    while (!queue_.empty()) {
+        PacedPacket* packet = queue_.front();
+        if (!CanSend(packet, now_ms)) {
+            break;
+        }
+        std::pop_heap(queue_.begin(), queue_.end(), LaterPacket());
+        queue_.pop_back();
+        if (packet->priority != kHighPriority) {
+            UseBudget(packet->length);
+        }
+        batch[count++] = packet;
+        if (count == kMaxBatchSize) {
+            SendBatch(batch, count, now_ms);
+            sent += count;
+            count = 0;
+        }
+    }
+    if (count > 0) {
+        SendBatch(batch, count, now_ms);
+        sent += count;
+    }
+    return sent;
+}
+
+size_t PacketPacer::QueueSizeBytes() const {
+    return queue_bytes_.load(std::memory_order_relaxed);
+}
+
+int64_t PacketPacer::ExpectedQueueTimeMs() const {
+    int kbps = pacing_bitrate_kbps_.load(std::memory_order_relaxed);
+    if (kbps <= 0) {
+        return 0;
+    }
+    return static_cast<int64_t>(QueueSizeBytes()) * 8 / kbps;
+}
+
+PacketPacerStatistics PacketPacer::GetStatistics() const {
+    PacketPacerStatistics stats = stats_;
+    stats.packets_dropped = packets_dropped_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void PacketPacer::ResetStatistics() {
+    memset(&stats_, 0, sizeof(stats_));
+    packets_dropped_.store(0, std::memory_order_relaxed);
+}
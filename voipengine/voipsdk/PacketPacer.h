@@ -0,0 +1,153 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#ifndef VOIP_PACKET_PACER_H
+#define VOIP_PACKET_PACER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include "LockFreePool.h"
+
+//Spreads outgoing RTP packets over time at the target bitrate, so a key
+//frame does not leave the phone as one burst that overflows a router queue.
+//
+//Works like webrtc::PacedSender with three changes. InsertPacket takes no
+//lock: packets are pushed on a lock free stack from any thread and moved to
+//the queue by Process(). The queue is a heap ordered by priority and then
+//by enqueue order, instead of one list per priority. Process() releases
+//every packet the budget allows in one TimeToSendPackets call, so the
+//transport builds and sends the whole burst in one go.
+//
+//Process() and the statistics must be called from one thread. Times are
+//passed in by the caller, which keeps the pacer independent of the clock.
+struct PacedPacket {
+    enum { kMaxPacketSize = 1500 };
+
+    int priority;
+    int64_t enqueue_time_ms;
+    uint32_t length;
+    uint8_t data[kMaxPacketSize];
+
+    //Set by the pacer.
+    uint64_t order;
+    PacedPacket* next;
+};
+
+struct PacketPacerStatistics {
+    uint64_t packets_sent;
+    uint64_t bytes_sent;
+    //Packets refused because the pool was exhausted or they were too big.
+    uint64_t packets_dropped;
+    //Sum and maximum of the time packets spent in the queue.
+    int64_t total_queue_time_ms;
+    int64_t max_queue_time_ms;
+    //Number of TimeToSendPackets calls.
+    uint64_t batches;
+};
+
+class PacketPacer {
+public:
+    enum Priority {
+        kHighPriority = 0,    //Audio and RTCP, never held back by the budget.
+        kNormalPriority = 1,  //Video.
+        kLowPriority = 2,     //Retransmissions and padding.
+    };
+
+    //Same as webrtc::PacedSender.
+    static const int64_t kDefaultMaxQueueLengthMs = 2000;
+    static const float kDefaultPaceMultiplier;
+
+    enum { kMaxBatchSize = 32 };
+
+    class Callback {
+    public:
+        //|packets| are owned by the pacer and only valid during the call.
+        virtual void TimeToSendPackets(const PacedPacket* const* packets,
+                                       int count) = 0;
+    protected:
+        virtual ~Callback() {}
+    };
+
+    //|capacity| bounds the number of queued packets, the storage is
+    //allocated up front.
+    PacketPacer(Callback* callback, int target_bitrate_kbps, int capacity);
+    ~PacketPacer();
+
+    //Thread safe, lock free. Returns false and drops the packet when the
+    //queue is full.
+    bool InsertPacket(Priority priority, const uint8_t* data, size_t length,
+                      int64_t now_ms);
+
+    //Thread safe, packets are paced at a multiple of the target.
+    void UpdateBitrate(int target_bitrate_kbps);
+    //Packets older than this are sent regardless of the budget.
+    void SetMaxQueueLengthMs(int64_t max_queue_length_ms);
+
+    //Milliseconds until Process() has something to do.
+    int64_t TimeUntilNextProcess(int64_t now_ms) const;
+    //Sends what the budget allows since the previous call. Returns the
+    //number of packets sent.
+    int Process(int64_t now_ms);
+
+    //Bytes waiting, including packets not yet moved to the queue.
+    size_t QueueSizeBytes() const;
+    //Time the queued bytes need at the pacing rate.
+    int64_t ExpectedQueueTimeMs() const;
+
+    PacketPacerStatistics GetStatistics() const;
+    void ResetStatistics();
+
+private:
+    //Processing cadence, same as webrtc::PacedSender.
+    static const int64_t kMinPacketLimitMs = 5;
+    //Longest interval credited to the budget, a late Process() must not
+    //release a burst. Same as webrtc::PacedSender.
+    static const int64_t kMaxIntervalTimeMs = 30;
+    //Longest debt carried over, in time at the pacing rate.
+    static const int64_t kMaxDebtMs = 500;
+
+    struct LaterPacket {
+        bool operator()(const PacedPacket* a, const PacedPacket* b) const {
+            if (a->priority != b->priority) {
+                return a->priority > b->priority;
+            }
+            return a->order > b->order;
+        }
+    };
+
+    void MoveIncoming();
+    void IncreaseBudget(int64_t delta_ms);
+    void UseBudget(size_t bytes);
+    bool CanSend(const PacedPacket* packet, int64_t now_ms) const;
+    void SendBatch(PacedPacket** batch, int count, int64_t now_ms);
+
+    Callback* callback_;
+    LockFreePool<PacedPacket> pool_;
+
+    //Producers push, Process() takes the whole stack.
+    std::atomic<PacedPacket*> incoming_;
+    std::atomic<uint64_t> next_order_;
+    std::atomic<size_t> queue_bytes_;
+    std::atomic<uint64_t> packets_dropped_;
+
+    std::vector<PacedPacket*> queue_;
+    std::atomic<int> pacing_bitrate_kbps_;
+    int64_t max_queue_length_ms_;
+    int64_t bytes_remaining_;
+    int64_t last_process_ms_;
+    bool has_processed_;
+
+    PacketPacerStatistics stats_;
+
+    PacketPacer(const PacketPacer&);
+    PacketPacer& operator=(const PacketPacer&);
+};
+
+#endif
@@ -0,0 +1,373 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include "ReceiveStatistics.h"
+
+#include <sched.h>
+#include <string.h>
+#include "webrtc/system_wrappers/interface/trace.h"
+
+//Jumps larger than this are a clock or stream restart, not jitter. Same as
+//webrtc.
+static const int32_t kMaxJitterSamples = 450000;
+
+static const uint32_t kMaxCumulativeLost = 0x00ffffff;
+
+static const int kMaxSpins = 64;
+
+//Marks the entry of an evicted stream. Lookups probe past it, so the
+//streams added after it on the same probe path are still found.
+static StreamStatistician* const kRemoved =
+    reinterpret_cast<StreamStatistician*>(1);
+
+static inline uint32_t TableStart(uint32_t ssrc, uint32_t mask) {
+    //Fibonacci hashing, SSRCs are random but may be assigned in sequence
+    //by a mixer.
+    return ((ssrc * 2654435761u) >> 16) & mask;
+}
+
+template<class T, class V>
+static inline void AddRelaxed(std::atomic<T>* counter, V value) {
+    counter->store(counter->load(std::memory_order_relaxed) +
+                   static_cast<T>(value), std::memory_order_relaxed);
+}
+
+StreamStatistician::StreamStatistician(uint32_t ssrc, int64_t now_ms)
+: ssrc_(ssrc),
+  started_(false),
+  max_sequence_number_(0),
+  cycles_(0),
+  last_transit_(0),
+  last_timestamp_(0),
+  sequence_(0),
+  base_sequence_number_(0),
+  extended_max_sequence_number_(0),
+  received_(0),
+  jitter_q4_(0),
+  packets_(0),
+  bytes_(0),
+  header_bytes_(0),
+  padding_bytes_(0),
+  last_receive_time_ms_(now_ms),
+  report_crit_(webrtc::CriticalSectionWrapper::CreateCriticalSection()),
+  reported_(false),
+  last_report_expected_(0),
+  last_report_received_(0),
+  cumulative_lost_(0) {
+    writer_.clear();
+    memset(&last_report_, 0, sizeof(last_report_));
+}
+
+void StreamStatistician::IncomingPacket(const ReceivedRtpPacket& packet,
+                                        int64_t now_ms) {
+    for (int spins = 0; writer_.test_and_set(std::memory_order_acquire);
+         spins++) {
+        //The holder may have been preempted.
+        if (spins >= kMaxSpins) {
+            sched_yield();
+        }
+    }
+
+    //Writers are serialized, so the counters need a plain load and store
+    //instead of a locked read-modify-write.
+    AddRelaxed(&packets_, 1);
+    AddRelaxed(&bytes_, packet.header_length + packet.payload_length +
+                        packet.padding_length);
+    AddRelaxed(&header_bytes_, packet.header_length);
+    AddRelaxed(&padding_bytes_, packet.padding_length);
+    last_receive_time_ms_.store(now_ms, std::memory_order_relaxed);
+
+    uint32_t receive_time_rtp =
+        static_cast<uint32_t>(now_ms * packet.clock_rate_hz / 1000);
+    uint32_t transit = receive_time_rtp - packet.timestamp;
+    uint32_t jitter_q4 = jitter_q4_.load(std::memory_order_relaxed);
+    uint32_t base_sequence_number =
+        base_sequence_number_.load(std::memory_order_relaxed);
+    bool in_order = false;
+    if (!started_) {
+        started_ = true;
+        max_sequence_number_ = packet.sequence_number;
+        base_sequence_number = packet.sequence_number;
+        last_transit_ = transit;
+        last_timestamp_ = packet.timestamp;
+    } else {
+        uint16_t delta = packet.sequence_number - max_sequence_number_;
+        if (delta != 0 && delta < 0x8000) {
+            in_order = true;
+            if (packet.sequence_number < max_sequence_number_) {
+                cycles_ += 1 << 16;
+            }
+            max_sequence_number_ = packet.sequence_number;
+        }
+    }
+    //Frames split over several packets share the timestamp and would
+    //count the packetization as jitter.
+    if (in_order && packet.timestamp != last_timestamp_) {
+        int32_t d = static_cast<int32_t>(transit - last_transit_);
+        if (d < 0) {
+            d = -d;
+        }
+        if (d < kMaxJitterSamples) {
+            jitter_q4 += ((d << 4) - static_cast<int32_t>(jitter_q4) + 8) >> 4;
+        }
+        last_transit_ = transit;
+        last_timestamp_ = packet.timestamp;
+    }
+
+    uint32_t sequence = sequence_.load(std::memory_order_relaxed);
+    sequence_.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    //The base goes inside the window too, or a reader could pair a new
+    //base with the old counters.
+    base_sequence_number_.store(base_sequence_number,
+                                std::memory_order_relaxed);
+    extended_max_sequence_number_.store(cycles_ + max_sequence_number_,
+                                        std::memory_order_relaxed);
+    AddRelaxed(&received_, 1);
+    jitter_q4_.store(jitter_q4, std::memory_order_relaxed);
+    sequence_.store(sequence + 2, std::memory_order_release);
+
+    writer_.clear(std::memory_order_release);
+}
+
+bool StreamStatistician::ReadSnapshot(Snapshot* snapshot) const {
+    for (int spins = 0;; spins++) {
+        //A writer preempted inside the window, or one holding the spin
+        //lock, keeps the sequence moving or odd.
+        if (spins >= kMaxSpins) {
+            sched_yield();
+        }
+        uint32_t begin = sequence_.load(std::memory_order_acquire);
+        if (begin & 1) {
+            continue;
+        }
+        snapshot->base_sequence_number =
+            base_sequence_number_.load(std::memory_order_relaxed);
+        snapshot->extended_max_sequence_number =
+            extended_max_sequence_number_.load(std::memory_order_relaxed);
+        snapshot->received = received_.load(std::memory_order_relaxed);
+        snapshot->jitter_q4 = jitter_q4_.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sequence_.load(std::memory_order_relaxed) == begin) {
+            return snapshot->received > 0;
+        }
+    }
+}
+
+bool StreamStatistician::GetStatistics(RtcpReportBlock* block, bool reset) {
+    webrtc::CriticalSectionScoped cs(report_crit_.get());
+    if (!reset) {
+        if (!reported_) {
+            return false;
+        }
+        *block = last_report_;
+        return true;
+    }
+
+    Snapshot snapshot;
+    if (!ReadSnapshot(&snapshot)) {
+        return false;
+    }
+    uint32_t expected = snapshot.extended_max_sequence_number -
+                        snapshot.base_sequence_number + 1;
+    uint32_t expected_interval = expected - last_report_expected_;
+    uint32_t received_interval = snapshot.received - last_report_received_;
+    int64_t lost_interval = static_cast<int64_t>(expected_interval) -
+                            received_interval;
+    uint8_t fraction_lost = 0;
+    if (expected_interval > 0 && lost_interval > 0) {
+        int64_t fraction = (lost_interval << 8) / expected_interval;
+        fraction_lost = fraction > 255 ? 255 : static_cast<uint8_t>(fraction);
+        cumulative_lost_ += static_cast<uint32_t>(lost_interval);
+        if (cumulative_lost_ > kMaxCumulativeLost) {
+            cumulative_lost_ = kMaxCumulativeLost;
+        }
+    }
+    last_report_expected_ = expected;
+    last_report_received_ = snapshot.received;
+
+    last_report_.ssrc = ssrc_;
+    last_report_.fraction_lost = fraction_lost;
+    last_report_.cumulative_lost = cumulative_lost_;
+    last_report_.extended_highest_sequence_number =
+        snapshot.extended_max_sequence_number;
+    last_report_.jitter = snapshot.jitter_q4 >> 4;
+    last_report_.last_sr = 0;
+    last_report_.delay_since_last_sr = 0;
+    reported_ = true;
+    *block = last_report_;
+    return true;
+}
+
+void StreamStatistician::GetDataCounters(StreamDataCounters* counters) const {
+    counters->packets = packets_.load(std::memory_order_relaxed);
+    counters->bytes = bytes_.load(std::memory_order_relaxed);
+    counters->header_bytes = header_bytes_.load(std::memory_order_relaxed);
+    counters->padding_bytes = padding_bytes_.load(std::memory_order_relaxed);
+}
+
+ReceiveStatistics::ReceiveStatistics()
+: num_streams_(0),
+  crit_(webrtc::CriticalSectionWrapper::CreateCriticalSection()),
+  exhausted_(false) {
+    for (int i = 0; i < kTableSize; i++) {
+        table_[i].store(NULL, std::memory_order_relaxed);
+    }
+}
+
+ReceiveStatistics::~ReceiveStatistics() {
+    for (int i = 0; i < kTableSize; i++) {
+        StreamStatistician* statistician =
+            table_[i].load(std::memory_order_relaxed);
+        if (statistician != kRemoved) {
+            delete statistician;
+        }
+    }
+    for (size_t i = 0; i < retired_.size(); i++) {
+        delete retired_[i].statistician;
+    }
+}
+
+StreamStatistician* ReceiveStatistics::GetStatistician(uint32_t ssrc) const {
+    uint32_t start = TableStart(ssrc, kTableSize - 1);
+    for (uint32_t i = 0; i < kTableSize; i++) {
+        StreamStatistician* statistician =
+            table_[(start + i) & (kTableSize - 1)].load(
+                std::memory_order_acquire);
+        if (statistician == NULL) {
+            return NULL;
+        }
+        if (statistician != kRemoved && statistician->ssrc() == ssrc) {
+            return statistician;
+        }
+    }
+    return NULL;
+}
+
+StreamStatistician* ReceiveStatistics::GetOrCreateStatistician(
+    uint32_t ssrc, int64_t now_ms) {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    //Another thread may have added it since the lookup without the lock.
+    StreamStatistician* statistician = GetStatistician(ssrc);
+    if (statistician != NULL) {
+        return statistician;
+    }
+    DeleteRetired(now_ms);
+    if (num_streams_.load(std::memory_order_relaxed) >= kMaxStreams &&
+        EvictIdleStatisticians(now_ms) == 0) {
+        if (!exhausted_) {
+            exhausted_ = true;
+            webrtc::Trace::Add(webrtc::kTraceWarning, webrtc::kTraceRtpRtcp,
+                               -1, "receive statistics: %d streams active, "
+                               "ssrc:%u not counted", kMaxStreams, ssrc);
+        }
+        return NULL;
+    }
+    exhausted_ = false;
+
+    //The lookup above went over the whole probe path, so the first free
+    //or removed entry on it is the place. With at most kMaxStreams of the
+    //kTableSize entries taken there is one.
+    uint32_t start = TableStart(ssrc, kTableSize - 1);
+    for (uint32_t i = 0; i < kTableSize; i++) {
+        std::atomic<StreamStatistician*>& entry =
+            table_[(start + i) & (kTableSize - 1)];
+        StreamStatistician* current = entry.load(std::memory_order_relaxed);
+        if (current == NULL || current == kRemoved) {
+            statistician = new StreamStatistician(ssrc, now_ms);
+            entry.store(statistician, std::memory_order_release);
+            num_streams_.fetch_add(1, std::memory_order_relaxed);
+            return statistician;
+        }
+    }
+    return NULL;
+}
+
+int ReceiveStatistics::EvictIdleStatisticians(int64_t now_ms) {
+    int evicted = 0;
+    for (int i = 0; i < kTableSize; i++) {
+        StreamStatistician* statistician =
+            table_[i].load(std::memory_order_relaxed);
+        if (statistician == NULL || statistician == kRemoved ||
+            now_ms - statistician->last_receive_time_ms() <=
+                kStreamTimeoutMs) {
+            continue;
+        }
+        table_[i].store(kRemoved, std::memory_order_release);
+        RetiredStatistician retired = { statistician, now_ms };
+        retired_.push_back(retired);
+        evicted++;
+    }
+    if (evicted == 0) {
+        return 0;
+    }
+    num_streams_.fetch_sub(evicted, std::memory_order_relaxed);
+
+    //A removed entry followed by a free one ends no other probe path, it
+    //is freed too so the paths stay short.
+    for (int i = kTableSize - 1; i >= 0; i--) {
+        if (table_[i].load(std::memory_order_relaxed) != kRemoved) {
+            continue;
+        }
+        for (int j = i; table_[j].load(std::memory_order_relaxed) ==
+                            kRemoved &&
+                        table_[(j + 1) & (kTableSize - 1)].load(
+                            std::memory_order_relaxed) == NULL;
+             j = (j - 1) & (kTableSize - 1)) {
+            table_[j].store(NULL, std::memory_order_release);
+        }
+    }
+    webrtc::Trace::Add(webrtc::kTraceStateInfo, webrtc::kTraceRtpRtcp, -1,
+                       "receive statistics: evicted %d idle streams",
+                       evicted);
+    return evicted;
+}
+
+void ReceiveStatistics::DeleteRetired(int64_t now_ms) {
+    //A receiving thread uses a statistician for one packet, a stream idle
+    //for kStreamTimeoutMs before and after its eviction is no longer in
+    //use.
+    size_t kept = 0;
+    for (size_t i = 0; i < retired_.size(); i++) {
+        if (now_ms - retired_[i].retire_time_ms > kStreamTimeoutMs) {
+            delete retired_[i].statistician;
+        } else {
+            retired_[kept++] = retired_[i];
+        }
+    }
+    retired_.resize(kept);
+}
+
+void ReceiveStatistics::IncomingPacket(const ReceivedRtpPacket& packet,
+                                       int64_t now_ms) {
+    StreamStatistician* statistician = GetStatistician(packet.ssrc);
+    if (statistician == NULL) {
+        statistician = GetOrCreateStatistician(packet.ssrc, now_ms);
+        if (statistician == NULL) {
+            return;
+        }
+    }
+    statistician->IncomingPacket(packet, now_ms);
+}
+
+int ReceiveStatistics::GetReportBlocks(RtcpReportBlock* blocks,
+                                       int max_blocks, int64_t now_ms) {
+    int count = 0;
+    for (int i = 0; i < kTableSize && count < max_blocks; i++) {
+        StreamStatistician* statistician =
+            table_[i].load(std::memory_order_acquire);
+        if (statistician == NULL || statistician == kRemoved ||
+            now_ms - statistician->last_receive_time_ms() > kStreamTimeoutMs) {
+            continue;
+        }
+        if (statistician->GetStatistics(&blocks[count], true)) {
+            count++;
+        }
+    }
+    return count;
+}
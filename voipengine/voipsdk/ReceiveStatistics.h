@@ -0,0 +1,172 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#ifndef VOIP_RECEIVE_STATISTICS_H
+#define VOIP_RECEIVE_STATISTICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include "RtcpWriter.h"
+#include "webrtc/system_wrappers/interface/critical_section_wrapper.h"
+#include "webrtc/system_wrappers/interface/scoped_ptr.h"
+
+//Per SSRC receive statistics for RTCP receiver reports.
+//
+//webrtc::ReceiveStatisticsImpl keeps a std::map of statisticians under one
+//lock that every incoming packet and every report takes. Here the
+//statisticians are found through a lock free open addressing table, the
+//data counters are relaxed atomics and the sequence and jitter state is
+//published through a seqlock, so building a report never blocks the
+//receiving threads and streams received on different threads never share
+//a lock. Only the first packet of a stream takes the table lock, to add
+//the stream or to evict idle ones.
+struct ReceivedRtpPacket {
+    uint32_t ssrc;
+    uint16_t sequence_number;
+    uint32_t timestamp;
+    //RTP clock of the payload type.
+    int clock_rate_hz;
+    size_t header_length;
+    size_t payload_length;
+    size_t padding_length;
+};
+
+struct StreamDataCounters {
+    uint32_t packets;
+    uint64_t bytes;
+    uint64_t header_bytes;
+    uint64_t padding_bytes;
+};
+
+class StreamStatistician {
+public:
+    //|now_ms| counts as the last receive time until the first packet.
+    StreamStatistician(uint32_t ssrc, int64_t now_ms);
+
+    uint32_t ssrc() const { return ssrc_; }
+
+    //Packets of one stream may come from several threads, they are
+    //serialized by a spin lock private to the stream.
+    void IncomingPacket(const ReceivedRtpPacket& packet, int64_t now_ms);
+
+    //Fills the loss and jitter fields of |block|. With |reset| the loss
+    //counts from the previous report are taken, otherwise the previous
+    //report is returned again. Returns false before the first packet or,
+    //without |reset|, before the first report.
+    bool GetStatistics(RtcpReportBlock* block, bool reset);
+
+    void GetDataCounters(StreamDataCounters* counters) const;
+    int64_t last_receive_time_ms() const {
+        return last_receive_time_ms_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Snapshot {
+        uint32_t base_sequence_number;
+        uint32_t extended_max_sequence_number;
+        uint32_t received;
+        uint32_t jitter_q4;
+    };
+
+    bool ReadSnapshot(Snapshot* snapshot) const;
+
+    const uint32_t ssrc_;
+
+    //Writer side, only touched with writer_ held.
+    std::atomic_flag writer_;
+    bool started_;
+    uint16_t max_sequence_number_;
+    uint32_t cycles_;
+    uint32_t last_transit_;
+    uint32_t last_timestamp_;
+
+    //Published under the seqlock, odd while a writer is updating.
+    std::atomic<uint32_t> sequence_;
+    std::atomic<uint32_t> base_sequence_number_;
+    std::atomic<uint32_t> extended_max_sequence_number_;
+    std::atomic<uint32_t> received_;
+    std::atomic<uint32_t> jitter_q4_;
+
+    std::atomic<uint32_t> packets_;
+    std::atomic<uint64_t> bytes_;
+    std::atomic<uint64_t> header_bytes_;
+    std::atomic<uint64_t> padding_bytes_;
+    std::atomic<int64_t> last_receive_time_ms_;
+
+    //Report side, the previous report.
+    webrtc::scoped_ptr<webrtc::CriticalSectionWrapper> report_crit_;
+    bool reported_;
+    uint32_t last_report_expected_;
+    uint32_t last_report_received_;
+    uint32_t cumulative_lost_;
+    RtcpReportBlock last_report_;
+
+    StreamStatistician(const StreamStatistician&);
+    StreamStatistician& operator=(const StreamStatistician&);
+};
+
+class ReceiveStatistics {
+public:
+    enum { kMaxStreams = 1024 };
+    //Streams without packets for this long are left out of reports, and
+    //evicted when a new stream finds all kMaxStreams taken.
+    enum { kStreamTimeoutMs = 8000 };
+
+    ReceiveStatistics();
+    ~ReceiveStatistics();
+
+    //Creates the statistician on the first packet of an SSRC. Packets of
+    //new streams are not counted while kMaxStreams streams are active,
+    //which is traced once until a stream can be added again.
+    void IncomingPacket(const ReceivedRtpPacket& packet, int64_t now_ms);
+
+    //NULL if no packet of |ssrc| was received or its stream was evicted.
+    //The statistician of an evicted stream is deleted kStreamTimeoutMs
+    //after the eviction, so the pointer is for immediate use only.
+    StreamStatistician* GetStatistician(uint32_t ssrc) const;
+
+    //One report block per active stream, at most |max_blocks|, last_sr and
+    //delay_since_last_sr are left for the caller. Returns the count.
+    int GetReportBlocks(RtcpReportBlock* blocks, int max_blocks,
+                        int64_t now_ms);
+
+    int num_streams() const {
+        return num_streams_.load(std::memory_order_relaxed);
+    }
+
+private:
+    enum { kTableSize = 2 * kMaxStreams };
+
+    struct RetiredStatistician {
+        StreamStatistician* statistician;
+        int64_t retire_time_ms;
+    };
+
+    StreamStatistician* GetOrCreateStatistician(uint32_t ssrc,
+                                                int64_t now_ms);
+    //Both with crit_ held.
+    int EvictIdleStatisticians(int64_t now_ms);
+    void DeleteRetired(int64_t now_ms);
+
+    std::atomic<StreamStatistician*> table_[kTableSize];
+    std::atomic<int> num_streams_;
+
+    //Serializes adding and evicting streams, lookups go without it.
+    webrtc::scoped_ptr<webrtc::CriticalSectionWrapper> crit_;
+    //Evicted statisticians, kept until no receiving thread can still be
+    //using one it looked up before the eviction.
+    std::vector<RetiredStatistician> retired_;
+    bool exhausted_;
+
+    ReceiveStatistics(const ReceiveStatistics&);
+    ReceiveStatistics& operator=(const ReceiveStatistics&);
+};
+
+#endif
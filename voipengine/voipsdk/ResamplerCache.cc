@@ -0,0 +1,301 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include "ResamplerCache.h"
+
+#include <assert.h>
+#include <string.h>
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VOIP_HAS_NEON
+#endif
+#include "webrtc/common_audio/include/audio_util.h"
+
+//Idle resamplers kept per ratio, enough for a room full of participants
+//sharing one codec rate.
+static const size_t kMaxIdlePerRatio = 16;
+
+CachedPushResampler::CachedPushResampler(int source_frames,
+                                         int destination_frames)
+: resampler_(new webrtc::SincResampler(source_frames * 1.0 / destination_frames,
+                                       source_frames, this)),
+  source_ptr_(NULL),
+  source_ptr_int_(NULL),
+  source_frames_(source_frames),
+  destination_frames_(destination_frames),
+  first_pass_(true),
+  source_available_(0) {
+}
+
+CachedPushResampler::~CachedPushResampler() {
+}
+
+void CachedPushResampler::Reset() {
+    resampler_->Flush();
+    source_ptr_ = NULL;
+    source_ptr_int_ = NULL;
+    first_pass_ = true;
+    source_available_ = 0;
+}
+
+int CachedPushResampler::Resample(const int16_t* source, int source_frames,
+                                  int16_t* destination,
+                                  int destination_capacity) {
+    assert(destination_capacity >= destination_frames_);
+    if (!float_buffer_.get()) {
+        float_buffer_.reset(new float[destination_frames_]);
+    }
+
+    source_ptr_int_ = source;
+    //NULL float source makes Run() read from the int16 source.
+    Resample(NULL, source_frames, float_buffer_.get(), destination_frames_);
+    webrtc::FloatS16ToS16(float_buffer_.get(), destination_frames_,
+                          destination);
+    source_ptr_int_ = NULL;
+    return destination_frames_;
+}
+
+int CachedPushResampler::Resample(const float* source, int source_frames,
+                                  float* destination,
+                                  int destination_capacity) {
+    assert(source_frames == resampler_->request_frames());
+    assert(destination_capacity >= destination_frames_);
+    source_ptr_ = source;
+    source_available_ = source_frames;
+
+    //Prime the SincResampler buffer with half a kernel of delay on the first
+    //pass, see webrtc::PushSincResampler::Resample.
+    if (first_pass_) {
+        resampler_->Resample(resampler_->ChunkSize(), destination);
+    }
+
+    resampler_->Resample(destination_frames_, destination);
+    source_ptr_ = NULL;
+    return destination_frames_;
+}
+
+void CachedPushResampler::Run(int frames, float* destination) {
+    assert(source_available_ == frames);
+
+    if (first_pass_) {
+        memset(destination, 0, frames * sizeof(float));
+        first_pass_ = false;
+        return;
+    }
+
+    if (source_ptr_) {
+        memcpy(destination, source_ptr_, frames * sizeof(float));
+    } else {
+        for (int i = 0; i < frames; ++i) {
+            destination[i] = static_cast<float>(source_ptr_int_[i]);
+        }
+    }
+    source_available_ -= frames;
+}
+
+ResamplerCache* ResamplerCache::Instance() {
+    static ResamplerCache* instance = new ResamplerCache();
+    return instance;
+}
+
+ResamplerCache::ResamplerCache()
+: crit_(webrtc::CriticalSectionWrapper::CreateCriticalSection()),
+  hits_(0),
+  misses_(0) {
+}
+
+ResamplerCache::~ResamplerCache() {
+    Clear();
+}
+
+CachedPushResampler* ResamplerCache::Acquire(int source_frames,
+                                             int destination_frames) {
+    {
+        webrtc::CriticalSectionScoped lock(crit_.get());
+        ResamplerList& list = idle_[Key(source_frames, destination_frames)];
+        if (!list.empty()) {
+            CachedPushResampler* resampler = list.back();
+            list.pop_back();
+            hits_++;
+            return resampler;
+        }
+        misses_++;
+    }
+    //Kernel construction runs outside the lock.
+    return new CachedPushResampler(source_frames, destination_frames);
+}
+
+void ResamplerCache::Release(CachedPushResampler* resampler) {
+    if (resampler == NULL) {
+        return;
+    }
+    resampler->Reset();
+
+    webrtc::CriticalSectionScoped lock(crit_.get());
+    ResamplerList& list = idle_[Key(resampler->source_frames(),
+                                    resampler->destination_frames())];
+    if (list.size() >= kMaxIdlePerRatio) {
+        delete resampler;
+        return;
+    }
+    list.push_back(resampler);
+}
+
+void ResamplerCache::Prewarm(const int* rates_hz, int num_rates,
+                             int count_per_ratio) {
+    for (int i = 0; i < num_rates; i++) {
+        for (int j = 0; j < num_rates; j++) {
+            if (rates_hz[i] == rates_hz[j]) {
+                continue;
+            }
+            int source_frames = rates_hz[i] / 100;
+            int destination_frames = rates_hz[j] / 100;
+
+            std::vector<CachedPushResampler*> created;
+            {
+                webrtc::CriticalSectionScoped lock(crit_.get());
+                Key key(source_frames, destination_frames);
+                int existing = static_cast<int>(idle_[key].size());
+                if (existing >= count_per_ratio) {
+                    continue;
+                }
+                created.resize(count_per_ratio - existing);
+            }
+            for (size_t k = 0; k < created.size(); k++) {
+                created[k] = new CachedPushResampler(source_frames,
+                                                     destination_frames);
+            }
+            for (size_t k = 0; k < created.size(); k++) {
+                Release(created[k]);
+            }
+        }
+    }
+}
+
+void ResamplerCache::Clear() {
+    webrtc::CriticalSectionScoped lock(crit_.get());
+    std::map<Key, ResamplerList>::iterator it;
+    for (it = idle_.begin(); it != idle_.end(); ++it) {
+        for (size_t i = 0; i < it->second.size(); i++) {
+            delete it->second[i];
+        }
+    }
+    idle_.clear();
+}
+
+static void DeinterleaveToFloat(const int16_t* src, int frames,
+                                int num_channels, float* dst) {
+    int i = 0;
+#if defined(VOIP_HAS_NEON)
+    if (num_channels == 2) {
+        float* left = dst;
+        float* right = dst + frames;
+        for (; i + 8 <= frames; i += 8) {
+            int16x8x2_t v = vld2q_s16(src + 2 * i);
+            vst1q_f32(left + i, vcvtq_f32_s32(vmovl_s16(vget_low_s16(v.val[0]))));
+            vst1q_f32(left + i + 4, vcvtq_f32_s32(vmovl_s16(vget_high_s16(v.val[0]))));
+            vst1q_f32(right + i, vcvtq_f32_s32(vmovl_s16(vget_low_s16(v.val[1]))));
+            vst1q_f32(right + i + 4, vcvtq_f32_s32(vmovl_s16(vget_high_s16(v.val[1]))));
+        }
+    }
+#endif
+    for (; i < frames; i++) {
+        for (int ch = 0; ch < num_channels; ch++) {
+            dst[ch * frames + i] = src[i * num_channels + ch];
+        }
+    }
+}
+
+#if defined(VOIP_HAS_NEON)
+static inline int16x4_t RoundToS16(float32x4_t v) {
+    //Round half away from zero like webrtc::FloatS16ToS16, the conversion
+    //and the narrowing both saturate.
+    uint32x4_t sign = vandq_u32(vreinterpretq_u32_f32(v),
+                                vdupq_n_u32(0x80000000));
+    float32x4_t half = vreinterpretq_f32_u32(
+        vorrq_u32(vreinterpretq_u32_f32(vdupq_n_f32(0.5f)), sign));
+    return vqmovn_s32(vcvtq_s32_f32(vaddq_f32(v, half)));
+}
+#endif
+
+static void InterleaveToS16(const float* src, int frames, int num_channels,
+                            int16_t* dst) {
+    int i = 0;
+#if defined(VOIP_HAS_NEON)
+    if (num_channels == 2) {
+        const float* left = src;
+        const float* right = src + frames;
+        for (; i + 8 <= frames; i += 8) {
+            int16x8x2_t v;
+            v.val[0] = vcombine_s16(RoundToS16(vld1q_f32(left + i)),
+                                    RoundToS16(vld1q_f32(left + i + 4)));
+            v.val[1] = vcombine_s16(RoundToS16(vld1q_f32(right + i)),
+                                    RoundToS16(vld1q_f32(right + i + 4)));
+            vst2q_s16(dst + 2 * i, v);
+        }
+    }
+#endif
+    for (; i < frames; i++) {
+        for (int ch = 0; ch < num_channels; ch++) {
+            dst[i * num_channels + ch] =
+                webrtc::FloatS16ToS16(src[ch * frames + i]);
+        }
+    }
+}
+
+InterleavedResampler::InterleavedResampler(int source_rate_hz,
+                                           int destination_rate_hz,
+                                           int num_channels)
+: num_channels_(num_channels),
+  source_frames_(source_rate_hz / 100),
+  destination_frames_(destination_rate_hz / 100),
+  source_planes_(new float[source_frames_ * num_channels]),
+  destination_planes_(new float[destination_frames_ * num_channels]) {
+    assert(num_channels > 0 && num_channels <= kMaxChannels);
+    memset(resamplers_, 0, sizeof(resamplers_));
+    if (source_frames_ == destination_frames_) {
+        return;
+    }
+    ResamplerCache* cache = ResamplerCache::Instance();
+    for (int ch = 0; ch < num_channels_; ch++) {
+        resamplers_[ch] = cache->Acquire(source_frames_, destination_frames_);
+    }
+}
+
+InterleavedResampler::~InterleavedResampler() {
+    ResamplerCache* cache = ResamplerCache::Instance();
+    for (int ch = 0; ch < num_channels_; ch++) {
+        cache->Release(resamplers_[ch]);
+    }
+}
+
+int InterleavedResampler::Resample(const int16_t* source, int source_length,
+                                   int16_t* destination,
+                                   int destination_capacity) {
+    if (source_length != source_frames_ * num_channels_ ||
+        destination_capacity < destination_frames_ * num_channels_) {
+        return -1;
+    }
+    if (source_frames_ == destination_frames_) {
+        memcpy(destination, source, source_length * sizeof(int16_t));
+        return source_length;
+    }
+
+    DeinterleaveToFloat(source, source_frames_, num_channels_,
+                        source_planes_.get());
+    for (int ch = 0; ch < num_channels_; ch++) {
+        resamplers_[ch]->Resample(source_planes_.get() + ch * source_frames_,
+                                  source_frames_,
+                                  destination_planes_.get() +
+                                      ch * destination_frames_,
+                                  destination_frames_);
+    }
+    InterleaveToS16(destination_planes_.get(), destination_frames_,
+                    num_channels_, destination);
+    return destination_frames_ * num_channels_;
+}
@@ -0,0 +1,137 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#ifndef VOIP_RESAMPLER_CACHE_H
+#define VOIP_RESAMPLER_CACHE_H
+
+#include <map>
+#include <vector>
+#include "webrtc/common_audio/resampler/sinc_resampler.h"
+#include "webrtc/system_wrappers/interface/critical_section_wrapper.h"
+#include "webrtc/system_wrappers/interface/scoped_ptr.h"
+
+//Push based sinc resampler that can be reset and handed to a new owner.
+//Behaves like webrtc::PushSincResampler, the only difference is Reset(),
+//which restores the just-constructed state without rebuilding the kernels.
+class CachedPushResampler : public webrtc::SincResamplerCallback {
+public:
+    CachedPushResampler(int source_frames, int destination_frames);
+    virtual ~CachedPushResampler();
+
+    int Resample(const int16_t* source, int source_frames,
+                 int16_t* destination, int destination_capacity);
+    int Resample(const float* source, int source_frames,
+                 float* destination, int destination_capacity);
+
+    //Drops the buffered history, the next Resample() primes again.
+    void Reset();
+
+    int source_frames() const { return source_frames_; }
+    int destination_frames() const { return destination_frames_; }
+
+    virtual void Run(int frames, float* destination);
+
+private:
+    webrtc::scoped_ptr<webrtc::SincResampler> resampler_;
+    webrtc::scoped_ptr<float[]> float_buffer_;
+    const float* source_ptr_;
+    const int16_t* source_ptr_int_;
+    const int source_frames_;
+    const int destination_frames_;
+    bool first_pass_;
+    int source_available_;
+};
+
+//Process wide pool of CachedPushResampler keyed by the 10ms block sizes,
+//SincResampler builds 33 kernels of 32 taps in its constructor, so
+//participants joining with the same codec rate reuse an idle instance
+//instead of paying that cost on the join path.
+class ResamplerCache {
+public:
+    static ResamplerCache* Instance();
+
+    //Returns an idle resampler for the ratio or constructs a new one.
+    CachedPushResampler* Acquire(int source_frames, int destination_frames);
+    //Resets |resampler| and keeps it for the next Acquire().
+    void Release(CachedPushResampler* resampler);
+
+    //Constructs idle resamplers between every pair of |rates_hz| ahead of
+    //time, e.g. 8/16/32/48kHz at call setup.
+    void Prewarm(const int* rates_hz, int num_rates, int count_per_ratio);
+
+    //Frees every idle resampler.
+    void Clear();
+
+    int hits() const { return hits_; }
+    int misses() const { return misses_; }
+
+private:
+    typedef std::pair<int, int> Key;
+    typedef std::vector<CachedPushResampler*> ResamplerList;
+
+    ResamplerCache();
+    ~ResamplerCache();
+
+    webrtc::scoped_ptr<webrtc::CriticalSectionWrapper> crit_;
+    std::map<Key, ResamplerList> idle_;
+    int hits_;
+    int misses_;
+};
+
+//RAII handle returning the resampler to the cache.
+class ScopedPushResampler {
+public:
+    ScopedPushResampler(int source_frames, int destination_frames)
+    : resampler_(ResamplerCache::Instance()->Acquire(source_frames,
+                                                     destination_frames)) {
+    }
+    ~ScopedPushResampler() {
+        ResamplerCache::Instance()->Release(resampler_);
+    }
+    CachedPushResampler* operator->() const { return resampler_; }
+    CachedPushResampler* get() const { return resampler_; }
+
+private:
+    CachedPushResampler* resampler_;
+
+    ScopedPushResampler(const ScopedPushResampler&);
+    ScopedPushResampler& operator=(const ScopedPushResampler&);
+};
+
+//Resamples interleaved int16 audio with |num_channels| channels. The input
+//is deinterleaved and converted to float in a single pass over the block,
+//each channel runs through a cached resampler, and the result is converted
+//and interleaved back in a single pass.
+class InterleavedResampler {
+public:
+    enum { kMaxChannels = 8 };
+
+    InterleavedResampler(int source_rate_hz, int destination_rate_hz,
+                         int num_channels);
+    ~InterleavedResampler();
+
+    //|source_length| and |destination_capacity| count samples of all
+    //channels. Returns the number of samples written, or -1 on error.
+    int Resample(const int16_t* source, int source_length,
+                 int16_t* destination, int destination_capacity);
+
+    int num_channels() const { return num_channels_; }
+
+private:
+    const int num_channels_;
+    const int source_frames_;
+    const int destination_frames_;
+    CachedPushResampler* resamplers_[kMaxChannels];
+    webrtc::scoped_ptr<float[]> source_planes_;
+    webrtc::scoped_ptr<float[]> destination_planes_;
+
+    InterleavedResampler(const InterleavedResampler&);
+    InterleavedResampler& operator=(const InterleavedResampler&);
+};
+
+#endif
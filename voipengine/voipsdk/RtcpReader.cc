@@ -0,0 +1,293 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include "RtcpReader.h"
+
+#include <string.h>
+
+static const size_t kHeaderSize = 4;
+static const size_t kReportBlockSize = 24;
+static const size_t kFeedbackHeaderSize = 12;
+
+static const uint8_t kPacketTypeSr = 200;
+static const uint8_t kPacketTypeRr = 201;
+static const uint8_t kPacketTypeSdes = 202;
+static const uint8_t kPacketTypeBye = 203;
+static const uint8_t kPacketTypeRtpFb = 205;
+static const uint8_t kPacketTypePsFb = 206;
+
+static const uint8_t kFmtNack = 1;
+static const uint8_t kFmtTransportFeedback = 15;
+static const uint8_t kFmtPli = 1;
+static const uint8_t kFmtFir = 4;
+static const uint8_t kFmtAfb = 15;
+
+static const uint8_t kSdesEnd = 0;
+static const uint8_t kSdesCname = 1;
+
+static inline uint16_t ReadUint16(const uint8_t* p) {
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t ReadUint32(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) |
+           p[3];
+}
+
+RtcpReader::RtcpReader()
+: num_events_(0),
+  num_nack_(0) {
+}
+
+RtcpEvent* RtcpReader::AddEvent(RtcpEventType type, uint32_t sender_ssrc,
+                                uint32_t media_ssrc) {
+    if (num_events_ == kMaxEvents) {
+        return NULL;
+    }
+    RtcpEvent* event = &events_[num_events_++];
+    event->type = type;
+    event->sender_ssrc = sender_ssrc;
+    event->media_ssrc = media_ssrc;
+    return event;
+}
+
+bool RtcpReader::Parse(const uint8_t* packet, size_t length) {
+    num_events_ = 0;
+    num_nack_ = 0;
+
+    const uint8_t* p = packet;
+    const uint8_t* end = packet + length;
+    while (p < end) {
+        if (static_cast<size_t>(end - p) < kHeaderSize || (p[0] >> 6) != 2) {
+            return false;
+        }
+        size_t block_length = (ReadUint16(p + 2) + 1) * 4;
+        if (block_length > static_cast<size_t>(end - p)) {
+            return false;
+        }
+        const uint8_t* block = p;
+        const uint8_t* block_end = p + block_length;
+        p = block_end;
+        if (block[0] & 0x20) {
+            //Padding, the last octet holds its size.
+            uint8_t padding = block_end[-1];
+            if (padding == 0 || padding > block_length - kHeaderSize) {
+                return false;
+            }
+            block_end -= padding;
+        }
+        size_t size = block_end - block;
+        uint8_t count = block[0] & 0x1f;
+
+        switch (block[1]) {
+            case kPacketTypeSr: {
+                if (size < 28 + count * kReportBlockSize) {
+                    return false;
+                }
+                uint32_t ssrc = ReadUint32(block + 4);
+                RtcpEvent* event = AddEvent(kRtcpSenderReport, ssrc, 0);
+                if (event == NULL) {
+                    return false;
+                }
+                event->sender_report.ntp_seconds = ReadUint32(block + 8);
+                event->sender_report.ntp_fraction = ReadUint32(block + 12);
+                event->sender_report.rtp_timestamp = ReadUint32(block + 16);
+                event->sender_report.packet_count = ReadUint32(block + 20);
+                event->sender_report.octet_count = ReadUint32(block + 24);
+                if (!ParseReportBlocks(block + 28, count, ssrc)) {
+                    return false;
+                }
+                break;
+            }
+            case kPacketTypeRr: {
+                if (size < 8 + count * kReportBlockSize) {
+                    return false;
+                }
+                uint32_t ssrc = ReadUint32(block + 4);
+                if (AddEvent(kRtcpReceiverReport, ssrc, 0) == NULL ||
+                    !ParseReportBlocks(block + 8, count, ssrc)) {
+                    return false;
+                }
+                break;
+            }
+            case kPacketTypeSdes:
+                if (!ParseSdes(block + kHeaderSize, block_end, count)) {
+                    return false;
+                }
+                break;
+            case kPacketTypeBye:
+                if (size < kHeaderSize + count * 4) {
+                    return false;
+                }
+                for (int i = 0; i < count; i++) {
+                    if (AddEvent(kRtcpBye, ReadUint32(block + 4 + 4 * i),
+                                 0) == NULL) {
+                        return false;
+                    }
+                }
+                break;
+            case kPacketTypeRtpFb: {
+                if (size < kFeedbackHeaderSize) {
+                    return false;
+                }
+                uint32_t sender_ssrc = ReadUint32(block + 4);
+                uint32_t media_ssrc = ReadUint32(block + 8);
+                if (count == kFmtNack) {
+                    if (!ParseNack(block + kFeedbackHeaderSize, block_end,
+                                   sender_ssrc, media_ssrc)) {
+                        return false;
+                    }
+                } else if (count == kFmtTransportFeedback) {
+                    RtcpEvent* event = AddEvent(kRtcpTransportFeedback,
+                                                sender_ssrc, media_ssrc);
+                    if (event == NULL) {
+                        return false;
+                    }
+                    event->raw.data = block;
+                    event->raw.length = block_length;
+                }
+                break;
+            }
+            case kPacketTypePsFb:
+                if (size < kFeedbackHeaderSize ||
+                    !ParsePayloadFeedback(count, block, block_end)) {
+                    return false;
+                }
+                break;
+            default:
+                //APP, XR and unknown types are skipped.
+                break;
+        }
+    }
+    return true;
+}
+
+bool RtcpReader::ParseReportBlocks(const uint8_t* p, int count,
+                                   uint32_t sender_ssrc) {
+    for (int i = 0; i < count; i++, p += kReportBlockSize) {
+        RtcpEvent* event = AddEvent(kRtcpReportBlock, sender_ssrc,
+                                    ReadUint32(p));
+        if (event == NULL) {
+            return false;
+        }
+        RtcpReportBlock& block = event->report_block;
+        block.ssrc = event->media_ssrc;
+        block.fraction_lost = p[4];
+        block.cumulative_lost = (p[5] << 16) | (p[6] << 8) | p[7];
+        block.extended_highest_sequence_number = ReadUint32(p + 8);
+        block.jitter = ReadUint32(p + 12);
+        block.last_sr = ReadUint32(p + 16);
+        block.delay_since_last_sr = ReadUint32(p + 20);
+    }
+    return true;
+}
+
+bool RtcpReader::ParseSdes(const uint8_t* p, const uint8_t* end, int count) {
+    const uint8_t* start = p;
+    for (int i = 0; i < count; i++) {
+        if (end - p < 4) {
+            return false;
+        }
+        uint32_t ssrc = ReadUint32(p);
+        p += 4;
+        for (;;) {
+            if (p >= end) {
+                return false;
+            }
+            uint8_t type = *p++;
+            if (type == kSdesEnd) {
+                break;
+            }
+            if (p >= end || end - p - 1 < *p) {
+                return false;
+            }
+            uint8_t item_length = *p++;
+            if (type == kSdesCname) {
+                RtcpEvent* event = AddEvent(kRtcpCname, ssrc, 0);
+                if (event == NULL) {
+                    return false;
+                }
+                event->raw.data = p;
+                event->raw.length = item_length;
+            }
+            p += item_length;
+        }
+        //The next chunk starts on a 32 bit boundary.
+        p = start + ((p - start + 3) & ~3);
+    }
+    return true;
+}
+
+bool RtcpReader::ParseNack(const uint8_t* p, const uint8_t* end,
+                           uint32_t sender_ssrc, uint32_t media_ssrc) {
+    RtcpEvent* event = AddEvent(kRtcpNack, sender_ssrc, media_ssrc);
+    if (event == NULL) {
+        return false;
+    }
+    event->nack.first = num_nack_;
+    for (; end - p >= 4; p += 4) {
+        //A full item expands to 17 sequence numbers.
+        if (num_nack_ + 17 > kMaxNackSequenceNumbers) {
+            event->nack.count = num_nack_ - event->nack.first;
+            return false;
+        }
+        uint16_t pid = ReadUint16(p);
+        uint32_t blp = ReadUint16(p + 2);
+        nack_list_[num_nack_++] = pid;
+        while (blp) {
+            nack_list_[num_nack_++] = pid + 1 + __builtin_ctz(blp);
+            //Clears the lowest set bit.
+            blp &= blp - 1;
+        }
+    }
+    event->nack.count = num_nack_ - event->nack.first;
+    return true;
+}
+
+bool RtcpReader::ParsePayloadFeedback(uint8_t fmt, const uint8_t* block,
+                                      const uint8_t* end) {
+    uint32_t sender_ssrc = ReadUint32(block + 4);
+    uint32_t media_ssrc = ReadUint32(block + 8);
+    const uint8_t* p = block + kFeedbackHeaderSize;
+    if (fmt == kFmtPli) {
+        return AddEvent(kRtcpPli, sender_ssrc, media_ssrc) != NULL;
+    }
+    if (fmt == kFmtFir) {
+        for (; end - p >= 8; p += 8) {
+            RtcpEvent* event = AddEvent(kRtcpFir, sender_ssrc, ReadUint32(p));
+            if (event == NULL) {
+                return false;
+            }
+            event->fir.command_seq = p[4];
+        }
+        return true;
+    }
+    if (fmt == kFmtAfb && end - p >= 8 && memcmp(p, "REMB", 4) == 0) {
+        int ssrc_count = p[4];
+        if (end - p < 8 + 4 * ssrc_count) {
+            return false;
+        }
+        uint8_t exponent = p[5] >> 2;
+        uint32_t mantissa = ((p[5] & 0x03) << 16) | ReadUint16(p + 6);
+        RtcpEvent* event = AddEvent(kRtcpRemb, sender_ssrc,
+                                    ssrc_count > 0 ? ReadUint32(p + 8) : 0);
+        if (event == NULL) {
+            return false;
+        }
+        //Saturates instead of overflowing on absurd exponents.
+        uint64_t bitrate = exponent < 32 ?
+            static_cast<uint64_t>(mantissa) << exponent : UINT64_MAX;
+        event->remb.bitrate_bps = bitrate > 0xffffffff ? 0xffffffff :
+                                  static_cast<uint32_t>(bitrate);
+        event->remb.ssrc_count = ssrc_count;
+        event->remb.ssrcs = p + 8;
+        return true;
+    }
+    //Other application layer feedback is skipped.
+    return true;
+}
@@ -0,0 +1,111 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#ifndef VOIP_RTCP_READER_H
+#define VOIP_RTCP_READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "RtcpWriter.h"
+
+enum RtcpEventType {
+    kRtcpSenderReport,
+    kRtcpReceiverReport,
+    //One per report block of the preceding SR or RR.
+    kRtcpReportBlock,
+    kRtcpCname,
+    kRtcpBye,
+    kRtcpNack,
+    kRtcpPli,
+    kRtcpFir,
+    kRtcpRemb,
+    kRtcpTransportFeedback,
+};
+
+struct RtcpEvent {
+    RtcpEventType type;
+    uint32_t sender_ssrc;
+    //Report block source, feedback target or FIR target.
+    uint32_t media_ssrc;
+    union {
+        struct {
+            uint32_t ntp_seconds;
+            uint32_t ntp_fraction;
+            uint32_t rtp_timestamp;
+            uint32_t packet_count;
+            uint32_t octet_count;
+        } sender_report;
+        RtcpReportBlock report_block;
+        //Sequence numbers in RtcpReader::nack_list().
+        struct {
+            int first;
+            int count;
+        } nack;
+        struct {
+            uint8_t command_seq;
+        } fir;
+        //|ssrcs| points to the big endian target SSRCs in the packet,
+        //media_ssrc holds the first one.
+        struct {
+            uint32_t bitrate_bps;
+            int ssrc_count;
+            const uint8_t* ssrcs;
+        } remb;
+        //Points into the parsed packet, e.g. for TransportFeedback::Parse
+        //or the CNAME text.
+        struct {
+            const uint8_t* data;
+            size_t length;
+        } raw;
+    };
+};
+
+//Decodes a whole compound RTCP packet in one pass into a flat array of
+//events, instead of webrtc::RTCPUtility::RTCPParserV2's state machine that
+//returns one item per Iterate() call. NACK bitmasks are expanded with a
+//count trailing zeros loop into one shared sequence number array. All
+//storage is inside the reader, parsing does not allocate.
+//
+//  RtcpReader reader;
+//  reader.Parse(packet, length);
+//  for (int i = 0; i < reader.num_events(); i++) {
+//      const RtcpEvent& event = reader.event(i);
+//      ...
+//  }
+class RtcpReader {
+public:
+    enum { kMaxEvents = 64 };
+    enum { kMaxNackSequenceNumbers = 1024 };
+
+    RtcpReader();
+
+    //Returns false on a malformed block or when the event storage runs
+    //out. The events before that point are kept.
+    bool Parse(const uint8_t* packet, size_t length);
+
+    int num_events() const { return num_events_; }
+    const RtcpEvent& event(int index) const { return events_[index]; }
+    const uint16_t* nack_list() const { return nack_list_; }
+
+private:
+    RtcpEvent* AddEvent(RtcpEventType type, uint32_t sender_ssrc,
+                        uint32_t media_ssrc);
+    bool ParseReportBlocks(const uint8_t* p, int count, uint32_t sender_ssrc);
+    bool ParseSdes(const uint8_t* p, const uint8_t* end, int count);
+    bool ParseNack(const uint8_t* p, const uint8_t* end, uint32_t sender_ssrc,
+                   uint32_t media_ssrc);
+    bool ParsePayloadFeedback(uint8_t fmt, const uint8_t* block,
+                              const uint8_t* end);
+
+    int num_events_;
+    int num_nack_;
+    RtcpEvent events_[kMaxEvents];
+    uint16_t nack_list_[kMaxNackSequenceNumbers];
+};
+
+#endif
@@ -0,0 +1,273 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include "RtcpWriter.h"
+
+#include <stdio.h>
+#include <string.h>
+#include "webrtc/common_types.h"
+#include "webrtc/modules/rtp_rtcp/source/byte_io.h"
+#include "webrtc/system_wrappers/interface/trace.h"
+#include "TransportFeedback.h"
+
+using webrtc::ByteWriter;
+
+static const size_t kHeaderSize = 4;
+static const size_t kReportBlockSize = 24;
+//Header, sender SSRC and media SSRC.
+static const size_t kFeedbackHeaderSize = 12;
+
+static const uint8_t kPacketTypeSr = 200;
+static const uint8_t kPacketTypeRr = 201;
+static const uint8_t kPacketTypeSdes = 202;
+static const uint8_t kPacketTypeBye = 203;
+static const uint8_t kPacketTypeRtpFb = 205;
+static const uint8_t kPacketTypePsFb = 206;
+
+static const uint8_t kFmtNack = 1;
+static const uint8_t kFmtPli = 1;
+static const uint8_t kFmtFir = 4;
+static const uint8_t kFmtAfb = 15;
+
+static const uint8_t kSdesCname = 1;
+
+RtcpWriter::RtcpWriter(uint8_t* buffer, size_t capacity)
+: buffer_(buffer),
+  capacity_(capacity),
+  length_(0) {
+}
+
+uint8_t* RtcpWriter::Reserve(size_t size) {
+    if (size > capacity_ - length_) {
+        return NULL;
+    }
+    uint8_t* p = buffer_ + length_;
+    length_ += size;
+    return p;
+}
+
+void RtcpWriter::WriteHeader(uint8_t* p, uint8_t count_or_fmt,
+                             uint8_t packet_type, size_t size) {
+    p[0] = 0x80 | (count_or_fmt & 0x1f);
+    p[1] = packet_type;
+    ByteWriter<uint16_t>::WriteBigEndian(p + 2,
+                                         static_cast<uint16_t>(size / 4 - 1));
+}
+
+void RtcpWriter::WriteReportBlocks(uint8_t* p, const RtcpReportBlock* blocks,
+                                   int count) {
+    for (int i = 0; i < count; i++, p += kReportBlockSize) {
+        const RtcpReportBlock& block = blocks[i];
+        ByteWriter<uint32_t>::WriteBigEndian(p, block.ssrc);
+        p[4] = block.fraction_lost;
+        ByteWriter<uint32_t, 3>::WriteBigEndian(p + 5, block.cumulative_lost);
+        ByteWriter<uint32_t>::WriteBigEndian(
+            p + 8, block.extended_highest_sequence_number);
+        ByteWriter<uint32_t>::WriteBigEndian(p + 12, block.jitter);
+        ByteWriter<uint32_t>::WriteBigEndian(p + 16, block.last_sr);
+        ByteWriter<uint32_t>::WriteBigEndian(p + 20, block.delay_since_last_sr);
+    }
+}
+
+bool RtcpWriter::AddSenderReport(uint32_t ssrc, uint32_t ntp_seconds,
+                                 uint32_t ntp_fraction, uint32_t rtp_timestamp,
+                                 uint32_t packet_count, uint32_t octet_count,
+                                 const RtcpReportBlock* blocks, int count) {
+    if (count < 0 || count > kMaxReportBlocks) {
+        return false;
+    }
+    size_t size = 28 + count * kReportBlockSize;
+    uint8_t* p = Reserve(size);
+    if (p == NULL) {
+        return false;
+    }
+    WriteHeader(p, count, kPacketTypeSr, size);
+    ByteWriter<uint32_t>::WriteBigEndian(p + 4, ssrc);
+    ByteWriter<uint32_t>::WriteBigEndian(p + 8, ntp_seconds);
+    ByteWriter<uint32_t>::WriteBigEndian(p + 12, ntp_fraction);
+    ByteWriter<uint32_t>::WriteBigEndian(p + 16, rtp_timestamp);
+    ByteWriter<uint32_t>::WriteBigEndian(p + 20, packet_count);
+    ByteWriter<uint32_t>::WriteBigEndian(p + 24, octet_count);
+    WriteReportBlocks(p + 28, blocks, count);
+    return true;
+}
+
+bool RtcpWriter::AddReceiverReport(uint32_t ssrc,
+                                   const RtcpReportBlock* blocks, int count) {
+    if (count < 0 || count > kMaxReportBlocks) {
+        return false;
+    }
+    size_t size = 8 + count * kReportBlockSize;
+    uint8_t* p = Reserve(size);
+    if (p == NULL) {
+        return false;
+    }
+    WriteHeader(p, count, kPacketTypeRr, size);
+    ByteWriter<uint32_t>::WriteBigEndian(p + 4, ssrc);
+    WriteReportBlocks(p + 8, blocks, count);
+    return true;
+}
+
+bool RtcpWriter::AddSdesCname(uint32_t ssrc, const char* cname) {
+    size_t cname_length = strlen(cname);
+    if (cname_length > kMaxCnameLength) {
+        return false;
+    }
+    //SSRC, type, length, text and at least one null octet ending the
+    //chunk, padded to 32 bits.
+    size_t chunk_size = (4 + 2 + cname_length + 1 + 3) & ~static_cast<size_t>(3);
+    size_t size = kHeaderSize + chunk_size;
+    uint8_t* p = Reserve(size);
+    if (p == NULL) {
+        return false;
+    }
+    WriteHeader(p, 1, kPacketTypeSdes, size);
+    ByteWriter<uint32_t>::WriteBigEndian(p + 4, ssrc);
+    p[8] = kSdesCname;
+    p[9] = static_cast<uint8_t>(cname_length);
+    memcpy(p + 10, cname, cname_length);
+    memset(p + 10 + cname_length, 0, chunk_size - 6 - cname_length);
+    return true;
+}
+
+bool RtcpWriter::AddBye(uint32_t ssrc) {
+    uint8_t* p = Reserve(8);
+    if (p == NULL) {
+        return false;
+    }
+    WriteHeader(p, 1, kPacketTypeBye, 8);
+    ByteWriter<uint32_t>::WriteBigEndian(p + 4, ssrc);
+    return true;
+}
+
+int RtcpWriter::AddNack(uint32_t sender_ssrc, uint32_t media_ssrc,
+                        const uint16_t* sequence_numbers, int count) {
+    if (count <= 0 || remaining() < kFeedbackHeaderSize + 4) {
+        return 0;
+    }
+    //One PID/BLP item covers a packet and the 16 after it. Count the items
+    //that fit before writing anything.
+    size_t max_items = (remaining() - kFeedbackHeaderSize) / 4;
+    size_t items = 0;
+    int written = 0;
+    while (written < count && items < max_items) {
+        uint16_t pid = sequence_numbers[written++];
+        while (written < count &&
+               static_cast<uint16_t>(sequence_numbers[written] - pid - 1) < 16) {
+            written++;
+        }
+        items++;
+    }
+
+    size_t size = kFeedbackHeaderSize + items * 4;
+    uint8_t* p = Reserve(size);
+    WriteHeader(p, kFmtNack, kPacketTypeRtpFb, size);
+    ByteWriter<uint32_t>::WriteBigEndian(p + 4, sender_ssrc);
+    ByteWriter<uint32_t>::WriteBigEndian(p + 8, media_ssrc);
+    p += kFeedbackHeaderSize;
+    for (int i = 0; i < written; p += 4) {
+        uint16_t pid = sequence_numbers[i++];
+        uint16_t blp = 0;
+        while (i < written) {
+            uint16_t offset = sequence_numbers[i] - pid - 1;
+            if (offset >= 16) {
+                break;
+            }
+            blp |= 1 << offset;
+            i++;
+        }
+        ByteWriter<uint16_t>::WriteBigEndian(p, pid);
+        ByteWriter<uint16_t>::WriteBigEndian(p + 2, blp);
+    }
+
+    if (webrtc::Trace::level_filter() & webrtc::kTraceDebug) {
+        TraceNack(media_ssrc, sequence_numbers, written);
+    }
+    return written;
+}
+
+void RtcpWriter::TraceNack(uint32_t media_ssrc,
+                           const uint16_t* sequence_numbers, int count) {
+    char text[256];
+    size_t n = 0;
+    for (int i = 0; i < count && n + 8 < sizeof(text); i++) {
+        n += snprintf(text + n, sizeof(text) - n, "%u,", sequence_numbers[i]);
+    }
+    text[n > 0 ? n - 1 : 0] = 0;
+    webrtc::Trace::Add(webrtc::kTraceDebug, webrtc::kTraceRtpRtcp, -1,
+                       "RTCP NACK ssrc:%u %s", media_ssrc, text);
+}
+
+bool RtcpWriter::AddPli(uint32_t sender_ssrc, uint32_t media_ssrc) {
+    uint8_t* p = Reserve(kFeedbackHeaderSize);
+    if (p == NULL) {
+        return false;
+    }
+    WriteHeader(p, kFmtPli, kPacketTypePsFb, kFeedbackHeaderSize);
+    ByteWriter<uint32_t>::WriteBigEndian(p + 4, sender_ssrc);
+    ByteWriter<uint32_t>::WriteBigEndian(p + 8, media_ssrc);
+    return true;
+}
+
+bool RtcpWriter::AddFir(uint32_t sender_ssrc, uint32_t media_ssrc,
+                        uint8_t command_seq) {
+    size_t size = kFeedbackHeaderSize + 8;
+    uint8_t* p = Reserve(size);
+    if (p == NULL) {
+        return false;
+    }
+    WriteHeader(p, kFmtFir, kPacketTypePsFb, size);
+    ByteWriter<uint32_t>::WriteBigEndian(p + 4, sender_ssrc);
+    //RFC 5104, the media source field is unused, the target is in the FCI.
+    ByteWriter<uint32_t>::WriteBigEndian(p + 8, 0);
+    ByteWriter<uint32_t>::WriteBigEndian(p + 12, media_ssrc);
+    p[16] = command_seq;
+    p[17] = p[18] = p[19] = 0;
+    return true;
+}
+
+bool RtcpWriter::AddRemb(uint32_t sender_ssrc, uint32_t bitrate_bps,
+                         const uint32_t* ssrcs, int count) {
+    if (count < 0 || count > 0xff) {
+        return false;
+    }
+    size_t size = kFeedbackHeaderSize + 8 + count * 4;
+    uint8_t* p = Reserve(size);
+    if (p == NULL) {
+        return false;
+    }
+    //6 bit exponent, 18 bit mantissa.
+    uint8_t exponent = 0;
+    while ((bitrate_bps >> exponent) >= (1u << 18)) {
+        exponent++;
+    }
+    uint32_t mantissa = bitrate_bps >> exponent;
+
+    WriteHeader(p, kFmtAfb, kPacketTypePsFb, size);
+    ByteWriter<uint32_t>::WriteBigEndian(p + 4, sender_ssrc);
+    ByteWriter<uint32_t>::WriteBigEndian(p + 8, 0);
+    memcpy(p + 12, "REMB", 4);
+    p[16] = static_cast<uint8_t>(count);
+    p[17] = static_cast<uint8_t>((exponent << 2) | (mantissa >> 16));
+    ByteWriter<uint16_t>::WriteBigEndian(p + 18,
+                                         static_cast<uint16_t>(mantissa));
+    for (int i = 0; i < count; i++) {
+        ByteWriter<uint32_t>::WriteBigEndian(p + 20 + 4 * i, ssrcs[i]);
+    }
+    return true;
+}
+
+bool RtcpWriter::AddTransportFeedback(const TransportFeedback& feedback) {
+    size_t size = feedback.BuildLength();
+    if (size > remaining()) {
+        return false;
+    }
+    size_t written = feedback.Build(buffer_ + length_, remaining());
+    length_ += written;
+    return written > 0;
+}
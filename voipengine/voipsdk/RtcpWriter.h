@@ -0,0 +1,92 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#ifndef VOIP_RTCP_WRITER_H
+#define VOIP_RTCP_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+class TransportFeedback;
+
+struct RtcpReportBlock {
+    uint32_t ssrc;
+    uint8_t fraction_lost;
+    //24 bits on the wire.
+    uint32_t cumulative_lost;
+    uint32_t extended_highest_sequence_number;
+    uint32_t jitter;
+    uint32_t last_sr;
+    uint32_t delay_since_last_sr;
+};
+
+//Writes a compound RTCP packet into a caller owned buffer, usually on the
+//stack. Unlike webrtc::RTCPSender and rtcp::RtcpPacket there is no heap
+//allocation, no std::map of report blocks and no string formatting unless
+//debug tracing is on.
+//
+//Every Add method checks the remaining space first and returns false
+//without writing anything when the block does not fit, so the packet
+//built so far stays valid.
+//
+//  uint8_t buffer[IP_PACKET_SIZE];
+//  RtcpWriter writer(buffer, sizeof(buffer));
+//  writer.AddReceiverReport(ssrc, &block, 1);
+//  writer.AddSdesCname(ssrc, "voip");
+//  writer.AddNack(ssrc, media_ssrc, nack_list, nack_count);
+//  Send(buffer, writer.length());
+class RtcpWriter {
+public:
+    enum { kMaxReportBlocks = 31 };
+    enum { kMaxCnameLength = 255 };
+
+    RtcpWriter(uint8_t* buffer, size_t capacity);
+
+    //NTP time split in seconds and fraction as in the report.
+    bool AddSenderReport(uint32_t ssrc, uint32_t ntp_seconds,
+                         uint32_t ntp_fraction, uint32_t rtp_timestamp,
+                         uint32_t packet_count, uint32_t octet_count,
+                         const RtcpReportBlock* blocks, int count);
+    bool AddReceiverReport(uint32_t ssrc, const RtcpReportBlock* blocks,
+                           int count);
+    bool AddSdesCname(uint32_t ssrc, const char* cname);
+    bool AddBye(uint32_t ssrc);
+
+    //Generic NACK, |sequence_numbers| in increasing order (with wrap).
+    //Packs as many as fit, returns how many were written.
+    int AddNack(uint32_t sender_ssrc, uint32_t media_ssrc,
+                const uint16_t* sequence_numbers, int count);
+    bool AddPli(uint32_t sender_ssrc, uint32_t media_ssrc);
+    bool AddFir(uint32_t sender_ssrc, uint32_t media_ssrc, uint8_t command_seq);
+    bool AddRemb(uint32_t sender_ssrc, uint32_t bitrate_bps,
+                 const uint32_t* ssrcs, int count);
+    bool AddTransportFeedback(const TransportFeedback& feedback);
+
+    size_t length() const { return length_; }
+    //Bytes left for further blocks.
+    size_t remaining() const { return capacity_ - length_; }
+
+private:
+    //Returns NULL if |size| bytes do not fit.
+    uint8_t* Reserve(size_t size);
+    static void WriteHeader(uint8_t* p, uint8_t count_or_fmt,
+                            uint8_t packet_type, size_t size);
+    static void WriteReportBlocks(uint8_t* p, const RtcpReportBlock* blocks,
+                                  int count);
+    static void TraceNack(uint32_t media_ssrc, const uint16_t* sequence_numbers,
+                          int count);
+
+    uint8_t* buffer_;
+    size_t capacity_;
+    size_t length_;
+
+    RtcpWriter(const RtcpWriter&);
+    RtcpWriter& operator=(const RtcpWriter&);
+};
+
+#endif
@@ -0,0 +1,112 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include "RtpHeaderExtensions.h"
+
+#include <string.h>
+
+static const size_t kRtpHeaderSize = 12;
+static const uint16_t kOneByteHeaderProfile = 0xbede;
+static const uint8_t kPaddingId = 0;
+static const uint8_t kStopId = 15;
+
+RtpExtensionMap::RtpExtensionMap() {
+    memset(ids_, 0, sizeof(ids_));
+    memset(types_, kRtpExtensionNumberOfExtensions, sizeof(types_));
+}
+
+bool RtpExtensionMap::Register(RtpExtensionType type, uint8_t id) {
+    if (type >= kRtpExtensionNumberOfExtensions || id < kMinId ||
+        id > kMaxId) {
+        return false;
+    }
+    if (types_[id] != kRtpExtensionNumberOfExtensions &&
+        types_[id] != type) {
+        return false;
+    }
+    Deregister(type);
+    ids_[type] = id;
+    types_[id] = type;
+    return true;
+}
+
+void RtpExtensionMap::Deregister(RtpExtensionType type) {
+    if (type >= kRtpExtensionNumberOfExtensions || ids_[type] == 0) {
+        return;
+    }
+    types_[ids_[type]] = kRtpExtensionNumberOfExtensions;
+    ids_[type] = 0;
+}
+
+RtpPacketExtensions::RtpPacketExtensions()
+: packet_(NULL),
+  header_length_(0) {
+    memset(offsets_, 0, sizeof(offsets_));
+    memset(lengths_, 0, sizeof(lengths_));
+}
+
+bool RtpPacketExtensions::Parse(const RtpExtensionMap& map,
+                                const uint8_t* packet, size_t length) {
+    memset(lengths_, 0, sizeof(lengths_));
+    packet_ = packet;
+    header_length_ = 0;
+    if (length < kRtpHeaderSize || (packet[0] >> 6) != 2) {
+        return false;
+    }
+    size_t header_length = kRtpHeaderSize + (packet[0] & 0x0f) * 4;
+    if (!(packet[0] & 0x10)) {
+        if (header_length > length) {
+            return false;
+        }
+        header_length_ = header_length;
+        return true;
+    }
+
+    if (header_length + 4 > length) {
+        return false;
+    }
+    const uint8_t* p = packet + header_length;
+    uint16_t profile = (p[0] << 8) | p[1];
+    size_t extension_length = ((p[2] << 8) | p[3]) * 4;
+    header_length += 4 + extension_length;
+    if (header_length > length) {
+        return false;
+    }
+    header_length_ = header_length;
+    if (profile != kOneByteHeaderProfile) {
+        //Two-byte or unknown profile, none of ours.
+        return true;
+    }
+
+    p += 4;
+    const uint8_t* end = p + extension_length;
+    while (p < end) {
+        uint8_t id = p[0] >> 4;
+        if (id == kPaddingId) {
+            p++;
+            continue;
+        }
+        if (id == kStopId) {
+            break;
+        }
+        uint8_t value_length = (p[0] & 0x0f) + 1;
+        if (p + 1 + value_length > end) {
+            //The elements before it are not trusted either.
+            memset(lengths_, 0, sizeof(lengths_));
+            header_length_ = 0;
+            return false;
+        }
+        //Unknown ids land in the spare entry.
+        uint8_t type = map.GetType(id);
+        offsets_[type] = static_cast<uint16_t>(p + 1 - packet);
+        lengths_[type] = value_length;
+        p += 1 + value_length;
+    }
+    lengths_[kRtpExtensionNumberOfExtensions] = 0;
+    return true;
+}
@@ -0,0 +1,175 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#ifndef VOIP_RTP_HEADER_EXTENSIONS_H
+#define VOIP_RTP_HEADER_EXTENSIONS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//One-byte RTP header extensions (RFC 5285) for the known set of
+//extensions.
+//
+//webrtc::RtpHeaderExtensionMap looks up every element in a std::map while
+//parsing and RTPSender looks the offsets up again to rewrite a value in
+//place. Here the negotiated ids are resolved once into flat tables, a
+//parse records the offset of every known element in one pass without a
+//lookup per element, and the accessors are templates on a traits class so
+//the size check and value codec are resolved at compile time.
+//
+//  RtpExtensionMap map;
+//  map.Register(kRtpExtensionAbsoluteSendTime, 3);
+//  RtpPacketExtensions extensions;
+//  if (extensions.Parse(map, packet, length)) {
+//      uint32_t send_time;
+//      extensions.Get<AbsoluteSendTime>(&send_time);
+//      extensions.Update<AbsoluteSendTime>(packet, now_24bits);
+//  }
+enum RtpExtensionType {
+    kRtpExtensionTransmissionTimeOffset,
+    kRtpExtensionAudioLevel,
+    kRtpExtensionAbsoluteSendTime,
+    kRtpExtensionTransportSequenceNumber,
+    kRtpExtensionNumberOfExtensions,
+};
+
+//urn:ietf:params:rtp-hdrext:toffset, 24 bit signed.
+struct TransmissionTimeOffset {
+    static const RtpExtensionType kType = kRtpExtensionTransmissionTimeOffset;
+    static const uint8_t kValueSize = 3;
+    typedef int32_t ValueType;
+
+    static ValueType Read(const uint8_t* p) {
+        uint32_t value = (p[0] << 16) | (p[1] << 8) | p[2];
+        //Sign extends bit 23 without shifting a signed value.
+        return static_cast<int32_t>(value ^ 0x800000) - 0x800000;
+    }
+    static void Write(uint8_t* p, ValueType value) {
+        uint32_t bits = static_cast<uint32_t>(value);
+        p[0] = static_cast<uint8_t>(bits >> 16);
+        p[1] = static_cast<uint8_t>(bits >> 8);
+        p[2] = static_cast<uint8_t>(bits);
+    }
+};
+
+//urn:ietf:params:rtp-hdrext:ssrc-audio-level, voice activity in the top
+//bit and the level in -dBov below.
+struct AudioLevel {
+    static const RtpExtensionType kType = kRtpExtensionAudioLevel;
+    static const uint8_t kValueSize = 1;
+    typedef uint8_t ValueType;
+
+    static ValueType Read(const uint8_t* p) { return p[0]; }
+    static void Write(uint8_t* p, ValueType value) { p[0] = value; }
+};
+
+//http://www.webrtc.org/experiments/rtp-hdrext/abs-send-time, 6.18 fixed
+//point seconds.
+struct AbsoluteSendTime {
+    static const RtpExtensionType kType = kRtpExtensionAbsoluteSendTime;
+    static const uint8_t kValueSize = 3;
+    typedef uint32_t ValueType;
+
+    static ValueType Read(const uint8_t* p) {
+        return (p[0] << 16) | (p[1] << 8) | p[2];
+    }
+    static void Write(uint8_t* p, ValueType value) {
+        p[0] = static_cast<uint8_t>(value >> 16);
+        p[1] = static_cast<uint8_t>(value >> 8);
+        p[2] = static_cast<uint8_t>(value);
+    }
+    static ValueType FromMs(int64_t time_ms) {
+        return static_cast<uint32_t>(((time_ms << 18) / 1000) & 0x00ffffff);
+    }
+};
+
+//Transport wide sequence number used by TransportFeedback.
+struct TransportSequenceNumber {
+    static const RtpExtensionType kType = kRtpExtensionTransportSequenceNumber;
+    static const uint8_t kValueSize = 2;
+    typedef uint16_t ValueType;
+
+    static ValueType Read(const uint8_t* p) {
+        return static_cast<uint16_t>((p[0] << 8) | p[1]);
+    }
+    static void Write(uint8_t* p, ValueType value) {
+        p[0] = static_cast<uint8_t>(value >> 8);
+        p[1] = static_cast<uint8_t>(value);
+    }
+};
+
+class RtpExtensionMap {
+public:
+    //Ids 1 to 14 of the one-byte header.
+    enum { kMinId = 1, kMaxId = 14 };
+
+    RtpExtensionMap();
+
+    //Returns false for an invalid id or one taken by another extension.
+    bool Register(RtpExtensionType type, uint8_t id);
+    void Deregister(RtpExtensionType type);
+
+    //0 if not registered.
+    uint8_t GetId(RtpExtensionType type) const { return ids_[type]; }
+    //kRtpExtensionNumberOfExtensions if the id is unused.
+    RtpExtensionType GetType(uint8_t id) const {
+        return static_cast<RtpExtensionType>(types_[id & 0x0f]);
+    }
+
+private:
+    uint8_t ids_[kRtpExtensionNumberOfExtensions];
+    uint8_t types_[16];
+};
+
+class RtpPacketExtensions {
+public:
+    RtpPacketExtensions();
+
+    //Parses the fixed header, CSRCs and extensions. Returns false on a
+    //malformed header, a packet without extensions parses fine. After a
+    //failed parse Has() is false for every extension.
+    bool Parse(const RtpExtensionMap& map, const uint8_t* packet,
+               size_t length);
+
+    size_t header_length() const { return header_length_; }
+
+    template<class Extension>
+    bool Has() const {
+        return lengths_[Extension::kType] == Extension::kValueSize;
+    }
+
+    template<class Extension>
+    bool Get(typename Extension::ValueType* value) const {
+        if (!Has<Extension>()) {
+            return false;
+        }
+        *value = Extension::Read(packet_ + offsets_[Extension::kType]);
+        return true;
+    }
+
+    //Rewrites the value in |packet|, the buffer that was parsed. Returns
+    //false if the packet does not carry the extension.
+    template<class Extension>
+    bool Update(uint8_t* packet, typename Extension::ValueType value) const {
+        if (!Has<Extension>()) {
+            return false;
+        }
+        Extension::Write(packet + offsets_[Extension::kType], value);
+        return true;
+    }
+
+private:
+    const uint8_t* packet_;
+    size_t header_length_;
+    //Indexed by type, the extra entry collects unknown ids so the parse
+    //loop stores unconditionally.
+    uint16_t offsets_[kRtpExtensionNumberOfExtensions + 1];
+    uint8_t lengths_[kRtpExtensionNumberOfExtensions + 1];
+};
+
+#endif
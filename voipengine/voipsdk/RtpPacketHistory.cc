@@ -0,0 +1,197 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include "RtpPacketHistory.h"
+
+#include <string.h>
+#include <algorithm>
+
+static const size_t kRtpHeaderSize = 12;
+
+//Unwrapped sequence numbers start here so older packets stay positive.
+static const int64_t kUnwrapBase = 1 << 16;
+
+static int RoundUpCapacity(int capacity) {
+    int size = 1;
+    while (size < capacity && size < RtpPacketHistory::kMaxCapacity) {
+        size <<= 1;
+    }
+    return size;
+}
+
+static size_t ClampPacketLength(size_t length) {
+    return std::max(kRtpHeaderSize,
+                    std::min(length, static_cast<size_t>(
+                        RtpPacketHistory::kMaxPacketLength)));
+}
+
+static inline uint16_t RtpSequenceNumber(const uint8_t* packet) {
+    return static_cast<uint16_t>((packet[2] << 8) | packet[3]);
+}
+
+RtpPacketHistory::RtpPacketHistory(int capacity, size_t max_packet_length)
+: crit_(webrtc::CriticalSectionWrapper::CreateCriticalSection()),
+  capacity_(RoundUpCapacity(capacity)),
+  max_packet_length_(ClampPacketLength(max_packet_length)),
+  slot_size_((max_packet_length_ + kAlignment - 1) & ~(kAlignment - 1)),
+  newest_(-1),
+  slab_(webrtc::AlignedMalloc<uint8_t>(
+      static_cast<size_t>(capacity_) * slot_size_, kAlignment)),
+  slots_(capacity_),
+  valid_((capacity_ + 63) / 64, 0) {
+}
+
+int64_t RtpPacketHistory::Unwrap(uint16_t sequence_number) const {
+    if (newest_ < 0) {
+        return kUnwrapBase + sequence_number;
+    }
+    int16_t delta = static_cast<int16_t>(
+        sequence_number - static_cast<uint16_t>(newest_));
+    return newest_ + delta;
+}
+
+void RtpPacketHistory::SetValid(int index, bool valid) {
+    uint64_t bit = static_cast<uint64_t>(1) << (index & 63);
+    if (valid) {
+        valid_[index >> 6] |= bit;
+    } else {
+        valid_[index >> 6] &= ~bit;
+    }
+}
+
+int RtpPacketHistory::FindSlot(uint16_t sequence_number) const {
+    if (newest_ < 0) {
+        return -1;
+    }
+    //Compares the unwrapped value, a slot not overwritten for 65536
+    //sequence numbers holds an older packet with the same 16 bits.
+    int64_t unwrapped = Unwrap(sequence_number);
+    int index = SlotIndex(unwrapped);
+    if (!(valid_[index >> 6] & (static_cast<uint64_t>(1) << (index & 63))) ||
+        slots_[index].unwrapped != unwrapped) {
+        return -1;
+    }
+    return index;
+}
+
+bool RtpPacketHistory::PutRtpPacket(const uint8_t* packet, size_t length,
+                                    int64_t capture_time_ms) {
+    if (length < kRtpHeaderSize || length > max_packet_length_) {
+        return false;
+    }
+    uint16_t sequence_number = RtpSequenceNumber(packet);
+
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    int64_t unwrapped = Unwrap(sequence_number);
+    if (newest_ >= 0 && unwrapped <= newest_ - capacity_) {
+        //Its slot belongs to a newer packet.
+        return false;
+    }
+    if (unwrapped > newest_) {
+        newest_ = unwrapped;
+    }
+    int index = SlotIndex(unwrapped);
+    memcpy(SlotData(index), packet, length);
+    Slot& slot = slots_[index];
+    slot.unwrapped = unwrapped;
+    slot.length = static_cast<uint16_t>(length);
+    slot.sent = false;
+    slot.capture_time_ms = capture_time_ms;
+    slot.send_time_ms = 0;
+    SetValid(index, true);
+    return true;
+}
+
+void RtpPacketHistory::SetSent(uint16_t sequence_number, int64_t now_ms) {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    int index = FindSlot(sequence_number);
+    if (index < 0) {
+        return;
+    }
+    slots_[index].sent = true;
+    slots_[index].send_time_ms = now_ms;
+}
+
+bool RtpPacketHistory::GetPacketAndSetSendTime(uint16_t sequence_number,
+                                               int64_t min_elapsed_time_ms,
+                                               int64_t now_ms,
+                                               uint8_t* buffer,
+                                               size_t* length,
+                                               int64_t* capture_time_ms) {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    int index = FindSlot(sequence_number);
+    if (index < 0) {
+        return false;
+    }
+    Slot& slot = slots_[index];
+    if (slot.length > *length) {
+        return false;
+    }
+    if (slot.sent && min_elapsed_time_ms > 0 &&
+        now_ms - slot.send_time_ms < min_elapsed_time_ms) {
+        return false;
+    }
+    memcpy(buffer, SlotData(index), slot.length);
+    *length = slot.length;
+    if (capture_time_ms) {
+        *capture_time_ms = slot.capture_time_ms;
+    }
+    slot.sent = true;
+    slot.send_time_ms = now_ms;
+    return true;
+}
+
+bool RtpPacketHistory::GetBestFittingPacket(size_t target_length,
+                                            uint8_t* buffer, size_t* length) {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    int best = -1;
+    size_t best_diff = 0;
+    for (size_t word = 0; word < valid_.size(); word++) {
+        uint64_t bits = valid_[word];
+        while (bits) {
+            int index = static_cast<int>(word * 64) + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            size_t slot_length = slots_[index].length;
+            if (slot_length > *length) {
+                continue;
+            }
+            size_t diff = slot_length > target_length ?
+                          slot_length - target_length :
+                          target_length - slot_length;
+            if (best < 0 || diff < best_diff) {
+                best = index;
+                best_diff = diff;
+                if (diff == 0) {
+                    break;
+                }
+            }
+        }
+        if (best >= 0 && best_diff == 0) {
+            break;
+        }
+    }
+    if (best < 0) {
+        return false;
+    }
+    memcpy(buffer, SlotData(best), slots_[best].length);
+    *length = slots_[best].length;
+    return true;
+}
+
+bool RtpPacketHistory::HasRtpPacket(uint16_t sequence_number) const {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    return FindSlot(sequence_number) >= 0;
+}
+
+void RtpPacketHistory::Clear() {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    for (size_t i = 0; i < valid_.size(); i++) {
+        valid_[i] = 0;
+    }
+    newest_ = -1;
+}
@@ -0,0 +1,114 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#ifndef VOIP_RTP_PACKET_HISTORY_H
+#define VOIP_RTP_PACKET_HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "webrtc/system_wrappers/interface/aligned_malloc.h"
+#include "webrtc/system_wrappers/interface/critical_section_wrapper.h"
+#include "webrtc/system_wrappers/interface/scoped_ptr.h"
+
+//Recently sent RTP packets kept for retransmission on NACK.
+//
+//webrtc::RTPPacketHistory keeps a std::vector per packet and parallel
+//vectors of metadata. Here the history is a power of two ring indexed by
+//the unwrapped sequence number masked with the capacity: every packet has
+//a fixed slot in one aligned slab, so a NACK lookup is a single index and
+//a store is one memcpy. A bitmap of the occupied slots lets
+//GetBestFittingPacket skip empty ones a word at a time.
+//
+//The slab is allocated up front, capacity() slots of |max_packet_length|
+//rounded up to a cache line. That is 1024 x 1216 bytes, about 1.2 MB, for
+//a 600 packet history of 1200 byte packets, and at most kMaxCapacity x
+//1536 bytes, about 12 MB.
+//
+//Thread safe.
+class RtpPacketHistory {
+public:
+    enum { kMaxPacketLength = 1500 };
+    //The power of two below webrtc's kMaxHistoryCapacity of 9600, 2.6
+    //seconds of 1200 byte packets at 30 Mbps.
+    enum { kMaxCapacity = 8192 };
+
+    //|capacity| is rounded up to a power of two, at most kMaxCapacity, and
+    //|max_packet_length| is clamped to kMaxPacketLength.
+    RtpPacketHistory(int capacity, size_t max_packet_length);
+
+    int capacity() const { return capacity_; }
+    size_t max_packet_length() const { return max_packet_length_; }
+
+    //Stores a copy, replacing the packet capacity() sequence numbers
+    //older. Returns false for a malformed or too long packet, or one that
+    //is already capacity() sequence numbers behind the newest.
+    bool PutRtpPacket(const uint8_t* packet, size_t length,
+                      int64_t capture_time_ms);
+
+    //Marks a stored packet as sent, the retransmission wait counts from
+    //here.
+    void SetSent(uint16_t sequence_number, int64_t now_ms);
+
+    //|length| holds the size of |buffer| on input and the packet length on
+    //output.
+    //
+    //Copies the packet for a retransmission. Returns false if it is not
+    //stored, |buffer| is too small, or it was sent less than
+    //|min_elapsed_time_ms| ago so a NACK arriving within an RTT is not
+    //served twice. On success the send time is set to |now_ms|.
+    bool GetPacketAndSetSendTime(uint16_t sequence_number,
+                                 int64_t min_elapsed_time_ms, int64_t now_ms,
+                                 uint8_t* buffer, size_t* length,
+                                 int64_t* capture_time_ms);
+
+    //The stored packet closest to |target_length| bytes, used as
+    //redundant padding. Returns false if the history is empty.
+    bool GetBestFittingPacket(size_t target_length, uint8_t* buffer,
+                              size_t* length);
+
+    bool HasRtpPacket(uint16_t sequence_number) const;
+    void Clear();
+
+private:
+    //Slots are whole cache lines, so they do not share a line.
+    enum { kAlignment = 64 };
+
+    struct Slot {
+        int64_t unwrapped;
+        uint16_t length;
+        bool sent;
+        int64_t capture_time_ms;
+        int64_t send_time_ms;
+    };
+
+    //Caller holds crit_.
+    //The stored packets are within kMaxCapacity of the newest, so the
+    //closest unwrapped value is theirs.
+    int64_t Unwrap(uint16_t sequence_number) const;
+    int SlotIndex(int64_t unwrapped) const {
+        return static_cast<int>(unwrapped & (capacity_ - 1));
+    }
+    int FindSlot(uint16_t sequence_number) const;
+    uint8_t* SlotData(int index) const {
+        return slab_.get() + static_cast<size_t>(index) * slot_size_;
+    }
+    void SetValid(int index, bool valid);
+
+    webrtc::scoped_ptr<webrtc::CriticalSectionWrapper> crit_;
+    const int capacity_;
+    const size_t max_packet_length_;
+    const size_t slot_size_;
+    //Unwrapped sequence number of the newest packet, -1 when empty.
+    int64_t newest_;
+    webrtc::scoped_ptr<uint8_t, webrtc::AlignedFreeDeleter> slab_;
+    std::vector<Slot> slots_;
+    std::vector<uint64_t> valid_;
+};
+
+#endif
@@ -0,0 +1,223 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include "SimulcastEncoder.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include "webrtc/system_wrappers/interface/tick_util.h"
+
+SimulcastEncoder::SimulcastEncoder(PacketSink* sink, I420BufferPool* pool)
+: sink_(sink),
+  pool_(pool),
+  queue_crit_(webrtc::CriticalSectionWrapper::CreateCriticalSection()),
+  crit_(webrtc::CriticalSectionWrapper::CreateCriticalSection()),
+  num_streams_(0),
+  max_framerate_(0),
+  frames_(0),
+  sum_scale_time_us_(0) {
+    memset(streams_, 0, sizeof(streams_));
+    memset(bitrates_kbps_, 0, sizeof(bitrates_kbps_));
+    memset(key_frame_needed_, 0, sizeof(key_frame_needed_));
+    for (int i = 0; i < webrtc::kMaxSimulcastStreams; i++) {
+        stream_sinks_[i].Set(this, i);
+    }
+}
+
+SimulcastEncoder::~SimulcastEncoder() {
+    Release();
+}
+
+void SimulcastEncoder::AllocateBitrate(const webrtc::SimulcastStream* streams,
+                                       int num_streams, uint32_t bitrate_kbps,
+                                       uint32_t* stream_bitrates_kbps) {
+    for (int i = 0; i < num_streams; i++) {
+        stream_bitrates_kbps[i] = 0;
+    }
+    if (num_streams == 0) {
+        return;
+    }
+    uint32_t remaining = bitrate_kbps;
+    int top = 0;
+    for (int i = 0; i < num_streams; i++) {
+        //The lowest stream is always sent, even below its minimum.
+        if (i > 0 && remaining < streams[i].minBitrate) {
+            break;
+        }
+        uint32_t bitrate = std::min(remaining, streams[i].targetBitrate);
+        stream_bitrates_kbps[i] = bitrate;
+        remaining -= bitrate;
+        top = i;
+    }
+    if (streams[top].maxBitrate > stream_bitrates_kbps[top]) {
+        stream_bitrates_kbps[top] += std::min(
+            remaining, streams[top].maxBitrate - stream_bitrates_kbps[top]);
+    }
+}
+
+bool SimulcastEncoder::Init(const webrtc::SimulcastStream* streams,
+                            int num_streams, int max_framerate,
+                            size_t max_payload_size) {
+    if (num_streams <= 0 || num_streams > webrtc::kMaxSimulcastStreams) {
+        return false;
+    }
+    webrtc::CriticalSectionScoped queue_cs(queue_crit_.get());
+    ReleaseEncoders();
+
+    uint32_t bitrates_kbps[webrtc::kMaxSimulcastStreams];
+    uint32_t start_kbps = 0;
+    for (int i = 0; i < num_streams; i++) {
+        start_kbps += streams[i].targetBitrate;
+    }
+    AllocateBitrate(streams, num_streams, start_kbps, bitrates_kbps);
+
+    //The streams already run in parallel, libvpx threads go to the largest.
+    //VP8PartitionEncoder::Init waits for its queue, so the encoders are
+    //made before crit_ is taken.
+    int cores = static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN));
+    webrtc::scoped_ptr<VP8PartitionEncoder> encoders[webrtc::kMaxSimulcastStreams];
+    for (int i = 0; i < num_streams; i++) {
+        VP8EncoderSettings settings;
+        settings.width = streams[i].width;
+        settings.height = streams[i].height;
+        settings.start_bitrate_kbps = std::max(bitrates_kbps[i],
+                                               streams[i].minBitrate);
+        settings.max_framerate = max_framerate;
+        settings.threads = i == num_streams - 1 ?
+                           std::max(1, cores - (num_streams - 1)) : 1;
+        settings.max_payload_size = max_payload_size;
+        encoders[i].reset(new VP8PartitionEncoder(&stream_sinks_[i]));
+        if (!encoders[i]->Init(settings)) {
+            return false;
+        }
+    }
+
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    memcpy(streams_, streams, num_streams * sizeof(streams[0]));
+    memcpy(bitrates_kbps_, bitrates_kbps,
+           num_streams * sizeof(bitrates_kbps[0]));
+    num_streams_ = num_streams;
+    max_framerate_ = max_framerate;
+    for (int i = 0; i < num_streams; i++) {
+        encoders_[i].swap(encoders[i]);
+        key_frame_needed_[i] = false;
+    }
+    return true;
+}
+
+void SimulcastEncoder::Release() {
+    webrtc::CriticalSectionScoped queue_cs(queue_crit_.get());
+    ReleaseEncoders();
+}
+
+void SimulcastEncoder::ReleaseEncoders() {
+    //Deleted after crit_ is left, each waits for its queue.
+    webrtc::scoped_ptr<VP8PartitionEncoder> encoders[webrtc::kMaxSimulcastStreams];
+    {
+        webrtc::CriticalSectionScoped cs(crit_.get());
+        for (int i = 0; i < num_streams_; i++) {
+            encoders[i].swap(encoders_[i]);
+        }
+        num_streams_ = 0;
+    }
+}
+
+void SimulcastEncoder::EncodeFrame(
+    const webrtc::scoped_refptr<I420Buffer>& frame, int64_t capture_time_ms,
+    bool key_frame) {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    if (num_streams_ == 0) {
+        return;
+    }
+
+    //Largest level first, each scaled from the smallest one built so far.
+    int64_t start_us = webrtc::TickTime::MicrosecondTimestamp();
+    webrtc::scoped_refptr<I420Buffer> levels[webrtc::kMaxSimulcastStreams];
+    webrtc::scoped_refptr<I420Buffer> source = frame;
+    for (int i = num_streams_ - 1; i >= 0; i--) {
+        if (i > 0 && bitrates_kbps_[i] == 0) {
+            continue;
+        }
+        if (streams_[i].width == source->width() &&
+            streams_[i].height == source->height()) {
+            levels[i] = source;
+            continue;
+        }
+        levels[i] = pool_->CreateBuffer(streams_[i].width, streams_[i].height);
+        if (levels[i].get() == NULL) {
+            continue;
+        }
+        ScaleI420Buffer(*source, levels[i].get());
+        source = levels[i];
+    }
+    sum_scale_time_us_ += webrtc::TickTime::MicrosecondTimestamp() - start_us;
+    frames_++;
+
+    for (int i = 0; i < num_streams_; i++) {
+        if (levels[i].get() == NULL) {
+            continue;
+        }
+        encoders_[i]->EncodeFrame(levels[i], capture_time_ms,
+                                  key_frame || key_frame_needed_[i]);
+        key_frame_needed_[i] = false;
+    }
+}
+
+void SimulcastEncoder::OnNetworkChanged(const uint32_t target_bitrate,
+                                        const uint8_t fraction_loss,
+                                        const uint32_t rtt) {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    uint32_t bitrates_kbps[webrtc::kMaxSimulcastStreams];
+    AllocateBitrate(streams_, num_streams_, target_bitrate / 1000,
+                    bitrates_kbps);
+    for (int i = 0; i < num_streams_; i++) {
+        if (bitrates_kbps[i] == 0 && i > 0) {
+            bitrates_kbps_[i] = 0;
+            continue;
+        }
+        if (i > 0 && bitrates_kbps_[i] == 0) {
+            key_frame_needed_[i] = true;
+        }
+        bitrates_kbps_[i] = bitrates_kbps[i];
+        encoders_[i]->SetRates(std::max(bitrates_kbps[i],
+                                        streams_[i].minBitrate),
+                               max_framerate_);
+    }
+}
+
+void SimulcastEncoder::Flush() {
+    webrtc::CriticalSectionScoped queue_cs(queue_crit_.get());
+    VP8PartitionEncoder* encoders[webrtc::kMaxSimulcastStreams];
+    int num_streams;
+    {
+        webrtc::CriticalSectionScoped cs(crit_.get());
+        num_streams = num_streams_;
+        for (int i = 0; i < num_streams; i++) {
+            encoders[i] = encoders_[i].get();
+        }
+    }
+    //Without crit_, the sink may call back in while the queues drain.
+    for (int i = 0; i < num_streams; i++) {
+        encoders[i]->Flush();
+    }
+}
+
+SimulcastStatistics SimulcastEncoder::GetStatistics() {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    SimulcastStatistics stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.num_streams = num_streams_;
+    for (int i = 0; i < num_streams_; i++) {
+        stats.streams[i] = encoders_[i]->GetStatistics();
+        stats.target_bitrate_kbps[i] = bitrates_kbps_[i];
+    }
+    stats.frames = frames_;
+    stats.sum_scale_time_us = sum_scale_time_us_;
+    return stats;
+}
@@ -0,0 +1,130 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#ifndef VOIP_SIMULCAST_ENCODER_H
+#define VOIP_SIMULCAST_ENCODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "webrtc/common_types.h"
+#include "webrtc/modules/bitrate_controller/include/bitrate_controller.h"
+#include "webrtc/system_wrappers/interface/critical_section_wrapper.h"
+#include "webrtc/system_wrappers/interface/scoped_ptr.h"
+#include "I420BufferPool.h"
+#include "VP8PartitionEncoder.h"
+
+struct SimulcastStatistics {
+    int num_streams;
+    //Per stream, lowest resolution first.
+    VP8EncoderStatistics streams[webrtc::kMaxSimulcastStreams];
+    uint32_t target_bitrate_kbps[webrtc::kMaxSimulcastStreams];
+    uint64_t frames;
+    //Time spent building the scaling pyramid.
+    int64_t sum_scale_time_us;
+};
+
+//Encodes one capture into several VP8 streams of decreasing resolution.
+//
+//VideoCodec carries simulcast streams, but VP8EncoderImpl in this tree
+//encodes a single stream, and VPMSimpleSpatialResampler scales the frame
+//again for each consumer. Here every captured frame is scaled once into a
+//pyramid of pooled buffers, each level box filtered from the next larger
+//one, and each level goes to its own VP8PartitionEncoder, which encodes on
+//its own queue, so the streams are encoded in parallel.
+//
+//The estimate from the BitrateController, received through
+//OnNetworkChanged, is split over the streams as webrtc's simulcast does:
+//each stream from the lowest up gets its target bitrate, the highest sent
+//stream gets the rest up to its maximum, and streams whose minimum no
+//longer fits are paused.
+//
+//Nothing in the engine creates one yet. AVSendStream sends a single stream
+//through ViE, so a call that uses it has to register it with its
+//BitrateController through SetBitrateObserver and send its packets with
+//an RTP sender per stream.
+//
+//Thread safe. The sink is called from the encoder queues concurrently and
+//may call back into the encoder, except for Init, Release and Flush.
+class SimulcastEncoder : public webrtc::BitrateObserver {
+public:
+    class PacketSink {
+    public:
+        //|stream| 0 is the lowest resolution.
+        virtual void OnSimulcastPacket(int stream, const VP8Packet& packet) = 0;
+    protected:
+        virtual ~PacketSink() {}
+    };
+
+    SimulcastEncoder(PacketSink* sink, I420BufferPool* pool);
+    virtual ~SimulcastEncoder();
+
+    //|streams| from the lowest resolution up, as in VideoCodec.
+    bool Init(const webrtc::SimulcastStream* streams, int num_streams,
+              int max_framerate, size_t max_payload_size);
+    void Release();
+
+    void EncodeFrame(const webrtc::scoped_refptr<I420Buffer>& frame,
+                     int64_t capture_time_ms, bool key_frame);
+
+    //webrtc::BitrateObserver.
+    virtual void OnNetworkChanged(const uint32_t target_bitrate,
+                                  const uint8_t fraction_loss,
+                                  const uint32_t rtt);
+
+    //Waits until the queued frames are encoded.
+    void Flush();
+
+    SimulcastStatistics GetStatistics();
+
+    //Splits |bitrate_kbps| over |streams|, 0 for a paused stream.
+    static void AllocateBitrate(const webrtc::SimulcastStream* streams,
+                                int num_streams, uint32_t bitrate_kbps,
+                                uint32_t* stream_bitrates_kbps);
+
+private:
+    class StreamSink : public VP8PartitionEncoder::PacketSink {
+    public:
+        StreamSink() : owner_(NULL), stream_(0) {}
+        void Set(SimulcastEncoder* owner, int stream) {
+            owner_ = owner;
+            stream_ = stream;
+        }
+        virtual void OnVP8Packet(const VP8Packet& packet) {
+            owner_->sink_->OnSimulcastPacket(stream_, packet);
+        }
+    private:
+        SimulcastEncoder* owner_;
+        int stream_;
+    };
+
+    //Caller holds queue_crit_.
+    void ReleaseEncoders();
+
+    PacketSink* sink_;
+    I420BufferPool* pool_;
+
+    //Held by Init, Release and Flush, which wait for the encoder queues
+    //without crit_, so the encoders are not replaced under them.
+    webrtc::scoped_ptr<webrtc::CriticalSectionWrapper> queue_crit_;
+    webrtc::scoped_ptr<webrtc::CriticalSectionWrapper> crit_;
+    int num_streams_;
+    int max_framerate_;
+    webrtc::SimulcastStream streams_[webrtc::kMaxSimulcastStreams];
+    uint32_t bitrates_kbps_[webrtc::kMaxSimulcastStreams];
+    //A stream resumed after a pause starts with a key frame.
+    bool key_frame_needed_[webrtc::kMaxSimulcastStreams];
+    StreamSink stream_sinks_[webrtc::kMaxSimulcastStreams];
+    webrtc::scoped_ptr<VP8PartitionEncoder> encoders_[webrtc::kMaxSimulcastStreams];
+    uint64_t frames_;
+    int64_t sum_scale_time_us_;
+
+    SimulcastEncoder(const SimulcastEncoder&);
+    SimulcastEncoder& operator=(const SimulcastEncoder&);
+};
+
+#endif
@@ -0,0 +1,318 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include "TransportFeedback.h"
+
+#include <string.h>
+
+static const size_t kHeaderSize = 20;
+static const uint8_t kRtpFbPayloadType = 205;
+static const uint8_t kTransportFeedbackFmt = 15;
+//Two bit status vector chunk, 7 symbols.
+static const int kSymbolsPerChunk = 7;
+
+static inline uint16_t ReadUint16(const uint8_t* p) {
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t ReadUint32(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) |
+           p[3];
+}
+
+static inline void WriteUint16(uint16_t v, uint8_t* p) {
+    p[0] = static_cast<uint8_t>(v >> 8);
+    p[1] = static_cast<uint8_t>(v);
+}
+
+static inline void WriteUint32(uint32_t v, uint8_t* p) {
+    p[0] = static_cast<uint8_t>(v >> 24);
+    p[1] = static_cast<uint8_t>(v >> 16);
+    p[2] = static_cast<uint8_t>(v >> 8);
+    p[3] = static_cast<uint8_t>(v);
+}
+
+static inline bool IsNewerSequenceNumber(uint16_t seq, uint16_t prev) {
+    return seq != prev && static_cast<uint16_t>(seq - prev) < 0x8000;
+}
+
+static inline int64_t FloorDiv(int64_t a, int64_t b) {
+    int64_t q = a / b;
+    return (a % b != 0 && a < 0) ? q - 1 : q;
+}
+
+//Shifting a negative value left is undefined, extend the sign by hand.
+static inline int32_t SignExtend24(uint32_t v) {
+    v &= 0xffffff;
+    return (v & 0x800000) ? static_cast<int32_t>(v) - 0x1000000 :
+                            static_cast<int32_t>(v);
+}
+
+TransportFeedback::TransportFeedback()
+: sender_ssrc_(0),
+  media_ssrc_(0),
+  feedback_seq_(0) {
+    SetBase(0, 0);
+}
+
+void TransportFeedback::SetBase(uint16_t base_sequence_number,
+                                int64_t reference_time_us) {
+    base_seq_ = base_sequence_number;
+    //Keep the value representable in 24 bits.
+    reference_time_ = SignExtend24(static_cast<uint32_t>(
+        FloorDiv(reference_time_us, kReferenceTimeScaleUs)));
+    last_time_us_ = static_cast<int64_t>(reference_time_) *
+                    kReferenceTimeScaleUs;
+    count_ = 0;
+}
+
+bool TransportFeedback::AddReceivedPacket(uint16_t sequence_number,
+                                          int64_t arrival_time_us) {
+    uint16_t index = sequence_number - base_seq_;
+    if (index < count_ || index >= kMaxStatusCount) {
+        return false;
+    }
+    int64_t delta_us = arrival_time_us - last_time_us_;
+    int64_t ticks = (delta_us + (delta_us >= 0 ? kDeltaScaleUs / 2 :
+                                 -kDeltaScaleUs / 2)) / kDeltaScaleUs;
+    if (ticks < INT16_MIN || ticks > INT16_MAX) {
+        return false;
+    }
+    for (; count_ < index; count_++) {
+        status_[count_] = kNotReceived;
+        delta_[count_] = 0;
+        arrival_us_[count_] = 0;
+    }
+    status_[index] = (ticks >= 0 && ticks <= 0xff) ? kSmallDelta : kLargeDelta;
+    delta_[index] = static_cast<int16_t>(ticks);
+    last_time_us_ += ticks * kDeltaScaleUs;
+    arrival_us_[index] = last_time_us_;
+    count_ = index + 1;
+    return true;
+}
+
+size_t TransportFeedback::BuildLength() const {
+    size_t length = kHeaderSize;
+    length += 2 * ((count_ + kSymbolsPerChunk - 1) / kSymbolsPerChunk);
+    for (int i = 0; i < count_; i++) {
+        if (status_[i] == kSmallDelta) {
+            length += 1;
+        } else if (status_[i] == kLargeDelta) {
+            length += 2;
+        }
+    }
+    return (length + 3) & ~static_cast<size_t>(3);
+}
+
+size_t TransportFeedback::Build(uint8_t* buffer, size_t capacity) const {
+    size_t length = BuildLength();
+    if (length > capacity) {
+        return 0;
+    }
+    buffer[0] = 0x80 | kTransportFeedbackFmt;
+    buffer[1] = kRtpFbPayloadType;
+    WriteUint16(static_cast<uint16_t>(length / 4 - 1), buffer + 2);
+    WriteUint32(sender_ssrc_, buffer + 4);
+    WriteUint32(media_ssrc_, buffer + 8);
+    WriteUint16(base_seq_, buffer + 12);
+    WriteUint16(static_cast<uint16_t>(count_), buffer + 14);
+    uint32_t reference_time = static_cast<uint32_t>(reference_time_) &
+                              0xffffff;
+    WriteUint32((reference_time << 8) | feedback_seq_, buffer + 16);
+
+    uint8_t* p = buffer + kHeaderSize;
+    for (int i = 0; i < count_; i += kSymbolsPerChunk) {
+        uint16_t chunk = 0xc000;
+        for (int j = 0; j < kSymbolsPerChunk && i + j < count_; j++) {
+            chunk |= status_[i + j] << (2 * (kSymbolsPerChunk - 1 - j));
+        }
+        WriteUint16(chunk, p);
+        p += 2;
+    }
+    for (int i = 0; i < count_; i++) {
+        if (status_[i] == kSmallDelta) {
+            *p++ = static_cast<uint8_t>(delta_[i]);
+        } else if (status_[i] == kLargeDelta) {
+            WriteUint16(static_cast<uint16_t>(delta_[i]), p);
+            p += 2;
+        }
+    }
+    memset(p, 0, buffer + length - p);
+    return length;
+}
+
+bool TransportFeedback::Parse(const uint8_t* buffer, size_t length) {
+    if (length < kHeaderSize || (buffer[0] >> 6) != 2 ||
+        (buffer[0] & 0x1f) != kTransportFeedbackFmt ||
+        buffer[1] != kRtpFbPayloadType) {
+        return false;
+    }
+    size_t packet_length = (ReadUint16(buffer + 2) + 1) * 4;
+    if (packet_length > length || packet_length < kHeaderSize) {
+        return false;
+    }
+    int count = ReadUint16(buffer + 14);
+    if (count > kMaxStatusCount) {
+        return false;
+    }
+    const uint8_t* end = buffer + packet_length;
+    sender_ssrc_ = ReadUint32(buffer + 4);
+    media_ssrc_ = ReadUint32(buffer + 8);
+    base_seq_ = ReadUint16(buffer + 12);
+    uint32_t word = ReadUint32(buffer + 16);
+    reference_time_ = SignExtend24(word >> 8);
+    feedback_seq_ = static_cast<uint8_t>(word);
+    count_ = 0;
+
+    const uint8_t* p = buffer + kHeaderSize;
+    while (count_ < count) {
+        if (p + 2 > end) {
+            return false;
+        }
+        uint16_t chunk = ReadUint16(p);
+        p += 2;
+        if (!(chunk & 0x8000)) {
+            //Run length chunk.
+            uint8_t status = (chunk >> 13) & 0x03;
+            int run = chunk & 0x1fff;
+            for (int i = 0; i < run && count_ < count; i++) {
+                status_[count_++] = status;
+            }
+        } else if (!(chunk & 0x4000)) {
+            //One bit status vector, 14 symbols.
+            for (int i = 13; i >= 0 && count_ < count; i--) {
+                status_[count_++] = ((chunk >> i) & 0x01) ? kSmallDelta :
+                                                            kNotReceived;
+            }
+        } else {
+            for (int i = kSymbolsPerChunk - 1; i >= 0 && count_ < count; i--) {
+                status_[count_++] = (chunk >> (2 * i)) & 0x03;
+            }
+        }
+    }
+
+    int64_t time_us = static_cast<int64_t>(reference_time_) *
+                      kReferenceTimeScaleUs;
+    for (int i = 0; i < count_; i++) {
+        if (status_[i] == kNotReceived) {
+            delta_[i] = 0;
+            arrival_us_[i] = 0;
+            continue;
+        }
+        if (status_[i] == kSmallDelta) {
+            if (p + 1 > end) {
+                return false;
+            }
+            delta_[i] = *p++;
+        } else if (status_[i] == kLargeDelta) {
+            if (p + 2 > end) {
+                return false;
+            }
+            delta_[i] = static_cast<int16_t>(ReadUint16(p));
+            p += 2;
+        } else {
+            return false;
+        }
+        time_us += delta_[i] * kDeltaScaleUs;
+        arrival_us_[i] = time_us;
+    }
+    last_time_us_ = time_us;
+    return true;
+}
+
+TransportFeedbackGenerator::TransportFeedbackGenerator(uint32_t sender_ssrc,
+                                                       uint32_t media_ssrc)
+: sender_ssrc_(sender_ssrc),
+  media_ssrc_(media_ssrc),
+  feedback_seq_(0),
+  has_packets_(false),
+  next_seq_(0),
+  highest_seq_(0) {
+    for (int i = 0; i < kHistorySize; i++) {
+        history_[i].valid = false;
+    }
+}
+
+const TransportFeedbackGenerator::Arrival* TransportFeedbackGenerator::Find(
+    uint16_t seq) const {
+    const Arrival& arrival = history_[seq % kHistorySize];
+    if (arrival.valid && arrival.seq == seq) {
+        return &arrival;
+    }
+    return NULL;
+}
+
+void TransportFeedbackGenerator::OnPacketArrival(uint16_t sequence_number,
+                                                 int64_t arrival_time_us) {
+    if (!has_packets_) {
+        has_packets_ = true;
+        next_seq_ = sequence_number;
+        highest_seq_ = sequence_number;
+    } else if (IsNewerSequenceNumber(next_seq_, sequence_number)) {
+        //Already reported as lost.
+        return;
+    } else if (IsNewerSequenceNumber(sequence_number, highest_seq_)) {
+        highest_seq_ = sequence_number;
+    }
+    Arrival& arrival = history_[sequence_number % kHistorySize];
+    arrival.valid = true;
+    arrival.seq = sequence_number;
+    arrival.arrival_time_us = arrival_time_us;
+
+    //Whatever fell out of the history can not be reported any more.
+    if (static_cast<uint16_t>(highest_seq_ - next_seq_) >= kHistorySize) {
+        next_seq_ = highest_seq_ - kHistorySize + 1;
+    }
+}
+
+size_t TransportFeedbackGenerator::BuildFeedback(uint8_t* buffer,
+                                                 size_t capacity) {
+    if (!has_packets_ || IsNewerSequenceNumber(next_seq_, highest_seq_)) {
+        return 0;
+    }
+    //Skip the lost packets at the start, the message starts with the first
+    //one received.
+    const Arrival* first = NULL;
+    uint16_t seq = next_seq_;
+    for (;; seq++) {
+        first = Find(seq);
+        if (first || seq == highest_seq_) {
+            break;
+        }
+    }
+    if (first == NULL) {
+        next_seq_ = highest_seq_ + 1;
+        return 0;
+    }
+
+    TransportFeedback feedback;
+    feedback.SetSenderSsrc(sender_ssrc_);
+    feedback.SetMediaSsrc(media_ssrc_);
+    feedback.SetFeedbackSequenceNumber(feedback_seq_);
+    feedback.SetBase(seq, first->arrival_time_us);
+    uint16_t last_seq = seq;
+    for (;; seq++) {
+        const Arrival* arrival = Find(seq);
+        if (arrival) {
+            if (!feedback.AddReceivedPacket(seq, arrival->arrival_time_us)) {
+                break;
+            }
+            last_seq = seq;
+        }
+        if (seq == highest_seq_) {
+            break;
+        }
+    }
+
+    size_t length = feedback.Build(buffer, capacity);
+    if (length > 0) {
+        feedback_seq_++;
+        next_seq_ = last_seq + 1;
+    }
+    return length;
+}
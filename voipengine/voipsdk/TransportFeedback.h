@@ -0,0 +1,116 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#ifndef VOIP_TRANSPORT_FEEDBACK_H
+#define VOIP_TRANSPORT_FEEDBACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//RTCP transport feedback (RTPFB, FMT 15) from
+//draft-holmer-rmcat-transport-wide-cc-extensions: the receiver reports the
+//arrival time of every packet so the sender can run the delay based
+//bandwidth estimation itself.
+//
+//  0  V=2 P FMT=15 | PT=205 | length
+//  4  SSRC of packet sender
+//  8  SSRC of media source
+// 12  base sequence number | packet status count
+// 16  reference time (24 bits, 64 ms) | feedback packet count
+// 20  packet chunks, 16 bits each
+//     receive deltas, 1 byte (0 to 63.75 ms) or 2 bytes signed, 250 us
+//     zero padding to 32 bits
+//
+//Only two bit status vector chunks are written, all chunk types are
+//parsed.
+class TransportFeedback {
+public:
+    enum { kMaxStatusCount = 256 };
+    enum { kDeltaScaleUs = 250 };
+    enum { kReferenceTimeScaleUs = 64000 };
+
+    TransportFeedback();
+
+    void SetSenderSsrc(uint32_t ssrc) { sender_ssrc_ = ssrc; }
+    void SetMediaSsrc(uint32_t ssrc) { media_ssrc_ = ssrc; }
+    void SetFeedbackSequenceNumber(uint8_t seq) { feedback_seq_ = seq; }
+    //Starts a new message, drops all packets.
+    void SetBase(uint16_t base_sequence_number, int64_t reference_time_us);
+
+    //Packets must be added in increasing sequence number order, skipped
+    //ones are reported lost. Returns false if the packet does not fit.
+    bool AddReceivedPacket(uint16_t sequence_number, int64_t arrival_time_us);
+
+    size_t BuildLength() const;
+    //Returns the message length, 0 if |capacity| is too small.
+    size_t Build(uint8_t* buffer, size_t capacity) const;
+    bool Parse(const uint8_t* buffer, size_t length);
+
+    uint32_t sender_ssrc() const { return sender_ssrc_; }
+    uint32_t media_ssrc() const { return media_ssrc_; }
+    uint8_t feedback_sequence_number() const { return feedback_seq_; }
+    uint16_t base_sequence_number() const { return base_seq_; }
+    int packet_status_count() const { return count_; }
+    bool IsReceived(int index) const { return status_[index] != kNotReceived; }
+    //Arrival time on the receiver's clock, only differences are meaningful.
+    int64_t ArrivalTimeUs(int index) const { return arrival_us_[index]; }
+
+private:
+    enum Status {
+        kNotReceived = 0,
+        kSmallDelta = 1,
+        kLargeDelta = 2,
+    };
+
+    uint32_t sender_ssrc_;
+    uint32_t media_ssrc_;
+    uint8_t feedback_seq_;
+    uint16_t base_seq_;
+    //24 bit signed on the wire.
+    int32_t reference_time_;
+    int64_t last_time_us_;
+    int count_;
+    uint8_t status_[kMaxStatusCount];
+    int16_t delta_[kMaxStatusCount];
+    int64_t arrival_us_[kMaxStatusCount];
+};
+
+//Receiver side, records arrivals and turns them into feedback messages.
+class TransportFeedbackGenerator {
+public:
+    TransportFeedbackGenerator(uint32_t sender_ssrc, uint32_t media_ssrc);
+
+    void OnPacketArrival(uint16_t sequence_number, int64_t arrival_time_us);
+
+    //Writes feedback for the packets since the previous message, returns
+    //its length or 0 if nothing new arrived. Call again while it returns
+    //non zero if many packets are waiting.
+    size_t BuildFeedback(uint8_t* buffer, size_t capacity);
+
+private:
+    enum { kHistorySize = 1024 };
+
+    struct Arrival {
+        bool valid;
+        uint16_t seq;
+        int64_t arrival_time_us;
+    };
+
+    const Arrival* Find(uint16_t seq) const;
+
+    uint32_t sender_ssrc_;
+    uint32_t media_ssrc_;
+    uint8_t feedback_seq_;
+    bool has_packets_;
+    //First packet not reported yet and the highest one seen.
+    uint16_t next_seq_;
+    uint16_t highest_seq_;
+    Arrival history_[kHistorySize];
+};
+
+#endif
@@ -9,6 +9,8 @@
 
 #import <Foundation/Foundation.h>
 
+@class UIView;
+
 @interface VOIPEngine : NSObject
 @property(nonatomic)int voipPort;
 
@@ -22,6 +24,17 @@
 @property(nonatomic)int32_t calleeIP;
 @property(nonatomic)int calleePort;
 @property(nonatomic)BOOL isHeadphone;
+//XOR parity protection of the voice stream, adapted to the loss the peer
+//reports. Peers without support ignore the extra packets.
+@property(nonatomic)BOOL enableAudioFEC;
+
+//Video call, set before startStream.
+@property(nonatomic)BOOL videoEnabled;
+@property(nonatomic, weak)UIView *localRender;
+@property(nonatomic, weak)UIView *remoteRender;
+//VP8 temporal layers for group calls, so a forwarding server can drop the
+//upper layers for receivers with less bandwidth. 0 or 1 for a single layer.
+@property(nonatomic)int videoTemporalLayers;
 -(void)startStream;
 -(void)stopStream;
 @end
@@ -9,12 +9,18 @@
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <atomic>
 #import "VOIPEngine.h"
 #import "AVSendStream.h"
 #import "AVReceiveStream.h"
 #import "util.h"
 #import "WebRTC.h"
 #include "webrtc/voice_engine/include/voe_network.h"
+#include "webrtc/video_engine/include/vie_network.h"
+#include "webrtc/system_wrappers/interface/tick_util.h"
+#include "AudioFec.h"
+#include "MediaDemux.h"
+#include "PacketPacer.h"
 
 //兼容没有消息头的旧版本协议
 #define COMPATIBLE
@@ -22,6 +28,8 @@
 
 #define VOIP_AUDIO 1
 #define VOIP_VIDEO 2
+//rtp:parity packet, rtcp:loss report
+#define VOIP_AUDIO_FEC 3
 
 #define VOIP_RTP 1
 #define VOIP_RTCP 2
@@ -31,6 +39,14 @@
 #define VOIP_AUTH_STATUS 2
 #define VOIP_DATA 3
 
+//Datagrams read per read event, a key frame arrives as a burst.
+static const int kMaxReadsPerEvent = 64;
+//Room for a few key frames in the kernel.
+static const int kVideoSocketBufferSize = 512*1024;
+//Video is paced at a multiple of this, audio and RTCP are never paced.
+static const int kVideoPacingKbps = 900;
+static const int kVideoPacerCapacity = 512;
+
 @interface VOIPData : NSObject
 @property(nonatomic, assign)int64_t sender;
 @property(nonatomic, assign)int64_t receiver;
@@ -43,21 +59,124 @@
 
 @end
 
-@interface VOIPEngine()<VoiceTransport>
+class VOIPFecReceiver : public AudioFecDecoder::Callback {
+public:
+    VOIPFecReceiver(webrtc::VoENetwork *voe_network, int channel)
+    : voe_network_(voe_network), channel_(channel) {
+    }
+
+    virtual void OnRecoveredPacket(const uint8_t *packet, size_t length) {
+        voe_network_->ReceivedRTPPacket(channel_, packet, length);
+    }
+
+private:
+    webrtc::VoENetwork *voe_network_;
+    int channel_;
+};
+
+class VOIPMediaReceiver : public MediaDemux::Receiver {
+public:
+    VOIPMediaReceiver(webrtc::VoENetwork *voe_network, int voice_channel,
+                      webrtc::ViENetwork *vie_network, int video_send_channel,
+                      int video_receive_channel)
+    : voe_network_(voe_network), voice_channel_(voice_channel),
+      vie_network_(vie_network), video_send_channel_(video_send_channel),
+      video_receive_channel_(video_receive_channel) {
+    }
+
+    virtual void OnRtpPacket(MediaType media, const uint8_t *packet, size_t length) {
+        if (media == kMediaAudio) {
+            voe_network_->ReceivedRTPPacket(voice_channel_, packet, length);
+        } else if (video_receive_channel_ != -1) {
+            vie_network_->ReceivedRTPPacket(video_receive_channel_, packet, length,
+                                            webrtc::PacketTime());
+        }
+    }
+
+    virtual void OnRtcpPacket(MediaType media, const uint8_t *packet, size_t length) {
+        if (media == kMediaAudio) {
+            voe_network_->ReceivedRTCPPacket(voice_channel_, packet, length);
+            return;
+        }
+        if (video_receive_channel_ == -1) {
+            return;
+        }
+        //Sender reports are for the receive channel, NACK and PLI for the
+        //send channel. Each channel ignores what is not addressed to it.
+        vie_network_->ReceivedRTCPPacket(video_receive_channel_, packet, length);
+        vie_network_->ReceivedRTCPPacket(video_send_channel_, packet, length);
+    }
+
+private:
+    webrtc::VoENetwork *voe_network_;
+    int voice_channel_;
+    webrtc::ViENetwork *vie_network_;
+    int video_send_channel_;
+    int video_receive_channel_;
+};
+
+@interface VOIPEngine()<VoiceTransport, VideoTransport> {
+    //Read by the video send path without a lock. Set before the video
+    //channel starts and cleared only after it is stopped, so a pacer that
+    //was read stays valid for the whole InsertPacket.
+    std::atomic<PacketPacer*> _videoPacer;
+}
 @property(nonatomic) NSDate *beginDate;
 @property(nonatomic) BOOL isPeerConnected;
 @property(strong, nonatomic) AudioSendStream *sendStream;
 @property(strong, nonatomic) AudioReceiveStream *recvStream;
+@property(strong, nonatomic) AVSendStream *avSendStream;
+@property(strong, nonatomic) AVReceiveStream *avRecvStream;
+
+@property(nonatomic, assign) MediaDemux *demux;
+@property(nonatomic, assign) VOIPMediaReceiver *mediaReceiver;
+
+@property(nonatomic, assign) PacketPacer::Callback *videoPacerCallback;
+@property(nonatomic, strong) dispatch_queue_t videoSendQueue;
+@property(nonatomic, strong) dispatch_source_t videoPacerTimer;
 
 @property(nonatomic, assign)int udpFD;
 @property(nonatomic, strong)dispatch_source_t readSource;
 @property(nonatomic, getter=isAuth) BOOL auth;
 @property(nonatomic) BOOL isPeerNoHeader;
+
+@property(nonatomic, assign) AudioFecEncoder *fecEncoder;
+@property(nonatomic, assign) AudioFecDecoder *fecDecoder;
+@property(nonatomic, assign) AudioFecController *fecController;
+@property(nonatomic, assign) VOIPFecReceiver *fecReceiver;
+@property(nonatomic, strong) dispatch_source_t fecReportTimer;
+
+-(void)sendVideoPacket:(const void*)data length:(int)length;
 @end
 
+class VOIPVideoPacerCallback : public PacketPacer::Callback {
+public:
+    VOIPVideoPacerCallback(VOIPEngine *engine) : engine_(engine) {
+    }
+
+    virtual void TimeToSendPackets(const PacedPacket* const* packets, int count) {
+        for (int i = 0; i < count; i++) {
+            [engine_ sendVideoPacket:packets[i]->data length:packets[i]->length];
+        }
+    }
+
+private:
+    //Not retained: dropping the last reference here would run dealloc on
+    //the send queue, where stopVideoPacer waits for that same queue.
+    //stopVideoPacer runs before the engine is gone and waits for Process(),
+    //so the engine outlives every call.
+    __unsafe_unretained VOIPEngine *engine_;
+};
+
 
 @implementation VOIPEngine
 
+-(void)dealloc {
+    [self stopFEC];
+    [self stopVideoPacer];
+    [self stopDemux];
+}
+
 -(void)listenVOIP {
     if (self.readSource) {
         return;
@@ -72,6 +191,11 @@
     
     int one = 1;
     setsockopt(self.udpFD, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (self.videoEnabled) {
+        int size = kVideoSocketBufferSize;
+        setsockopt(self.udpFD, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        setsockopt(self.udpFD, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    }
     
     bind(self.udpFD, (struct sockaddr *)&addr,sizeof(addr));
     
@@ -128,15 +252,28 @@
 }
 
 -(void)handleRead {
-    char buf[64*1024] = {0};
+    //Drains the socket, so voice packets behind a burst of video do not
+    //wait for the next read event.
+    for (int i = 0; i < kMaxReadsPerEvent && self.udpFD != -1; i++) {
+        if (![self readPacket]) {
+            break;
+        }
+    }
+}
+
+-(BOOL)readPacket {
+    char buf[64*1024];
     struct sockaddr_in addr;
     socklen_t len = sizeof(addr);
-    size_t n = recvfrom(self.udpFD, buf, 64*1024, 0, (struct sockaddr*)&addr, &len);
+    ssize_t n = recvfrom(self.udpFD, buf, 64*1024, 0, (struct sockaddr*)&addr, &len);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return NO;
+    }
     if (n <= 0) {
         NSLog(@"recv udp error:%d, %s", errno, strerror(errno));
         [self closeUDP];
         [self listenVOIP];
-        return;
+        return NO;
     }
 
     int cmd = buf[0] & 0x0f;
@@ -155,6 +292,7 @@
         }
     }
 #endif
+    return YES;
 }
 
 -(void)onVOIPData:(VOIPData*)data ip:(int)ip port:(int)port {
@@ -162,62 +300,264 @@
         NSLog(@"skip data...");
         return;
     }
-    if (self.recvStream == nil) {
+    if (self.demux == NULL) {
         NSLog(@"skip data...");
         return;
     }
-    int channel = self.recvStream.voiceChannel;
     
     const void *packet = [data.content bytes];
     NSInteger packet_length = [data.content length];
     
-    WebRTC *rtc = [WebRTC sharedWebRTC];
-    
     if (!self.isPeerConnected && self.calleeIP == ip && self.calleePort == port) {
         self.isPeerConnected = YES;
         NSLog(@"peer connected");
     }
     
-    if (data.isRTP) {
-        if (data.type == VOIP_AUDIO) {
-            //NSLog(@"audio data:%zd content:%zd", packet_length, data.content.length);
-            rtc.voe_network->ReceivedRTPPacket(channel, packet, packet_length);
+    if (data.type == VOIP_AUDIO_FEC) {
+        if (!data.isRTP) {
+            [self handleFECReport:(const uint8_t*)packet length:packet_length];
+        } else if (self.fecDecoder) {
+            self.fecDecoder->OnFecPacket((const uint8_t*)packet, packet_length);
         }
-    } else {
-        if (data.type == VOIP_AUDIO) {
-            //NSLog(@"audio rtcp data:%zd", packet_length);
-            rtc.voe_network->ReceivedRTCPPacket(channel, packet, packet_length);
+        return;
+    }
+
+    //Audio is delivered here, video on the demux queue.
+    self.demux->DeliverPacket(data.type, data.isRTP, (const uint8_t*)packet, packet_length);
+    if (data.type == VOIP_AUDIO && data.isRTP && self.fecDecoder) {
+        self.fecDecoder->OnMediaPacket((const uint8_t*)packet, packet_length);
+    }
+}
+
+-(int)receiveVoiceChannel {
+    if (self.avRecvStream) {
+        return self.avRecvStream.voiceChannel;
+    }
+    return self.recvStream.voiceChannel;
+}
+
+#pragma mark media demux
+-(void)startDemux {
+    if (self.demux) {
+        return;
+    }
+    WebRTC *rtc = [WebRTC sharedWebRTC];
+    int videoSendChannel = self.avSendStream ? self.avSendStream.videoChannel : -1;
+    int videoReceiveChannel = self.avRecvStream ? self.avRecvStream.videoChannel : -1;
+    self.mediaReceiver = new VOIPMediaReceiver(rtc.voe_network, [self receiveVoiceChannel],
+                                               rtc.network, videoSendChannel, videoReceiveChannel);
+    self.demux = new MediaDemux(self.mediaReceiver, MediaDemux::kDefaultVideoQueueSize);
+}
+
+-(void)stopDemux {
+    if (self.demux) {
+        MediaDemuxStatistics stats = self.demux->GetStatistics();
+        NSLog(@"media demux audio:%llu video:%llu video dropped:%llu max video batch:%u",
+              stats.audio_packets, stats.video_packets, stats.video_dropped, stats.max_video_batch);
+    }
+    //Waits for the queued video.
+    delete self.demux;
+    self.demux = NULL;
+    delete self.mediaReceiver;
+    self.mediaReceiver = NULL;
+}
+
+#pragma mark video pacing
+-(void)startVideoPacer {
+    if (_videoPacer.load(std::memory_order_relaxed)) {
+        return;
+    }
+    self.videoPacerCallback = new VOIPVideoPacerCallback(self);
+    PacketPacer *pacer = new PacketPacer(self.videoPacerCallback, kVideoPacingKbps, kVideoPacerCapacity);
+    self.videoSendQueue = dispatch_queue_create("com.beetle.voip.video_send", DISPATCH_QUEUE_SERIAL);
+    self.videoPacerTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, self.videoSendQueue);
+    dispatch_source_set_timer(self.videoPacerTimer, DISPATCH_TIME_NOW, 5*NSEC_PER_MSEC, NSEC_PER_MSEC);
+    dispatch_source_set_event_handler(self.videoPacerTimer, ^{
+        pacer->Process(webrtc::TickTime::MillisecondTimestamp());
+    });
+    dispatch_resume(self.videoPacerTimer);
+    _videoPacer.store(pacer, std::memory_order_release);
+}
+
+//Called once the video channel is stopped, see _videoPacer.
+-(void)stopVideoPacer {
+    PacketPacer *pacer = _videoPacer.load(std::memory_order_relaxed);
+    if (!pacer) {
+        return;
+    }
+    _videoPacer.store(NULL, std::memory_order_relaxed);
+    dispatch_source_cancel(self.videoPacerTimer);
+    self.videoPacerTimer = nil;
+    //Waits for a running Process().
+    dispatch_sync(self.videoSendQueue, ^{});
+    self.videoSendQueue = nil;
+
+    PacketPacerStatistics stats = pacer->GetStatistics();
+    NSLog(@"video pacer sent:%llu bytes:%llu dropped:%llu max queue time:%lldms",
+          stats.packets_sent, stats.bytes_sent, stats.packets_dropped, stats.max_queue_time_ms);
+    delete pacer;
+    delete self.videoPacerCallback;
+    self.videoPacerCallback = NULL;
+}
+
+#pragma mark audio fec
+-(void)startFEC {
+    if (!self.enableAudioFEC || self.fecEncoder) {
+        return;
+    }
+    WebRTC *rtc = [WebRTC sharedWebRTC];
+    self.fecEncoder = new AudioFecEncoder();
+    self.fecController = new AudioFecController();
+    self.fecReceiver = new VOIPFecReceiver(rtc.voe_network, [self receiveVoiceChannel]);
+    self.fecDecoder = new AudioFecDecoder(self.fecReceiver);
+
+    self.fecReportTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, dispatch_get_main_queue());
+    dispatch_source_set_timer(self.fecReportTimer, dispatch_time(DISPATCH_TIME_NOW, NSEC_PER_SEC), NSEC_PER_SEC, NSEC_PER_SEC/10);
+    __weak VOIPEngine *wself = self;
+    dispatch_source_set_event_handler(self.fecReportTimer, ^{
+        [wself sendFECReport];
+    });
+    dispatch_resume(self.fecReportTimer);
+}
+
+-(void)stopFEC {
+    if (self.fecReportTimer) {
+        dispatch_source_cancel(self.fecReportTimer);
+        self.fecReportTimer = nil;
+    }
+    if (self.fecEncoder) {
+        NSLog(@"audio fec media bytes:%llu fec bytes:%llu lost:%u recovered:%u",
+              self.fecEncoder->media_bytes(), self.fecEncoder->fec_bytes(),
+              self.fecDecoder->packets_lost(), self.fecDecoder->packets_recovered());
+    }
+    @synchronized(self) {
+        delete self.fecEncoder;
+        self.fecEncoder = NULL;
+    }
+    delete self.fecDecoder;
+    self.fecDecoder = NULL;
+    delete self.fecReceiver;
+    self.fecReceiver = NULL;
+    delete self.fecController;
+    self.fecController = NULL;
+}
+
+-(void)sendFECReport {
+    if (!self.fecDecoder) {
+        return;
+    }
+    uint8_t report[2];
+    self.fecDecoder->GetLossReport(&report[0], &report[1]);
+
+    VOIPData *vData = [[VOIPData alloc] init];
+    vData.sender = self.caller;
+    vData.receiver = self.callee;
+    vData.type = VOIP_AUDIO_FEC;
+    vData.rtp = NO;
+    vData.content = [NSData dataWithBytes:report length:sizeof(report)];
+    [self sendVOIPData:vData];
+}
+
+-(void)handleFECReport:(const uint8_t*)report length:(NSInteger)length {
+    if (!self.fecController || length < 2) {
+        return;
+    }
+    if (!self.fecController->OnLossReport(report[0], report[1])) {
+        return;
+    }
+    AudioFecProtection protection = self.fecController->protection();
+    NSLog(@"audio fec group size:%d stride:%d", protection.group_size, protection.stride);
+    @synchronized(self) {
+        if (self.fecEncoder) {
+            self.fecEncoder->SetProtection(protection);
         }
     }
 }
 
+-(void)sendFECPacket:(const void*)data length:(int)length {
+    uint8_t fec[kAudioFecHeaderSize + kAudioFecMaxPacketSize];
+    size_t fecLength = 0;
+    @synchronized(self) {
+        if (!self.fecEncoder) {
+            return;
+        }
+        fecLength = self.fecEncoder->AddMediaPacket((const uint8_t*)data, length, fec, sizeof(fec));
+    }
+    if (fecLength == 0) {
+        return;
+    }
+
+    VOIPData *vData = [[VOIPData alloc] init];
+    vData.sender = self.caller;
+    vData.receiver = self.callee;
+    vData.type = VOIP_AUDIO_FEC;
+    vData.rtp = YES;
+    vData.content = [NSData dataWithBytes:fec length:fecLength];
+    [self sendVOIPData:vData];
+}
+
 
 
 -(void)startStream {
-    if (self.sendStream || self.recvStream) return;
-    
-    self.sendStream = [[AudioSendStream alloc] init];
-    self.sendStream.voiceTransport = self;
-    [self.sendStream start];
-    
-    self.recvStream = [[AudioReceiveStream alloc] init];
-    self.recvStream.voiceTransport = self;
-    self.recvStream.isHeadphone = self.isHeadphone;
-    self.recvStream.isLoudspeaker = NO;
+    if (self.sendStream || self.recvStream || self.avSendStream || self.avRecvStream) return;
     
-    [self.recvStream start];
+    if (self.videoEnabled) {
+        [self startVideoStream];
+    } else {
+        self.sendStream = [[AudioSendStream alloc] init];
+        self.sendStream.voiceTransport = self;
+        [self.sendStream start];
+        
+        self.recvStream = [[AudioReceiveStream alloc] init];
+        self.recvStream.voiceTransport = self;
+        self.recvStream.isHeadphone = self.isHeadphone;
+        self.recvStream.isLoudspeaker = NO;
+        
+        [self.recvStream start];
+    }
     
+    [self startDemux];
+    [self startFEC];
     [self listenVOIP];
     self.beginDate = [NSDate date];
 }
 
+-(void)startVideoStream {
+    [self startVideoPacer];
+    
+    self.avSendStream = [[AVSendStream alloc] init];
+    self.avSendStream.voiceTransport = self;
+    self.avSendStream.videoTransport = self;
+    self.avSendStream.hasVideo = YES;
+    self.avSendStream.temporalLayers = self.videoTemporalLayers;
+    self.avSendStream.render = self.localRender;
+    [self.avSendStream start];
+    
+    self.avRecvStream = [[AVReceiveStream alloc] init];
+    self.avRecvStream.voiceTransport = self;
+    self.avRecvStream.videoTransport = self;
+    self.avRecvStream.isHeadphone = self.isHeadphone;
+    self.avRecvStream.isLoudspeaker = NO;
+    self.avRecvStream.render = self.remoteRender;
+    self.avRecvStream.uid = self.callee;
+    [self.avRecvStream start];
+}
+
 -(void)stopStream {
-    if (!self.sendStream && !self.recvStream) return;
+    if (!self.sendStream && !self.recvStream && !self.avSendStream && !self.avRecvStream) return;
     NSLog(@"stop stream");
+    //No more packets are read, the video still queued in the demux reaches
+    //the channels before they stop.
+    [self closeUDP];
+    [self stopDemux];
+
     [self.sendStream stop];
     [self.recvStream stop];
+    [self.avSendStream stop];
+    [self.avRecvStream stop];
     
-    [self closeUDP];
+    [self stopVideoPacer];
+    [self stopFEC];
 }
 
 -(void)closeUDP {
@@ -374,6 +714,7 @@
     //NSLog(@"send rtp package:%d", length);
     
     [self sendVOIPData:vData];
+    [self sendFECPacket:data length:length];
     return length;
 }
 
@@ -395,5 +736,44 @@
     return length;
 }
 
+#pragma mark VideoTransport
+-(void)sendVideoPacket:(const void*)data length:(int)length {
+    VOIPData *vData = [[VOIPData alloc] init];
+    
+    vData.sender = self.caller;
+    vData.receiver = self.callee;
+    vData.type = VOIP_VIDEO;
+    vData.rtp = YES;
+    vData.content = [NSData dataWithBytes:data length:length];
+    
+    [self sendVOIPData:vData];
+}
+
+-(int)sendRTPPacketV:(const void*)data length:(int)length {
+    //Queued behind nothing but other video, audio is sent as it comes.
+    PacketPacer *pacer = _videoPacer.load(std::memory_order_acquire);
+    if (pacer) {
+        pacer->InsertPacket(PacketPacer::kNormalPriority, (const uint8_t*)data,
+                            length, webrtc::TickTime::MillisecondTimestamp());
+        return length;
+    }
+    [self sendVideoPacket:data length:length];
+    return length;
+}
+
+-(int)sendRTCPPacketV:(const void*)data length:(int)length STOR:(BOOL)STOR {
+    //Unlike audio the receive channel reports too, its RTCP carries the
+    //NACK and PLI requests.
+    VOIPData *vData = [[VOIPData alloc] init];
+    
+    vData.sender = self.caller;
+    vData.receiver = self.callee;
+    vData.rtp = NO;
+    vData.type = VOIP_VIDEO;
+    vData.content = [NSData dataWithBytes:data length:length];
+    
+    [self sendVOIPData:vData];
+    return length;
+}
 
 @end
@@ -0,0 +1,459 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include "VP8PartitionEncoder.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include "chromium/src/third_party/libvpx/source/libvpx/vpx/vpx_encoder.h"
+#include "chromium/src/third_party/libvpx/source/libvpx/vpx/vp8cx.h"
+#include "webrtc/system_wrappers/interface/tick_util.h"
+
+//Same as webrtc::VP8EncoderImpl.
+#if defined(__arm__) || defined(__aarch64__)
+static const int kCpuSpeed = -12;
+#else
+static const int kCpuSpeed = -6;
+#endif
+static const int kMinResolutionForThreads = 320 * 240;
+
+struct InitContext {
+    VP8PartitionEncoder* encoder;
+    const VP8EncoderSettings* settings;
+    bool result;
+};
+
+VP8PartitionEncoder::VP8PartitionEncoder(PacketSink* sink)
+: sink_(sink),
+  queue_(dispatch_queue_create("com.beetle.voip.video_encode",
+                               DISPATCH_QUEUE_SERIAL)),
+  crit_(webrtc::CriticalSectionWrapper::CreateCriticalSection()),
+  has_pending_(false),
+  rates_changed_(false),
+  bitrate_kbps_(0),
+  framerate_(0),
+  scheduler_(NULL),
+  scheduler_stream_(-1),
+  skipped_key_frame_(false),
+  encoder_(NULL),
+  config_(NULL),
+  raw_(NULL),
+  picture_id_(0),
+  inited_(false),
+  stats_crit_(webrtc::CriticalSectionWrapper::CreateCriticalSection()) {
+    memset(&settings_, 0, sizeof(settings_));
+    memset(&stats_, 0, sizeof(stats_));
+    pending_.capture_time_ms = 0;
+    pending_.key_frame = false;
+}
+
+VP8PartitionEncoder::~VP8PartitionEncoder() {
+    Release();
+    dispatch_release(queue_);
+}
+
+int VP8PartitionEncoder::NumberOfThreads(const VP8EncoderSettings& settings,
+                                         int cores) {
+    if (settings.threads > 0) {
+        return std::min(settings.threads, static_cast<int>(kMaxThreads));
+    }
+    if (settings.width * settings.height < kMinResolutionForThreads) {
+        return 1;
+    }
+    return std::max(1, std::min(cores, static_cast<int>(kMaxThreads)));
+}
+
+bool VP8PartitionEncoder::Init(const VP8EncoderSettings& settings) {
+    if (settings.width <= 0 || settings.height <= 0 ||
+        settings.max_framerate <= 0 ||
+        settings.max_payload_size <= kPayloadDescriptorSize) {
+        return false;
+    }
+    //The encoder is only touched on its queue.
+    InitContext init = {this, &settings, false};
+    dispatch_sync_f(queue_, &init, InitTask);
+    if (init.result) {
+        webrtc::CriticalSectionScoped cs(crit_.get());
+        bitrate_kbps_ = settings.start_bitrate_kbps;
+        framerate_ = settings.max_framerate;
+        rates_changed_ = false;
+    }
+    return init.result;
+}
+
+void VP8PartitionEncoder::InitTask(void* context) {
+    InitContext* init = static_cast<InitContext*>(context);
+    init->result = init->encoder->InitEncoder(*init->settings);
+}
+
+bool VP8PartitionEncoder::InitEncoder(const VP8EncoderSettings& settings) {
+    ReleaseEncoder();
+    settings_ = settings;
+    int threads = NumberOfThreads(settings,
+                                  static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN)));
+    //One token partition per thread, libvpx allows 1, 2, 4 or 8.
+    int token_partitions = 0;
+    while ((2 << token_partitions) <= threads && token_partitions < 3) {
+        token_partitions++;
+    }
+
+    encoder_ = new vpx_codec_ctx_t;
+    config_ = new vpx_codec_enc_cfg_t;
+    if (vpx_codec_enc_config_default(vpx_codec_vp8_cx(), config_, 0)) {
+        ReleaseEncoder();
+        return false;
+    }
+    config_->g_w = settings.width;
+    config_->g_h = settings.height;
+    config_->g_threads = threads;
+    config_->g_timebase.num = 1;
+    config_->g_timebase.den = kRtpClockRateKhz * 1000;
+    config_->g_lag_in_frames = 0;
+    config_->g_error_resilient = VPX_ERROR_RESILIENT_DEFAULT;
+    config_->g_pass = VPX_RC_ONE_PASS;
+    config_->rc_end_usage = VPX_CBR;
+    config_->rc_target_bitrate = settings.start_bitrate_kbps;
+    config_->rc_min_quantizer = 2;
+    config_->rc_max_quantizer = 56;
+    config_->rc_undershoot_pct = 100;
+    config_->rc_overshoot_pct = 15;
+    config_->rc_buf_initial_sz = 500;
+    config_->rc_buf_optimal_sz = 600;
+    config_->rc_buf_sz = 1000;
+    config_->rc_dropframe_thresh = 30;
+    config_->rc_resize_allowed = 0;
+    config_->kf_mode = VPX_KF_AUTO;
+    config_->kf_max_dist = 3000;
+
+    if (vpx_codec_enc_init(encoder_, vpx_codec_vp8_cx(), config_,
+                           VPX_CODEC_USE_OUTPUT_PARTITION)) {
+        delete encoder_;
+        encoder_ = NULL;
+        ReleaseEncoder();
+        return false;
+    }
+    //webrtc::VP8EncoderImpl::MaxIntraTarget.
+    int max_intra_pct = std::max(300, static_cast<int>(
+        config_->rc_buf_optimal_sz * 0.5 * settings.max_framerate / 10));
+    vpx_codec_control(encoder_, VP8E_SET_CPUUSED, kCpuSpeed);
+    vpx_codec_control(encoder_, VP8E_SET_TOKEN_PARTITIONS, token_partitions);
+    vpx_codec_control(encoder_, VP8E_SET_NOISE_SENSITIVITY, 0);
+    vpx_codec_control(encoder_, VP8E_SET_STATIC_THRESHOLD, 1);
+    vpx_codec_control(encoder_, VP8E_SET_MAX_INTRA_BITRATE_PCT, max_intra_pct);
+
+    raw_ = vpx_img_wrap(NULL, VPX_IMG_FMT_I420, settings.width,
+                        settings.height, 1, NULL);
+    packet_buffer_.reset(new uint8_t[settings.max_payload_size]);
+    {
+        webrtc::CriticalSectionScoped cs(stats_crit_.get());
+        stats_.threads = threads;
+        stats_.token_partitions = 1 << token_partitions;
+    }
+    inited_ = true;
+    return true;
+}
+
+void VP8PartitionEncoder::Release() {
+    dispatch_sync_f(queue_, this, ReleaseTask);
+}
+
+void VP8PartitionEncoder::ReleaseTask(void* context) {
+    static_cast<VP8PartitionEncoder*>(context)->ReleaseEncoder();
+}
+
+void VP8PartitionEncoder::ReleaseEncoder() {
+    inited_ = false;
+    if (encoder_) {
+        vpx_codec_destroy(encoder_);
+        delete encoder_;
+        encoder_ = NULL;
+    }
+    delete config_;
+    config_ = NULL;
+    if (raw_) {
+        vpx_img_free(raw_);
+        raw_ = NULL;
+    }
+}
+
+void VP8PartitionEncoder::SetEncodeScheduler(EncodeScheduler* scheduler,
+                                             int stream) {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    scheduler_ = scheduler;
+    scheduler_stream_ = stream;
+}
+
+void VP8PartitionEncoder::EncodeFrame(
+    const webrtc::scoped_refptr<I420Buffer>& input, int64_t capture_time_ms,
+    bool key_frame) {
+    webrtc::scoped_refptr<I420Buffer> frame = input;
+    EncodeScheduler* scheduler;
+    int stream;
+    {
+        webrtc::CriticalSectionScoped cs(crit_.get());
+        scheduler = scheduler_;
+        stream = scheduler_stream_;
+    }
+    if (scheduler) {
+        frame = scheduler->ScheduleFrame(stream, input, capture_time_ms,
+                                         webrtc::TickTime::MillisecondTimestamp());
+        if (frame.get() == NULL) {
+            if (key_frame) {
+                //Requested again with the next frame.
+                webrtc::CriticalSectionScoped cs(crit_.get());
+                skipped_key_frame_ = true;
+            }
+            webrtc::CriticalSectionScoped cs(stats_crit_.get());
+            stats_.frames_skipped++;
+            return;
+        }
+    }
+
+    bool schedule = false;
+    bool replaced = false;
+    {
+        webrtc::CriticalSectionScoped cs(crit_.get());
+        key_frame = key_frame || skipped_key_frame_;
+        skipped_key_frame_ = false;
+        if (has_pending_) {
+            replaced = true;
+            //Keep the request when a key frame is replaced.
+            key_frame = key_frame || pending_.key_frame;
+        } else {
+            schedule = true;
+        }
+        pending_.buffer = frame;
+        pending_.capture_time_ms = capture_time_ms;
+        pending_.key_frame = key_frame;
+        has_pending_ = true;
+    }
+    if (replaced) {
+        if (scheduler) {
+            scheduler->OnFrameDropped(stream);
+        }
+        webrtc::CriticalSectionScoped cs(stats_crit_.get());
+        stats_.frames_dropped++;
+    }
+    if (schedule) {
+        dispatch_async_f(queue_, this, EncodeTask);
+    }
+}
+
+void VP8PartitionEncoder::SetRates(int bitrate_kbps, int framerate) {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    bitrate_kbps_ = bitrate_kbps;
+    framerate_ = std::max(1, framerate);
+    rates_changed_ = true;
+}
+
+void VP8PartitionEncoder::FlushTask(void* /*context*/) {
+}
+
+void VP8PartitionEncoder::Flush() {
+    dispatch_sync_f(queue_, this, FlushTask);
+}
+
+VP8EncoderStatistics VP8PartitionEncoder::GetStatistics() {
+    webrtc::CriticalSectionScoped cs(stats_crit_.get());
+    return stats_;
+}
+
+void VP8PartitionEncoder::EncodeTask(void* context) {
+    static_cast<VP8PartitionEncoder*>(context)->EncodePending();
+}
+
+void VP8PartitionEncoder::EncodePending() {
+    PendingFrame frame;
+    bool rates_changed;
+    int bitrate_kbps;
+    int framerate;
+    EncodeScheduler* scheduler;
+    int stream;
+    {
+        webrtc::CriticalSectionScoped cs(crit_.get());
+        if (!has_pending_) {
+            return;
+        }
+        scheduler = scheduler_;
+        stream = scheduler_stream_;
+        frame.buffer = pending_.buffer;
+        pending_.buffer = NULL;
+        frame.capture_time_ms = pending_.capture_time_ms;
+        frame.key_frame = pending_.key_frame;
+        has_pending_ = false;
+        rates_changed = rates_changed_;
+        rates_changed_ = false;
+        bitrate_kbps = bitrate_kbps_;
+        framerate = framerate_;
+    }
+    if (!inited_) {
+        //ScheduleFrame counted it in flight.
+        if (scheduler) {
+            scheduler->OnFrameDropped(stream);
+        }
+        return;
+    }
+    if (rates_changed) {
+        config_->rc_target_bitrate = bitrate_kbps;
+        vpx_codec_enc_config_set(encoder_, config_);
+        settings_.max_framerate = framerate;
+    }
+    Encode(frame);
+}
+
+void VP8PartitionEncoder::Encode(const PendingFrame& frame) {
+    EncodeScheduler* scheduler;
+    int stream;
+    {
+        webrtc::CriticalSectionScoped cs(crit_.get());
+        scheduler = scheduler_;
+        stream = scheduler_stream_;
+    }
+    const I420Buffer* buffer = frame.buffer.get();
+    if (buffer == NULL) {
+        return;
+    }
+    if (buffer->width() != settings_.width ||
+        buffer->height() != settings_.height) {
+        //The resolution changed upstream, e.g. by the EncodeScheduler.
+        //libvpx starts again with a key frame.
+        VP8EncoderSettings settings = settings_;
+        settings.width = buffer->width();
+        settings.height = buffer->height();
+        settings.start_bitrate_kbps = config_->rc_target_bitrate;
+        if (!InitEncoder(settings)) {
+            if (scheduler) {
+                scheduler->OnFrameDropped(stream);
+            }
+            webrtc::CriticalSectionScoped cs(stats_crit_.get());
+            stats_.frames_dropped++;
+            return;
+        }
+    }
+    //libvpx only reads the planes.
+    raw_->planes[VPX_PLANE_Y] = const_cast<uint8_t*>(buffer->data(webrtc::kYPlane));
+    raw_->planes[VPX_PLANE_U] = const_cast<uint8_t*>(buffer->data(webrtc::kUPlane));
+    raw_->planes[VPX_PLANE_V] = const_cast<uint8_t*>(buffer->data(webrtc::kVPlane));
+    raw_->stride[VPX_PLANE_Y] = buffer->stride(webrtc::kYPlane);
+    raw_->stride[VPX_PLANE_U] = buffer->stride(webrtc::kUPlane);
+    raw_->stride[VPX_PLANE_V] = buffer->stride(webrtc::kVPlane);
+
+    uint32_t timestamp =
+        static_cast<uint32_t>(frame.capture_time_ms * kRtpClockRateKhz);
+    vpx_codec_pts_t pts = frame.capture_time_ms * kRtpClockRateKhz;
+    unsigned long duration = kRtpClockRateKhz * 1000 / settings_.max_framerate;
+    vpx_enc_frame_flags_t flags = frame.key_frame ? VPX_EFLAG_FORCE_KF : 0;
+
+    int64_t start_us = webrtc::TickTime::MicrosecondTimestamp();
+    if (scheduler) {
+        scheduler->OnEncodeStarted(stream, frame.capture_time_ms,
+                                   start_us / 1000);
+    }
+    if (vpx_codec_encode(encoder_, raw_, pts, duration, flags,
+                         VPX_DL_REALTIME)) {
+        if (scheduler) {
+            scheduler->OnFrameDropped(stream);
+        }
+        webrtc::CriticalSectionScoped cs(stats_crit_.get());
+        stats_.frames_dropped++;
+        return;
+    }
+
+    //Partitions come out in order, the last one without the fragment flag.
+    bool first_packet = true;
+    bool key_frame = false;
+    vpx_codec_iter_t iter = NULL;
+    const vpx_codec_cx_pkt_t* pkt;
+    while ((pkt = vpx_codec_get_cx_data(encoder_, &iter)) != NULL) {
+        if (pkt->kind != VPX_CODEC_CX_FRAME_PKT) {
+            continue;
+        }
+        key_frame = (pkt->data.frame.flags & VPX_FRAME_IS_KEY) != 0;
+        bool last = (pkt->data.frame.flags & VPX_FRAME_IS_FRAGMENT) == 0;
+        Packetize(static_cast<const uint8_t*>(pkt->data.frame.buf),
+                  pkt->data.frame.sz, pkt->data.frame.partition_id, last,
+                  key_frame, timestamp, frame.capture_time_ms, &first_packet);
+        if (last) {
+            break;
+        }
+    }
+    int64_t end_us = webrtc::TickTime::MicrosecondTimestamp();
+    if (scheduler) {
+        scheduler->OnFrameEncoded(stream, static_cast<int>(end_us - start_us),
+                                  key_frame, end_us / 1000);
+    }
+    int64_t encode_time_ms = (end_us - start_us) / 1000;
+
+    webrtc::CriticalSectionScoped cs(stats_crit_.get());
+    if (first_packet) {
+        //Dropped by the rate control.
+        stats_.frames_dropped++;
+        return;
+    }
+    picture_id_ = (picture_id_ + 1) & 0x7FFF;
+    stats_.frames_encoded++;
+    stats_.sum_encode_time_ms += encode_time_ms;
+    if (key_frame) {
+        stats_.key_frames++;
+    }
+}
+
+void VP8PartitionEncoder::Packetize(const uint8_t* data, size_t length,
+                                    int partition, bool last_partition,
+                                    bool key_frame, uint32_t timestamp,
+                                    int64_t capture_time_ms,
+                                    bool* first_packet) {
+    if (length == 0) {
+        return;
+    }
+    //Equal sized packets, each from a single partition, as the strict mode
+    //of RtpPacketizerVp8 but without aggregating across partitions.
+    size_t max_data = settings_.max_payload_size - kPayloadDescriptorSize;
+    size_t num_packets = (length + max_data - 1) / max_data;
+    size_t packet_size = length / num_packets;
+    size_t remainder = length % num_packets;
+
+    uint8_t* payload = packet_buffer_.get();
+    VP8Packet packet;
+    packet.payload = payload;
+    packet.timestamp = timestamp;
+    packet.key_frame = key_frame;
+    packet.partition = partition;
+    packet.capture_time_ms = capture_time_ms;
+
+    size_t offset = 0;
+    for (size_t i = 0; i < num_packets; i++) {
+        size_t size = packet_size + (i < remainder ? 1 : 0);
+        //X, S on the first packet of the partition, partition index. With
+        //eight token partitions the last index does not fit in the 3 bit
+        //field and is sent as 7, receivers find partitions by the S bit.
+        payload[0] = 0x80 | (i == 0 ? 0x10 : 0x00) | std::min(partition, 7);
+        payload[1] = 0x80;
+        payload[2] = 0x80 | static_cast<uint8_t>(picture_id_ >> 8);
+        payload[3] = static_cast<uint8_t>(picture_id_);
+        memcpy(payload + kPayloadDescriptorSize, data + offset, size);
+        offset += size;
+        packet.payload_length = kPayloadDescriptorSize + size;
+        packet.marker_bit = last_partition && i == num_packets - 1;
+
+        if (*first_packet) {
+            *first_packet = false;
+            int latency = static_cast<int>(
+                webrtc::TickTime::MillisecondTimestamp() - capture_time_ms);
+            webrtc::CriticalSectionScoped cs(stats_crit_.get());
+            stats_.last_capture_to_first_packet_ms = latency;
+            stats_.max_capture_to_first_packet_ms =
+                std::max(stats_.max_capture_to_first_packet_ms, latency);
+            stats_.sum_capture_to_first_packet_ms += latency;
+        }
+        sink_->OnVP8Packet(packet);
+    }
+    webrtc::CriticalSectionScoped cs(stats_crit_.get());
+    stats_.packets += num_packets;
+}
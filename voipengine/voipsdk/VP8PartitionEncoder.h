@@ -0,0 +1,178 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#ifndef VOIP_VP8_PARTITION_ENCODER_H
+#define VOIP_VP8_PARTITION_ENCODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <dispatch/dispatch.h>
+#include "webrtc/system_wrappers/interface/critical_section_wrapper.h"
+#include "webrtc/system_wrappers/interface/scoped_ptr.h"
+#include "EncodeScheduler.h"
+#include "I420BufferPool.h"
+
+typedef struct vpx_codec_ctx vpx_codec_ctx_t;
+typedef struct vpx_codec_enc_cfg vpx_codec_enc_cfg_t;
+typedef struct vpx_image vpx_image_t;
+
+struct VP8EncoderSettings {
+    int width;
+    int height;
+    int start_bitrate_kbps;
+    int max_framerate;
+    //Encoder threads, 0 for one per core.
+    int threads;
+    //Bytes of VP8 payload descriptor and data per packet.
+    size_t max_payload_size;
+};
+
+//One RTP payload, the VP8 payload descriptor followed by partition data.
+struct VP8Packet {
+    const uint8_t* payload;
+    size_t payload_length;
+    //90 kHz, from the capture time.
+    uint32_t timestamp;
+    //Last packet of the frame.
+    bool marker_bit;
+    bool key_frame;
+    int partition;
+    int64_t capture_time_ms;
+};
+
+struct VP8EncoderStatistics {
+    uint64_t frames_encoded;
+    //Dropped by the rate control or replaced while waiting for the encoder.
+    uint64_t frames_dropped;
+    //Skipped by the EncodeScheduler before queueing.
+    uint64_t frames_skipped;
+    uint64_t key_frames;
+    uint64_t packets;
+    int threads;
+    int token_partitions;
+    //From EncodeFrame to the first packet of the frame.
+    int last_capture_to_first_packet_ms;
+    int max_capture_to_first_packet_ms;
+    int64_t sum_capture_to_first_packet_ms;
+    int64_t sum_encode_time_ms;
+};
+
+//VP8 encoder that packetizes each partition as it comes out of libvpx.
+//
+//webrtc::VP8EncoderImpl picks the thread count from the cores and the
+//resolution only, copies the partitions of the whole frame into one
+//EncodedImage, and RtpPacketizerVp8 runs Vp8PartitionAggregator over the
+//complete frame before the first packet exists. Here the encoder runs one
+//thread and one token partition per core (up to 8), so libvpx writes the
+//token partitions in parallel. vpx_codec_encode still returns only once
+//every partition is written. What goes is the EncodedImage copy and the
+//aggregation pass: the partitions are read in place through
+//VPX_CODEC_USE_OUTPUT_PARTITION, split into equal sized packets and handed
+//to the sink one by one, so the first packet leaves as soon as libvpx
+//returns.
+//
+//EncodeFrame only queues the shared buffer. Encoding runs on a serial
+//queue, so the capture thread never waits for libvpx and the sink, usually
+//the pacer, sends the last frame while the next one is encoded. A frame
+//still waiting when the next arrives is replaced. With an EncodeScheduler
+//frames are skipped or scaled before they are queued, and the encoder
+//follows resolution changes with a key frame.
+//
+//Thread safe.
+class VP8PartitionEncoder {
+public:
+    class PacketSink {
+    public:
+        //Called on the encoder queue, |packet| is only valid during the call.
+        virtual void OnVP8Packet(const VP8Packet& packet) = 0;
+    protected:
+        virtual ~PacketSink() {}
+    };
+
+    enum { kMaxThreads = 8 };
+    //RTP timestamps of video count a 90 kHz clock.
+    enum { kRtpClockRateKhz = 90 };
+    enum { kDefaultMaxPayloadSize = 1200 };
+    //X, I and a 15 bit picture id.
+    enum { kPayloadDescriptorSize = 4 };
+
+    explicit VP8PartitionEncoder(PacketSink* sink);
+    ~VP8PartitionEncoder();
+
+    //Returns false if libvpx refused the settings.
+    bool Init(const VP8EncoderSettings& settings);
+    void Release();
+
+    //Frames go through |scheduler| as |stream|, NULL to encode every frame.
+    void SetEncodeScheduler(EncodeScheduler* scheduler, int stream);
+
+    //|capture_time_ms| is on the TickTime clock.
+    void EncodeFrame(const webrtc::scoped_refptr<I420Buffer>& frame,
+                     int64_t capture_time_ms, bool key_frame);
+
+    void SetRates(int bitrate_kbps, int framerate);
+
+    //Waits until the queued frame is encoded.
+    void Flush();
+
+    VP8EncoderStatistics GetStatistics();
+
+    //Threads for |settings|, used by Init.
+    static int NumberOfThreads(const VP8EncoderSettings& settings, int cores);
+
+private:
+    struct PendingFrame {
+        webrtc::scoped_refptr<I420Buffer> buffer;
+        int64_t capture_time_ms;
+        bool key_frame;
+    };
+
+    static void InitTask(void* context);
+    static void ReleaseTask(void* context);
+    static void EncodeTask(void* context);
+    static void FlushTask(void* context);
+    //On the encoder queue.
+    bool InitEncoder(const VP8EncoderSettings& settings);
+    void ReleaseEncoder();
+    void EncodePending();
+    void Encode(const PendingFrame& frame);
+    void Packetize(const uint8_t* data, size_t length, int partition,
+                   bool last_partition, bool key_frame, uint32_t timestamp,
+                   int64_t capture_time_ms, bool* first_packet);
+
+    PacketSink* sink_;
+    dispatch_queue_t queue_;
+
+    //Guards pending_, the rate settings and the scheduler.
+    webrtc::scoped_ptr<webrtc::CriticalSectionWrapper> crit_;
+    PendingFrame pending_;
+    bool has_pending_;
+    bool rates_changed_;
+    int bitrate_kbps_;
+    int framerate_;
+    EncodeScheduler* scheduler_;
+    int scheduler_stream_;
+    bool skipped_key_frame_;
+
+    //Encoder queue only.
+    vpx_codec_ctx_t* encoder_;
+    vpx_codec_enc_cfg_t* config_;
+    vpx_image_t* raw_;
+    VP8EncoderSettings settings_;
+    uint16_t picture_id_;
+    bool inited_;
+    webrtc::scoped_ptr<uint8_t[]> packet_buffer_;
+
+    webrtc::scoped_ptr<webrtc::CriticalSectionWrapper> stats_crit_;
+    VP8EncoderStatistics stats_;
+
+    VP8PartitionEncoder(const VP8PartitionEncoder&);
+    VP8PartitionEncoder& operator=(const VP8PartitionEncoder&);
+};
+
+#endif
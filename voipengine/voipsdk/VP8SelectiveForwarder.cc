@@ -0,0 +1,556 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include "VP8SelectiveForwarder.h"
+
+#include <string.h>
+#include <algorithm>
+
+//Layers are added while their cumulative rate stays below this share of
+//the receiver's estimate.
+static const int kLayerBitratePercent = 90;
+
+static inline bool IsNewerSequenceNumber(uint16_t a, uint16_t b) {
+    return a != b && static_cast<uint16_t>(a - b) < 0x8000;
+}
+
+static inline bool IsNewerTimestamp(uint32_t a, uint32_t b) {
+    return a != b && a - b < 0x80000000;
+}
+
+int ParseVP8PayloadDescriptor(const uint8_t* payload, size_t length,
+                              webrtc::RTPVideoHeaderVP8* header) {
+    header->InitRTPVideoHeaderVP8();
+    if (length < 1) {
+        return -1;
+    }
+    const uint8_t* p = payload;
+    const uint8_t* end = payload + length;
+    header->nonReference = (*p & 0x20) != 0;
+    header->beginningOfPartition = (*p & 0x10) != 0;
+    header->partitionId = *p & 0x0F;
+    bool extension = (*p & 0x80) != 0;
+    p++;
+    if (extension) {
+        if (p >= end) {
+            return -1;
+        }
+        bool has_picture_id = (*p & 0x80) != 0;
+        bool has_tl0_pic_idx = (*p & 0x40) != 0;
+        bool has_tid = (*p & 0x20) != 0;
+        bool has_key_idx = (*p & 0x10) != 0;
+        p++;
+        if (has_picture_id) {
+            if (p >= end) {
+                return -1;
+            }
+            if (*p & 0x80) {
+                if (p + 1 >= end) {
+                    return -1;
+                }
+                header->pictureId = ((p[0] & 0x7F) << 8) | p[1];
+                p += 2;
+            } else {
+                header->pictureId = p[0] & 0x7F;
+                p++;
+            }
+        }
+        if (has_tl0_pic_idx) {
+            if (p >= end) {
+                return -1;
+            }
+            header->tl0PicIdx = *p++;
+        }
+        if (has_tid || has_key_idx) {
+            if (p >= end) {
+                return -1;
+            }
+            if (has_tid) {
+                header->temporalIdx = (*p >> 6) & 0x03;
+                header->layerSync = (*p & 0x20) != 0;
+            }
+            if (has_key_idx) {
+                header->keyIdx = *p & 0x1F;
+            }
+            p++;
+        }
+    }
+    if (p >= end) {
+        return -1;
+    }
+    return static_cast<int>(p - payload);
+}
+
+VP8SelectiveForwarder::VP8SelectiveForwarder(Sender* sender)
+: sender_(sender),
+  crit_(webrtc::CriticalSectionWrapper::CreateCriticalSection()),
+  num_receivers_(0),
+  num_layers_(1),
+  key_frame_request_(false),
+  window_start_ms_(-1),
+  has_rates_(false) {
+    memset(receivers_, 0, sizeof(receivers_));
+    memset(window_bytes_, 0, sizeof(window_bytes_));
+    memset(&stats_, 0, sizeof(stats_));
+}
+
+VP8SelectiveForwarder::Receiver* VP8SelectiveForwarder::FindReceiver(
+    int receiver) {
+    for (int i = 0; i < num_receivers_; i++) {
+        if (receivers_[i].id == receiver) {
+            return &receivers_[i];
+        }
+    }
+    return NULL;
+}
+
+bool VP8SelectiveForwarder::AddReceiver(int receiver) {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    if (FindReceiver(receiver) || num_receivers_ == kMaxReceivers) {
+        return false;
+    }
+    Receiver* r = &receivers_[num_receivers_++];
+    memset(r, 0, sizeof(*r));
+    r->id = receiver;
+    r->layer = webrtc::kMaxTemporalStreams - 1;
+    r->waiting_for_key_frame = true;
+    key_frame_request_ = true;
+    return true;
+}
+
+void VP8SelectiveForwarder::RemoveReceiver(int receiver) {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    Receiver* r = FindReceiver(receiver);
+    if (r) {
+        *r = receivers_[--num_receivers_];
+    }
+}
+
+void VP8SelectiveForwarder::SetReceiverBitrate(int receiver,
+                                               uint32_t bitrate_bps) {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    Receiver* r = FindReceiver(receiver);
+    if (r) {
+        r->bitrate_bps = bitrate_bps;
+    }
+}
+
+int VP8SelectiveForwarder::ReceiverLayer(int receiver) {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    Receiver* r = FindReceiver(receiver);
+    if (r == NULL) {
+        return -1;
+    }
+    return std::min(r->layer, num_layers_ - 1);
+}
+
+int VP8SelectiveForwarder::TranslateNack(int receiver,
+                                         const uint16_t* sequence_numbers,
+                                         int count,
+                                         uint16_t* source_sequence_numbers) {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    Receiver* r = FindReceiver(receiver);
+    if (r == NULL) {
+        return 0;
+    }
+    int translated = 0;
+    for (int i = 0; i < count; i++) {
+        //Lost before the forwarder, it has the offset of the forwarded
+        //packet below it. A gap across a cut was mapped by MapCutGap.
+        for (int back = 0; back < kSequenceHistory; back++) {
+            uint16_t output = sequence_numbers[i] - back;
+            const SequenceMapping& m = r->to_source[output & (kSequenceHistory - 1)];
+            if (m.used && m.from == output) {
+                source_sequence_numbers[translated++] = m.to + back;
+                break;
+            }
+        }
+    }
+    return translated;
+}
+
+bool VP8SelectiveForwarder::TakeKeyFrameRequest() {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    bool request = key_frame_request_;
+    key_frame_request_ = false;
+    return request;
+}
+
+VP8ForwarderStatistics VP8SelectiveForwarder::GetStatistics() {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    return stats_;
+}
+
+void VP8SelectiveForwarder::UpdateRates(int temporal_idx, size_t length,
+                                        int64_t now_ms) {
+    if (window_start_ms_ < 0) {
+        window_start_ms_ = now_ms;
+    }
+    int64_t elapsed_ms = now_ms - window_start_ms_;
+    if (elapsed_ms >= kRateWindowMs) {
+        for (int i = 0; i < webrtc::kMaxTemporalStreams; i++) {
+            stats_.layer_bitrate_bps[i] =
+                static_cast<uint32_t>(window_bytes_[i] * 8000LL / elapsed_ms);
+            window_bytes_[i] = 0;
+        }
+        window_start_ms_ = now_ms;
+        has_rates_ = true;
+    }
+    window_bytes_[temporal_idx] += static_cast<uint32_t>(length);
+}
+
+int VP8SelectiveForwarder::LayerForBitrate(uint32_t bitrate_bps) const {
+    //Everything until the first window or the first estimate.
+    if (!has_rates_ || bitrate_bps == 0) {
+        return num_layers_ - 1;
+    }
+    uint64_t budget = static_cast<uint64_t>(bitrate_bps) *
+                      kLayerBitratePercent / 100;
+    uint64_t cumulative = stats_.layer_bitrate_bps[0];
+    int layer = 0;
+    while (layer + 1 < num_layers_ &&
+           cumulative + stats_.layer_bitrate_bps[layer + 1] <= budget) {
+        layer++;
+        cumulative += stats_.layer_bitrate_bps[layer];
+    }
+    return layer;
+}
+
+bool VP8SelectiveForwarder::StartFrame(Receiver* receiver, int temporal_idx,
+                                       bool layer_sync, bool key_frame) {
+    if (receiver->waiting_for_key_frame) {
+        if (!key_frame) {
+            return false;
+        }
+        receiver->waiting_for_key_frame = false;
+    }
+    int target = LayerForBitrate(receiver->bitrate_bps);
+    if (key_frame) {
+        receiver->layer = target;
+    } else if (target < receiver->layer) {
+        //Frames of the upper layers are never referenced by the lower ones.
+        receiver->layer = target;
+    } else if (temporal_idx == receiver->layer + 1 && temporal_idx <= target &&
+               layer_sync) {
+        //A sync frame only references the base layer, but the frames after
+        //it also reference the layers in between, which the receiver has
+        //to get already.
+        receiver->layer = temporal_idx;
+    }
+    return temporal_idx <= receiver->layer;
+}
+
+VP8SelectiveForwarder::FrameDecision* VP8SelectiveForwarder::DecideFrame(
+    Receiver* receiver, uint32_t timestamp, const webrtc::RTPVideoHeaderVP8& vp8,
+    int temporal_idx, bool frame_start, bool key_frame) {
+    //The newest frame first, it has nearly every packet.
+    for (int i = 1; i <= kFrameHistory; i++) {
+        FrameDecision* frame =
+            &receiver->frames[(receiver->next_frame + kFrameHistory - i) %
+                              kFrameHistory];
+        if (frame->used && frame->timestamp == timestamp) {
+            return frame;
+        }
+    }
+    bool forward;
+    if (!receiver->has_frames ||
+        IsNewerTimestamp(timestamp, receiver->newest_timestamp)) {
+        if (receiver->waiting_for_key_frame && !frame_start) {
+            //Only the first packet tells a key frame, left undecided.
+            key_frame_request_ = true;
+            return NULL;
+        }
+        forward = StartFrame(receiver, temporal_idx, vp8.layerSync, key_frame);
+        if (receiver->waiting_for_key_frame) {
+            key_frame_request_ = true;
+        }
+        receiver->newest_timestamp = timestamp;
+        receiver->has_frames = true;
+    } else {
+        //An older frame whose first packet came late, the layers are not
+        //switched for it.
+        forward = !receiver->waiting_for_key_frame &&
+                  temporal_idx <= receiver->layer;
+    }
+    FrameDecision* frame = &receiver->frames[receiver->next_frame];
+    receiver->next_frame = (receiver->next_frame + 1) % kFrameHistory;
+    memset(frame, 0, sizeof(*frame));
+    frame->used = true;
+    frame->forward = forward;
+    frame->timestamp = timestamp;
+    frame->picture_id = vp8.pictureId;
+    frame->tl0_pic_idx = vp8.tl0PicIdx;
+    frame->temporal_idx = temporal_idx;
+    return frame;
+}
+
+bool VP8SelectiveForwarder::FindDroppedRun(const Receiver& receiver,
+                                           const FrameDecision& frame,
+                                           uint16_t sequence_number,
+                                           bool frame_start, uint16_t* begin,
+                                           uint16_t* end) const {
+    //Frames between the last forwarded one and |frame|, the first and the
+    //last of them when the picture IDs tell.
+    const FrameDecision* first = NULL;
+    const FrameDecision* last = NULL;
+    bool only_dropped = false;
+    bool adjacent = false;
+    if (frame.picture_id != webrtc::kNoPictureId &&
+        receiver.last_picture_id != webrtc::kNoPictureId) {
+        //7 or 15 bit picture IDs.
+        int mask = frame.picture_id > 0x7F || receiver.last_picture_id > 0x7F ?
+                   0x7FFF : 0x7F;
+        int distance = (frame.picture_id - receiver.last_picture_id) & mask;
+        int dropped = 0;
+        for (int i = 0; i < kFrameHistory; i++) {
+            const FrameDecision& f = receiver.frames[i];
+            if (!f.used || f.forward || f.picture_id == webrtc::kNoPictureId) {
+                continue;
+            }
+            int d = (f.picture_id - receiver.last_picture_id) & mask;
+            if (d > 0 && d < distance) {
+                dropped++;
+                if (d == 1) {
+                    first = &f;
+                }
+                if (d == distance - 1) {
+                    last = &f;
+                }
+            }
+        }
+        only_dropped = distance > 0 && dropped == distance - 1;
+        adjacent = distance == 1;
+    }
+    //Receiving the base layer only, a lost frame between two consecutive
+    //TL0PICIDX was of a dropped layer.
+    if (!only_dropped && receiver.layer == 0 && frame.temporal_idx == 0 &&
+        receiver.last_temporal_idx == 0 &&
+        frame.tl0_pic_idx != webrtc::kNoTl0PicIdx &&
+        receiver.last_tl0_pic_idx != webrtc::kNoTl0PicIdx) {
+        only_dropped =
+            ((frame.tl0_pic_idx - receiver.last_tl0_pic_idx) & 0xFF) == 1;
+    }
+    if (!only_dropped) {
+        return false;
+    }
+    if (adjacent) {
+        *begin = receiver.last_sequence_number + 1;
+        *end = receiver.last_sequence_number;
+        return true;
+    }
+    if (receiver.last_marker) {
+        *begin = receiver.last_sequence_number + 1;
+    } else if (first && first->has_first) {
+        *begin = first->first_sequence_number;
+    } else {
+        return false;
+    }
+    if (frame_start) {
+        *end = sequence_number - 1;
+    } else if (last && last->has_last) {
+        *end = last->last_sequence_number;
+    } else {
+        return false;
+    }
+    //Within the gap, in order.
+    uint16_t gap = sequence_number - receiver.last_sequence_number - 1;
+    uint16_t run = *end - *begin + 1;
+    return static_cast<uint16_t>(*begin - receiver.last_sequence_number - 1) +
+           run <= gap;
+}
+
+//|kept| is set to the lost packets right after the last forwarded one that
+//keep its offset when a run of dropped frames is cut out after them, -1
+//if there is no cut.
+uint16_t VP8SelectiveForwarder::FrameOffset(const Receiver& receiver,
+                                            const FrameDecision& frame,
+                                            uint16_t sequence_number,
+                                            bool frame_start, int* kept) const {
+    *kept = -1;
+    if (!receiver.has_forwarded) {
+        return 0;
+    }
+    if (IsNewerSequenceNumber(sequence_number, receiver.last_sequence_number)) {
+        //Everything between was seen and dropped.
+        uint16_t gap = sequence_number - receiver.last_sequence_number - 1;
+        if (gap == receiver.dropped_since_forwarded) {
+            return sequence_number - receiver.last_output - 1;
+        }
+        //Otherwise the run of dropped frames is cut out when its ends are
+        //known, with their lost packets, which the receiver must not NACK.
+        //Lost packets of the forwarded frames keep their gap.
+        uint16_t begin;
+        uint16_t end;
+        if (FindDroppedRun(receiver, frame, sequence_number, frame_start,
+                           &begin, &end)) {
+            *kept = static_cast<uint16_t>(begin - receiver.last_sequence_number -
+                                          1);
+            return receiver.sequence_number_offset +
+                   static_cast<uint16_t>(end - begin + 1);
+        }
+        return receiver.sequence_number_offset;
+    }
+    //A late frame, the offset did not change up to the next forwarded one.
+    const FrameDecision* next = NULL;
+    for (int i = 0; i < kFrameHistory; i++) {
+        const FrameDecision& f = receiver.frames[i];
+        if (f.used && f.has_offset &&
+            IsNewerTimestamp(f.timestamp, frame.timestamp) &&
+            (next == NULL || IsNewerTimestamp(next->timestamp, f.timestamp))) {
+            next = &f;
+        }
+    }
+    return next ? next->sequence_number_offset :
+                  receiver.sequence_number_offset;
+}
+
+void VP8SelectiveForwarder::MapCutGap(Receiver* receiver,
+                                      uint16_t sequence_number, uint16_t out,
+                                      int kept) {
+    //Lost packets on either side of the cut, the first |kept| with the
+    //offset before it and the others with the new one. TranslateNack could
+    //not tell them apart from the packets around the gap.
+    uint16_t gap = out - receiver->last_output - 1;
+    for (int k = 1; k <= gap; k++) {
+        uint16_t output = receiver->last_output + k;
+        SequenceMapping& m = receiver->to_source[output & (kSequenceHistory - 1)];
+        m.used = true;
+        m.from = output;
+        m.to = k <= kept ? receiver->last_sequence_number + k :
+                           sequence_number - (out - output);
+    }
+}
+
+void VP8SelectiveForwarder::DropPacket(Receiver* receiver,
+                                       uint16_t sequence_number) {
+    receiver->to_output[sequence_number & (kSequenceHistory - 1)].used = false;
+    if (receiver->has_forwarded &&
+        IsNewerSequenceNumber(sequence_number, receiver->last_sequence_number)) {
+        receiver->dropped_since_forwarded++;
+    }
+    stats_.packets_dropped++;
+}
+
+bool VP8SelectiveForwarder::IncomingPacket(const uint8_t* packet,
+                                           size_t length, int64_t now_ms) {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    stats_.packets++;
+
+    RtpPacketExtensions header;
+    if (length > kMaxPacketSize ||
+        !header.Parse(extension_map_, packet, length)) {
+        stats_.parse_errors++;
+        return false;
+    }
+    size_t payload_length = length - header.header_length();
+    if (packet[0] & 0x20) {
+        //Padding, the last byte holds its size.
+        size_t padding = packet[length - 1];
+        if (padding > payload_length) {
+            stats_.parse_errors++;
+            return false;
+        }
+        payload_length -= padding;
+    }
+    uint16_t sequence_number = (packet[2] << 8) | packet[3];
+    if (payload_length == 0) {
+        //Padding only, the receivers do not need it.
+        for (int i = 0; i < num_receivers_; i++) {
+            DropPacket(&receivers_[i], sequence_number);
+        }
+        return true;
+    }
+    const uint8_t* payload = packet + header.header_length();
+    webrtc::RTPVideoHeaderVP8 vp8;
+    int descriptor_length = ParseVP8PayloadDescriptor(payload, payload_length,
+                                                      &vp8);
+    if (descriptor_length < 0) {
+        stats_.parse_errors++;
+        return false;
+    }
+    int temporal_idx = vp8.temporalIdx == webrtc::kNoTemporalIdx ?
+                       0 : vp8.temporalIdx;
+    if (temporal_idx + 1 > num_layers_) {
+        num_layers_ = temporal_idx + 1;
+    }
+    UpdateRates(temporal_idx, length, now_ms);
+
+    uint32_t timestamp = (packet[4] << 24) | (packet[5] << 16) |
+                         (packet[6] << 8) | packet[7];
+    bool marker = (packet[1] & 0x80) != 0;
+    bool frame_start = vp8.beginningOfPartition && vp8.partitionId == 0;
+    //The inverted P bit of the VP8 frame header.
+    bool key_frame = frame_start && (payload[descriptor_length] & 0x01) == 0;
+
+    bool copied = false;
+    for (int i = 0; i < num_receivers_; i++) {
+        Receiver* r = &receivers_[i];
+        uint16_t out;
+        const SequenceMapping& mapped =
+            r->to_output[sequence_number & (kSequenceHistory - 1)];
+        if (mapped.used && mapped.from == sequence_number) {
+            //A retransmission, sent as the first time.
+            out = mapped.to;
+        } else {
+            FrameDecision* frame = DecideFrame(r, timestamp, vp8, temporal_idx,
+                                               frame_start, key_frame);
+            if (frame == NULL || !frame->forward) {
+                if (frame && frame_start) {
+                    frame->has_first = true;
+                    frame->first_sequence_number = sequence_number;
+                }
+                if (frame && marker) {
+                    frame->has_last = true;
+                    frame->last_sequence_number = sequence_number;
+                }
+                DropPacket(r, sequence_number);
+                continue;
+            }
+            int kept = -1;
+            if (!frame->has_offset) {
+                frame->sequence_number_offset =
+                    FrameOffset(*r, *frame, sequence_number, frame_start, &kept);
+                frame->has_offset = true;
+            }
+            out = sequence_number - frame->sequence_number_offset;
+            if (kept >= 0) {
+                MapCutGap(r, sequence_number, out, kept);
+            }
+            SequenceMapping& to_output =
+                r->to_output[sequence_number & (kSequenceHistory - 1)];
+            to_output.used = true;
+            to_output.from = sequence_number;
+            to_output.to = out;
+            SequenceMapping& to_source = r->to_source[out & (kSequenceHistory - 1)];
+            to_source.used = true;
+            to_source.from = out;
+            to_source.to = sequence_number;
+            if (!r->has_forwarded ||
+                IsNewerSequenceNumber(sequence_number, r->last_sequence_number)) {
+                r->has_forwarded = true;
+                r->last_sequence_number = sequence_number;
+                r->last_output = out;
+                r->last_marker = marker;
+                r->last_picture_id = frame->picture_id;
+                r->last_tl0_pic_idx = frame->tl0_pic_idx;
+                r->last_temporal_idx = frame->temporal_idx;
+                r->sequence_number_offset = frame->sequence_number_offset;
+                r->dropped_since_forwarded = 0;
+            }
+        }
+        if (!copied) {
+            memcpy(buffer_, packet, length);
+            copied = true;
+        }
+        buffer_[2] = static_cast<uint8_t>(out >> 8);
+        buffer_[3] = static_cast<uint8_t>(out);
+        stats_.packets_forwarded++;
+        sender_->ForwardPacket(r->id, buffer_, length);
+    }
+    return true;
+}
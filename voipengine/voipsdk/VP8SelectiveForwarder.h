@@ -0,0 +1,194 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#ifndef VOIP_VP8_SELECTIVE_FORWARDER_H
+#define VOIP_VP8_SELECTIVE_FORWARDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "webrtc/common_types.h"
+#include "webrtc/modules/interface/module_common_types.h"
+#include "webrtc/system_wrappers/interface/critical_section_wrapper.h"
+#include "webrtc/system_wrappers/interface/scoped_ptr.h"
+#include "RtpHeaderExtensions.h"
+
+//Fills |header| like webrtc::RtpDepacketizerVp8 from the VP8 payload
+//descriptor at the start of |payload|. Returns the descriptor length, or
+//-1 if it is malformed or no data follows.
+int ParseVP8PayloadDescriptor(const uint8_t* payload, size_t length,
+                              webrtc::RTPVideoHeaderVP8* header);
+
+struct VP8ForwarderStatistics {
+    uint64_t packets;
+    uint64_t parse_errors;
+    //Summed over the receivers.
+    uint64_t packets_forwarded;
+    uint64_t packets_dropped;
+    //Over the last rate window, per temporal layer.
+    uint32_t layer_bitrate_bps[webrtc::kMaxTemporalStreams];
+};
+
+//Forwards one VP8 stream with temporal layers to several receivers, each
+//getting as many layers as its REMB allows, without transcoding.
+//
+//Each packet's RTP header and VP8 payload descriptor are parsed once, as
+//RtpDepacketizerVp8 would, and the TID decides per receiver whether the
+//frame is sent. The decision is made once per RTP timestamp and kept, so
+//reordered and retransmitted packets of a frame follow it. Frames are
+//dropped whole. When the picture IDs, the TL0PICIDX or the packets seen
+//show that only dropped frames lie between two forwarded ones, and both
+//ends of that run are known, its sequence numbers are cut out of the
+//receiver's stream, so it does not NACK the dropped layers, even their
+//lost packets. Every forwarded packet is mapped in a ring, which gives
+//retransmissions their first sequence number and translates the
+//receiver's NACKs back. A receiver drops to fewer layers at once, moves up
+//one layer at a sync frame of that layer or to any at a key frame, and
+//starts with a key frame, requested through TakeKeyFrameRequest.
+//
+//Thread safe.
+class VP8SelectiveForwarder {
+public:
+    class Sender {
+    public:
+        //|packet| is only valid during the call.
+        virtual void ForwardPacket(int receiver, const uint8_t* packet,
+                                   size_t length) = 0;
+    protected:
+        virtual ~Sender() {}
+    };
+
+    enum { kMaxReceivers = 32 };
+    enum { kMaxPacketSize = 1500 };
+    enum { kRateWindowMs = 1000 };
+    //Power of two, the forwarded packets a NACK can still refer to.
+    enum { kSequenceHistory = 512 };
+    //Frames whose decision is kept.
+    enum { kFrameHistory = 32 };
+
+    explicit VP8SelectiveForwarder(Sender* sender);
+
+    //Returns false if |receiver| exists or there are too many.
+    bool AddReceiver(int receiver);
+    void RemoveReceiver(int receiver);
+
+    //Estimated bitrate of the receiver, from its REMB.
+    void SetReceiverBitrate(int receiver, uint32_t bitrate_bps);
+
+    //Returns false for a packet that is not RTP with a VP8 payload.
+    bool IncomingPacket(const uint8_t* packet, size_t length, int64_t now_ms);
+
+    //Highest temporal layer |receiver| gets, -1 if unknown.
+    int ReceiverLayer(int receiver);
+
+    //Maps the sequence numbers of a NACK from |receiver| to those of the
+    //incoming stream, also of packets lost before the forwarder, leaving
+    //out the ones older than kSequenceHistory. Returns the count written
+    //to |source_sequence_numbers|.
+    int TranslateNack(int receiver, const uint16_t* sequence_numbers, int count,
+                      uint16_t* source_sequence_numbers);
+
+    //True once whenever a receiver waits for a key frame.
+    bool TakeKeyFrameRequest();
+
+    VP8ForwarderStatistics GetStatistics();
+
+private:
+    struct FrameDecision {
+        bool used;
+        bool forward;
+        //Set by the first packet forwarded.
+        bool has_offset;
+        //Of a dropped frame, its first and last packet were seen.
+        bool has_first;
+        bool has_last;
+        uint32_t timestamp;
+        int picture_id;
+        int tl0_pic_idx;
+        int temporal_idx;
+        //Subtracted from the sequence numbers of the frame's packets.
+        uint16_t sequence_number_offset;
+        uint16_t first_sequence_number;
+        uint16_t last_sequence_number;
+    };
+
+    struct SequenceMapping {
+        bool used;
+        uint16_t from;
+        uint16_t to;
+    };
+
+    struct Receiver {
+        int id;
+        uint32_t bitrate_bps;
+        int layer;
+        bool waiting_for_key_frame;
+
+        FrameDecision frames[kFrameHistory];
+        int next_frame;
+        bool has_frames;
+        uint32_t newest_timestamp;
+
+        //Newest packet forwarded.
+        bool has_forwarded;
+        uint16_t last_sequence_number;
+        uint16_t last_output;
+        bool last_marker;
+        int last_picture_id;
+        int last_tl0_pic_idx;
+        int last_temporal_idx;
+        uint16_t sequence_number_offset;
+        //Packets dropped after it.
+        int dropped_since_forwarded;
+
+        //Indexed by the incoming and by the outgoing sequence number.
+        SequenceMapping to_output[kSequenceHistory];
+        SequenceMapping to_source[kSequenceHistory];
+    };
+
+    //Caller holds crit_.
+    Receiver* FindReceiver(int receiver);
+    void UpdateRates(int temporal_idx, size_t length, int64_t now_ms);
+    int LayerForBitrate(uint32_t bitrate_bps) const;
+    bool StartFrame(Receiver* receiver, int temporal_idx, bool layer_sync,
+                    bool key_frame);
+    FrameDecision* DecideFrame(Receiver* receiver, uint32_t timestamp,
+                               const webrtc::RTPVideoHeaderVP8& vp8,
+                               int temporal_idx, bool frame_start,
+                               bool key_frame);
+    bool FindDroppedRun(const Receiver& receiver, const FrameDecision& frame,
+                        uint16_t sequence_number, bool frame_start,
+                        uint16_t* begin, uint16_t* end) const;
+    uint16_t FrameOffset(const Receiver& receiver, const FrameDecision& frame,
+                         uint16_t sequence_number, bool frame_start,
+                         int* kept) const;
+    void MapCutGap(Receiver* receiver, uint16_t sequence_number, uint16_t out,
+                   int kept);
+    void DropPacket(Receiver* receiver, uint16_t sequence_number);
+
+    Sender* sender_;
+    webrtc::scoped_ptr<webrtc::CriticalSectionWrapper> crit_;
+    //Empty, the parser only needs the header length.
+    RtpExtensionMap extension_map_;
+    Receiver receivers_[kMaxReceivers];
+    int num_receivers_;
+
+    int num_layers_;
+    bool key_frame_request_;
+
+    int64_t window_start_ms_;
+    uint32_t window_bytes_[webrtc::kMaxTemporalStreams];
+    bool has_rates_;
+
+    uint8_t buffer_[kMaxPacketSize];
+    VP8ForwarderStatistics stats_;
+
+    VP8SelectiveForwarder(const VP8SelectiveForwarder&);
+    VP8SelectiveForwarder& operator=(const VP8SelectiveForwarder&);
+};
+
+#endif
@@ -0,0 +1,634 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include "VideoFrameOps.h"
+
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VOIP_HAS_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define VOIP_HAS_SSE2
+#endif
+
+//Rows scaled before a transpose, one 8x8 block high.
+static const int kBandRows = 8;
+
+#if defined(VOIP_HAS_NEON)
+//Row i of |r| becomes column i of the 8x8 block at |dst|.
+static inline void Transpose8x8(const uint8x8_t r[8], uint8_t* dst,
+                                int dst_stride) {
+    uint8x8x2_t b0 = vtrn_u8(r[0], r[1]);
+    uint8x8x2_t b1 = vtrn_u8(r[2], r[3]);
+    uint8x8x2_t b2 = vtrn_u8(r[4], r[5]);
+    uint8x8x2_t b3 = vtrn_u8(r[6], r[7]);
+    uint16x4x2_t c0 = vtrn_u16(vreinterpret_u16_u8(b0.val[0]),
+                               vreinterpret_u16_u8(b1.val[0]));
+    uint16x4x2_t c1 = vtrn_u16(vreinterpret_u16_u8(b0.val[1]),
+                               vreinterpret_u16_u8(b1.val[1]));
+    uint16x4x2_t c2 = vtrn_u16(vreinterpret_u16_u8(b2.val[0]),
+                               vreinterpret_u16_u8(b3.val[0]));
+    uint16x4x2_t c3 = vtrn_u16(vreinterpret_u16_u8(b2.val[1]),
+                               vreinterpret_u16_u8(b3.val[1]));
+    uint32x2x2_t d0 = vtrn_u32(vreinterpret_u32_u16(c0.val[0]),
+                               vreinterpret_u32_u16(c2.val[0]));
+    uint32x2x2_t d1 = vtrn_u32(vreinterpret_u32_u16(c1.val[0]),
+                               vreinterpret_u32_u16(c3.val[0]));
+    uint32x2x2_t d2 = vtrn_u32(vreinterpret_u32_u16(c0.val[1]),
+                               vreinterpret_u32_u16(c2.val[1]));
+    uint32x2x2_t d3 = vtrn_u32(vreinterpret_u32_u16(c1.val[1]),
+                               vreinterpret_u32_u16(c3.val[1]));
+    vst1_u8(dst, vreinterpret_u8_u32(d0.val[0]));
+    vst1_u8(dst + dst_stride, vreinterpret_u8_u32(d1.val[0]));
+    vst1_u8(dst + 2 * dst_stride, vreinterpret_u8_u32(d2.val[0]));
+    vst1_u8(dst + 3 * dst_stride, vreinterpret_u8_u32(d3.val[0]));
+    vst1_u8(dst + 4 * dst_stride, vreinterpret_u8_u32(d0.val[1]));
+    vst1_u8(dst + 5 * dst_stride, vreinterpret_u8_u32(d1.val[1]));
+    vst1_u8(dst + 6 * dst_stride, vreinterpret_u8_u32(d2.val[1]));
+    vst1_u8(dst + 7 * dst_stride, vreinterpret_u8_u32(d3.val[1]));
+}
+#elif defined(VOIP_HAS_SSE2)
+//The low 8 bytes of row i of |r| become column i of the 8x8 block at
+//|dst|.
+static inline void Transpose8x8(const __m128i r[8], uint8_t* dst,
+                                int dst_stride) {
+    __m128i t0 = _mm_unpacklo_epi8(r[0], r[1]);
+    __m128i t1 = _mm_unpacklo_epi8(r[2], r[3]);
+    __m128i t2 = _mm_unpacklo_epi8(r[4], r[5]);
+    __m128i t3 = _mm_unpacklo_epi8(r[6], r[7]);
+    __m128i u0 = _mm_unpacklo_epi16(t0, t1);
+    __m128i u1 = _mm_unpackhi_epi16(t0, t1);
+    __m128i u2 = _mm_unpacklo_epi16(t2, t3);
+    __m128i u3 = _mm_unpackhi_epi16(t2, t3);
+    //Two columns each.
+    __m128i v0 = _mm_unpacklo_epi32(u0, u2);
+    __m128i v1 = _mm_unpackhi_epi32(u0, u2);
+    __m128i v2 = _mm_unpacklo_epi32(u1, u3);
+    __m128i v3 = _mm_unpackhi_epi32(u1, u3);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst), v0);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + dst_stride),
+                     _mm_srli_si128(v0, 8));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + 2 * dst_stride), v1);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + 3 * dst_stride),
+                     _mm_srli_si128(v1, 8));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + 4 * dst_stride), v2);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + 5 * dst_stride),
+                     _mm_srli_si128(v2, 8));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + 6 * dst_stride), v3);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + 7 * dst_stride),
+                     _mm_srli_si128(v3, 8));
+}
+
+static inline __m128i LoadLow(const uint8_t* p) {
+    return _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+}
+#endif
+
+//dst[x][y] = src[y][x], |width| x |height| of the source.
+static void TransposePlane(const uint8_t* src, int src_stride,
+                           uint8_t* dst, int dst_stride,
+                           int width, int height) {
+    int y = 0;
+#if defined(VOIP_HAS_NEON) || defined(VOIP_HAS_SSE2)
+    //Eight source rows at a time, so every destination row is written
+    //8 bytes at a time.
+    for (; y + 8 <= height; y += 8) {
+        const uint8_t* s = src + y * src_stride;
+        int x = 0;
+        for (; x + 8 <= width; x += 8) {
+#if defined(VOIP_HAS_NEON)
+            uint8x8_t r[8];
+            for (int i = 0; i < 8; i++) {
+                r[i] = vld1_u8(s + i * src_stride + x);
+            }
+#else
+            __m128i r[8];
+            for (int i = 0; i < 8; i++) {
+                r[i] = LoadLow(s + i * src_stride + x);
+            }
+#endif
+            Transpose8x8(r, dst + x * dst_stride + y, dst_stride);
+        }
+        for (; x < width; x++) {
+            for (int i = 0; i < 8; i++) {
+                dst[x * dst_stride + y + i] = s[i * src_stride + x];
+            }
+        }
+    }
+#endif
+    for (; y < height; y++) {
+        const uint8_t* s = src + y * src_stride;
+        for (int x = 0; x < width; x++) {
+            dst[x * dst_stride + y] = s[x];
+        }
+    }
+}
+
+void VideoFrameOps::RotatePlane90(const uint8_t* src, int src_stride,
+                                  uint8_t* dst, int dst_stride,
+                                  int width, int height) {
+    //Transposing the rows bottom up turns the picture clockwise.
+    src += (height - 1) * src_stride;
+    TransposePlane(src, -src_stride, dst, dst_stride, width, height);
+}
+
+//The two channels of an interleaved row, |width| pairs, in one pass.
+static void SplitRow(const uint8_t* src, uint8_t* dst0, uint8_t* dst1,
+                     int width) {
+    int x = 0;
+#if defined(VOIP_HAS_NEON)
+    for (; x + 16 <= width; x += 16) {
+        uint8x16x2_t uv = vld2q_u8(src + 2 * x);
+        vst1q_u8(dst0 + x, uv.val[0]);
+        vst1q_u8(dst1 + x, uv.val[1]);
+    }
+#elif defined(VOIP_HAS_SSE2)
+    const __m128i mask = _mm_set1_epi16(0xFF);
+    for (; x + 16 <= width; x += 16) {
+        const __m128i* p = reinterpret_cast<const __m128i*>(src + 2 * x);
+        __m128i uv0 = _mm_loadu_si128(p);
+        __m128i uv1 = _mm_loadu_si128(p + 1);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst0 + x),
+                         _mm_packus_epi16(_mm_and_si128(uv0, mask),
+                                          _mm_and_si128(uv1, mask)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst1 + x),
+                         _mm_packus_epi16(_mm_srli_epi16(uv0, 8),
+                                          _mm_srli_epi16(uv1, 8)));
+    }
+#endif
+    for (; x < width; x++) {
+        dst0[x] = src[2 * x];
+        dst1[x] = src[2 * x + 1];
+    }
+}
+
+static void ScaleRowDown2Box(const uint8_t* s0, const uint8_t* s1,
+                             uint8_t* dst, int dst_width) {
+    int x = 0;
+#if defined(VOIP_HAS_NEON)
+    for (; x + 8 <= dst_width; x += 8) {
+        uint16x8_t sum = vpaddlq_u8(vld1q_u8(s0 + 2 * x));
+        sum = vpadalq_u8(sum, vld1q_u8(s1 + 2 * x));
+        vst1_u8(dst + x, vrshrn_n_u16(sum, 2));
+    }
+#elif defined(VOIP_HAS_SSE2)
+    const __m128i mask = _mm_set1_epi16(0xFF);
+    const __m128i two = _mm_set1_epi16(2);
+    for (; x + 8 <= dst_width; x += 8) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s0 + 2 * x));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s1 + 2 * x));
+        __m128i sum = _mm_add_epi16(_mm_and_si128(a, mask),
+                                    _mm_srli_epi16(a, 8));
+        sum = _mm_add_epi16(sum, _mm_and_si128(b, mask));
+        sum = _mm_add_epi16(sum, _mm_srli_epi16(b, 8));
+        sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x),
+                         _mm_packus_epi16(sum, sum));
+    }
+#endif
+    for (; x < dst_width; x++) {
+        dst[x] = static_cast<uint8_t>((s0[2 * x] + s0[2 * x + 1] +
+                                       s1[2 * x] + s1[2 * x + 1] + 2) >> 2);
+    }
+}
+
+//(a * (256 - f) + b * f + 128) >> 8, |f| in 1..255.
+static void InterpolateRow(const uint8_t* a, const uint8_t* b, uint8_t* dst,
+                           int width, int f) {
+    int x = 0;
+#if defined(VOIP_HAS_NEON)
+    uint8x8_t fa = vdup_n_u8(static_cast<uint8_t>(256 - f));
+    uint8x8_t fb = vdup_n_u8(static_cast<uint8_t>(f));
+    for (; x + 16 <= width; x += 16) {
+        uint8x16_t va = vld1q_u8(a + x);
+        uint8x16_t vb = vld1q_u8(b + x);
+        uint16x8_t lo = vmull_u8(vget_low_u8(va), fa);
+        uint16x8_t hi = vmull_u8(vget_high_u8(va), fa);
+        lo = vmlal_u8(lo, vget_low_u8(vb), fb);
+        hi = vmlal_u8(hi, vget_high_u8(vb), fb);
+        vst1q_u8(dst + x, vcombine_u8(vrshrn_n_u16(lo, 8),
+                                      vrshrn_n_u16(hi, 8)));
+    }
+#elif defined(VOIP_HAS_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i fa = _mm_set1_epi16(static_cast<short>(256 - f));
+    const __m128i fb = _mm_set1_epi16(static_cast<short>(f));
+    const __m128i round = _mm_set1_epi16(128);
+    for (; x + 16 <= width; x += 16) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x));
+        //At most 255 * 256, the sums fit unsigned 16 bit lanes.
+        __m128i lo = _mm_add_epi16(
+            _mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), fa),
+            _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), fb));
+        __m128i hi = _mm_add_epi16(
+            _mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), fa),
+            _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), fb));
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 8);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x),
+                         _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; x < width; x++) {
+        dst[x] = static_cast<uint8_t>((a[x] * (256 - f) + b[x] * f + 128) >> 8);
+    }
+}
+
+//Horizontal filter with 7 bit weights as libyuv's ScaleFilterCols_C.
+static void FilterCols(const uint8_t* src, int src_width, uint8_t* dst,
+                       int dst_width, int x, int dx) {
+    int last = src_width - 1;
+    for (int j = 0; j < dst_width; j++, x += dx) {
+        int xi = x >> 16;
+        int a = src[xi];
+        int b = xi < last ? src[xi + 1] : a;
+        int f = (x >> 9) & 0x7F;
+        dst[j] = static_cast<uint8_t>(a + ((f * (b - a)) >> 7));
+    }
+}
+
+//32 bit sums, libyuv's 16 bit ones overflow past 257 rows.
+static void AddRow(const uint8_t* src, uint32_t* sum, int width) {
+    int x = 0;
+#if defined(VOIP_HAS_NEON)
+    for (; x + 16 <= width; x += 16) {
+        uint8x16_t v = vld1q_u8(src + x);
+        uint16x8_t lo = vmovl_u8(vget_low_u8(v));
+        uint16x8_t hi = vmovl_u8(vget_high_u8(v));
+        vst1q_u32(sum + x, vaddw_u16(vld1q_u32(sum + x), vget_low_u16(lo)));
+        vst1q_u32(sum + x + 4, vaddw_u16(vld1q_u32(sum + x + 4),
+                                         vget_high_u16(lo)));
+        vst1q_u32(sum + x + 8, vaddw_u16(vld1q_u32(sum + x + 8),
+                                         vget_low_u16(hi)));
+        vst1q_u32(sum + x + 12, vaddw_u16(vld1q_u32(sum + x + 12),
+                                          vget_high_u16(hi)));
+    }
+#elif defined(VOIP_HAS_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 16 <= width; x += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        __m128i w[4] = {
+            _mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+            _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero)
+        };
+        __m128i* s = reinterpret_cast<__m128i*>(sum + x);
+        for (int i = 0; i < 4; i++) {
+            _mm_storeu_si128(s + i, _mm_add_epi32(_mm_loadu_si128(s + i), w[i]));
+        }
+    }
+#endif
+    for (; x < width; x++) {
+        sum[x] += src[x];
+    }
+}
+
+//Rounded averages of 4x4 blocks from the column sums of 4 rows, as
+//libyuv's ScaleRowDown4Box_C.
+static void Down4Cols(const uint32_t* sum, uint8_t* dst, int dst_width) {
+    for (int j = 0; j < dst_width; j++) {
+        const uint32_t* s = sum + 4 * j;
+        dst[j] = static_cast<uint8_t>((s[0] + s[1] + s[2] + s[3] + 8) >> 4);
+    }
+}
+
+//Averages the column sums of |box_height| rows over the boxes starting at
+//every step of |dx|, dividing by a 16 bit reciprocal as libyuv's
+//ScaleAddCols2_C. Boxes over 65536 pixels, where that reciprocal is 0,
+//divide exactly.
+static void BoxCols(const uint32_t* sum, int src_width, uint8_t* dst,
+                    int dst_width, int dx, int box_height) {
+    int min_box_width = dx >> 16;
+    int64_t area[2];
+    area[0] = static_cast<int64_t>(min_box_width) * box_height;
+    area[1] = area[0] + box_height;
+    int64_t scale[2];
+    scale[0] = 65536 / area[0];
+    scale[1] = 65536 / area[1];
+    int x = 0;
+    for (int j = 0; j < dst_width; j++) {
+        int x0 = x >> 16;
+        x += dx;
+        int x1 = x >> 16;
+        if (x1 > src_width) {
+            x1 = src_width;
+        }
+        int64_t total = 0;
+        for (int i = x0; i < x1; i++) {
+            total += sum[i];
+        }
+        int k = x1 - x0 - min_box_width;
+        dst[j] = static_cast<uint8_t>(scale[k] ? (total * scale[k]) >> 16 :
+                                                 total / area[k]);
+    }
+}
+
+//16.16 positions as libyuv's ScaleSlope: centered when scaling down, the
+//corners aligned when scaling up, with FixedDiv1's step so that the last
+//source pixel is reached once.
+static void Slope(int src_size, int dst_size, int* start, int* delta) {
+    if (dst_size <= src_size) {
+        *delta = static_cast<int>((static_cast<int64_t>(src_size) << 16) /
+                                  dst_size);
+        *start = (*delta >> 1) - 32768;
+    } else {
+        *delta = static_cast<int>(((static_cast<int64_t>(src_size) << 16) -
+                                   0x00010001) / (dst_size - 1));
+        *start = 0;
+    }
+}
+
+//Scales a plane one destination row at a time, with the filter libyuv's
+//ScalePlane picks for kFilterBox. With |channels| 2 the plane is
+//interleaved, as NV12 chroma, and both channels are scaled together from
+//rows split in one pass.
+class RowScaler {
+public:
+    enum { kMaxChannels = 2 };
+
+    RowScaler(const uint8_t* src, int src_stride, int channels,
+              int src_width, int src_height, int dst_width, int dst_height)
+    : src_(src),
+      src_stride_(src_stride),
+      channels_(channels),
+      src_width_(src_width),
+      src_height_(src_height),
+      dst_width_(dst_width),
+      dst_height_(dst_height) {
+        filtered_y_[0] = -1;
+        filtered_y_[1] = -1;
+        if (dst_width == src_width && dst_height == src_height) {
+            mode_ = kCopy;
+        } else if (dst_width * 2 == src_width && dst_height * 2 == src_height) {
+            mode_ = kDown2Box;
+        } else if (dst_width * 4 == src_width && dst_height * 4 == src_height) {
+            mode_ = kDown4Box;
+        } else if (dst_height * 2 < src_height && dst_width < src_width) {
+            //ScaleFilterReduce keeps the box only when the height shrinks
+            //by more than half and the width shrinks.
+            mode_ = kBox;
+            dx_ = static_cast<int>((static_cast<int64_t>(src_width) << 16) /
+                                   dst_width);
+            dy_ = static_cast<int>((static_cast<int64_t>(src_height) << 16) /
+                                   dst_height);
+        } else {
+            //As ScalePlaneBilinearUp when the height grows, which filters
+            //the source rows horizontally first, otherwise vertically first
+            //as ScalePlaneBilinearDown.
+            mode_ = dst_height > src_height ? kBilinearUp : kBilinear;
+            Slope(src_width, dst_width, &x_, &dx_);
+            Slope(src_height, dst_height, &y_, &dy_);
+        }
+        for (int c = 0; c < channels; c++) {
+            if (channels > 1) {
+                rows_[0][c].resize(src_width);
+                rows_[1][c].resize(src_width);
+            }
+            if (mode_ == kDown4Box || mode_ == kBox) {
+                sum_[c].resize(src_width);
+            } else if (mode_ == kBilinear) {
+                row_[c].resize(src_width);
+            } else if (mode_ == kBilinearUp) {
+                filtered_[0][c].resize(dst_width);
+                filtered_[1][c].resize(dst_width);
+            }
+        }
+    }
+
+    //|dst| holds one row per channel.
+    void ScaleRow(int j, uint8_t* const* dst) {
+        const uint8_t* s0[kMaxChannels];
+        const uint8_t* s1[kMaxChannels];
+        switch (mode_) {
+        case kCopy:
+            if (channels_ == 1) {
+                memcpy(dst[0], src_ + j * src_stride_, src_width_);
+            } else {
+                SplitRow(src_ + j * src_stride_, dst[0], dst[1], src_width_);
+            }
+            break;
+        case kDown2Box:
+            Rows(2 * j, 0, s0);
+            Rows(2 * j + 1, 1, s1);
+            for (int c = 0; c < channels_; c++) {
+                ScaleRowDown2Box(s0[c], s1[c], dst[c], dst_width_);
+            }
+            break;
+        case kDown4Box:
+            SumRows(4 * j, 4 * j + 4);
+            for (int c = 0; c < channels_; c++) {
+                Down4Cols(&sum_[c][0], dst[c], dst_width_);
+            }
+            break;
+        case kBilinear: {
+            //Positions past the last row repeat it.
+            int y = std::min(y_ + j * dy_, (src_height_ - 1) << 16);
+            int f = (y >> 8) & 0xFF;
+            Rows(y >> 16, 0, s0);
+            if (f != 0) {
+                Rows((y >> 16) + 1, 1, s1);
+            }
+            for (int c = 0; c < channels_; c++) {
+                const uint8_t* s = s0[c];
+                if (f != 0) {
+                    InterpolateRow(s, s1[c], &row_[c][0], src_width_, f);
+                    s = &row_[c][0];
+                }
+                FilterCols(s, src_width_, dst[c], dst_width_, x_, dx_);
+            }
+            break;
+        }
+        case kBilinearUp: {
+            int y = std::min(y_ + j * dy_, (src_height_ - 1) << 16);
+            int f = (y >> 8) & 0xFF;
+            int slot = Filtered(y >> 16);
+            int next = f != 0 ? Filtered((y >> 16) + 1) : slot;
+            for (int c = 0; c < channels_; c++) {
+                if (f != 0) {
+                    InterpolateRow(&filtered_[slot][c][0],
+                                   &filtered_[next][c][0], dst[c],
+                                   dst_width_, f);
+                } else {
+                    memcpy(dst[c], &filtered_[slot][c][0], dst_width_);
+                }
+            }
+            break;
+        }
+        case kBox: {
+            int y0 = static_cast<int>((static_cast<int64_t>(j) * dy_) >> 16);
+            int y1 = static_cast<int>((static_cast<int64_t>(j + 1) * dy_) >> 16);
+            y1 = std::max(y0 + 1, std::min(y1, src_height_));
+            SumRows(y0, y1);
+            for (int c = 0; c < channels_; c++) {
+                BoxCols(&sum_[c][0], src_width_, dst[c], dst_width_, dx_,
+                        y1 - y0);
+            }
+            break;
+        }
+        }
+    }
+
+private:
+    enum Mode { kCopy, kDown2Box, kDown4Box, kBilinear, kBilinearUp, kBox };
+
+    //Source row |y| of each channel, split into |slot| when interleaved.
+    void Rows(int y, int slot, const uint8_t** rows) {
+        const uint8_t* s = src_ + y * src_stride_;
+        if (channels_ == 1) {
+            rows[0] = s;
+            return;
+        }
+        SplitRow(s, &rows_[slot][0][0], &rows_[slot][1][0], src_width_);
+        rows[0] = &rows_[slot][0][0];
+        rows[1] = &rows_[slot][1][0];
+    }
+
+    //Column sums of source rows |y0| to |y1|.
+    void SumRows(int y0, int y1) {
+        const uint8_t* s[kMaxChannels];
+        for (int c = 0; c < channels_; c++) {
+            memset(&sum_[c][0], 0, src_width_ * sizeof(sum_[c][0]));
+        }
+        for (int y = y0; y < y1; y++) {
+            Rows(y, 0, s);
+            for (int c = 0; c < channels_; c++) {
+                AddRow(s[c], &sum_[c][0], src_width_);
+            }
+        }
+    }
+
+    //The slot holding source row |y| filtered to the destination width.
+    //Consecutive rows alternate slots, each is filtered once.
+    int Filtered(int y) {
+        int slot = y & 1;
+        if (filtered_y_[slot] != y) {
+            const uint8_t* s[kMaxChannels];
+            Rows(y, slot, s);
+            for (int c = 0; c < channels_; c++) {
+                FilterCols(s[c], src_width_, &filtered_[slot][c][0],
+                           dst_width_, x_, dx_);
+            }
+            filtered_y_[slot] = y;
+        }
+        return slot;
+    }
+
+    const uint8_t* src_;
+    int src_stride_;
+    int channels_;
+    int src_width_;
+    int src_height_;
+    int dst_width_;
+    int dst_height_;
+    Mode mode_;
+    int x_, dx_, y_, dy_;
+    std::vector<uint8_t> rows_[2][kMaxChannels];
+    std::vector<uint8_t> row_[kMaxChannels];
+    std::vector<uint8_t> filtered_[2][kMaxChannels];
+    int filtered_y_[2];
+    std::vector<uint32_t> sum_[kMaxChannels];
+};
+
+//Scales into bands of 8 rows that stay in the cache and are transposed
+//into |dst| from there, so the source is read once and the destination
+//written once.
+static void ScaleRotatePlane(const uint8_t* src, int src_stride, int channels,
+                             int src_width, int src_height,
+                             uint8_t* const* dst, const int* dst_stride,
+                             int dst_width, int dst_height, bool rotate) {
+    uint8_t* rows[RowScaler::kMaxChannels];
+    if (!rotate) {
+        RowScaler scaler(src, src_stride, channels, src_width, src_height,
+                         dst_width, dst_height);
+        for (int j = 0; j < dst_height; j++) {
+            for (int c = 0; c < channels; c++) {
+                rows[c] = dst[c] + j * dst_stride[c];
+            }
+            scaler.ScaleRow(j, rows);
+        }
+        return;
+    }
+    //Turned clockwise, the destination rows are the scaled source columns.
+    int width = dst_height;
+    int height = dst_width;
+    RowScaler scaler(src, src_stride, channels, src_width, src_height,
+                     width, height);
+    std::vector<uint8_t> bands[RowScaler::kMaxChannels];
+    for (int c = 0; c < channels; c++) {
+        bands[c].resize(kBandRows * width);
+    }
+    for (int j = 0; j < height; j += kBandRows) {
+        int band_rows = std::min(kBandRows, height - j);
+        for (int i = 0; i < band_rows; i++) {
+            for (int c = 0; c < channels; c++) {
+                rows[c] = &bands[c][i * width];
+            }
+            scaler.ScaleRow(j + i, rows);
+        }
+        //Scaled row j lands in destination column height - 1 - j.
+        for (int c = 0; c < channels; c++) {
+            VideoFrameOps::RotatePlane90(&bands[c][0], width,
+                                         dst[c] + height - j - band_rows,
+                                         dst_stride[c], width, band_rows);
+        }
+    }
+}
+
+bool VideoFrameOps::ScaleRotateToI420(const uint8_t* src_y, int src_stride_y,
+                                      const uint8_t* src_u, int src_stride_u,
+                                      const uint8_t* src_v, int src_stride_v,
+                                      int src_pixel_stride_uv,
+                                      int src_width, int src_height,
+                                      uint8_t* dst_y, int dst_stride_y,
+                                      uint8_t* dst_u, int dst_stride_u,
+                                      uint8_t* dst_v, int dst_stride_v,
+                                      int dst_width, int dst_height,
+                                      int rotation) {
+    if ((rotation != 0 && rotation != 90) || dst_width <= 0 ||
+        dst_height <= 0 || src_width <= 0 || src_height <= 0) {
+        return false;
+    }
+    if (src_pixel_stride_uv != 1 &&
+        (src_pixel_stride_uv != 2 || src_stride_u != src_stride_v ||
+         (src_v - src_u != 1 && src_u - src_v != 1))) {
+        return false;
+    }
+    bool rotate = rotation == 90;
+    int src_chroma_width = (src_width + 1) / 2;
+    int src_chroma_height = (src_height + 1) / 2;
+    int dst_chroma_width = (dst_width + 1) / 2;
+    int dst_chroma_height = (dst_height + 1) / 2;
+    ScaleRotatePlane(src_y, src_stride_y, 1, src_width, src_height,
+                     &dst_y, &dst_stride_y, dst_width, dst_height, rotate);
+    if (src_pixel_stride_uv == 2) {
+        //Both channels of the interleaved plane in one pass over it, the
+        //first in memory is U in NV12 and V in NV21.
+        bool u_first = src_u < src_v;
+        uint8_t* dst[2] = { u_first ? dst_u : dst_v, u_first ? dst_v : dst_u };
+        int dst_stride[2] = { u_first ? dst_stride_u : dst_stride_v,
+                              u_first ? dst_stride_v : dst_stride_u };
+        ScaleRotatePlane(std::min(src_u, src_v), src_stride_u, 2,
+                         src_chroma_width, src_chroma_height, dst, dst_stride,
+                         dst_chroma_width, dst_chroma_height, rotate);
+        return true;
+    }
+    ScaleRotatePlane(src_u, src_stride_u, 1,
+                     src_chroma_width, src_chroma_height,
+                     &dst_u, &dst_stride_u, dst_chroma_width, dst_chroma_height,
+                     rotate);
+    ScaleRotatePlane(src_v, src_stride_v, 1,
+                     src_chroma_width, src_chroma_height,
+                     &dst_v, &dst_stride_v, dst_chroma_width, dst_chroma_height,
+                     rotate);
+    return true;
+}
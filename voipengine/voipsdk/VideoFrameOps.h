@@ -0,0 +1,59 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#ifndef VOIP_VIDEO_FRAME_OPS_H
+#define VOIP_VIDEO_FRAME_OPS_H
+
+#include <stdint.h>
+
+//Vectorized plane operations of the capture path, NEON on device and SSE2
+//on the simulator, picked at compile time like AudioFrameOps.
+//
+//The libyuv in this tree has no NEON horizontal filter for the bilinear
+//scaler, and on the simulator it is built with LIBYUV_DISABLE_X86, so
+//those rows run in C. Rotation is here so that it can be fused with the
+//split of the NV12 chroma plane and with scaling. Scaling is only offered
+//fused, whole planes are scaled by libyuv's kFilterBox, see
+//ScaleI420Buffer. The fused scaler picks its filter as ScalePlane does for
+//kFilterBox and steps through the same 16.16 positions, except that
+//libyuv's dedicated 3/4 and 3/8 filters are not reproduced, those sizes
+//are scaled bilinear.
+//
+//Widths and heights are of the source unless noted, planes must not
+//overlap.
+class VideoFrameOps {
+public:
+    //Clockwise, |dst| is |height| wide and |width| high.
+    static void RotatePlane90(const uint8_t* src, int src_stride,
+                              uint8_t* dst, int dst_stride,
+                              int width, int height);
+
+    //Scales, and with |rotation| 90 turns clockwise, a 4:2:0 frame into
+    //I420 in one pass, with rounded averages of 2x2 and 4x4 blocks for
+    //exact halves and quarters, averages of the covered source pixels when
+    //the height shrinks by more than half and bilinear otherwise. Bands of
+    //eight scaled rows stay in the cache and are transposed into the
+    //destination from there, so no full size intermediate frame is
+    //written. |src_pixel_stride_uv| is 1 for I420 and 2 for NV12 and NV21,
+    //whose U and V pointers are one byte apart in the interleaved plane,
+    //which is split into U and V as it is read. |dst_width| and
+    //|dst_height| are after the rotation. False for rotations other than 0
+    //and 90.
+    static bool ScaleRotateToI420(const uint8_t* src_y, int src_stride_y,
+                                  const uint8_t* src_u, int src_stride_u,
+                                  const uint8_t* src_v, int src_stride_v,
+                                  int src_pixel_stride_uv,
+                                  int src_width, int src_height,
+                                  uint8_t* dst_y, int dst_stride_y,
+                                  uint8_t* dst_u, int dst_stride_u,
+                                  uint8_t* dst_v, int dst_stride_v,
+                                  int dst_width, int dst_height,
+                                  int rotation);
+};
+
+#endif
@@ -0,0 +1,392 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include "VideoJitterBuffer.h"
+
+#include <string.h>
+
+static inline bool IsNewerSequenceNumber(uint16_t a, uint16_t b) {
+    return a != b && static_cast<uint16_t>(a - b) < 0x8000;
+}
+
+static inline bool IsNewerTimestamp(uint32_t a, uint32_t b) {
+    return a != b && a - b < 0x80000000;
+}
+
+VideoJitterBuffer::VideoJitterBuffer()
+: crit_(webrtc::CriticalSectionWrapper::CreateCriticalSection()),
+  slab_(webrtc::AlignedMalloc<uint8_t>(
+      static_cast<size_t>(kMaxPackets) * kMaxPayloadSize, kAlignment)) {
+    memset(&stats_, 0, sizeof(stats_));
+    FlushLocked();
+    key_frame_request_ = false;
+}
+
+bool VideoJitterBuffer::IsReceived(uint16_t sequence_number) const {
+    int index = sequence_number & (kMaxPackets - 1);
+    return (received_[index >> 6] >> (index & 63)) & 1 &&
+           packets_[index].sequence_number == sequence_number;
+}
+
+void VideoJitterBuffer::SetReceived(uint16_t sequence_number, bool received) {
+    int index = sequence_number & (kMaxPackets - 1);
+    uint64_t bit = static_cast<uint64_t>(1) << (index & 63);
+    if (received) {
+        received_[index >> 6] |= bit;
+    } else {
+        received_[index >> 6] &= ~bit;
+    }
+}
+
+int VideoJitterBuffer::FindFrame(uint32_t timestamp) {
+    if (last_frame_ != kNoFrame && frames_[last_frame_].used &&
+        frames_[last_frame_].timestamp == timestamp) {
+        return last_frame_;
+    }
+    for (int i = 0; i < kMaxFrames; i++) {
+        if (frames_[i].used && frames_[i].timestamp == timestamp) {
+            last_frame_ = i;
+            return i;
+        }
+    }
+    return kNoFrame;
+}
+
+int VideoJitterBuffer::AllocateFrame(uint32_t timestamp) {
+    if (num_frames_ == kMaxFrames) {
+        return kNoFrame;
+    }
+    for (int i = 0; i < kMaxFrames; i++) {
+        if (!frames_[i].used) {
+            memset(&frames_[i], 0, sizeof(frames_[i]));
+            frames_[i].used = true;
+            frames_[i].timestamp = timestamp;
+            num_frames_++;
+            last_frame_ = i;
+            return i;
+        }
+    }
+    return kNoFrame;
+}
+
+bool VideoJitterBuffer::IsComplete(const FrameSlot& frame) const {
+    return frame.has_first && frame.has_last &&
+           frame.packets == static_cast<uint16_t>(frame.last_sequence_number -
+                                                  frame.first_sequence_number) + 1;
+}
+
+bool VideoJitterBuffer::IsDecodable(const FrameSlot& frame) const {
+    if (!IsComplete(frame)) {
+        return false;
+    }
+    return frame.key_frame ||
+           (has_decoded_ &&
+            frame.first_sequence_number ==
+            static_cast<uint16_t>(last_decoded_sequence_number_ + 1));
+}
+
+bool VideoJitterBuffer::IsStalled(int64_t now_ms) const {
+    int oldest = kNoFrame;
+    for (int i = 0; i < kMaxFrames; i++) {
+        if (!frames_[i].used) {
+            continue;
+        }
+        //Complete but not decodable, the packets before it are missing.
+        if (IsComplete(frames_[i]) &&
+            now_ms - frames_[i].complete_time_ms >= kMaxNackWaitMs) {
+            return true;
+        }
+        if (oldest == kNoFrame ||
+            IsNewerTimestamp(frames_[oldest].timestamp, frames_[i].timestamp)) {
+            oldest = i;
+        }
+    }
+    return oldest != kNoFrame &&
+           now_ms - frames_[oldest].first_packet_time_ms >= kMaxHoldMs;
+}
+
+void VideoJitterBuffer::RequestKeyFrame(int64_t now_ms) {
+    key_frame_request_ = true;
+    key_frame_pending_ = true;
+    key_frame_request_time_ms_ = now_ms;
+}
+
+int VideoJitterBuffer::FindNextFrame() {
+    int next = kNoFrame;
+    for (int i = 0; i < kMaxFrames; i++) {
+        if (!frames_[i].used || !IsDecodable(frames_[i])) {
+            continue;
+        }
+        if (next == kNoFrame ||
+            IsNewerTimestamp(frames_[next].timestamp, frames_[i].timestamp)) {
+            next = i;
+        }
+    }
+    return next;
+}
+
+void VideoJitterBuffer::ReleaseFrame(int index, bool dropped) {
+    FrameSlot& frame = frames_[index];
+    if (frame.packets > 0) {
+        uint16_t sequence_number = frame.low_sequence_number;
+        for (;;) {
+            if (IsReceived(sequence_number) &&
+                packets_[sequence_number & (kMaxPackets - 1)].timestamp ==
+                frame.timestamp) {
+                SetReceived(sequence_number, false);
+            }
+            if (sequence_number == frame.high_sequence_number) {
+                break;
+            }
+            sequence_number++;
+        }
+    }
+    frame.used = false;
+    num_frames_--;
+    if (dropped) {
+        stats_.frames_dropped++;
+    }
+}
+
+void VideoJitterBuffer::FlushLocked() {
+    memset(received_, 0, sizeof(received_));
+    memset(frames_, 0, sizeof(frames_));
+    num_frames_ = 0;
+    last_frame_ = kNoFrame;
+    has_newest_ = false;
+    newest_sequence_number_ = 0;
+    has_decoded_ = false;
+    last_decoded_sequence_number_ = 0;
+    last_decoded_timestamp_ = 0;
+    key_frame_pending_ = false;
+    key_frame_request_time_ms_ = 0;
+}
+
+JitterInsertResult VideoJitterBuffer::InsertPacket(const JitterPacket& packet,
+                                                   int64_t now_ms) {
+    if (packet.payload_length > kMaxPayloadSize) {
+        return kJitterPacketError;
+    }
+    uint16_t sequence_number = packet.sequence_number;
+
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    stats_.packets++;
+    if (has_decoded_ &&
+        (!IsNewerTimestamp(packet.timestamp, last_decoded_timestamp_) ||
+         !IsNewerSequenceNumber(sequence_number,
+                                last_decoded_sequence_number_))) {
+        stats_.old_packets++;
+        return kJitterOldPacket;
+    }
+    if (IsReceived(sequence_number)) {
+        stats_.duplicate_packets++;
+        return kJitterDuplicatePacket;
+    }
+
+    //The ring holds kMaxPackets sequence numbers from the last extracted
+    //frame on. Beyond that packets would overwrite held ones and the NACK
+    //list could not be tracked.
+    bool flushed = false;
+    int slot = sequence_number & (kMaxPackets - 1);
+    bool overwrites = (received_[slot >> 6] >> (slot & 63)) & 1;
+    bool too_far = has_decoded_ &&
+        static_cast<uint16_t>(sequence_number -
+                              last_decoded_sequence_number_ - 1) >= kMaxPackets;
+    int index = FindFrame(packet.timestamp);
+    if (index == kNoFrame) {
+        index = AllocateFrame(packet.timestamp);
+    }
+    if (overwrites || too_far || index == kNoFrame) {
+        FlushLocked();
+        stats_.flushes++;
+        RequestKeyFrame(now_ms);
+        flushed = true;
+        index = AllocateFrame(packet.timestamp);
+    }
+
+    memcpy(SlotData(sequence_number), packet.payload, packet.payload_length);
+    packets_[slot].sequence_number = sequence_number;
+    packets_[slot].length = static_cast<uint16_t>(packet.payload_length);
+    packets_[slot].timestamp = packet.timestamp;
+    SetReceived(sequence_number, true);
+    if (!has_newest_ ||
+        IsNewerSequenceNumber(sequence_number, newest_sequence_number_)) {
+        newest_sequence_number_ = sequence_number;
+        has_newest_ = true;
+    }
+
+    FrameSlot& frame = frames_[index];
+    if (frame.packets == 0) {
+        frame.low_sequence_number = sequence_number;
+        frame.high_sequence_number = sequence_number;
+        frame.first_packet_time_ms = now_ms;
+    } else if (IsNewerSequenceNumber(frame.low_sequence_number,
+                                     sequence_number)) {
+        frame.low_sequence_number = sequence_number;
+    } else if (IsNewerSequenceNumber(sequence_number,
+                                     frame.high_sequence_number)) {
+        frame.high_sequence_number = sequence_number;
+    }
+    frame.packets++;
+    frame.length += packet.payload_length;
+    frame.key_frame |= packet.key_frame;
+    if (packet.first_packet) {
+        frame.has_first = true;
+        frame.first_sequence_number = sequence_number;
+    }
+    if (packet.marker_bit) {
+        frame.has_last = true;
+        frame.last_sequence_number = sequence_number;
+    }
+
+    if (flushed) {
+        return kJitterFlushed;
+    }
+    if (IsComplete(frame)) {
+        frame.complete_time_ms = now_ms;
+        return kJitterCompleteFrame;
+    }
+    return kJitterIncompleteFrame;
+}
+
+bool VideoJitterBuffer::NextCompleteFrame(JitterFrameInfo* info) {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    int index = FindNextFrame();
+    if (index == kNoFrame) {
+        return false;
+    }
+    const FrameSlot& frame = frames_[index];
+    info->timestamp = frame.timestamp;
+    info->key_frame = frame.key_frame;
+    info->first_sequence_number = frame.first_sequence_number;
+    info->last_sequence_number = frame.last_sequence_number;
+    info->length = frame.length;
+    info->first_packet_time_ms = frame.first_packet_time_ms;
+    info->complete_time_ms = frame.complete_time_ms;
+    return true;
+}
+
+int VideoJitterBuffer::ExtractFrame(uint8_t* buffer, size_t capacity,
+                                    JitterFrameInfo* info, int64_t now_ms) {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    int index = FindNextFrame();
+    if (index == kNoFrame) {
+        //The oldest frame held waits for packets, a key frame is needed
+        //when they are not coming back.
+        if ((!key_frame_pending_ ||
+             now_ms - key_frame_request_time_ms_ >= kMaxHoldMs) &&
+            IsStalled(now_ms)) {
+            RequestKeyFrame(now_ms);
+        }
+        return -1;
+    }
+    FrameSlot& frame = frames_[index];
+    if (frame.length > capacity) {
+        return -1;
+    }
+
+    size_t length = 0;
+    uint16_t sequence_number = frame.first_sequence_number;
+    for (;;) {
+        const PacketSlot& slot = packets_[sequence_number & (kMaxPackets - 1)];
+        memcpy(buffer + length, SlotData(sequence_number), slot.length);
+        length += slot.length;
+        if (sequence_number == frame.last_sequence_number) {
+            break;
+        }
+        sequence_number++;
+    }
+
+    info->timestamp = frame.timestamp;
+    info->key_frame = frame.key_frame;
+    info->first_sequence_number = frame.first_sequence_number;
+    info->last_sequence_number = frame.last_sequence_number;
+    info->length = length;
+    info->first_packet_time_ms = frame.first_packet_time_ms;
+    info->complete_time_ms = frame.complete_time_ms;
+
+    has_decoded_ = true;
+    last_decoded_sequence_number_ = frame.last_sequence_number;
+    last_decoded_timestamp_ = frame.timestamp;
+    if (frame.key_frame) {
+        key_frame_pending_ = false;
+    }
+    ReleaseFrame(index, false);
+    stats_.frames_extracted++;
+
+    //A key frame skips the older frames, they can never be decoded.
+    for (int i = 0; i < kMaxFrames; i++) {
+        if (frames_[i].used &&
+            !IsNewerTimestamp(frames_[i].timestamp, last_decoded_timestamp_)) {
+            ReleaseFrame(i, true);
+        }
+    }
+    return static_cast<int>(length);
+}
+
+int VideoJitterBuffer::GetNackList(uint16_t* sequence_numbers, int max_count) {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    if (!has_newest_) {
+        return 0;
+    }
+    uint16_t start;
+    if (has_decoded_) {
+        start = last_decoded_sequence_number_ + 1;
+    } else {
+        //Before the first frame, from the oldest packet held.
+        start = newest_sequence_number_;
+        for (int i = 0; i < kMaxFrames; i++) {
+            if (frames_[i].used && frames_[i].packets > 0 &&
+                IsNewerSequenceNumber(start, frames_[i].low_sequence_number)) {
+                start = frames_[i].low_sequence_number;
+            }
+        }
+    }
+    int remaining = static_cast<uint16_t>(newest_sequence_number_ - start);
+    if (remaining >= kMaxPackets) {
+        return 0;
+    }
+
+    //A word of the bitset at a time, the missing ones are the clear bits.
+    int count = 0;
+    uint16_t sequence_number = start;
+    while (remaining > 0 && count < max_count) {
+        int index = sequence_number & (kMaxPackets - 1);
+        int bit = index & 63;
+        int span = 64 - bit < remaining ? 64 - bit : remaining;
+        uint64_t missing = ~received_[index >> 6] >> bit;
+        if (span < 64) {
+            missing &= (static_cast<uint64_t>(1) << span) - 1;
+        }
+        while (missing && count < max_count) {
+            sequence_numbers[count++] =
+                sequence_number + __builtin_ctzll(missing);
+            missing &= missing - 1;
+        }
+        sequence_number += span;
+        remaining -= span;
+    }
+    return count;
+}
+
+bool VideoJitterBuffer::TakeKeyFrameRequest() {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    bool request = key_frame_request_;
+    key_frame_request_ = false;
+    return request;
+}
+
+void VideoJitterBuffer::Flush() {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    FlushLocked();
+}
+
+JitterBufferStatistics VideoJitterBuffer::GetStatistics() {
+    webrtc::CriticalSectionScoped cs(crit_.get());
+    return stats_;
+}
@@ -0,0 +1,185 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#ifndef VOIP_VIDEO_JITTER_BUFFER_H
+#define VOIP_VIDEO_JITTER_BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "webrtc/system_wrappers/interface/aligned_malloc.h"
+#include "webrtc/system_wrappers/interface/critical_section_wrapper.h"
+#include "webrtc/system_wrappers/interface/scoped_ptr.h"
+
+//Assembles video frames from RTP packets for NACK based receivers.
+//
+//webrtc::VCMJitterBuffer keeps frames in std::maps, free frames in a
+//std::list, the missing sequence numbers in a std::set and every frame's
+//packets in another std::list, so each insert does several tree and list
+//operations. Here everything is preallocated: packets sit in a ring of
+//slots indexed by seq & mask with their payload in one slab, a bitset of
+//the received sequence numbers gives the NACK list a word at a time, and
+//frames live in a small fixed table found through the last used slot,
+//which is the frame of nearly every packet.
+//
+//Thread safe.
+struct JitterPacket {
+    uint16_t sequence_number;
+    uint32_t timestamp;
+    //First and last packet of the frame, from the payload descriptor and
+    //the marker bit.
+    bool first_packet;
+    bool marker_bit;
+    bool key_frame;
+    const uint8_t* payload;
+    size_t payload_length;
+};
+
+struct JitterFrameInfo {
+    uint32_t timestamp;
+    bool key_frame;
+    uint16_t first_sequence_number;
+    uint16_t last_sequence_number;
+    //Payload bytes of the assembled frame.
+    size_t length;
+    //Arrival of the first and of the completing packet.
+    int64_t first_packet_time_ms;
+    int64_t complete_time_ms;
+};
+
+enum JitterInsertResult {
+    kJitterPacketError,
+    //Older than the last extracted frame.
+    kJitterOldPacket,
+    kJitterDuplicatePacket,
+    kJitterIncompleteFrame,
+    kJitterCompleteFrame,
+    //The buffer overflowed and was flushed, a key frame is needed.
+    kJitterFlushed,
+};
+
+struct JitterBufferStatistics {
+    uint64_t packets;
+    uint64_t duplicate_packets;
+    uint64_t old_packets;
+    uint64_t frames_extracted;
+    //Frames dropped incomplete or undecodable.
+    uint64_t frames_dropped;
+    uint64_t flushes;
+};
+
+class VideoJitterBuffer {
+public:
+    //Power of two.
+    enum { kMaxPackets = 1024 };
+    enum { kMaxFrames = 64 };
+    enum { kMaxPayloadSize = 1500 };
+    //With nothing decodable, a key frame is requested once a complete
+    //frame has waited this long behind the missing packets, or once the
+    //oldest frame is held for kMaxHoldMs. NACK gets the first bound to
+    //repair the gap, the second covers losses nothing complete follows.
+    enum { kMaxNackWaitMs = 400 };
+    enum { kMaxHoldMs = 1000 };
+
+    VideoJitterBuffer();
+
+    JitterInsertResult InsertPacket(const JitterPacket& packet, int64_t now_ms);
+
+    //The oldest frame that is complete and decodable, a key frame or the
+    //continuation of the last extracted frame.
+    bool NextCompleteFrame(JitterFrameInfo* info);
+
+    //Copies that frame's payloads in sequence order into |buffer| and
+    //releases it together with the older frames that can no longer be
+    //decoded. Returns the length, or -1 if there is no such frame or
+    //|buffer| is too small.
+    int ExtractFrame(uint8_t* buffer, size_t capacity, JitterFrameInfo* info,
+                     int64_t now_ms);
+
+    //Sequence numbers missing between the last extracted frame and the
+    //newest packet, oldest first. Returns the count.
+    int GetNackList(uint16_t* sequence_numbers, int max_count);
+
+    //True once after a flush or when ExtractFrame finds the stream stalled,
+    //see kMaxNackWaitMs. A stall is requested again every kMaxHoldMs until
+    //a key frame is extracted.
+    bool TakeKeyFrameRequest();
+
+    void Flush();
+
+    JitterBufferStatistics GetStatistics();
+
+private:
+    enum { kAlignment = 64 };
+    enum { kNoFrame = -1 };
+
+    struct PacketSlot {
+        uint16_t sequence_number;
+        uint16_t length;
+        uint32_t timestamp;
+    };
+
+    struct FrameSlot {
+        bool used;
+        bool key_frame;
+        bool has_first;
+        bool has_last;
+        uint32_t timestamp;
+        uint16_t first_sequence_number;
+        uint16_t last_sequence_number;
+        //Range of the packets received so far.
+        uint16_t low_sequence_number;
+        uint16_t high_sequence_number;
+        int packets;
+        size_t length;
+        int64_t first_packet_time_ms;
+        int64_t complete_time_ms;
+    };
+
+    //Caller holds crit_.
+    bool IsReceived(uint16_t sequence_number) const;
+    void SetReceived(uint16_t sequence_number, bool received);
+    int FindFrame(uint32_t timestamp);
+    int AllocateFrame(uint32_t timestamp);
+    bool IsComplete(const FrameSlot& frame) const;
+    bool IsDecodable(const FrameSlot& frame) const;
+    bool IsStalled(int64_t now_ms) const;
+    void RequestKeyFrame(int64_t now_ms);
+    int FindNextFrame();
+    void ReleaseFrame(int index, bool dropped);
+    void FlushLocked();
+    uint8_t* SlotData(uint16_t sequence_number) const {
+        return slab_.get() +
+               static_cast<size_t>(sequence_number & (kMaxPackets - 1)) *
+               kMaxPayloadSize;
+    }
+
+    webrtc::scoped_ptr<webrtc::CriticalSectionWrapper> crit_;
+    webrtc::scoped_ptr<uint8_t, webrtc::AlignedFreeDeleter> slab_;
+    PacketSlot packets_[kMaxPackets];
+    uint64_t received_[kMaxPackets / 64];
+    FrameSlot frames_[kMaxFrames];
+    int num_frames_;
+    int last_frame_;
+
+    bool has_newest_;
+    uint16_t newest_sequence_number_;
+    bool has_decoded_;
+    uint16_t last_decoded_sequence_number_;
+    uint32_t last_decoded_timestamp_;
+    bool key_frame_request_;
+    //Requested and not yet extracted.
+    bool key_frame_pending_;
+    int64_t key_frame_request_time_ms_;
+
+    JitterBufferStatistics stats_;
+
+    VideoJitterBuffer(const VideoJitterBuffer&);
+    VideoJitterBuffer& operator=(const VideoJitterBuffer&);
+};
+
+#endif
@@ -0,0 +1,611 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#import <XCTest/XCTest.h>
+
+#include <string.h>
+#include <vector>
+#include "webrtc/modules/rtp_rtcp/source/forward_error_correction.h"
+#include "AudioFec.h"
+#include "BenchmarkUtil.h"
+#include "LossGenerator.h"
+
+namespace {
+
+//20ms of iLBC behind a 12 byte RTP header.
+enum { kRtpHeaderSize = 12 };
+enum { kVoicePayloadSize = 38 };
+enum { kPacketsPerSecond = 50 };
+//A packet recovered later than this is played out as concealment anyway,
+//about what NetEq waits for a voice packet.
+enum { kPlayoutDelayPackets = 3 };
+
+void MakeRtpPacket(uint16_t seq, size_t payload_size, uint8_t* packet) {
+    packet[0] = 0x80;
+    packet[1] = 102;
+    packet[2] = static_cast<uint8_t>(seq >> 8);
+    packet[3] = static_cast<uint8_t>(seq);
+    uint32_t timestamp = seq * 160u;
+    for (int i = 0; i < 4; i++) {
+        packet[4 + i] = static_cast<uint8_t>(timestamp >> (24 - 8 * i));
+        packet[8 + i] = static_cast<uint8_t>(0x12345678 >> (24 - 8 * i));
+    }
+    for (size_t i = 0; i < payload_size; i++) {
+        packet[kRtpHeaderSize + i] = static_cast<uint8_t>(seq * 31 + i * 7);
+    }
+}
+
+class RecordingCallback : public AudioFecDecoder::Callback {
+public:
+    RecordingCallback() : now_(0) {}
+
+    virtual void OnRecoveredPacket(const uint8_t* packet, size_t length) {
+        packets.push_back(std::vector<uint8_t>(packet, packet + length));
+        recovered_at.push_back(now_);
+    }
+
+    void set_now(int now) { now_ = now; }
+
+    std::vector<std::vector<uint8_t> > packets;
+    //Index of the voice packet being sent when each one was recovered.
+    std::vector<int> recovered_at;
+
+private:
+    int now_;
+};
+
+//Two state Gilbert-Elliott channel, losses come in runs of
+//1 / |leave_bad| packets on average.
+class BurstLossChannel {
+public:
+    BurstLossChannel(uint32_t seed, float loss_rate, float mean_burst)
+    : random_(seed),
+      bad_(false),
+      leave_bad_(1.0f / mean_burst),
+      enter_bad_(loss_rate * leave_bad_ / (1.0f - loss_rate)) {}
+
+    bool Lost() {
+        bad_ = bad_ ? !random_.Lost(leave_bad_) : random_.Lost(enter_bad_);
+        return bad_;
+    }
+
+private:
+    LossGenerator random_;
+    bool bad_;
+    float leave_bad_;
+    float enter_bad_;
+};
+
+struct TraceResult {
+    int concealed;
+    int voice_packets;
+    uint64_t media_bytes;
+    uint64_t fec_bytes;
+};
+
+//Sends |voice_packets| voice packets and their parity packets through the
+//channel. |group_size| 0 with |adaptive| set starts unprotected and lets
+//AudioFecController follow one loss report per second, as VOIPEngine does.
+TraceResult RunTrace(const AudioFecProtection& protection, bool adaptive,
+                     float loss_rate, float mean_burst, int voice_packets) {
+    AudioFecEncoder encoder;
+    encoder.SetProtection(protection);
+    AudioFecController controller;
+    RecordingCallback callback;
+    AudioFecDecoder decoder(&callback);
+    BurstLossChannel channel(7, loss_rate, mean_burst);
+
+    std::vector<bool> received(voice_packets, false);
+    uint8_t packet[kAudioFecMaxPacketSize];
+    uint8_t fec[kAudioFecHeaderSize + kAudioFecMaxPacketSize];
+    for (int i = 0; i < voice_packets; i++) {
+        callback.set_now(i);
+        uint16_t seq = static_cast<uint16_t>(i);
+        size_t length = kRtpHeaderSize + kVoicePayloadSize;
+        MakeRtpPacket(seq, kVoicePayloadSize, packet);
+        size_t fec_length = encoder.AddMediaPacket(packet, length, fec,
+                                                   sizeof(fec));
+        if (!channel.Lost()) {
+            received[i] = true;
+            decoder.OnMediaPacket(packet, length);
+        }
+        if (fec_length > 0 && !channel.Lost()) {
+            decoder.OnFecPacket(fec, fec_length);
+        }
+        if (adaptive && i % kPacketsPerSecond == kPacketsPerSecond - 1) {
+            uint8_t fraction_lost = 0;
+            uint8_t mean_burst_x10 = 0;
+            decoder.GetLossReport(&fraction_lost, &mean_burst_x10);
+            if (controller.OnLossReport(fraction_lost, mean_burst_x10)) {
+                encoder.SetProtection(controller.protection());
+            }
+        }
+    }
+
+    for (size_t i = 0; i < callback.packets.size(); i++) {
+        const std::vector<uint8_t>& p = callback.packets[i];
+        int seq = (p[2] << 8) | p[3];
+        if (callback.recovered_at[i] - seq <= kPlayoutDelayPackets) {
+            received[seq] = true;
+        }
+    }
+
+    TraceResult result;
+    result.concealed = 0;
+    for (int i = 0; i < voice_packets; i++) {
+        if (!received[i]) {
+            result.concealed++;
+        }
+    }
+    result.voice_packets = voice_packets;
+    result.media_bytes = encoder.media_bytes();
+    result.fec_bytes = encoder.fec_bytes();
+    return result;
+}
+
+AudioFecProtection Protection(int group_size, int stride) {
+    AudioFecProtection p;
+    p.group_size = group_size;
+    p.stride = stride;
+    return p;
+}
+
+//Media of one video-sized frame for the throughput benchmark.
+enum { kFramePacketSize = 1000 };
+enum { kFecSsrc = 0x12345678 };
+
+//Parity packets of one frame with groups of |group_size|. |stride| 2 is
+//the interleaved layout AudioFecController picks for bursty loss.
+void EncodeFrameAudioFec(const std::vector<std::vector<uint8_t> >& packets,
+                         int group_size, int stride,
+                         std::vector<std::vector<uint8_t> >* fec_packets) {
+    AudioFecEncoder encoder;
+    AudioFecProtection protection;
+    protection.group_size = group_size;
+    protection.stride = stride;
+    encoder.SetProtection(protection);
+    uint8_t fec[kAudioFecHeaderSize + kAudioFecMaxPacketSize];
+    fec_packets->clear();
+    for (size_t i = 0; i < packets.size(); i++) {
+        size_t n = encoder.AddMediaPacket(&packets[i][0], packets[i].size(),
+                                          fec, sizeof(fec));
+        if (n > 0) {
+            fec_packets->push_back(std::vector<uint8_t>(fec, fec + n));
+        }
+    }
+}
+
+//The same frame through webrtc::ForwardErrorCorrection, ULPFEC with the
+//random or bursty mask tables, returns the number of recovered packets.
+//DecodeFEC takes the received packets and the state is reset per frame.
+int RoundTripUlpfec(webrtc::ForwardErrorCorrection* fec,
+                    const webrtc::ForwardErrorCorrection::PacketList& media,
+                    uint8_t protection_factor,
+                    webrtc::FecMaskType mask_type) {
+    webrtc::ForwardErrorCorrection::PacketList fec_packets;
+    fec->GenerateFEC(media, protection_factor, 0, false, mask_type,
+                     &fec_packets);
+
+    webrtc::ForwardErrorCorrection::ReceivedPacketList received;
+    uint16_t seq = 0;
+    webrtc::ForwardErrorCorrection::PacketList::const_iterator it;
+    for (it = media.begin(); it != media.end(); ++it, ++seq) {
+        if (seq == 0) {
+            continue;
+        }
+        webrtc::ForwardErrorCorrection::ReceivedPacket* packet =
+            new webrtc::ForwardErrorCorrection::ReceivedPacket;
+        packet->pkt = new webrtc::ForwardErrorCorrection::Packet;
+        packet->pkt->length = (*it)->length;
+        memcpy(packet->pkt->data, (*it)->data, (*it)->length);
+        packet->seq_num = seq;
+        packet->ssrc = kFecSsrc;
+        packet->is_fec = false;
+        received.push_back(packet);
+    }
+    for (it = fec_packets.begin(); it != fec_packets.end(); ++it, ++seq) {
+        webrtc::ForwardErrorCorrection::ReceivedPacket* packet =
+            new webrtc::ForwardErrorCorrection::ReceivedPacket;
+        packet->pkt = new webrtc::ForwardErrorCorrection::Packet;
+        packet->pkt->length = (*it)->length;
+        memcpy(packet->pkt->data, (*it)->data, (*it)->length);
+        packet->seq_num = seq;
+        packet->ssrc = kFecSsrc;
+        packet->is_fec = true;
+        received.push_back(packet);
+    }
+
+    webrtc::ForwardErrorCorrection::RecoveredPacketList recovered;
+    fec->DecodeFEC(&received, &recovered);
+    int recovered_count = 0;
+    webrtc::ForwardErrorCorrection::RecoveredPacketList::iterator r;
+    for (r = recovered.begin(); r != recovered.end(); ++r) {
+        if ((*r)->was_recovered) {
+            recovered_count++;
+        }
+    }
+    fec->ResetState(&recovered);
+    return recovered_count;
+}
+
+}  // namespace
+
+@interface AudioFecTests : XCTestCase
+@end
+
+@implementation AudioFecTests
+
+- (void)testRecoversSingleLossByteExact {
+    uint8_t fec[kAudioFecHeaderSize + kAudioFecMaxPacketSize];
+    std::vector<std::vector<uint8_t> > packets;
+    for (int stride = 1; stride <= kAudioFecMaxStride; stride++) {
+        for (int group_size = 2; group_size <= kAudioFecMaxGroupSize;
+             group_size++) {
+            for (int lost = 0; lost < group_size; lost++) {
+                AudioFecEncoder encoder;
+                encoder.SetProtection(Protection(group_size, stride));
+                RecordingCallback callback;
+                AudioFecDecoder decoder(&callback);
+
+                //Lengths differ so the parity is zero padded.
+                packets.clear();
+                std::vector<uint8_t> first_fec;
+                for (int i = 0; i < group_size * stride; i++) {
+                    uint16_t seq = static_cast<uint16_t>(65530 + i);
+                    size_t payload = kVoicePayloadSize + i * 3;
+                    std::vector<uint8_t> p(kRtpHeaderSize + payload);
+                    MakeRtpPacket(seq, payload, &p[0]);
+                    packets.push_back(p);
+                    size_t n = encoder.AddMediaPacket(&p[0], p.size(), fec,
+                                                      sizeof(fec));
+                    //With a stride of two the second group closes after
+                    //the first, the lost packet is in the first.
+                    if (n > 0 && first_fec.empty()) {
+                        first_fec.assign(fec, fec + n);
+                    }
+                    if (i != lost * stride) {
+                        decoder.OnMediaPacket(&p[0], p.size());
+                    }
+                }
+                XCTAssertFalse(first_fec.empty());
+                decoder.OnFecPacket(&first_fec[0], first_fec.size());
+                XCTAssertEqual(callback.packets.size(), 1u,
+                               @"group %d stride %d lost %d", group_size,
+                               stride, lost);
+                if (callback.packets.size() == 1) {
+                    XCTAssertTrue(callback.packets[0] == packets[lost * stride]);
+                }
+                XCTAssertEqual(decoder.packets_recovered(), 1u);
+            }
+        }
+    }
+}
+
+- (void)testParityMatchesScalarXor {
+    //Every length from the header up covers the vector body and the tails.
+    uint8_t fec[kAudioFecHeaderSize + kAudioFecMaxPacketSize];
+    uint8_t a[kAudioFecMaxPacketSize];
+    uint8_t b[kAudioFecMaxPacketSize];
+    for (size_t length = kRtpHeaderSize; length <= kAudioFecMaxPacketSize;
+         length += (length < 200 ? 1 : 97)) {
+        size_t other = length > 40 ? length - 29 : length;
+        MakeRtpPacket(static_cast<uint16_t>(2 * length), length - kRtpHeaderSize,
+                      a);
+        MakeRtpPacket(static_cast<uint16_t>(2 * length + 1),
+                      other - kRtpHeaderSize, b);
+        AudioFecEncoder encoder;
+        encoder.SetProtection(Protection(2, 1));
+        XCTAssertEqual(encoder.AddMediaPacket(a, length, fec, sizeof(fec)), 0u);
+        XCTAssertEqual(encoder.AddMediaPacket(b, other, fec, sizeof(fec)),
+                       kAudioFecHeaderSize + length);
+
+        bool same = static_cast<size_t>(fec[4] << 8 | fec[5]) == (length ^ other);
+        for (size_t i = 0; i < length; i++) {
+            uint8_t expected = a[i] ^ (i < other ? b[i] : 0);
+            same = same && fec[kAudioFecHeaderSize + i] == expected;
+        }
+        XCTAssertTrue(same, @"length %d", static_cast<int>(length));
+    }
+}
+
+- (void)testPendingRingAcrossWrap {
+    //Parity for as many groups as the ring holds arrives ahead of the
+    //media, across the sequence number wrap, every group missing one packet.
+    static const int kGroups = 8;
+    AudioFecEncoder encoder;
+    encoder.SetProtection(Protection(4, 1));
+    RecordingCallback callback;
+    AudioFecDecoder decoder(&callback);
+    uint8_t packets[kGroups * 4][kRtpHeaderSize + kVoicePayloadSize];
+    uint8_t fec[kAudioFecHeaderSize + kAudioFecMaxPacketSize];
+    for (int i = 0; i < kGroups * 4; i++) {
+        MakeRtpPacket(static_cast<uint16_t>(65520 + i), kVoicePayloadSize,
+                      packets[i]);
+        size_t n = encoder.AddMediaPacket(packets[i], sizeof(packets[i]), fec,
+                                          sizeof(fec));
+        if (n > 0) {
+            decoder.OnFecPacket(fec, n);
+        }
+    }
+    for (int i = 0; i < kGroups * 4; i++) {
+        if (i % 4 != 1) {
+            decoder.OnMediaPacket(packets[i], sizeof(packets[i]));
+        }
+    }
+    XCTAssertEqual(callback.packets.size(), static_cast<size_t>(kGroups));
+    for (size_t i = 0; i < callback.packets.size(); i++) {
+        XCTAssertTrue(memcmp(&callback.packets[i][0], packets[i * 4 + 1],
+                             sizeof(packets[0])) == 0);
+    }
+}
+
+- (void)testParityBeforeMediaWaits {
+    AudioFecEncoder encoder;
+    encoder.SetProtection(Protection(4, 1));
+    RecordingCallback callback;
+    AudioFecDecoder decoder(&callback);
+    uint8_t packets[4][kRtpHeaderSize + kVoicePayloadSize];
+    uint8_t fec[kAudioFecHeaderSize + kAudioFecMaxPacketSize];
+    size_t fec_length = 0;
+    for (int i = 0; i < 4; i++) {
+        MakeRtpPacket(i, kVoicePayloadSize, packets[i]);
+        fec_length = encoder.AddMediaPacket(packets[i], sizeof(packets[i]),
+                                            fec, sizeof(fec));
+    }
+    XCTAssertTrue(fec_length > 0);
+
+    //Two missing, the parity is kept until one of them arrives.
+    decoder.OnMediaPacket(packets[0], sizeof(packets[0]));
+    decoder.OnMediaPacket(packets[3], sizeof(packets[3]));
+    decoder.OnFecPacket(fec, fec_length);
+    XCTAssertEqual(callback.packets.size(), 0u);
+    decoder.OnMediaPacket(packets[2], sizeof(packets[2]));
+    XCTAssertEqual(callback.packets.size(), 1u);
+    if (callback.packets.size() == 1) {
+        XCTAssertTrue(memcmp(&callback.packets[0][0], packets[1],
+                             sizeof(packets[1])) == 0);
+    }
+}
+
+- (void)testInterleavedRecoversBurstOfTwo {
+    AudioFecEncoder encoder;
+    encoder.SetProtection(Protection(3, 2));
+    RecordingCallback callback;
+    AudioFecDecoder decoder(&callback);
+    uint8_t packet[kRtpHeaderSize + kVoicePayloadSize];
+    uint8_t fec[kAudioFecHeaderSize + kAudioFecMaxPacketSize];
+    for (int i = 0; i < 6; i++) {
+        MakeRtpPacket(i, kVoicePayloadSize, packet);
+        size_t fec_length = encoder.AddMediaPacket(packet, sizeof(packet), fec,
+                                                   sizeof(fec));
+        if (i != 2 && i != 3) {
+            decoder.OnMediaPacket(packet, sizeof(packet));
+        }
+        if (fec_length > 0) {
+            decoder.OnFecPacket(fec, fec_length);
+        }
+    }
+    XCTAssertEqual(callback.packets.size(), 2u);
+    XCTAssertEqual(decoder.packets_lost(), 2u);
+    XCTAssertEqual(decoder.packets_recovered(), 2u);
+}
+
+- (void)testRejectsCorruptParity {
+    AudioFecEncoder encoder;
+    encoder.SetProtection(Protection(2, 1));
+    RecordingCallback callback;
+    AudioFecDecoder decoder(&callback);
+    uint8_t packet[kRtpHeaderSize + kVoicePayloadSize];
+    uint8_t fec[kAudioFecHeaderSize + kAudioFecMaxPacketSize];
+    MakeRtpPacket(0, kVoicePayloadSize, packet);
+    encoder.AddMediaPacket(packet, sizeof(packet), fec, sizeof(fec));
+    decoder.OnMediaPacket(packet, sizeof(packet));
+    MakeRtpPacket(1, kVoicePayloadSize, packet);
+    size_t fec_length = encoder.AddMediaPacket(packet, sizeof(packet), fec,
+                                               sizeof(fec));
+    XCTAssertTrue(fec_length > 0);
+
+    //A flipped bit in the covered sequence numbers gives a packet that is
+    //not the missing one.
+    fec[kAudioFecHeaderSize + 3] ^= 0x04;
+    decoder.OnFecPacket(fec, fec_length);
+    XCTAssertEqual(callback.packets.size(), 0u);
+
+    decoder.OnFecPacket(fec, kAudioFecHeaderSize);
+    XCTAssertEqual(callback.packets.size(), 0u);
+}
+
+- (void)testLossReportAndController {
+    RecordingCallback callback;
+    AudioFecDecoder decoder(&callback);
+    uint8_t packet[kRtpHeaderSize + kVoicePayloadSize];
+    //100 packets, two runs of two lost and one single loss.
+    for (int i = 0; i < 105; i++) {
+        if (i == 10 || i == 11 || i == 40 || i == 41 || i == 70) {
+            continue;
+        }
+        MakeRtpPacket(i, kVoicePayloadSize, packet);
+        decoder.OnMediaPacket(packet, sizeof(packet));
+    }
+    uint8_t fraction_lost = 0;
+    uint8_t mean_burst_x10 = 0;
+    decoder.GetLossReport(&fraction_lost, &mean_burst_x10);
+    XCTAssertEqual(fraction_lost, 5 * 256 / 105);
+    XCTAssertEqual(mean_burst_x10, 16);
+    decoder.GetLossReport(&fraction_lost, &mean_burst_x10);
+    XCTAssertEqual(fraction_lost, 0);
+
+    AudioFecController controller;
+    XCTAssertFalse(controller.OnLossReport(0, 0));
+    XCTAssertEqual(controller.protection().group_size, 0);
+    for (int i = 0; i < 10; i++) {
+        controller.OnLossReport(30, 25);
+    }
+    XCTAssertEqual(controller.protection().group_size, 2);
+    XCTAssertEqual(controller.protection().stride, 2);
+    for (int i = 0; i < 20; i++) {
+        controller.OnLossReport(0, 0);
+    }
+    XCTAssertEqual(controller.protection().group_size, 0);
+}
+
+//The loss-trace harness: concealed frames against the bytes spent on
+//parity, fixed protections and the adaptive controller, random and bursty
+//loss. Packets recovered after the playout delay count as concealed.
+- (void)testLossTraceConcealment {
+    static const int kVoicePackets = 60 * kPacketsPerSecond;
+    static const float kLossRates[] = { 0.02f, 0.05f, 0.10f, 0.20f };
+    static const float kBursts[] = { 1.0f, 2.5f };
+    static const int kGroupSizes[] = { 5, 3, 2 };
+    for (int b = 0; b < 2; b++) {
+        for (int l = 0; l < 4; l++) {
+            TraceResult none = RunTrace(Protection(0, 1), false, kLossRates[l],
+                                        kBursts[b], kVoicePackets);
+            double none_rate = 100.0 * none.concealed / none.voice_packets;
+            NSLog(@"fec %s loss %.0f%%: no fec %.2f%% concealed",
+                  b == 0 ? "random" : "bursty", kLossRates[l] * 100, none_rate);
+
+            for (int stride = 1; stride <= kAudioFecMaxStride; stride++) {
+                for (int g = 0; g < 3; g++) {
+                    TraceResult r = RunTrace(Protection(kGroupSizes[g], stride),
+                                             false, kLossRates[l], kBursts[b],
+                                             kVoicePackets);
+                    double rate = 100.0 * r.concealed / r.voice_packets;
+                    NSLog(@"  group %d stride %d: %.2f%% concealed (-%.2f), "
+                          "overhead %.1f%%", kGroupSizes[g], stride, rate,
+                          none_rate - rate, 100.0 * r.fec_bytes / r.media_bytes);
+                    XCTAssertTrue(r.concealed <= none.concealed);
+                }
+            }
+
+            TraceResult adaptive = RunTrace(Protection(0, 1), true,
+                                            kLossRates[l], kBursts[b],
+                                            kVoicePackets);
+            double rate = 100.0 * adaptive.concealed / adaptive.voice_packets;
+            NSLog(@"  adaptive: %.2f%% concealed (-%.2f), overhead %.1f%%",
+                  rate, none_rate - rate,
+                  100.0 * adaptive.fec_bytes / adaptive.media_bytes);
+            XCTAssertTrue(adaptive.concealed < none.concealed);
+        }
+    }
+}
+
+//Encode and decode throughput of one frame of 1-48 media packets with one
+//loss per parity group. AudioFec with consecutive and interleaved groups
+//against ULPFEC with the random and bursty mask tables at the same
+//overhead, one parity packet per four media packets.
+- (void)testBenchmarkFrameThroughput {
+    static const int kPacketCounts[] = { 1, 2, 4, 8, 12, 16, 24, 32, 48 };
+    static const uint8_t kProtectionFactor = 64;
+    static const char* kLayouts[] = { "random", "bursty" };
+    for (int c = 0; c < 9; c++) {
+        int num_packets = kPacketCounts[c];
+        int group_size = num_packets < 4 ? num_packets : 4;
+
+        std::vector<std::vector<uint8_t> > packets(num_packets);
+        webrtc::ForwardErrorCorrection::PacketList media;
+        for (int i = 0; i < num_packets; i++) {
+            packets[i].resize(kFramePacketSize);
+            MakeRtpPacket(static_cast<uint16_t>(i),
+                          kFramePacketSize - kRtpHeaderSize, &packets[i][0]);
+            webrtc::ForwardErrorCorrection::Packet* packet =
+                new webrtc::ForwardErrorCorrection::Packet;
+            packet->length = kFramePacketSize;
+            memcpy(packet->data, &packets[i][0], kFramePacketSize);
+            media.push_back(packet);
+        }
+        const std::vector<std::vector<uint8_t> >* media_packets = &packets;
+        const webrtc::ForwardErrorCorrection::PacketList* ulpfec_media = &media;
+        double frame_bytes = 1.0 * num_packets * kFramePacketSize;
+
+        for (int layout = 0; layout < 2; layout++) {
+            int stride = layout == 0 ? 1 : 2;
+            std::vector<std::vector<uint8_t> > fec_packets;
+            std::vector<std::vector<uint8_t> >* fp = &fec_packets;
+            double encode_ns = 0;
+            double decode_ns = 0;
+            if (group_size >= 2) {
+                encode_ns = MeasureNsPerCall(3, 200, ^{
+                    EncodeFrameAudioFec(*media_packets, group_size, stride, fp);
+                });
+                //A decoder per frame, as the ULPFEC state is reset per frame.
+                decode_ns = MeasureNsPerCall(3, 200, ^{
+                    AudioFecDecoder* decoder = new AudioFecDecoder(NULL);
+                    for (int i = 0; i < num_packets; i++) {
+                        if (i % (group_size * stride) >= stride) {
+                            decoder->OnMediaPacket(&(*media_packets)[i][0],
+                                                   kFramePacketSize);
+                        }
+                    }
+                    for (size_t i = 0; i < fp->size(); i++) {
+                        decoder->OnFecPacket(&(*fp)[i][0], (*fp)[i].size());
+                    }
+                    delete decoder;
+                });
+            }
+
+            webrtc::ForwardErrorCorrection ulpfec;
+            webrtc::ForwardErrorCorrection* u = &ulpfec;
+            webrtc::FecMaskType mask_type =
+                layout == 0 ? webrtc::kFecMaskRandom : webrtc::kFecMaskBursty;
+            webrtc::ForwardErrorCorrection::PacketList fec_list;
+            webrtc::ForwardErrorCorrection::PacketList* fl = &fec_list;
+            double ulpfec_encode_ns = MeasureNsPerCall(3, 200, ^{
+                fl->clear();
+                u->GenerateFEC(*ulpfec_media, kProtectionFactor, 0, false,
+                               mask_type, fl);
+            });
+            double ulpfec_round_trip_ns = MeasureNsPerCall(3, 200, ^{
+                RoundTripUlpfec(u, *ulpfec_media, kProtectionFactor, mask_type);
+            });
+
+            NSLog(@"fec %d packets %s: AudioFec encode %.0f MB/s decode %.0f "
+                  "MB/s, ULPFEC encode %.0f MB/s encode+decode %.0f MB/s",
+                  num_packets, kLayouts[layout],
+                  encode_ns > 0 ? frame_bytes * 1000 / encode_ns : 0,
+                  decode_ns > 0 ? frame_bytes * 1000 / decode_ns : 0,
+                  frame_bytes * 1000 / ulpfec_encode_ns,
+                  frame_bytes * 1000 / ulpfec_round_trip_ns);
+        }
+
+        while (!media.empty()) {
+            delete media.front();
+            media.pop_front();
+        }
+    }
+}
+
+- (void)testBenchmarkEncodeDecode {
+    uint8_t packet[kRtpHeaderSize + kVoicePayloadSize];
+    uint8_t fec[kAudioFecHeaderSize + kAudioFecMaxPacketSize];
+    uint8_t* p = packet;
+    uint8_t* f = fec;
+    for (int group_size = 2; group_size <= kAudioFecMaxGroupSize;
+         group_size *= 2) {
+        AudioFecEncoder encoder;
+        encoder.SetProtection(Protection(group_size, 1));
+        AudioFecEncoder* e = &encoder;
+        MakeRtpPacket(0, kVoicePayloadSize, packet);
+        double ns = MeasureNsPerCall(5, 10000, ^{
+            //Next sequence number, so the groups close.
+            if (++p[3] == 0) {
+                p[2]++;
+            }
+            e->AddMediaPacket(p, kRtpHeaderSize + kVoicePayloadSize, f,
+                              kAudioFecHeaderSize + kAudioFecMaxPacketSize);
+        });
+        NSLog(@"fec encode group %d: %.0f ns per voice packet", group_size, ns);
+    }
+
+    [self measureBlock:^{
+        TraceResult r = RunTrace(Protection(3, 2), false, 0.1f, 2.5f, 10000);
+        (void)r;
+    }];
+}
+
+@end
@@ -0,0 +1,232 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#import <XCTest/XCTest.h>
+
+#include <string.h>
+#include "webrtc/modules/interface/module_common_types.h"
+#include "webrtc/modules/utility/interface/audio_frame_operations.h"
+#include "AudioFrameOps.h"
+#include "BenchmarkUtil.h"
+
+//8, 16, 32, 44.1 and 48kHz, 44.1kHz also runs the scalar tail.
+static const int kSamplesPerChannel[] = { 80, 160, 320, 441, 480 };
+static const int kNumSizes = 5;
+
+static void FillFrame(int samples_per_channel, int num_channels,
+                      uint32_t seed, webrtc::AudioFrame* frame) {
+    frame->UpdateFrame(0, 0, NULL, samples_per_channel,
+                       samples_per_channel * 100,
+                       webrtc::AudioFrame::kNormalSpeech,
+                       webrtc::AudioFrame::kVadActive, num_channels);
+    for (int i = 0; i < samples_per_channel * num_channels; i++) {
+        seed = seed * 1103515245 + 12345;
+        frame->data_[i] = static_cast<int16_t>(seed >> 16);
+    }
+}
+
+static bool SameSamples(const webrtc::AudioFrame& a,
+                        const webrtc::AudioFrame& b) {
+    return a.num_channels_ == b.num_channels_ &&
+           a.samples_per_channel_ == b.samples_per_channel_ &&
+           memcmp(a.data_, b.data_, sizeof(int16_t) * a.samples_per_channel_ *
+                  a.num_channels_) == 0;
+}
+
+static int16_t Saturate(int32_t v) {
+    return static_cast<int16_t>(v > 32767 ? 32767 : (v < -32768 ? -32768 : v));
+}
+
+@interface AudioFrameOpsTests : XCTestCase
+@end
+
+@implementation AudioFrameOpsTests
+
+- (void)testMatchesAudioFrameOperations {
+    webrtc::AudioFrame expected;
+    webrtc::AudioFrame actual;
+    for (int s = 0; s < kNumSizes; s++) {
+        int samples = kSamplesPerChannel[s];
+
+        FillFrame(samples, 1, s, &expected);
+        actual.CopyFrom(expected);
+        XCTAssertEqual(webrtc::AudioFrameOperations::MonoToStereo(&expected),
+                       AudioFrameOps::MonoToStereo(&actual));
+        XCTAssertTrue(SameSamples(expected, actual), @"MonoToStereo %d", samples);
+
+        FillFrame(samples, 2, s, &expected);
+        actual.CopyFrom(expected);
+        XCTAssertEqual(webrtc::AudioFrameOperations::StereoToMono(&expected),
+                       AudioFrameOps::StereoToMono(&actual));
+        XCTAssertTrue(SameSamples(expected, actual), @"StereoToMono %d", samples);
+
+        FillFrame(samples, 2, s, &expected);
+        actual.CopyFrom(expected);
+        webrtc::AudioFrameOperations::SwapStereoChannels(&expected);
+        AudioFrameOps::SwapStereoChannels(&actual);
+        XCTAssertTrue(SameSamples(expected, actual), @"Swap %d", samples);
+
+        //Gains below one, above one the float to int16 cast of
+        //AudioFrameOperations::Scale is undefined.
+        FillFrame(samples, 2, s, &expected);
+        actual.CopyFrom(expected);
+        XCTAssertEqual(webrtc::AudioFrameOperations::Scale(0.7f, 0.25f, expected),
+                       AudioFrameOps::Scale(0.7f, 0.25f, &actual));
+        XCTAssertTrue(SameSamples(expected, actual), @"Scale %d", samples);
+
+        static const float kGains[] = { 0.0f, 0.5f, 1.0f, 1.7f, 4.0f, -2.5f };
+        for (int g = 0; g < 6; g++) {
+            for (int ch = 1; ch <= 2; ch++) {
+                FillFrame(samples, ch, s + g, &expected);
+                actual.CopyFrom(expected);
+                webrtc::AudioFrameOperations::ScaleWithSat(kGains[g], expected);
+                AudioFrameOps::ScaleWithSat(kGains[g], &actual);
+                XCTAssertTrue(SameSamples(expected, actual),
+                              @"ScaleWithSat %d %f", samples, kGains[g]);
+            }
+        }
+
+        FillFrame(samples, 2, s, &expected);
+        actual.CopyFrom(expected);
+        webrtc::AudioFrameOperations::Mute(expected);
+        AudioFrameOps::Mute(&actual);
+        XCTAssertTrue(SameSamples(expected, actual), @"Mute %d", samples);
+        XCTAssertEqual(actual.energy_, 0u);
+    }
+}
+
+- (void)testRejectsWrongChannels {
+    webrtc::AudioFrame frame;
+    FillFrame(160, 2, 1, &frame);
+    XCTAssertEqual(AudioFrameOps::MonoToStereo(&frame), -1);
+    FillFrame(160, 1, 1, &frame);
+    XCTAssertEqual(AudioFrameOps::StereoToMono(&frame), -1);
+    XCTAssertEqual(AudioFrameOps::Scale(1.0f, 1.0f, &frame), -1);
+
+    webrtc::AudioFrame other;
+    FillFrame(160, 2, 1, &other);
+    XCTAssertEqual(AudioFrameOps::ScaleAndAddWithSat(other, 1.0f, &frame), -1);
+}
+
+- (void)testScaleAndAddWithSat {
+    webrtc::AudioFrame src;
+    webrtc::AudioFrame dst;
+    webrtc::AudioFrame expected;
+    static const float kGains[] = { 0.0f, 0.3f, 1.0f, 2.0f, -1.5f };
+    for (int s = 0; s < kNumSizes; s++) {
+        for (int g = 0; g < 5; g++) {
+            int samples = kSamplesPerChannel[s];
+            FillFrame(samples, 2, s, &src);
+            FillFrame(samples, 2, s + 100, &dst);
+            expected.CopyFrom(dst);
+            for (int i = 0; i < samples * 2; i++) {
+                expected.data_[i] = Saturate(
+                    dst.data_[i] + static_cast<int32_t>(kGains[g] * src.data_[i]));
+            }
+            XCTAssertEqual(AudioFrameOps::ScaleAndAddWithSat(src, kGains[g],
+                                                             &dst), 0);
+            XCTAssertTrue(SameSamples(expected, dst), @"%d %f", samples,
+                          kGains[g]);
+        }
+    }
+}
+
+- (void)testMonoToStereoScaled {
+    webrtc::AudioFrame src;
+    int16_t actual[960];
+    int16_t expected[960];
+    for (int s = 0; s < kNumSizes; s++) {
+        int samples = kSamplesPerChannel[s];
+        FillFrame(samples, 1, s, &src);
+        AudioFrameOps::MonoToStereoScaled(src.data_, samples, 0.8f, 1.9f,
+                                          actual);
+        for (int i = 0; i < samples; i++) {
+            expected[2 * i] = Saturate(static_cast<int32_t>(0.8f * src.data_[i]));
+            expected[2 * i + 1] =
+                Saturate(static_cast<int32_t>(1.9f * src.data_[i]));
+        }
+        XCTAssertTrue(memcmp(actual, expected,
+                             samples * 2 * sizeof(int16_t)) == 0, @"%d",
+                      samples);
+    }
+}
+
+//ns per 10ms frame of each operation against AudioFrameOperations, and
+//the fused operations against the two passes they replace.
+- (void)testBenchmarkOperations {
+    webrtc::AudioFrame frame;
+    webrtc::AudioFrame other;
+    webrtc::AudioFrame* f = &frame;
+    webrtc::AudioFrame* o = &other;
+    for (int s = 0; s < kNumSizes; s++) {
+        int samples = kSamplesPerChannel[s];
+        FillFrame(samples, 2, s, &frame);
+        FillFrame(samples, 2, s + 1, &other);
+
+        double webrtc_ns = MeasureNsPerCall(5, 1000, ^{
+            webrtc::AudioFrameOperations::ScaleWithSat(1.001f, *f);
+        });
+        double ops_ns = MeasureNsPerCall(5, 1000, ^{
+            AudioFrameOps::ScaleWithSat(1.001f, f);
+        });
+        NSLog(@"ScaleWithSat %d Hz stereo: AudioFrameOperations %.0f ns, "
+              "AudioFrameOps %.0f ns", samples * 100, webrtc_ns, ops_ns);
+
+        webrtc_ns = MeasureNsPerCall(5, 1000, ^{
+            webrtc::AudioFrameOperations::SwapStereoChannels(f);
+        });
+        ops_ns = MeasureNsPerCall(5, 1000, ^{
+            AudioFrameOps::SwapStereoChannels(f);
+        });
+        NSLog(@"SwapStereoChannels %d Hz: AudioFrameOperations %.0f ns, "
+              "AudioFrameOps %.0f ns", samples * 100, webrtc_ns, ops_ns);
+
+        int16_t* mono = other.data_;
+        int16_t* stereo = frame.data_;
+        webrtc_ns = MeasureNsPerCall(5, 1000, ^{
+            webrtc::AudioFrameOperations::StereoToMono(stereo, samples, mono);
+        });
+        ops_ns = MeasureNsPerCall(5, 1000, ^{
+            AudioFrameOps::StereoToMono(stereo, samples, mono);
+        });
+        NSLog(@"StereoToMono %d Hz: AudioFrameOperations %.0f ns, "
+              "AudioFrameOps %.0f ns", samples * 100, webrtc_ns, ops_ns);
+
+        webrtc_ns = MeasureNsPerCall(5, 1000, ^{
+            webrtc::AudioFrameOperations::MonoToStereo(mono, samples, stereo);
+        });
+        ops_ns = MeasureNsPerCall(5, 1000, ^{
+            AudioFrameOps::MonoToStereo(mono, samples, stereo);
+        });
+        NSLog(@"MonoToStereo %d Hz: AudioFrameOperations %.0f ns, "
+              "AudioFrameOps %.0f ns", samples * 100, webrtc_ns, ops_ns);
+
+        FillFrame(samples, 2, s + 1, &other);
+        double two_pass_ns = MeasureNsPerCall(5, 1000, ^{
+            AudioFrameOps::ScaleWithSat(1.0f, o);
+            for (int i = 0; i < samples * 2; i++) {
+                f->data_[i] = Saturate(f->data_[i] + o->data_[i]);
+            }
+        });
+        double fused_ns = MeasureNsPerCall(5, 1000, ^{
+            AudioFrameOps::ScaleAndAddWithSat(*o, 1.0f, f);
+        });
+        NSLog(@"scale and add %d Hz stereo: two passes %.0f ns, fused %.0f ns",
+              samples * 100, two_pass_ns, fused_ns);
+    }
+
+    FillFrame(480, 2, 7, &frame);
+    FillFrame(480, 2, 8, &other);
+    [self measureBlock:^{
+        for (int i = 0; i < 10000; i++) {
+            AudioFrameOps::ScaleAndAddWithSat(*o, 0.5f, f);
+        }
+    }];
+}
+
+@end
@@ -0,0 +1,36 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#ifndef VOIP_BENCHMARK_UTIL_H
+#define VOIP_BENCHMARK_UTIL_H
+
+#include <stdint.h>
+#include "webrtc/system_wrappers/interface/tick_util.h"
+
+//Wall time of one call of |body| in nanoseconds, the best of |rounds|
+//rounds of |iterations| calls. XCTest's measureBlock reports one number per
+//test method, the sweeps over sizes and thread counts log one line per
+//point with this instead.
+template<typename Body>
+double MeasureNsPerCall(int rounds, int iterations, Body body) {
+    double best = -1;
+    for (int r = 0; r < rounds; r++) {
+        int64_t start = webrtc::TickTime::MicrosecondTimestamp();
+        for (int i = 0; i < iterations; i++) {
+            body();
+        }
+        int64_t elapsed = webrtc::TickTime::MicrosecondTimestamp() - start;
+        double ns = elapsed * 1000.0 / iterations;
+        if (best < 0 || ns < best) {
+            best = ns;
+        }
+    }
+    return best;
+}
+
+#endif
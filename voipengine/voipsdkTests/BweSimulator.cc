@@ -0,0 +1,285 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include "BweSimulator.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <dispatch/dispatch.h>
+#include "webrtc/system_wrappers/interface/tick_util.h"
+#include "DelayBasedBwe.h"
+#include "LossGenerator.h"
+#include "TransportFeedback.h"
+
+static const int64_t kStepUs = 1000;
+static const size_t kMaxFeedbackSize = 1500;
+
+static bool PointNotAfter(const LinkTracePoint& point, int64_t time_ms) {
+    return point.time_ms <= time_ms;
+}
+
+bool LinkTrace::Parse(const char* text, size_t length) {
+    const char* p = text;
+    const char* end = text + length;
+    while (p < end) {
+        const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (eol == NULL) {
+            eol = end;
+        }
+        char line[128];
+        size_t n = std::min(static_cast<size_t>(eol - p), sizeof(line) - 1);
+        memcpy(line, p, n);
+        line[n] = 0;
+        p = eol + 1;
+
+        char* comment = strchr(line, '#');
+        if (comment) {
+            *comment = 0;
+        }
+        long long time_ms = 0;
+        int capacity_kbps = 0;
+        int delay_ms = 0;
+        float loss_percent = 0;
+        int fields = sscanf(line, "%lld %d %d %f", &time_ms, &capacity_kbps,
+                            &delay_ms, &loss_percent);
+        if (fields <= 0) {
+            //Blank line.
+            continue;
+        }
+        if (fields < 3 || capacity_kbps <= 0 || delay_ms < 0 ||
+            (!points_.empty() && time_ms <= points_.back().time_ms)) {
+            return false;
+        }
+        LinkTracePoint point;
+        point.time_ms = time_ms;
+        point.capacity_bps = capacity_kbps * 1000;
+        point.delay_ms = delay_ms;
+        point.loss_rate = fields == 4 ? loss_percent / 100 : 0;
+        points_.push_back(point);
+    }
+    return !points_.empty();
+}
+
+void LinkTrace::AddPoint(const LinkTracePoint& point) {
+    points_.push_back(point);
+}
+
+int64_t LinkTrace::duration_ms() const {
+    return points_.empty() ? 0 : points_.back().time_ms;
+}
+
+const LinkTracePoint& LinkTrace::At(int64_t time_ms) const {
+    std::vector<LinkTracePoint>::const_iterator it =
+        std::lower_bound(points_.begin(), points_.end(), time_ms,
+                         PointNotAfter);
+    if (it == points_.begin()) {
+        return *it;
+    }
+    return *(it - 1);
+}
+
+namespace {
+
+struct InFlight {
+    uint16_t seq;
+    int64_t arrival_us;
+};
+
+struct FeedbackInFlight {
+    int64_t arrival_us;
+    size_t length;
+    uint8_t data[kMaxFeedbackSize];
+};
+
+struct RunAllContext {
+    const BweScenario* scenarios;
+    BweScenarioResult* results;
+};
+
+void RunScenario(void* context, size_t index) {
+    RunAllContext* all = static_cast<RunAllContext*>(context);
+    BweSimulator::Run(all->scenarios[index], &all->results[index]);
+}
+
+}  // namespace
+
+void BweSimulator::Run(const BweScenario& scenario,
+                       BweScenarioResult* result) {
+    memset(result, 0, sizeof(*result));
+    result->name = scenario.name;
+    if (scenario.trace == NULL || scenario.trace->empty() ||
+        scenario.packet_size <= 0) {
+        return;
+    }
+    int64_t duration_ms = scenario.duration_ms > 0 ?
+                          scenario.duration_ms : scenario.trace->duration_ms();
+    int64_t duration_us = duration_ms * 1000;
+    int64_t feedback_interval_us = std::max(scenario.feedback_interval_ms, 1) *
+                                   1000;
+
+    DelayBasedBwe bwe(scenario.start_bitrate_bps, scenario.min_bitrate_bps,
+                      scenario.max_bitrate_bps);
+    TransportFeedbackGenerator generator(0, 0);
+    LossGenerator loss(scenario.seed);
+    std::deque<InFlight> packets;
+    std::deque<FeedbackInFlight> feedbacks;
+
+    int64_t link_free_us = 0;
+    //The link delivers in order, a drop of the delay holds packets behind
+    //the ones already on the way instead of reordering the queues.
+    int64_t last_arrival_us = 0;
+    int64_t last_feedback_arrival_us = 0;
+    int64_t next_send_us = 0;
+    int64_t next_feedback_us = feedback_interval_us;
+    uint16_t seq = 0;
+    uint64_t delivered_bits = 0;
+    double capacity_integral = 0;
+    double target_integral = 0;
+    int64_t queue_delay_sum_us = 0;
+    int min_target = bwe.target_bitrate_bps();
+    int max_target = min_target;
+
+    for (int64_t now_us = 0; now_us < duration_us; now_us += kStepUs) {
+        const LinkTracePoint& link = scenario.trace->At(now_us / 1000);
+        int target = bwe.target_bitrate_bps();
+
+        while (next_send_us <= now_us) {
+            int64_t start_us = webrtc::TickTime::MicrosecondTimestamp();
+            bwe.OnPacketSent(seq, scenario.packet_size, now_us / 1000);
+            result->estimator_time_us +=
+                webrtc::TickTime::MicrosecondTimestamp() - start_us;
+            result->packets_sent++;
+
+            int64_t queue_us = std::max<int64_t>(link_free_us - now_us, 0);
+            queue_delay_sum_us += queue_us;
+            result->max_queue_delay_ms = std::max(result->max_queue_delay_ms,
+                static_cast<int>(queue_us / 1000));
+            if (loss.Lost(link.loss_rate) ||
+                queue_us > scenario.queue_limit_ms * 1000) {
+                result->packets_lost++;
+            } else {
+                link_free_us = std::max(link_free_us, now_us) +
+                    static_cast<int64_t>(scenario.packet_size) * 8 * 1000000 /
+                    link.capacity_bps;
+                InFlight packet;
+                packet.seq = seq;
+                packet.arrival_us = std::max(last_arrival_us,
+                    link_free_us + link.delay_ms * 1000);
+                last_arrival_us = packet.arrival_us;
+                packets.push_back(packet);
+            }
+            seq++;
+            next_send_us += static_cast<int64_t>(scenario.packet_size) * 8 *
+                            1000000 / std::max(target, 1);
+        }
+
+        while (!packets.empty() && packets.front().arrival_us <= now_us) {
+            generator.OnPacketArrival(packets.front().seq,
+                                      packets.front().arrival_us);
+            delivered_bits += scenario.packet_size * 8;
+            packets.pop_front();
+        }
+
+        if (now_us >= next_feedback_us) {
+            next_feedback_us += feedback_interval_us;
+            for (;;) {
+                FeedbackInFlight feedback;
+                feedback.length = generator.BuildFeedback(feedback.data,
+                                                          sizeof(feedback.data));
+                if (feedback.length == 0) {
+                    break;
+                }
+                feedback.arrival_us = std::max(last_feedback_arrival_us,
+                    now_us + link.delay_ms * 1000);
+                last_feedback_arrival_us = feedback.arrival_us;
+                feedbacks.push_back(feedback);
+                result->feedback_messages++;
+            }
+        }
+
+        while (!feedbacks.empty() && feedbacks.front().arrival_us <= now_us) {
+            TransportFeedback feedback;
+            int64_t start_us = webrtc::TickTime::MicrosecondTimestamp();
+            if (feedback.Parse(feedbacks.front().data,
+                               feedbacks.front().length)) {
+                bwe.OnTransportFeedback(feedback, now_us / 1000);
+            }
+            result->estimator_time_us +=
+                webrtc::TickTime::MicrosecondTimestamp() - start_us;
+            feedbacks.pop_front();
+        }
+
+        target = bwe.target_bitrate_bps();
+        min_target = std::min(min_target, target);
+        max_target = std::max(max_target, target);
+        capacity_integral += link.capacity_bps;
+        target_integral += target;
+    }
+
+    int64_t steps = std::max<int64_t>(duration_us / kStepUs, 1);
+    result->duration_ms = duration_ms;
+    result->mean_capacity_kbps = static_cast<int>(capacity_integral / steps /
+                                                  1000);
+    result->mean_target_kbps = static_cast<int>(target_integral / steps / 1000);
+    result->min_target_kbps = min_target / 1000;
+    result->max_target_kbps = max_target / 1000;
+    if (capacity_integral > 0) {
+        result->utilization_percent = static_cast<int>(
+            delivered_bits * 100 * (1000000.0 / kStepUs) / capacity_integral);
+    }
+    if (result->packets_sent > 0) {
+        result->mean_queue_delay_ms = static_cast<int>(
+            queue_delay_sum_us / result->packets_sent / 1000);
+    }
+    result->estimator_state_bytes = sizeof(DelayBasedBwe);
+}
+
+void BweSimulator::RunAll(const BweScenario* scenarios, int count,
+                          BweScenarioResult* results) {
+    RunAllContext context;
+    context.scenarios = scenarios;
+    context.results = results;
+    dispatch_apply_f(count,
+                     dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+                     &context, RunScenario);
+}
+
+int BweSimulator::FormatHeader(bool with_timing, char* buffer,
+                               size_t capacity) {
+    return snprintf(buffer, capacity,
+                    "name,duration_ms,packets_sent,packets_lost,"
+                    "feedback_messages,mean_capacity_kbps,mean_target_kbps,"
+                    "min_target_kbps,max_target_kbps,utilization_percent,"
+                    "mean_queue_delay_ms,max_queue_delay_ms,"
+                    "estimator_state_bytes%s\n",
+                    with_timing ? ",estimator_time_us" : "");
+}
+
+int BweSimulator::FormatResult(const BweScenarioResult& result,
+                               bool with_timing, char* buffer,
+                               size_t capacity) {
+    char timing[32] = "";
+    if (with_timing) {
+        snprintf(timing, sizeof(timing), ",%lld",
+                 static_cast<long long>(result.estimator_time_us));
+    }
+    return snprintf(buffer, capacity,
+                    "%s,%lld,%llu,%llu,%llu,%d,%d,%d,%d,%d,%d,%d,%d%s\n",
+                    result.name ? result.name : "",
+                    static_cast<long long>(result.duration_ms),
+                    static_cast<unsigned long long>(result.packets_sent),
+                    static_cast<unsigned long long>(result.packets_lost),
+                    static_cast<unsigned long long>(result.feedback_messages),
+                    result.mean_capacity_kbps, result.mean_target_kbps,
+                    result.min_target_kbps, result.max_target_kbps,
+                    result.utilization_percent, result.mean_queue_delay_ms,
+                    result.max_queue_delay_ms, result.estimator_state_bytes,
+                    timing);
+}
@@ -0,0 +1,99 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#ifndef VOIP_BWE_SIMULATOR_H
+#define VOIP_BWE_SIMULATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+//Capacity, one way delay and random loss of a link over time, e.g. a
+//recorded cellular or Wi-Fi trace. A point holds until the next one.
+struct LinkTracePoint {
+    int64_t time_ms;
+    int capacity_bps;
+    int delay_ms;
+    //0 to 1.
+    float loss_rate;
+};
+
+class LinkTrace {
+public:
+    //One point per line, "time_ms capacity_kbps delay_ms loss_percent",
+    //'#' starts a comment. Times must increase. Returns false on a
+    //malformed line.
+    bool Parse(const char* text, size_t length);
+    void AddPoint(const LinkTracePoint& point);
+
+    bool empty() const { return points_.empty(); }
+    int64_t duration_ms() const;
+    //The point in effect at |time_ms|, the first one before the trace
+    //starts. Const, so parallel scenarios may share a trace.
+    const LinkTracePoint& At(int64_t time_ms) const;
+
+private:
+    std::vector<LinkTracePoint> points_;
+};
+
+struct BweScenario {
+    const char* name;
+    const LinkTrace* trace;
+    //0 runs up to the last trace point.
+    int64_t duration_ms;
+    int start_bitrate_bps;
+    int min_bitrate_bps;
+    int max_bitrate_bps;
+    int packet_size;
+    int feedback_interval_ms;
+    //Tail drop once the bottleneck queue holds this much.
+    int queue_limit_ms;
+    //Seeds the loss pattern, equal seeds give equal runs.
+    uint32_t seed;
+};
+
+struct BweScenarioResult {
+    const char* name;
+    int64_t duration_ms;
+    uint64_t packets_sent;
+    uint64_t packets_lost;
+    uint64_t feedback_messages;
+    int mean_capacity_kbps;
+    int mean_target_kbps;
+    int min_target_kbps;
+    int max_target_kbps;
+    //Delivered bits over the capacity integral, in percent.
+    int utilization_percent;
+    int mean_queue_delay_ms;
+    int max_queue_delay_ms;
+    //Time spent parsing feedback and inside the estimator, and the
+    //estimator's fixed state size. It does not allocate after construction.
+    int64_t estimator_time_us;
+    int estimator_state_bytes;
+};
+
+//Replays link traces through DelayBasedBwe: the sender transmits at the
+//estimate, the packets cross a single bottleneck queue and the receiver
+//answers with TransportFeedback over an uncongested return path. Runs are
+//deterministic so results can be diffed across builds to catch rate
+//control and performance regressions.
+class BweSimulator {
+public:
+    static void Run(const BweScenario& scenario, BweScenarioResult* result);
+    //Scenarios run in parallel, one per core.
+    static void RunAll(const BweScenario* scenarios, int count,
+                       BweScenarioResult* results);
+
+    //Comma separated, one line per result with a header line, no timing
+    //columns when |with_timing| is false so the output diffs exactly.
+    static int FormatHeader(bool with_timing, char* buffer, size_t capacity);
+    static int FormatResult(const BweScenarioResult& result, bool with_timing,
+                            char* buffer, size_t capacity);
+};
+
+#endif
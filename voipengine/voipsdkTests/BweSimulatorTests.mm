@@ -0,0 +1,200 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#import <XCTest/XCTest.h>
+
+#include <string.h>
+#include "webrtc/system_wrappers/interface/tick_util.h"
+#include "BweSimulator.h"
+
+namespace {
+
+//Time ms, capacity kbps, one way delay ms, loss percent.
+const char kSteadyTrace[] =
+    "0 1500 50\n"
+    "60000 1500 50\n";
+const char kCapacityDropTrace[] =
+    "0 2000 40\n"
+    "30000 500 40  # the bottleneck drops to a quarter\n"
+    "60000 500 40\n";
+const char kDelayDropTrace[] =
+    "0 1500 300\n"
+    "20000 1500 20 # a route change\n"
+    "40000 1500 20\n";
+const char kLossyTrace[] =
+    "0 1500 60 3\n"
+    "60000 1500 60 3\n";
+const char kCellularTrace[] =
+    "# capacity and delay of a moving cellular uplink\n"
+    "0 1200 60\n"
+    "5000 800 90 1\n"
+    "10000 1800 50\n"
+    "15000 400 150 2\n"
+    "20000 1000 80\n"
+    "25000 2500 40\n"
+    "30000 600 120 1\n"
+    "40000 1500 60\n";
+
+enum { kNumScenarios = 5 };
+
+BweScenario MakeScenario(const char* name, const LinkTrace* trace) {
+    BweScenario scenario;
+    scenario.name = name;
+    scenario.trace = trace;
+    scenario.duration_ms = 0;
+    scenario.start_bitrate_bps = 300000;
+    scenario.min_bitrate_bps = 50000;
+    scenario.max_bitrate_bps = 5000000;
+    scenario.packet_size = 1200;
+    scenario.feedback_interval_ms = 100;
+    scenario.queue_limit_ms = 500;
+    scenario.seed = 1;
+    return scenario;
+}
+
+bool ParseTrace(const char* text, LinkTrace* trace) {
+    return trace->Parse(text, strlen(text));
+}
+
+bool SameResult(const BweScenarioResult& a, const BweScenarioResult& b) {
+    char line_a[256];
+    char line_b[256];
+    BweSimulator::FormatResult(a, false, line_a, sizeof(line_a));
+    BweSimulator::FormatResult(b, false, line_b, sizeof(line_b));
+    return strcmp(line_a, line_b) == 0;
+}
+
+}  // namespace
+
+@interface BweSimulatorTests : XCTestCase
+@end
+
+@implementation BweSimulatorTests
+
+- (void)testParseTrace {
+    LinkTrace trace;
+    XCTAssertTrue(ParseTrace(kCellularTrace, &trace));
+    XCTAssertEqual(trace.duration_ms(), 40000);
+    XCTAssertEqual(trace.At(-5).capacity_bps, 1200000);
+    XCTAssertEqual(trace.At(4999).capacity_bps, 1200000);
+    XCTAssertEqual(trace.At(5000).delay_ms, 90);
+    XCTAssertEqual(trace.At(16000).loss_rate, 0.02f);
+    XCTAssertEqual(trace.At(100000).capacity_bps, 1500000);
+
+    LinkTrace bad;
+    XCTAssertFalse(ParseTrace("0 1000 50\n0 1000 50\n", &bad));
+    LinkTrace no_capacity;
+    XCTAssertFalse(ParseTrace("0 0 50\n", &no_capacity));
+    LinkTrace empty;
+    XCTAssertFalse(ParseTrace("# nothing\n\n", &empty));
+}
+
+- (void)testRunIsDeterministic {
+    LinkTrace trace;
+    ParseTrace(kCellularTrace, &trace);
+    BweScenario scenarios[3];
+    for (int i = 0; i < 3; i++) {
+        scenarios[i] = MakeScenario("cellular", &trace);
+    }
+    scenarios[2].seed = 2;
+    BweScenarioResult serial;
+    BweSimulator::Run(scenarios[0], &serial);
+    BweScenarioResult parallel[3];
+    BweSimulator::RunAll(scenarios, 3, parallel);
+    XCTAssertTrue(SameResult(serial, parallel[0]));
+    XCTAssertTrue(SameResult(serial, parallel[1]));
+    //Another loss pattern.
+    XCTAssertFalse(SameResult(serial, parallel[2]));
+}
+
+- (void)testSteadyLinkIsUsed {
+    LinkTrace trace;
+    ParseTrace(kSteadyTrace, &trace);
+    BweScenarioResult result;
+    BweSimulator::Run(MakeScenario("steady", &trace), &result);
+    XCTAssertEqual(result.packets_lost, 0u);
+    XCTAssertTrue(result.utilization_percent >= 60, @"%d%%",
+                  result.utilization_percent);
+    XCTAssertTrue(result.max_target_kbps <= 2 * 1500);
+    XCTAssertTrue(result.mean_queue_delay_ms < 100);
+}
+
+- (void)testFollowsCapacityDrop {
+    LinkTrace trace;
+    ParseTrace(kCapacityDropTrace, &trace);
+    BweScenario scenario = MakeScenario("capacity drop", &trace);
+    BweScenarioResult before;
+    scenario.duration_ms = 30000;
+    BweSimulator::Run(scenario, &before);
+    BweScenarioResult after;
+    scenario.duration_ms = 0;
+    BweSimulator::Run(scenario, &after);
+
+    //The queue built by the drop is drained, not held at the tail drop
+    //limit for the rest of the call.
+    XCTAssertTrue(after.mean_queue_delay_ms < 150, @"%d ms",
+                  after.mean_queue_delay_ms);
+    XCTAssertTrue(after.packets_lost - before.packets_lost <
+                  after.packets_sent / 20);
+}
+
+- (void)testDelayDropIsNotCongestion {
+    //Packets sent after the delay drops queue behind those already on the
+    //way, the link does not reorder them. A shorter path is no reason to
+    //back off.
+    LinkTrace trace;
+    ParseTrace(kDelayDropTrace, &trace);
+    BweScenarioResult result;
+    BweSimulator::Run(MakeScenario("delay drop", &trace), &result);
+    XCTAssertEqual(result.packets_lost, 0u);
+    XCTAssertTrue(result.min_target_kbps >= 300, @"%d kbps",
+                  result.min_target_kbps);
+}
+
+//The scenario set in parallel, as CSV with the estimator time, so runs
+//can be diffed across builds.
+- (void)testBenchmarkScenarios {
+    LinkTrace traces[kNumScenarios];
+    ParseTrace(kSteadyTrace, &traces[0]);
+    ParseTrace(kCapacityDropTrace, &traces[1]);
+    ParseTrace(kDelayDropTrace, &traces[2]);
+    ParseTrace(kLossyTrace, &traces[3]);
+    ParseTrace(kCellularTrace, &traces[4]);
+    static const char* kNames[kNumScenarios] = {
+        "steady", "capacity_drop", "delay_drop", "lossy", "cellular"
+    };
+    BweScenario scenarios[kNumScenarios];
+    for (int i = 0; i < kNumScenarios; i++) {
+        scenarios[i] = MakeScenario(kNames[i], &traces[i]);
+    }
+    BweScenarioResult results[kNumScenarios];
+
+    int64_t start = webrtc::TickTime::MicrosecondTimestamp();
+    BweSimulator::RunAll(scenarios, kNumScenarios, results);
+    int64_t elapsed_us = webrtc::TickTime::MicrosecondTimestamp() - start;
+
+    //The lines end in a newline, NSLog adds its own.
+    char line[256];
+    int n = BweSimulator::FormatHeader(true, line, sizeof(line));
+    NSLog(@"%.*s", n - 1, line);
+    for (int i = 0; i < kNumScenarios; i++) {
+        n = BweSimulator::FormatResult(results[i], true, line, sizeof(line));
+        NSLog(@"%.*s", n - 1, line);
+        XCTAssertTrue(results[i].packets_sent > 0);
+    }
+    NSLog(@"bwe simulator: %d scenarios in %lld ms", kNumScenarios,
+          static_cast<long long>(elapsed_us / 1000));
+
+    BweScenario* s = scenarios;
+    BweScenarioResult* r = results;
+    [self measureBlock:^{
+        BweSimulator::RunAll(s, kNumScenarios, r);
+    }];
+}
+
+@end
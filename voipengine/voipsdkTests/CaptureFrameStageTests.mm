@@ -0,0 +1,230 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#import <XCTest/XCTest.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "libyuv/scale.h"
+#include "BenchmarkUtil.h"
+#include "CaptureFrameStage.h"
+
+namespace {
+
+//A gradient with noise in NV12, as the camera delivers it.
+void MakeNV12(int width, int height, std::vector<uint8_t>* frame) {
+    int chroma_width = (width + 1) / 2;
+    int chroma_height = (height + 1) / 2;
+    frame->resize(width * height + 2 * chroma_width * chroma_height);
+    uint32_t seed = 1;
+    for (size_t i = 0; i < frame->size(); i++) {
+        seed = seed * 1103515245 + 12345;
+        (*frame)[i] = static_cast<uint8_t>(i * 3 / width + ((seed >> 16) & 15));
+    }
+}
+
+//The same picture with the chroma planes split, |swap| gives NV21 instead.
+void ConvertNV12(const std::vector<uint8_t>& nv12, int width, int height,
+                 bool swap, std::vector<uint8_t>* frame) {
+    int chroma_size = ((width + 1) / 2) * ((height + 1) / 2);
+    const uint8_t* uv = &nv12[width * height];
+    frame->assign(nv12.begin(), nv12.begin() + width * height);
+    frame->resize(nv12.size());
+    uint8_t* dst = &(*frame)[width * height];
+    for (int i = 0; i < chroma_size; i++) {
+        if (swap) {
+            dst[2 * i] = uv[2 * i + 1];
+            dst[2 * i + 1] = uv[2 * i];
+        } else {
+            dst[i] = uv[2 * i];
+            dst[chroma_size + i] = uv[2 * i + 1];
+        }
+    }
+}
+
+bool SamePicture(const I420Buffer& a, const I420Buffer& b) {
+    if (a.width() != b.width() || a.height() != b.height()) {
+        return false;
+    }
+    for (int i = 0; i < I420Buffer::kNumPlanes; i++) {
+        webrtc::PlaneType plane = I420Buffer::kPlanes[i];
+        int shift = plane == webrtc::kYPlane ? 0 : 1;
+        int width = (a.width() + shift) >> shift;
+        int height = (a.height() + shift) >> shift;
+        for (int y = 0; y < height; y++) {
+            if (memcmp(a.data(plane) + y * a.stride(plane),
+                       b.data(plane) + y * b.stride(plane), width) != 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+//The passes VideoCaptureImpl and VPMSimpleSpatialResampler make: the
+//capture converted and rotated into a full size frame, which is then
+//scaled to the send size.
+void ConvertSeparately(const std::vector<uint8_t>& nv12, int width, int height,
+                       webrtc::VideoRotationMode rotation,
+                       webrtc::I420VideoFrame* rotated, I420Buffer* dst) {
+    bool turned = rotation == webrtc::kRotate90;
+    int rotated_width = turned ? height : width;
+    int rotated_height = turned ? width : height;
+    int half_width = (rotated_width + 1) / 2;
+    rotated->CreateEmptyFrame(rotated_width, rotated_height, rotated_width,
+                              half_width, half_width);
+    webrtc::ConvertToI420(webrtc::kNV12, &nv12[0], 0, 0, width, height,
+                          nv12.size(), rotation, rotated);
+    for (int i = 0; i < I420Buffer::kNumPlanes; i++) {
+        webrtc::PlaneType plane = I420Buffer::kPlanes[i];
+        int shift = plane == webrtc::kYPlane ? 0 : 1;
+        libyuv::ScalePlane(rotated->buffer(plane), rotated->stride(plane),
+                           (rotated_width + shift) >> shift,
+                           (rotated_height + shift) >> shift,
+                           dst->MutableData(plane), dst->stride(plane),
+                           (dst->width() + shift) >> shift,
+                           (dst->height() + shift) >> shift,
+                           libyuv::kFilterBox);
+    }
+}
+
+}  // namespace
+
+@interface CaptureFrameStageTests : XCTestCase
+@end
+
+@implementation CaptureFrameStageTests
+
+- (void)testFormatsGiveTheSamePicture {
+    static const int kWidth = 640;
+    static const int kHeight = 360;
+    std::vector<uint8_t> nv12;
+    std::vector<uint8_t> nv21;
+    std::vector<uint8_t> i420;
+    MakeNV12(kWidth, kHeight, &nv12);
+    ConvertNV12(nv12, kWidth, kHeight, true, &nv21);
+    ConvertNV12(nv12, kWidth, kHeight, false, &i420);
+
+    I420BufferPool pool;
+    CaptureFrameStage stage(&pool);
+    stage.SetOutput(180, 320, webrtc::kRotate90);
+    webrtc::scoped_refptr<I420Buffer> a = stage.IncomingFrame(
+        &nv12[0], nv12.size(), kWidth, kHeight, webrtc::kNV12, 1000);
+    webrtc::scoped_refptr<I420Buffer> b = stage.IncomingFrame(
+        &nv21[0], nv21.size(), kWidth, kHeight, webrtc::kNV21, 1033);
+    webrtc::scoped_refptr<I420Buffer> c = stage.IncomingFrame(
+        &i420[0], i420.size(), kWidth, kHeight, webrtc::kI420, 1066);
+    XCTAssertTrue(a.get() != NULL && b.get() != NULL && c.get() != NULL);
+    XCTAssertEqual(a->width(), 180);
+    XCTAssertEqual(a->height(), 320);
+    XCTAssertEqual(a->timestamp(), 90000u);
+    XCTAssertEqual(a->render_time_ms(), 1000);
+    XCTAssertTrue(SamePicture(*a, *b));
+    XCTAssertTrue(SamePicture(*a, *c));
+
+    CaptureStageStatistics stats = stage.GetStatistics();
+    XCTAssertEqual(stats.frames, 3u);
+    XCTAssertEqual(stats.frames_fused, 3u);
+}
+
+//The fused path gives the picture of the separate passes at exact halves,
+//where both use the same 2x2 box.
+- (void)testMatchesSeparatePasses {
+    static const int kWidth = 1280;
+    static const int kHeight = 720;
+    std::vector<uint8_t> nv12;
+    MakeNV12(kWidth, kHeight, &nv12);
+    I420BufferPool pool;
+    CaptureFrameStage stage(&pool);
+    stage.SetOutput(360, 640, webrtc::kRotate90);
+    webrtc::scoped_refptr<I420Buffer> fused = stage.IncomingFrame(
+        &nv12[0], nv12.size(), kWidth, kHeight, webrtc::kNV12, 0);
+    webrtc::I420VideoFrame rotated;
+    webrtc::scoped_refptr<I420Buffer> separate = pool.CreateBuffer(360, 640);
+    ConvertSeparately(nv12, kWidth, kHeight, webrtc::kRotate90, &rotated,
+                      separate.get());
+    XCTAssertTrue(fused.get() != NULL);
+    XCTAssertTrue(SamePicture(*fused, *separate));
+}
+
+- (void)testFallsBackForOtherRotations {
+    static const int kWidth = 640;
+    static const int kHeight = 360;
+    std::vector<uint8_t> nv12;
+    MakeNV12(kWidth, kHeight, &nv12);
+    I420BufferPool pool;
+    CaptureFrameStage stage(&pool);
+    stage.SetOutput(0, 0, webrtc::kRotate270);
+    webrtc::scoped_refptr<I420Buffer> frame = stage.IncomingFrame(
+        &nv12[0], nv12.size(), kWidth, kHeight, webrtc::kNV12, 0);
+    XCTAssertTrue(frame.get() != NULL);
+    XCTAssertEqual(frame->width(), kHeight);
+    XCTAssertEqual(frame->height(), kWidth);
+    CaptureStageStatistics stats = stage.GetStatistics();
+    XCTAssertEqual(stats.frames, 1u);
+    XCTAssertEqual(stats.frames_fused, 0u);
+    XCTAssertTrue(stage.IncomingFrame(&nv12[0], nv12.size(), 0, kHeight,
+                                      webrtc::kNV12, 0).get() == NULL);
+}
+
+//Time per NV12 capture, 720p to QVGA and 1080p to 360p, upright and turned
+//for a portrait phone, fused against the separate passes.
+- (void)testBenchmarkNsPerFrame {
+    static const int kCases[][4] = {
+        { 1280, 720, 320, 240 }, { 1280, 720, 240, 320 },
+        { 1920, 1080, 640, 360 }, { 1920, 1080, 360, 640 },
+    };
+    I420BufferPool pool;
+    for (int k = 0; k < 4; k++) {
+        int width = kCases[k][0];
+        int height = kCases[k][1];
+        int dst_width = kCases[k][2];
+        int dst_height = kCases[k][3];
+        webrtc::VideoRotationMode rotation = dst_width < dst_height ?
+            webrtc::kRotate90 : webrtc::kRotateNone;
+        std::vector<uint8_t> nv12;
+        MakeNV12(width, height, &nv12);
+        std::vector<uint8_t>* n = &nv12;
+
+        CaptureFrameStage stage(&pool);
+        stage.SetOutput(dst_width, dst_height, rotation);
+        CaptureFrameStage* s = &stage;
+        double fused_ns = MeasureNsPerCall(3, 20, ^{
+            s->IncomingFrame(&(*n)[0], n->size(), width, height,
+                             webrtc::kNV12, 0);
+        });
+
+        webrtc::I420VideoFrame rotated;
+        webrtc::I420VideoFrame* r = &rotated;
+        webrtc::scoped_refptr<I420Buffer> output =
+            pool.CreateBuffer(dst_width, dst_height);
+        I420Buffer* o = output.get();
+        double separate_ns = MeasureNsPerCall(3, 20, ^{
+            ConvertSeparately(*n, width, height, rotation, r, o);
+        });
+        NSLog(@"capture NV12 %dx%d to %dx%d%s: fused %.0f ns/frame, "
+              "separate passes %.0f ns/frame", width, height, dst_width,
+              dst_height, rotation == webrtc::kRotate90 ? " turned" : "",
+              fused_ns, separate_ns);
+    }
+
+    std::vector<uint8_t> nv12;
+    MakeNV12(1280, 720, &nv12);
+    std::vector<uint8_t>* n = &nv12;
+    CaptureFrameStage stage(&pool);
+    stage.SetOutput(240, 320, webrtc::kRotate90);
+    CaptureFrameStage* s = &stage;
+    [self measureBlock:^{
+        for (int i = 0; i < 30; i++) {
+            s->IncomingFrame(&(*n)[0], n->size(), 1280, 720, webrtc::kNV12, 0);
+        }
+    }];
+}
+
+@end
@@ -0,0 +1,374 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#import <XCTest/XCTest.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "BenchmarkUtil.h"
+#include "ConferenceMixer.h"
+
+namespace {
+
+//Sends a constant level, or noise around zero when |noise| is set, so the
+//expected mix of constant participants is plain arithmetic.
+class TestParticipant : public webrtc::MixerParticipant {
+public:
+    TestParticipant(int level, int sample_rate_hz, int num_channels)
+    : level_(level),
+      sample_rate_hz_(sample_rate_hz),
+      num_channels_(num_channels),
+      vad_active_(true),
+      noise_(false),
+      seed_(level + 1) {
+    }
+
+    void set_level(int level) { level_ = level; }
+    void set_vad_active(bool active) { vad_active_ = active; }
+    void set_noise(bool noise) { noise_ = noise; }
+
+    virtual int32_t GetAudioFrame(const int32_t id, webrtc::AudioFrame& frame) {
+        int samples = sample_rate_hz_ / 100;
+        frame.UpdateFrame(id, 0, NULL, samples, sample_rate_hz_,
+                          webrtc::AudioFrame::kNormalSpeech,
+                          vad_active_ ? webrtc::AudioFrame::kVadActive :
+                                        webrtc::AudioFrame::kVadPassive,
+                          num_channels_);
+        for (int i = 0; i < samples * num_channels_; i++) {
+            int16_t v = static_cast<int16_t>(level_);
+            if (noise_) {
+                seed_ = seed_ * 1103515245 + 12345;
+                v = static_cast<int16_t>(
+                    static_cast<int>((seed_ >> 16) % (2 * level_ + 1)) - level_);
+            }
+            frame.data_[i] = v;
+        }
+        return 0;
+    }
+
+    virtual int32_t NeededFrequency(const int32_t id) {
+        return sample_rate_hz_;
+    }
+
+private:
+    int level_;
+    const int sample_rate_hz_;
+    const int num_channels_;
+    bool vad_active_;
+    bool noise_;
+    uint32_t seed_;
+};
+
+class ParticipantList {
+public:
+    ~ParticipantList() {
+        for (size_t i = 0; i < participants_.size(); i++) {
+            delete participants_[i];
+        }
+    }
+    TestParticipant* Add(ConferenceMixer* mixer, int level, int sample_rate_hz,
+                         int num_channels) {
+        TestParticipant* participant =
+            new TestParticipant(level, sample_rate_hz, num_channels);
+        participants_.push_back(participant);
+        mixer->AddParticipant(participant);
+        return participant;
+    }
+    TestParticipant* operator[](size_t i) const { return participants_[i]; }
+    size_t size() const { return participants_.size(); }
+
+private:
+    std::vector<TestParticipant*> participants_;
+};
+
+}  // namespace
+
+@interface ConferenceMixerTests : XCTestCase
+@end
+
+@implementation ConferenceMixerTests
+
+- (void)testMixesLoudest {
+    ConferenceMixer mixer(1, 16000, 1, 16);
+    mixer.SetParallelFetch(false);
+    ParticipantList participants;
+    for (int i = 1; i <= 10; i++) {
+        participants.Add(&mixer, i * 100, 16000, 1);
+    }
+    XCTAssertEqual(mixer.NumberOfParticipants(), 10);
+
+    XCTAssertEqual(mixer.Process(), 3);
+    webrtc::AudioFrame frame;
+    XCTAssertEqual(mixer.GetMixedAudio(&frame), 0);
+    XCTAssertEqual(frame.samples_per_channel_, 160);
+    XCTAssertEqual(frame.num_channels_, 1);
+    XCTAssertEqual(frame.data_[0], 1000 + 900 + 800);
+    XCTAssertEqual(frame.data_[159], 1000 + 900 + 800);
+    for (size_t i = 0; i < participants.size(); i++) {
+        XCTAssertEqual(mixer.IsMixed(participants[i]), i >= 7);
+    }
+
+    mixer.SetMaximumMixedParticipants(5);
+    XCTAssertEqual(mixer.Process(), 5);
+    mixer.GetMixedAudio(&frame);
+    XCTAssertEqual(frame.data_[80], 1000 + 900 + 800 + 700 + 600);
+}
+
+- (void)testMixMinusLeavesOutOwnVoice {
+    ConferenceMixer mixer(1, 16000, 1, 8);
+    mixer.SetParallelFetch(false);
+    ParticipantList participants;
+    for (int i = 1; i <= 5; i++) {
+        participants.Add(&mixer, i * 100, 16000, 1);
+    }
+    mixer.Process();
+
+    webrtc::AudioFrame frame;
+    XCTAssertEqual(mixer.GetMixMinusAudio(participants[4], &frame), 0);
+    XCTAssertEqual(frame.data_[10], 400 + 300);
+    XCTAssertEqual(mixer.GetMixMinusAudio(participants[2], &frame), 0);
+    XCTAssertEqual(frame.data_[10], 500 + 400);
+    //Not mixed, hears the whole mix.
+    XCTAssertEqual(mixer.GetMixMinusAudio(participants[0], &frame), 0);
+    XCTAssertEqual(frame.data_[10], 500 + 400 + 300);
+
+    TestParticipant stranger(100, 16000, 1);
+    XCTAssertEqual(mixer.GetMixMinusAudio(&stranger, &frame), -1);
+}
+
+- (void)testVoiceActiveBeforeEnergy {
+    ConferenceMixer mixer(1, 16000, 1, 8);
+    mixer.SetParallelFetch(false);
+    ParticipantList participants;
+    TestParticipant* loud = participants.Add(&mixer, 5000, 16000, 1);
+    loud->set_vad_active(false);
+    for (int i = 1; i <= 3; i++) {
+        participants.Add(&mixer, i * 10, 16000, 1);
+    }
+    mixer.Process();
+    XCTAssertFalse(mixer.IsMixed(loud));
+
+    webrtc::AudioFrame frame;
+    mixer.GetMixedAudio(&frame);
+    XCTAssertEqual(frame.data_[0], 10 + 20 + 30);
+    XCTAssertEqual(frame.vad_activity_, webrtc::AudioFrame::kVadActive);
+}
+
+- (void)testAddAndRemove {
+    ConferenceMixer mixer(1, 16000, 1, 2);
+    TestParticipant a(100, 16000, 1);
+    TestParticipant b(200, 16000, 1);
+    TestParticipant c(300, 16000, 1);
+    XCTAssertEqual(mixer.AddParticipant(&a), 0);
+    XCTAssertEqual(mixer.AddParticipant(&a), -1);
+    XCTAssertEqual(mixer.AddParticipant(&b), 0);
+    XCTAssertEqual(mixer.AddParticipant(&c), -1);
+    XCTAssertEqual(mixer.AddParticipant(NULL), -1);
+
+    XCTAssertEqual(mixer.RemoveParticipant(&c), -1);
+    XCTAssertEqual(mixer.RemoveParticipant(&a), 0);
+    XCTAssertEqual(mixer.NumberOfParticipants(), 1);
+    XCTAssertEqual(mixer.AddParticipant(&c), 0);
+
+    mixer.Process();
+    webrtc::AudioFrame frame;
+    mixer.GetMixedAudio(&frame);
+    XCTAssertEqual(frame.data_[0], 200 + 300);
+    XCTAssertFalse(mixer.IsMixed(&a));
+}
+
+- (void)testRemixesAndResamplesToMixFormat {
+    ConferenceMixer mixer(1, 48000, 2, 4);
+    mixer.SetParallelFetch(false);
+    ParticipantList participants;
+    participants.Add(&mixer, 1000, 48000, 1);
+    participants.Add(&mixer, 2000, 16000, 2);
+
+    webrtc::AudioFrame frame;
+    for (int i = 0; i < 10; i++) {
+        mixer.Process();
+    }
+    mixer.GetMixedAudio(&frame);
+    XCTAssertEqual(frame.samples_per_channel_, 480);
+    XCTAssertEqual(frame.num_channels_, 2);
+    XCTAssertEqual(frame.sample_rate_hz_, 48000);
+    //The resampler has settled on the constant level by now.
+    for (int i = 0; i < 960; i++) {
+        if (abs(frame.data_[i] - 3000) > 30) {
+            XCTFail(@"sample %d is %d", i, frame.data_[i]);
+            break;
+        }
+    }
+}
+
+- (void)testParallelFetchMatchesSerial {
+    ConferenceMixer serial(1, 48000, 2, 32);
+    ConferenceMixer parallel(1, 48000, 2, 32);
+    serial.SetParallelFetch(false);
+    parallel.SetParallelFetch(true);
+    ParticipantList serial_participants;
+    ParticipantList parallel_participants;
+    for (int i = 0; i < 20; i++) {
+        int rate = i % 3 == 0 ? 16000 : 48000;
+        serial_participants.Add(&serial, 200 + i * 50, rate, 1 + i % 2)
+            ->set_noise(true);
+        parallel_participants.Add(&parallel, 200 + i * 50, rate, 1 + i % 2)
+            ->set_noise(true);
+    }
+
+    webrtc::AudioFrame expected;
+    webrtc::AudioFrame actual;
+    for (int frame = 0; frame < 20; frame++) {
+        XCTAssertEqual(serial.Process(), parallel.Process());
+        serial.GetMixedAudio(&expected);
+        parallel.GetMixedAudio(&actual);
+        XCTAssertTrue(memcmp(expected.data_, actual.data_,
+                             960 * sizeof(int16_t)) == 0, @"frame %d", frame);
+        for (int i = 0; i < 20; i++) {
+            serial.GetMixMinusAudio(serial_participants[i], &expected);
+            parallel.GetMixMinusAudio(parallel_participants[i], &actual);
+            XCTAssertTrue(memcmp(expected.data_, actual.data_,
+                                 960 * sizeof(int16_t)) == 0,
+                          @"frame %d participant %d", frame, i);
+        }
+    }
+}
+
+- (void)testStatistics {
+    ConferenceMixer mixer(1, 16000, 1, 16);
+    ParticipantList participants;
+    for (int i = 0; i < 12; i++) {
+        participants.Add(&mixer, 100, 16000, 1);
+    }
+    for (int i = 0; i < 25; i++) {
+        mixer.Process();
+    }
+
+    ConferenceMixerStatistics stats;
+    mixer.GetStatistics(&stats);
+    XCTAssertEqual(stats.process_count, 25u);
+    XCTAssertEqual(stats.limited_frames, 0u);
+    uint32_t fetches = 0;
+    uint32_t mixes = 0;
+    for (int i = 0; i < ConferenceMixerStatistics::kHistogramBuckets; i++) {
+        fetches += stats.fetch_histogram[i];
+        mixes += stats.mix_histogram[i];
+    }
+    XCTAssertEqual(fetches, 25u);
+    XCTAssertEqual(mixes, 25u);
+    XCTAssertLessThanOrEqual(stats.deadline_misses, stats.process_count);
+
+    mixer.ResetStatistics();
+    mixer.GetStatistics(&stats);
+    XCTAssertEqual(stats.process_count, 0u);
+    XCTAssertEqual(stats.max_process_time_us, 0);
+}
+
+- (void)testLimiterCapsAndReleases {
+    ConferenceMixer mixer(1, 16000, 1, 4);
+    mixer.SetParallelFetch(false);
+    ParticipantList participants;
+    for (int i = 0; i < 3; i++) {
+        participants.Add(&mixer, 12000, 16000, 1);
+    }
+
+    webrtc::AudioFrame frame;
+    for (int n = 0; n < 5; n++) {
+        mixer.Process();
+        mixer.GetMixedAudio(&frame);
+        for (int i = 0; i < 160; i++) {
+            XCTAssertGreaterThan(frame.data_[i], 0);
+            XCTAssertLessThanOrEqual(frame.data_[i],
+                                     ConferenceMixer::kLimiterThreshold);
+        }
+        //A mix-minus output is scaled by the same gain.
+        mixer.GetMixMinusAudio(participants[0], &frame);
+        XCTAssertLessThan(frame.data_[80], 24000);
+    }
+    ConferenceMixerStatistics stats;
+    mixer.GetStatistics(&stats);
+    XCTAssertEqual(stats.limited_frames, 5u);
+
+    //Quiet again, the gain returns to unity.
+    for (int i = 0; i < 3; i++) {
+        participants[i]->set_level(1000);
+    }
+    for (int n = 0; n < 60; n++) {
+        mixer.Process();
+    }
+    mixer.GetMixedAudio(&frame);
+    XCTAssertEqual(frame.data_[0], 3000);
+    XCTAssertEqual(frame.data_[159], 3000);
+}
+
+//Process() and a mix-minus output for every participant, 10ms of 48kHz
+//stereo, the three loudest mixed.
+- (void)testBenchmarkParticipants {
+    static const int kParticipants[] = { 3, 10, 25, 50, 100, 200 };
+    for (int n = 0; n < 6; n++) {
+        int count = kParticipants[n];
+        ConferenceMixer mixer(1, 48000, 2, count);
+        mixer.SetParallelFetch(false);
+        ParticipantList participants;
+        for (int i = 0; i < count; i++) {
+            participants.Add(&mixer, 100 + i * 10, 48000, 2)->set_noise(true);
+        }
+        ConferenceMixer* m = &mixer;
+        ParticipantList* p = &participants;
+        webrtc::AudioFrame frame;
+        webrtc::AudioFrame* out = &frame;
+        double ns = MeasureNsPerCall(3, 50, ^{
+            m->Process();
+            for (size_t i = 0; i < p->size(); i++) {
+                m->GetMixMinusAudio((*p)[i], out);
+            }
+        });
+        NSLog(@"mixer %d participants: %.1f us per 10 ms frame, %.0f ns per "
+              "participant", count, ns / 1000, ns / count);
+    }
+
+    //The fetch stage fanned out over the global queue.
+    for (int parallel = 0; parallel <= 1; parallel++) {
+        ConferenceMixer mixer(1, 48000, 2, 200);
+        mixer.SetParallelFetch(parallel != 0);
+        ParticipantList participants;
+        for (int i = 0; i < 200; i++) {
+            participants.Add(&mixer, 100 + i * 10, 16000, 1)->set_noise(true);
+        }
+        ConferenceMixer* m = &mixer;
+        double ns = MeasureNsPerCall(3, 50, ^{
+            m->Process();
+        });
+        ConferenceMixerStatistics stats;
+        mixer.GetStatistics(&stats);
+        NSLog(@"mixer 200 participants at 16 kHz, %s fetch: %.1f us per "
+              "Process(), %u deadline misses", parallel ? "parallel" : "serial",
+              ns / 1000, stats.deadline_misses);
+    }
+
+    ConferenceMixer mixer(1, 48000, 2, 200);
+    mixer.SetParallelFetch(false);
+    ParticipantList participants;
+    for (int i = 0; i < 200; i++) {
+        participants.Add(&mixer, 100 + i * 10, 48000, 2)->set_noise(true);
+    }
+    ConferenceMixer* m = &mixer;
+    ParticipantList* p = &participants;
+    [self measureBlock:^{
+        webrtc::AudioFrame frame;
+        for (int k = 0; k < 10; k++) {
+            m->Process();
+            for (size_t i = 0; i < p->size(); i++) {
+                m->GetMixMinusAudio((*p)[i], &frame);
+            }
+        }
+    }];
+}
+
+@end
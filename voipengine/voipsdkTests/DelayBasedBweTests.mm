@@ -0,0 +1,216 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#import <XCTest/XCTest.h>
+
+#include <vector>
+#include "BenchmarkUtil.h"
+#include "DelayBasedBwe.h"
+#include "TransportFeedback.h"
+
+namespace {
+
+enum { kFeedbackIntervalMs = 100 };
+
+//Sender and receiver of one packet flow. The one way delay grows by
+//|delay_growth_us| per packet, so a positive value is a filling queue.
+class FeedbackLoop {
+public:
+    explicit FeedbackLoop(DelayBasedBwe* bwe)
+    : bwe_(bwe),
+      now_ms_(0),
+      seq_(0),
+      delay_us_(50000),
+      changes_(0) {}
+
+    //Sends a |packet_size| packet every |interval_ms| for |duration_ms| and
+    //feeds the arrivals back every 100ms. Returns the changes of the target.
+    int Run(int duration_ms, int interval_ms, int packet_size,
+            int delay_growth_us) {
+        int64_t end_ms = now_ms_ + duration_ms;
+        int64_t next_feedback_ms = now_ms_ + kFeedbackIntervalMs;
+        for (; now_ms_ < end_ms; now_ms_ += interval_ms) {
+            bwe_->OnPacketSent(seq_, packet_size, now_ms_);
+            delay_us_ += delay_growth_us;
+            if (delay_us_ < 10000) {
+                delay_us_ = 10000;
+            }
+            Arrival arrival = { seq_, now_ms_ * 1000 + delay_us_ };
+            pending_.push_back(arrival);
+            seq_++;
+            if (now_ms_ >= next_feedback_ms) {
+                SendFeedback();
+                next_feedback_ms += kFeedbackIntervalMs;
+            }
+        }
+        return changes_;
+    }
+
+    int64_t now_ms() const { return now_ms_; }
+
+private:
+    struct Arrival {
+        uint16_t seq;
+        int64_t arrival_time_us;
+    };
+
+    void SendFeedback() {
+        size_t i = 0;
+        while (i < pending_.size()) {
+            TransportFeedback feedback;
+            feedback.SetBase(pending_[i].seq, pending_[i].arrival_time_us);
+            while (i < pending_.size() &&
+                   feedback.AddReceivedPacket(pending_[i].seq,
+                                              pending_[i].arrival_time_us)) {
+                i++;
+            }
+            if (bwe_->OnTransportFeedback(feedback, now_ms_)) {
+                changes_++;
+            }
+        }
+        pending_.clear();
+    }
+
+    DelayBasedBwe* bwe_;
+    int64_t now_ms_;
+    uint16_t seq_;
+    int64_t delay_us_;
+    int changes_;
+    std::vector<Arrival> pending_;
+};
+
+}  // namespace
+
+@interface DelayBasedBweTests : XCTestCase
+@end
+
+@implementation DelayBasedBweTests
+
+- (void)testStableDelayIncreasesToMax {
+    DelayBasedBwe bwe(300000, 50000, 1000000);
+    FeedbackLoop loop(&bwe);
+    //1200 bytes every 5ms is 1.92 Mbps on the wire.
+    loop.Run(60000, 5, 1200, 0);
+    XCTAssertEqual(bwe.usage(), kBweNormal);
+    XCTAssertEqual(bwe.target_bitrate_bps(), 1000000);
+}
+
+- (void)testGrowingDelayDecreases {
+    //The flow sends 1.92 Mbps whatever the target, decreases go below
+    //what was acknowledged.
+    DelayBasedBwe bwe(3000000, 50000, 5000000);
+    FeedbackLoop loop(&bwe);
+    loop.Run(2000, 5, 1200, 0);
+    int before = bwe.target_bitrate_bps();
+
+    //1ms more queueing every 5ms, the queue fills at a fifth of the rate.
+    loop.Run(1000, 5, 1200, 1000);
+    XCTAssertTrue(bwe.trend() > 0);
+    XCTAssertTrue(bwe.target_bitrate_bps() < before);
+    //Decreases are taken from the acknowledged rate, below what was sent.
+    XCTAssertTrue(bwe.target_bitrate_bps() <= 0.85 * 1920000);
+
+    //Draining the queue holds the rate.
+    int after = bwe.target_bitrate_bps();
+    loop.Run(300, 5, 1200, -3000);
+    XCTAssertEqual(bwe.usage(), kBweUnderusing);
+    XCTAssertTrue(bwe.target_bitrate_bps() <= after);
+}
+
+- (void)testStaysWithinMinAndMax {
+    DelayBasedBwe bwe(100000, 80000, 120000);
+    FeedbackLoop loop(&bwe);
+    loop.Run(3000, 20, 200, 2000);
+    XCTAssertEqual(bwe.target_bitrate_bps(), 80000);
+    loop.Run(60000, 20, 200, -100);
+    XCTAssertTrue(bwe.target_bitrate_bps() >= 80000 &&
+                  bwe.target_bitrate_bps() <= 120000);
+}
+
+- (void)testAckedRateAtHighBitrate {
+    //20 Mbps puts 2.5 MB in the one second window, bytes times 8000
+    //overflowed a 32-bit size_t.
+    DelayBasedBwe bwe(20000000, 1000000, 50000000);
+    FeedbackLoop loop(&bwe);
+    loop.Run(3000, 1, 2500, 0);
+    int acked = bwe.acked_bitrate_bps();
+    XCTAssertTrue(acked > 19000000 && acked < 21000000, @"acked %d", acked);
+}
+
+- (void)testFeedbackRoundTrip {
+    TransportFeedback feedback;
+    feedback.SetSenderSsrc(1);
+    feedback.SetMediaSsrc(2);
+    //A reference time below zero must survive the 24 bit field.
+    int64_t base_us = -3 * TransportFeedback::kReferenceTimeScaleUs - 1000;
+    feedback.SetBase(65530, base_us);
+    static const int kDeltasUs[] = { 0, 1000, 250, 70000, -20000, 3000 };
+    int64_t arrival_us = base_us;
+    for (int i = 0; i < 6; i++) {
+        arrival_us += kDeltasUs[i];
+        //Every other sequence number lost, across the wrap.
+        XCTAssertTrue(feedback.AddReceivedPacket(
+            static_cast<uint16_t>(65530 + 2 * i), arrival_us));
+    }
+    uint8_t buffer[1500];
+    size_t length = feedback.Build(buffer, sizeof(buffer));
+    XCTAssertTrue(length > 0 && length % 4 == 0);
+
+    TransportFeedback parsed;
+    XCTAssertTrue(parsed.Parse(buffer, length));
+    XCTAssertEqual(parsed.base_sequence_number(), 65530);
+    XCTAssertEqual(parsed.packet_status_count(), 11);
+    for (int i = 0; i < 11; i++) {
+        XCTAssertEqual(parsed.IsReceived(i), i % 2 == 0);
+        if (i % 2 == 0) {
+            XCTAssertEqual(parsed.ArrivalTimeUs(i), feedback.ArrivalTimeUs(i));
+        }
+    }
+    XCTAssertFalse(parsed.Parse(buffer, length - 4));
+}
+
+//Estimator cost per feedback message of 100 packets, about what a 10 Mbps
+//video stream sends between two messages.
+- (void)testBenchmarkFeedback {
+    static const int kMessages = 64;
+    static const int kPacketsPerMessage = 100;
+    std::vector<TransportFeedback> messages(kMessages);
+    for (int m = 0; m < kMessages; m++) {
+        uint16_t base = static_cast<uint16_t>(m * kPacketsPerMessage);
+        int64_t base_us = (m * kPacketsPerMessage) * 1000 + 40000;
+        messages[m].SetBase(base, base_us);
+        for (int i = 0; i < kPacketsPerMessage; i++) {
+            messages[m].AddReceivedPacket(base + i, base_us + i * 1000);
+        }
+    }
+    const std::vector<TransportFeedback>* msgs = &messages;
+
+    DelayBasedBwe bwe(2000000, 50000, 20000000);
+    DelayBasedBwe* b = &bwe;
+    int64_t now = 0;
+    int64_t* now_ms = &now;
+    double ns = MeasureNsPerCall(5, kMessages, ^{
+        int m = static_cast<int>(*now_ms / 100) % kMessages;
+        for (int i = 0; i < kPacketsPerMessage; i++) {
+            b->OnPacketSent(static_cast<uint16_t>(m * kPacketsPerMessage + i),
+                            1200, m * kPacketsPerMessage + i);
+        }
+        b->OnTransportFeedback((*msgs)[m], *now_ms);
+        *now_ms += 100;
+    });
+    NSLog(@"delay based bwe: %.0f ns per feedback of %d packets", ns,
+          kPacketsPerMessage);
+
+    [self measureBlock:^{
+        for (int m = 0; m < kMessages; m++) {
+            b->OnTransportFeedback((*msgs)[m], m * 100);
+        }
+    }];
+}
+
+@end
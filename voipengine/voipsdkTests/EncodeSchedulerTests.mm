@@ -0,0 +1,229 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#import <XCTest/XCTest.h>
+
+#include <stdint.h>
+#include <algorithm>
+#include <deque>
+#include "EncodeScheduler.h"
+
+namespace {
+
+enum { kFramerate = 30 };
+enum { kFrameIntervalMs = 33 };
+//Small captures keep the scaling cheap, the encode time is modelled.
+enum { kCaptureWidth = 160 };
+enum { kCaptureHeight = 96 };
+//A key frame takes this many delta frames.
+enum { kKeyFrameCost = 3 };
+
+//An encoder on its own queue, on the simulated clock. Encode time follows
+//the pixel count, a changed size re-initializes it and costs a key frame,
+//as in VP8PartitionEncoder.
+class SimulatedEncoder {
+public:
+    SimulatedEncoder(EncodeScheduler* scheduler, I420BufferPool* pool)
+    : scheduler_(scheduler), pool_(pool), busy_until_ms_(0), width_(0),
+      seed_(1), full_encode_us(0), noise_percent(0), frames(0),
+      key_frames(0), max_latency_ms(0), sum_latency_ms(0) {
+        stream_ = scheduler_->AddStream(kFramerate);
+    }
+
+    void Capture(int64_t now_ms) {
+        Complete(now_ms);
+        webrtc::scoped_refptr<I420Buffer> capture =
+            pool_->CreateBuffer(kCaptureWidth, kCaptureHeight);
+        webrtc::scoped_refptr<I420Buffer> frame =
+            scheduler_->ScheduleFrame(stream_, capture, now_ms, now_ms);
+        if (frame.get() == NULL) {
+            return;
+        }
+        bool key_frame = frame->width() != width_;
+        width_ = frame->width();
+        int64_t start_ms = std::max(now_ms, busy_until_ms_);
+        scheduler_->OnEncodeStarted(stream_, now_ms, start_ms);
+
+        seed_ = seed_ * 1103515245 + 12345;
+        int noise = static_cast<int>((seed_ >> 16) % 201) - 100;
+        int64_t encode_us = full_encode_us * (100 + noise * noise_percent / 100) /
+                            100 * frame->width() * frame->width() /
+                            (kCaptureWidth * kCaptureWidth);
+        if (key_frame) {
+            encode_us *= kKeyFrameCost;
+            key_frames++;
+        }
+        busy_until_ms_ = start_ms + encode_us / 1000;
+        Pending pending = { now_ms, busy_until_ms_,
+                            static_cast<int>(encode_us), key_frame };
+        pending_.push_back(pending);
+    }
+
+    //Reports the encodes that ended by |now_ms|.
+    void Complete(int64_t now_ms) {
+        while (!pending_.empty() && pending_.front().end_ms <= now_ms) {
+            const Pending& p = pending_.front();
+            scheduler_->OnFrameEncoded(stream_, p.encode_us, p.key_frame,
+                                       p.end_ms);
+            int latency = static_cast<int>(p.end_ms - p.capture_ms);
+            max_latency_ms = std::max(max_latency_ms, latency);
+            sum_latency_ms += latency;
+            frames++;
+            pending_.pop_front();
+        }
+    }
+
+    EncodeSchedulerStatistics Statistics() {
+        EncodeSchedulerStatistics stats;
+        scheduler_->GetStatistics(stream_, &stats);
+        return stats;
+    }
+
+private:
+    struct Pending {
+        int64_t capture_ms;
+        int64_t end_ms;
+        int encode_us;
+        bool key_frame;
+    };
+
+    EncodeScheduler* scheduler_;
+    I420BufferPool* pool_;
+    int stream_;
+    int64_t busy_until_ms_;
+    int width_;
+    uint32_t seed_;
+    std::deque<Pending> pending_;
+
+public:
+    //Delta frame encode time at the capture size.
+    int full_encode_us;
+    int noise_percent;
+    int frames;
+    int key_frames;
+    int max_latency_ms;
+    int64_t sum_latency_ms;
+};
+
+//Captures |seconds| of frames on every encoder, starting at |start_ms|.
+int64_t Run(SimulatedEncoder** encoders, int num_encoders, int64_t start_ms,
+            int seconds) {
+    int64_t now_ms = start_ms;
+    for (int f = 0; f < seconds * kFramerate; f++) {
+        for (int i = 0; i < num_encoders; i++) {
+            encoders[i]->Capture(now_ms);
+        }
+        now_ms += kFrameIntervalMs;
+    }
+    return now_ms;
+}
+
+}  // namespace
+
+@interface EncodeSchedulerTests : XCTestCase
+@end
+
+@implementation EncodeSchedulerTests
+
+- (void)testKeepsFullSizeWhenItFits {
+    I420BufferPool pool;
+    EncodeScheduler scheduler(&pool, 1, 80);
+    SimulatedEncoder encoder(&scheduler, &pool);
+    encoder.full_encode_us = 10000;
+    encoder.noise_percent = 20;
+    SimulatedEncoder* encoders[] = { &encoder };
+    Run(encoders, 1, 100000, 20);
+    EncodeSchedulerStatistics stats = encoder.Statistics();
+    XCTAssertEqual(stats.scale, static_cast<int>(EncodeScheduler::kFullScale));
+    XCTAssertEqual(stats.scale_changes, 0);
+    XCTAssertEqual(stats.frames_skipped, 0u);
+}
+
+//An encoder at 150% of its share goes straight to the size that fits,
+//instead of one re-initialization per eighth.
+- (void)testScalesDownInOneStep {
+    I420BufferPool pool;
+    EncodeScheduler scheduler(&pool, 1, 80);
+    SimulatedEncoder encoder(&scheduler, &pool);
+    encoder.full_encode_us = 40000;
+    SimulatedEncoder* encoders[] = { &encoder };
+    Run(encoders, 1, 100000, 30);
+    EncodeSchedulerStatistics stats = encoder.Statistics();
+    XCTAssertLessThan(stats.scale, static_cast<int>(EncodeScheduler::kFullScale));
+    XCTAssertEqual(stats.scale_changes, 1);
+    XCTAssertLessThanOrEqual(stats.usage_percent, stats.budget_percent);
+    XCTAssertLessThan(encoder.max_latency_ms,
+                      kFrameIntervalMs * 2 + kKeyFrameCost * 40);
+}
+
+//Encode times around the share, with frame to frame noise, must not move
+//the size back and forth.
+- (void)testDoesNotOscillateAroundTheShare {
+    static const int kEncodeUs[] = { 24000, 26000, 28000, 30000 };
+    for (int i = 0; i < 4; i++) {
+        I420BufferPool pool;
+        EncodeScheduler scheduler(&pool, 1, 80);
+        SimulatedEncoder encoder(&scheduler, &pool);
+        encoder.full_encode_us = kEncodeUs[i];
+        encoder.noise_percent = 30;
+        SimulatedEncoder* encoders[] = { &encoder };
+        Run(encoders, 1, 100000, 60);
+        EncodeSchedulerStatistics stats = encoder.Statistics();
+        XCTAssertLessThanOrEqual(stats.scale_changes, 2, @"%d us",
+                                 kEncodeUs[i]);
+        XCTAssertLessThanOrEqual(encoder.key_frames, 3);
+    }
+}
+
+//Load test: four 30fps streams on two cores, the load doubling for twenty
+//seconds as when another application takes the CPU, then going back.
+- (void)testLoadSteps {
+    I420BufferPool pool;
+    EncodeScheduler scheduler(&pool, 2, 80);
+    SimulatedEncoder* encoders[4];
+    for (int i = 0; i < 4; i++) {
+        encoders[i] = new SimulatedEncoder(&scheduler, &pool);
+        encoders[i]->full_encode_us = 12000 + i * 2000;
+        encoders[i]->noise_percent = 25;
+    }
+    static const int kPhaseSeconds[] = { 20, 20, 30 };
+    static const int kLoadPercent[] = { 100, 200, 100 };
+    int64_t now_ms = 100000;
+    for (int phase = 0; phase < 3; phase++) {
+        for (int i = 0; i < 4; i++) {
+            encoders[i]->full_encode_us = (12000 + i * 2000) *
+                                          kLoadPercent[phase] / 100;
+        }
+        now_ms = Run(encoders, 4, now_ms, kPhaseSeconds[phase]);
+        for (int i = 0; i < 4; i++) {
+            EncodeSchedulerStatistics stats = encoders[i]->Statistics();
+            NSLog(@"load %d%%, stream %d: scale %d/8, %d changes, %d key "
+                  "frames, usage %d%% of %d%%, %.1f%% skipped, latency avg "
+                  "%lld ms max %d ms", kLoadPercent[phase], i, stats.scale,
+                  stats.scale_changes, encoders[i]->key_frames,
+                  stats.usage_percent, stats.budget_percent,
+                  stats.frames_skipped * 100.0 / stats.frames,
+                  encoders[i]->frames > 0 ?
+                  encoders[i]->sum_latency_ms / encoders[i]->frames : 0,
+                  encoders[i]->max_latency_ms);
+        }
+    }
+    for (int i = 0; i < 4; i++) {
+        EncodeSchedulerStatistics stats = encoders[i]->Statistics();
+        //Down once for the load, up again by eighths after it.
+        XCTAssertLessThanOrEqual(stats.scale_changes, 6);
+        XCTAssertLessThanOrEqual(encoders[i]->key_frames,
+                                 stats.scale_changes + 1);
+        XCTAssertLessThanOrEqual(encoders[i]->key_frames, 6);
+        XCTAssertLessThan(stats.frames_skipped * 10, stats.frames);
+        XCTAssertLessThan(encoders[i]->max_latency_ms, 300);
+        delete encoders[i];
+    }
+}
+
+@end
@@ -0,0 +1,317 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#import <XCTest/XCTest.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "webrtc/system_wrappers/interface/tick_util.h"
+#include "I420BufferPool.h"
+
+namespace {
+
+enum { kWidth = 1280 };
+enum { kHeight = 720 };
+
+//Keeps the last frame as the encoder and the renderer do, or changes it
+//in place as an effect filter does.
+class HoldingSink : public I420FrameSink {
+public:
+    HoldingSink(I420BufferPool* pool, bool writes)
+    : pool_(pool), writes_(writes), frames(0), sum(0) {}
+
+    virtual void OnFrame(const webrtc::scoped_refptr<I420Buffer>& frame) {
+        if (writes_) {
+            held = pool_->MakeWritable(frame);
+            held->MutableData(webrtc::kYPlane)[0] ^= 1;
+        } else {
+            held = frame;
+        }
+        sum += held->data(webrtc::kYPlane)[kWidth];
+        frames++;
+    }
+
+    webrtc::scoped_refptr<I420Buffer> held;
+
+private:
+    I420BufferPool* pool_;
+    bool writes_;
+
+public:
+    int frames;
+    uint32_t sum;
+};
+
+//The same three sinks the way ViEFrameProviderBase feeds them, each with
+//its own deep copy.
+struct CopyingSink {
+    webrtc::I420VideoFrame frame;
+    bool writes;
+    uint32_t sum;
+
+    void OnFrame(const webrtc::I420VideoFrame& captured) {
+        frame.CopyFrame(captured);
+        if (writes) {
+            frame.buffer(webrtc::kYPlane)[0] ^= 1;
+        }
+        sum += frame.buffer(webrtc::kYPlane)[kWidth];
+    }
+};
+
+//Adds |other| to the fanout on its first frame.
+class AddingSink : public I420FrameSink {
+public:
+    AddingSink(I420FrameFanout* fanout, I420FrameSink* other)
+    : fanout_(fanout), other_(other), frames(0) {}
+
+    virtual void OnFrame(const webrtc::scoped_refptr<I420Buffer>& /*frame*/) {
+        if (frames++ == 0) {
+            fanout_->AddSink(other_);
+        }
+    }
+
+private:
+    I420FrameFanout* fanout_;
+    I420FrameSink* other_;
+
+public:
+    int frames;
+};
+
+//Takes |delay_ms| per frame and records whether a call is in progress.
+class SlowSink : public I420FrameSink {
+public:
+    explicit SlowSink(int delay_ms)
+    : delay_ms_(delay_ms), in_frame(false), frames(0) {}
+
+    virtual void OnFrame(const webrtc::scoped_refptr<I420Buffer>& /*frame*/) {
+        in_frame.store(true);
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms_));
+        frames.fetch_add(1);
+        in_frame.store(false);
+    }
+
+private:
+    int delay_ms_;
+
+public:
+    std::atomic<bool> in_frame;
+    std::atomic<int> frames;
+};
+
+void MakeSourceFrame(webrtc::I420VideoFrame* frame) {
+    int half_width = (kWidth + 1) / 2;
+    int half_height = (kHeight + 1) / 2;
+    std::vector<uint8_t> y(kWidth * kHeight);
+    std::vector<uint8_t> uv(half_width * half_height);
+    for (size_t i = 0; i < y.size(); i++) {
+        y[i] = static_cast<uint8_t>(i * 7);
+    }
+    memset(&uv[0], 128, uv.size());
+    frame->CreateFrame(static_cast<int>(y.size()), &y[0],
+                       static_cast<int>(uv.size()), &uv[0],
+                       static_cast<int>(uv.size()), &uv[0],
+                       kWidth, kHeight, kWidth, half_width, half_width);
+}
+
+}  // namespace
+
+@interface I420BufferPoolTests : XCTestCase
+@end
+
+@implementation I420BufferPoolTests
+
+- (void)testReusesReleasedBuffers {
+    I420BufferPool pool;
+    {
+        webrtc::scoped_refptr<I420Buffer> buffer =
+            pool.CreateBuffer(kWidth, kHeight);
+        for (int i = 0; i < I420Buffer::kNumPlanes; i++) {
+            webrtc::PlaneType plane = I420Buffer::kPlanes[i];
+            XCTAssertEqual(reinterpret_cast<uintptr_t>(buffer->data(plane)) %
+                           I420Buffer::kAlignment, 0u);
+            XCTAssertEqual(buffer->stride(plane) % I420Buffer::kAlignment, 0);
+        }
+        XCTAssertEqual(pool.GetStatistics().buffers_outstanding, 1u);
+    }
+    webrtc::scoped_refptr<I420Buffer> again =
+        pool.CreateBuffer(kWidth, kHeight);
+    I420BufferPoolStatistics stats = pool.GetStatistics();
+    XCTAssertEqual(stats.requests, 2u);
+    XCTAssertEqual(stats.pool_hits, 1u);
+    XCTAssertEqual(stats.buffers_outstanding, 1u);
+    XCTAssertTrue(pool.CreateBuffer(0, kHeight) == NULL);
+}
+
+- (void)testMakeWritableCopiesOnlyShared {
+    I420BufferPool pool;
+    webrtc::scoped_refptr<I420Buffer> a = pool.CreateBuffer(64, 48);
+    memset(a->MutableData(webrtc::kYPlane), 7, a->size());
+    a->set_timestamp(3000);
+
+    webrtc::scoped_refptr<I420Buffer> b = a;
+    webrtc::scoped_refptr<I420Buffer> c = pool.MakeWritable(b);
+    XCTAssertTrue(c.get() != a.get());
+    XCTAssertEqual(c->timestamp(), 3000u);
+    c->MutableData(webrtc::kYPlane)[0] = 9;
+    XCTAssertEqual(a->data(webrtc::kYPlane)[0], 7);
+    XCTAssertEqual(pool.GetStatistics().bytes_copied, a->size());
+
+    b = NULL;
+    XCTAssertTrue(pool.MakeWritable(a).get() == a.get());
+    XCTAssertEqual(pool.GetStatistics().bytes_copied, a->size());
+}
+
+- (void)testBuffersOutliveThePool {
+    webrtc::scoped_refptr<I420Buffer> buffer;
+    {
+        I420BufferPool pool;
+        buffer = pool.CreateBuffer(64, 48);
+    }
+    memset(buffer->MutableData(webrtc::kYPlane), 1, buffer->size());
+    buffer = NULL;
+}
+
+- (void)testFanoutDeliversToEverySink {
+    I420BufferPool pool;
+    I420FrameFanout fanout;
+    HoldingSink reader(&pool, false);
+    HoldingSink writer(&pool, true);
+    fanout.AddSink(&reader);
+    fanout.AddSink(&reader);
+    fanout.AddSink(&writer);
+    XCTAssertEqual(fanout.num_sinks(), 2);
+
+    webrtc::scoped_refptr<I420Buffer> frame = pool.CreateBuffer(64, 48);
+    memset(frame->MutableData(webrtc::kYPlane), 0, frame->size());
+    fanout.DeliverFrame(frame);
+    XCTAssertEqual(reader.frames, 1);
+    XCTAssertTrue(reader.held.get() == frame.get());
+    XCTAssertTrue(writer.held.get() != frame.get());
+    XCTAssertEqual(frame->data(webrtc::kYPlane)[0], 0);
+
+    fanout.RemoveSink(&reader);
+    fanout.RemoveSink(&reader);
+    fanout.DeliverFrame(frame);
+    XCTAssertEqual(reader.frames, 1);
+    XCTAssertEqual(writer.frames, 2);
+    XCTAssertEqual(fanout.num_sinks(), 1);
+}
+
+- (void)testSinkMayAddSinkFromOnFrame {
+    I420BufferPool pool;
+    I420FrameFanout fanout;
+    HoldingSink reader(&pool, false);
+    AddingSink adder(&fanout, &reader);
+    fanout.AddSink(&adder);
+
+    webrtc::scoped_refptr<I420Buffer> frame = pool.CreateBuffer(64, 48);
+    fanout.DeliverFrame(frame);
+    //Added during the delivery, it gets the next frame.
+    XCTAssertEqual(reader.frames, 0);
+    fanout.DeliverFrame(frame);
+    XCTAssertEqual(reader.frames, 1);
+    XCTAssertEqual(adder.frames, 2);
+}
+
+- (void)testRemoveSinkWaitsForDelivery {
+    I420BufferPool pool;
+    I420FrameFanout fanout;
+    SlowSink slow(5);
+    HoldingSink reader(&pool, false);
+    fanout.AddSink(&slow);
+    std::atomic<bool> done(false);
+    webrtc::scoped_refptr<I420Buffer> frame = pool.CreateBuffer(64, 48);
+    std::thread capture([&] {
+        while (!done.load()) {
+            fanout.DeliverFrame(frame);
+        }
+    });
+    while (slow.frames.load() < 2) {
+        std::this_thread::yield();
+    }
+
+    //Another sink can come and go while the slow one holds a delivery.
+    fanout.AddSink(&reader);
+    while (!slow.in_frame.load()) {
+        std::this_thread::yield();
+    }
+    fanout.RemoveSink(&slow);
+    XCTAssertFalse(slow.in_frame.load());
+    int frames = slow.frames.load();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    XCTAssertEqual(slow.frames.load(), frames);
+    done.store(true);
+    capture.join();
+    XCTAssertGreaterThan(reader.frames, 0);
+}
+
+//A 720p capture at 30fps to an encoder, a renderer and an effect filter
+//that changes the picture, with a deep copy per sink as ViEFrameProviderBase
+//makes and with the pooled buffer shared by the fanout.
+- (void)testBenchmarkFanout720p {
+    static const int kFrames = 300;
+    webrtc::I420VideoFrame source;
+    MakeSourceFrame(&source);
+    double frame_bytes = kWidth * kHeight * 3 / 2;
+
+    webrtc::I420VideoFrame captured;
+    CopyingSink copying[3];
+    for (int i = 0; i < 3; i++) {
+        copying[i].writes = i == 2;
+        copying[i].sum = 0;
+    }
+    int64_t start = webrtc::TickTime::MicrosecondTimestamp();
+    for (int f = 0; f < kFrames; f++) {
+        captured.CopyFrame(source);
+        for (int i = 0; i < 3; i++) {
+            copying[i].OnFrame(captured);
+        }
+    }
+    double copy_ms = (webrtc::TickTime::MicrosecondTimestamp() - start) /
+                     1000.0 / kFrames;
+
+    I420BufferPool pool;
+    I420FrameFanout fanout;
+    HoldingSink encoder(&pool, false);
+    HoldingSink renderer(&pool, false);
+    HoldingSink effect(&pool, true);
+    fanout.AddSink(&encoder);
+    fanout.AddSink(&renderer);
+    fanout.AddSink(&effect);
+    start = webrtc::TickTime::MicrosecondTimestamp();
+    for (int f = 0; f < kFrames; f++) {
+        fanout.DeliverFrame(pool.CopyFrom(source));
+    }
+    double fanout_ms = (webrtc::TickTime::MicrosecondTimestamp() - start) /
+                       1000.0 / kFrames;
+    I420BufferPoolStatistics stats = pool.GetStatistics();
+    XCTAssertEqual(encoder.frames, kFrames);
+    XCTAssertEqual(effect.sum, copying[2].sum);
+    XCTAssertGreaterThan(stats.pool_hits, stats.requests * 9 / 10);
+
+    NSLog(@"fanout 720p30, 3 sinks: deep copy %.3f ms/frame %.0f MB/s copied, "
+          "pooled %.3f ms/frame %.0f MB/s copied, %.1f%% pool hits",
+          copy_ms, 4 * frame_bytes * 30 / 1e6, fanout_ms,
+          stats.bytes_copied / static_cast<double>(kFrames) * 30 / 1e6,
+          stats.pool_hits * 100.0 / stats.requests);
+
+    I420BufferPool* p = &pool;
+    I420FrameFanout* o = &fanout;
+    webrtc::I420VideoFrame* s = &source;
+    [self measureBlock:^{
+        for (int f = 0; f < kFrames; f++) {
+            o->DeliverFrame(p->CopyFrom(*s));
+        }
+    }];
+}
+
+@end
@@ -0,0 +1,181 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#import <XCTest/XCTest.h>
+
+#include <atomic>
+#include <set>
+#include <thread>
+#include <vector>
+#include "webrtc/modules/audio_conference_mixer/source/memory_pool.h"
+#include "webrtc/system_wrappers/interface/tick_util.h"
+#include "LockFreePool.h"
+
+namespace {
+
+struct PoolItem {
+    PoolItem() : owner(0), value(0) {}
+    //Set while popped, a second owner would find it set.
+    std::atomic<int> owner;
+    int64_t value;
+};
+
+enum { kPoolCapacity = 64 };
+
+//Every thread pops |held| objects, writes them, checks and pushes them
+//back |rounds| times. Returns the number of objects that were handed to
+//two threads at once.
+int HammerLockFreePool(LockFreePool<PoolItem>* pool, int threads, int rounds,
+                       int held) {
+    std::atomic<int> conflicts(0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.push_back(std::thread([=, &conflicts] {
+            std::vector<PoolItem*> items(held);
+            for (int r = 0; r < rounds; r++) {
+                int popped = 0;
+                for (int i = 0; i < held; i++) {
+                    PoolItem* item = pool->Pop();
+                    if (item == NULL) {
+                        break;
+                    }
+                    if (item->owner.exchange(1) != 0) {
+                        conflicts++;
+                    }
+                    item->value = t * 1000000 + r;
+                    items[popped++] = item;
+                }
+                for (int i = 0; i < popped; i++) {
+                    if (items[i]->value != t * 1000000 + r) {
+                        conflicts++;
+                    }
+                    items[i]->owner.store(0);
+                    pool->Push(items[i]);
+                }
+            }
+        }));
+    }
+    for (int t = 0; t < threads; t++) {
+        workers[t].join();
+    }
+    return conflicts;
+}
+
+//The same pop, touch, push cycle through webrtc::MemoryPool.
+void HammerMemoryPool(webrtc::MemoryPool<PoolItem>* pool, int threads,
+                      int rounds) {
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.push_back(std::thread([=] {
+            for (int r = 0; r < rounds; r++) {
+                PoolItem* item = NULL;
+                pool->PopMemory(item);
+                item->value = r;
+                pool->PushMemory(item);
+            }
+        }));
+    }
+    for (int t = 0; t < threads; t++) {
+        workers[t].join();
+    }
+}
+
+}  // namespace
+
+@interface LockFreePoolTests : XCTestCase
+@end
+
+@implementation LockFreePoolTests
+
+- (void)testPopsEveryObjectOnce {
+    LockFreePool<PoolItem> pool(8);
+    std::set<PoolItem*> popped;
+    for (int i = 0; i < 8; i++) {
+        PoolItem* item = pool.Pop();
+        XCTAssertTrue(item != NULL);
+        XCTAssertTrue(pool.Owns(item));
+        popped.insert(item);
+    }
+    XCTAssertEqual(popped.size(), 8u);
+    XCTAssertTrue(pool.Pop() == NULL);
+
+    PoolItem* first = *popped.begin();
+    pool.Push(first);
+    XCTAssertTrue(pool.Pop() == first);
+    for (std::set<PoolItem*>::iterator it = popped.begin();
+         it != popped.end(); ++it) {
+        pool.Push(*it);
+    }
+
+    PoolItem outside;
+    XCTAssertFalse(pool.Owns(&outside));
+}
+
+- (void)testMemoryPoolInterface {
+    LockFreePool<PoolItem> pool(1);
+    PoolItem* item = NULL;
+    XCTAssertEqual(pool.PopMemory(item), 0);
+    XCTAssertTrue(item != NULL);
+    PoolItem* none = NULL;
+    XCTAssertEqual(pool.PopMemory(none), -1);
+    XCTAssertEqual(pool.PushMemory(item), 0);
+    XCTAssertTrue(item == NULL);
+    XCTAssertEqual(pool.PushMemory(item), -1);
+    {
+        ScopedPoolItem<PoolItem> scoped(&pool);
+        XCTAssertTrue(scoped.get() != NULL);
+        XCTAssertTrue(pool.Pop() == NULL);
+    }
+    XCTAssertTrue(pool.Pop() != NULL);
+}
+
+- (void)testConcurrentPopPush {
+    //More threads than objects, so Pop() also runs dry under contention.
+    LockFreePool<PoolItem> pool(kPoolCapacity);
+    XCTAssertEqual(HammerLockFreePool(&pool, 8, 20000, 4), 0);
+    XCTAssertEqual(HammerLockFreePool(&pool, 16, 5000, 8), 0);
+
+    std::set<PoolItem*> popped;
+    while (PoolItem* item = pool.Pop()) {
+        popped.insert(item);
+    }
+    XCTAssertEqual(popped.size(), static_cast<size_t>(kPoolCapacity));
+}
+
+//One pop and push per frame and participant, what the mixer's fetch tasks
+//do, against the list and critical section of webrtc::MemoryPool.
+- (void)testBenchmarkContention {
+    static const int kRounds = 100000;
+    for (int threads = 1; threads <= 16; threads *= 2) {
+        LockFreePool<PoolItem> lock_free(kPoolCapacity);
+        int64_t start = webrtc::TickTime::MicrosecondTimestamp();
+        HammerLockFreePool(&lock_free, threads, kRounds, 1);
+        int64_t lock_free_us = webrtc::TickTime::MicrosecondTimestamp() - start;
+
+        webrtc::MemoryPool<PoolItem>* memory_pool = NULL;
+        webrtc::MemoryPool<PoolItem>::CreateMemoryPool(memory_pool,
+                                                       kPoolCapacity);
+        start = webrtc::TickTime::MicrosecondTimestamp();
+        HammerMemoryPool(memory_pool, threads, kRounds);
+        int64_t locked_us = webrtc::TickTime::MicrosecondTimestamp() - start;
+        webrtc::MemoryPool<PoolItem>::DeleteMemoryPool(memory_pool);
+
+        double operations = 1.0 * threads * kRounds;
+        NSLog(@"pool %d threads: LockFreePool %.1f ns, MemoryPool %.1f ns per "
+              "pop and push", threads, lock_free_us * 1000 / operations,
+              locked_us * 1000 / operations);
+    }
+
+    LockFreePool<PoolItem> pool(kPoolCapacity);
+    LockFreePool<PoolItem>* p = &pool;
+    [self measureBlock:^{
+        HammerLockFreePool(p, 8, kRounds, 1);
+    }];
+}
+
+@end
@@ -0,0 +1,35 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#ifndef VOIP_LOSS_GENERATOR_H
+#define VOIP_LOSS_GENERATOR_H
+
+#include <stdint.h>
+
+//Random packet loss for the simulators, Park-Miller so that equal seeds give
+//equal loss patterns on every platform, unlike rand().
+class LossGenerator {
+public:
+    explicit LossGenerator(uint32_t seed) : state_(seed % 2147483647) {
+        if (state_ == 0) {
+            state_ = 1;
+        }
+    }
+
+    //Draws once, true with probability |loss_rate|.
+    bool Lost(float loss_rate) {
+        state_ = static_cast<uint32_t>(
+            (static_cast<uint64_t>(state_) * 48271) % 2147483647);
+        return state_ < loss_rate * 2147483647.0;
+    }
+
+private:
+    uint32_t state_;
+};
+
+#endif
@@ -0,0 +1,269 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#import <XCTest/XCTest.h>
+
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "webrtc/system_wrappers/interface/tick_util.h"
+#include "MediaDemux.h"
+
+namespace {
+
+enum { kPacketLength = 1000 };
+
+//The first two bytes of every test packet tag it. Audio is recorded on the
+//delivering thread and video on the video queue, each list is read after
+//MediaDemux::Flush.
+class RecordingReceiver : public MediaDemux::Receiver {
+public:
+    RecordingReceiver()
+    : video_cost_us(0), gate_open(true), entered(false) {}
+
+    virtual void OnRtpPacket(MediaType media, const uint8_t* packet,
+                             size_t length) {
+        Record(media, true, packet, length);
+    }
+
+    virtual void OnRtcpPacket(MediaType media, const uint8_t* packet,
+                              size_t length) {
+        Record(media, false, packet, length);
+    }
+
+    std::vector<int> audio_tags;
+    std::vector<int> video_tags;
+    std::vector<bool> video_rtp;
+    //Time of inserting one packet into the ViE jitter buffer.
+    int video_cost_us;
+    //Closed, video delivery waits in its first packet.
+    std::atomic<bool> gate_open;
+    std::atomic<bool> entered;
+
+private:
+    void Record(MediaType media, bool rtp, const uint8_t* packet,
+                size_t /*length*/) {
+        int tag = packet[0] << 8 | packet[1];
+        if (media == kMediaAudio) {
+            audio_tags.push_back(tag);
+            return;
+        }
+        entered.store(true);
+        while (!gate_open.load()) {
+            std::this_thread::yield();
+        }
+        video_tags.push_back(tag);
+        video_rtp.push_back(rtp);
+        if (video_cost_us > 0) {
+            int64_t end = webrtc::TickTime::MicrosecondTimestamp() +
+                          video_cost_us;
+            while (webrtc::TickTime::MicrosecondTimestamp() < end) {
+            }
+        }
+    }
+};
+
+bool DeliverTagged(MediaDemux* demux, int media, bool rtp, int tag,
+                   size_t length) {
+    uint8_t data[MediaDemux::kMaxPacketSize + 1];
+    memset(data, 0, length);
+    data[0] = static_cast<uint8_t>(tag >> 8);
+    data[1] = static_cast<uint8_t>(tag);
+    return demux->DeliverPacket(media, rtp, data, length);
+}
+
+struct LoopbackResult {
+    double mean_audio_delay_us;
+    int64_t max_audio_delay_us;
+};
+
+//One second of a call read from the socket in real time: 50 audio packets
+//a second, 30 video frames of 3 packets with a key frame of 150 packets
+//every half second. |direct| delivers the video on the reading thread as before
+//the demux. The audio delay is how late the read handler gets to an audio
+//packet after it arrived.
+LoopbackResult RunLoopback(bool direct, int video_cost_us) {
+    struct Arrival {
+        int64_t time_us;
+        int media;
+        int tag;
+    };
+    std::vector<Arrival> arrivals;
+    for (int i = 0; i < 50; i++) {
+        Arrival audio = { i * 20000 + 1000, kMediaAudio, i };
+        arrivals.push_back(audio);
+    }
+    int video_tag = 0;
+    for (int frame = 0; frame < 30; frame++) {
+        int packets = frame % 15 == 0 ? 150 : 3;
+        for (int i = 0; i < packets; i++) {
+            //A burst from the access point, 20us a packet.
+            Arrival video = { frame * 33333 + i * 20, kMediaVideo,
+                              video_tag++ };
+            arrivals.push_back(video);
+        }
+    }
+    std::stable_sort(arrivals.begin(), arrivals.end(),
+                     [](const Arrival& a, const Arrival& b) {
+                         return a.time_us < b.time_us;
+                     });
+
+    RecordingReceiver receiver;
+    receiver.video_cost_us = video_cost_us;
+    MediaDemux demux(&receiver, MediaDemux::kDefaultVideoQueueSize);
+    uint8_t data[kPacketLength];
+    memset(data, 0, sizeof(data));
+    int64_t total_delay_us = 0;
+    LoopbackResult result = { 0, 0 };
+    int64_t start = webrtc::TickTime::MicrosecondTimestamp();
+    for (size_t i = 0; i < arrivals.size(); i++) {
+        int64_t now;
+        while ((now = webrtc::TickTime::MicrosecondTimestamp() - start) <
+               arrivals[i].time_us) {
+        }
+        data[0] = static_cast<uint8_t>(arrivals[i].tag >> 8);
+        data[1] = static_cast<uint8_t>(arrivals[i].tag);
+        if (arrivals[i].media == kMediaAudio) {
+            int64_t delay_us = now - arrivals[i].time_us;
+            total_delay_us += delay_us;
+            if (delay_us > result.max_audio_delay_us) {
+                result.max_audio_delay_us = delay_us;
+            }
+        }
+        if (direct) {
+            receiver.OnRtpPacket(static_cast<MediaType>(arrivals[i].media),
+                                 data, kPacketLength);
+        } else {
+            demux.DeliverPacket(arrivals[i].media, true, data, kPacketLength);
+        }
+    }
+    demux.Flush();
+    result.mean_audio_delay_us = total_delay_us / 50.0;
+    return result;
+}
+
+}  // namespace
+
+@interface MediaDemuxTests : XCTestCase
+@end
+
+@implementation MediaDemuxTests
+
+- (void)testRoutesByMediaType {
+    RecordingReceiver receiver;
+    MediaDemux demux(&receiver, 16);
+    XCTAssertTrue(DeliverTagged(&demux, kMediaAudio, true, 1, 100));
+    XCTAssertTrue(DeliverTagged(&demux, kMediaAudio, false, 2, 100));
+    //Audio is delivered before the call returns.
+    XCTAssertEqual(receiver.audio_tags.size(), 2u);
+    XCTAssertTrue(DeliverTagged(&demux, kMediaVideo, true, 3, 100));
+    XCTAssertTrue(DeliverTagged(&demux, kMediaVideo, false, 4, 100));
+    XCTAssertFalse(DeliverTagged(&demux, 3, true, 5, 100));
+    XCTAssertFalse(DeliverTagged(&demux, kMediaVideo, true, 6,
+                                 MediaDemux::kMaxPacketSize + 1));
+    demux.Flush();
+
+    XCTAssertEqual(receiver.audio_tags.size(), 2u);
+    XCTAssertEqual(receiver.video_tags.size(), 2u);
+    XCTAssertEqual(receiver.video_tags[0], 3);
+    XCTAssertTrue(receiver.video_rtp[0]);
+    XCTAssertEqual(receiver.video_tags[1], 4);
+    XCTAssertFalse(receiver.video_rtp[1]);
+    MediaDemuxStatistics stats = demux.GetStatistics();
+    XCTAssertEqual(stats.audio_packets, 2u);
+    XCTAssertEqual(stats.video_packets, 2u);
+    XCTAssertEqual(stats.video_dropped, 1u);
+}
+
+- (void)testDropsVideoWhenQueueFull {
+    RecordingReceiver receiver;
+    receiver.gate_open.store(false);
+    MediaDemux demux(&receiver, 4);
+    XCTAssertTrue(DeliverTagged(&demux, kMediaVideo, true, 0, 100));
+    while (!receiver.entered.load()) {
+        std::this_thread::yield();
+    }
+    //The packet being delivered keeps its entry, three are left.
+    for (int i = 1; i <= 5; i++) {
+        XCTAssertEqual(DeliverTagged(&demux, kMediaVideo, true, i, 100),
+                       i <= 3, @"%d", i);
+    }
+    //The read handler is not held up by the blocked video.
+    XCTAssertTrue(DeliverTagged(&demux, kMediaAudio, true, 100, 100));
+    XCTAssertEqual(receiver.audio_tags.size(), 1u);
+    receiver.gate_open.store(true);
+    demux.Flush();
+
+    XCTAssertEqual(receiver.video_tags.size(), 4u);
+    for (int i = 0; i < 4; i++) {
+        XCTAssertEqual(receiver.video_tags[i], i);
+    }
+    MediaDemuxStatistics stats = demux.GetStatistics();
+    XCTAssertEqual(stats.video_packets, 4u);
+    XCTAssertEqual(stats.video_dropped, 2u);
+    XCTAssertEqual(stats.max_video_batch, 3u);
+}
+
+- (void)testKeepsVideoOrder {
+    RecordingReceiver receiver;
+    receiver.video_cost_us = 2;
+    MediaDemux* demux = new MediaDemux(&receiver, 64);
+    static const int kPackets = 20000;
+    int accepted = 0;
+    for (int i = 0; i < kPackets; i++) {
+        accepted += DeliverTagged(demux, kMediaVideo, true, i & 0xffff, 200);
+        if (i % 100 == 0) {
+            DeliverTagged(demux, kMediaAudio, true, i / 100, 100);
+        }
+    }
+    MediaDemuxStatistics stats = demux->GetStatistics();
+    //Deleting waits for the queued video.
+    delete demux;
+
+    XCTAssertEqual(static_cast<int>(receiver.video_tags.size()), accepted);
+    XCTAssertEqual(stats.video_packets + stats.video_dropped,
+                   static_cast<uint64_t>(kPackets));
+    for (size_t i = 1; i < receiver.video_tags.size(); i++) {
+        XCTAssertLessThan(receiver.video_tags[i - 1],
+                          receiver.video_tags[i]);
+    }
+    XCTAssertEqual(receiver.audio_tags.size(), 200u);
+}
+
+//Audio delay behind a key frame burst, with video inserted on the read
+//thread and through the demux, at jitter buffer insert costs of a fast
+//and a slow device.
+- (void)testBenchmarkLoopback {
+    static const int kVideoCostsUs[] = { 50, 200 };
+    for (int c = 0; c < 2; c++) {
+        LoopbackResult direct = RunLoopback(true, kVideoCostsUs[c]);
+        LoopbackResult demux = RunLoopback(false, kVideoCostsUs[c]);
+        NSLog(@"loopback, video insert %d us: audio delay direct mean %.0f "
+              "max %lld us, demux mean %.0f max %lld us",
+              kVideoCostsUs[c], direct.mean_audio_delay_us,
+              direct.max_audio_delay_us, demux.mean_audio_delay_us,
+              demux.max_audio_delay_us);
+    }
+
+    RecordingReceiver receiver;
+    MediaDemux demux(&receiver, MediaDemux::kDefaultVideoQueueSize);
+    MediaDemux* d = &demux;
+    [self measureBlock:^{
+        uint8_t data[kPacketLength];
+        memset(data, 0, sizeof(data));
+        for (int i = 0; i < 100000; i++) {
+            d->DeliverPacket(i % 4 == 0 ? kMediaAudio : kMediaVideo, true,
+                             data, kPacketLength);
+        }
+        d->Flush();
+    }];
+}
+
+@end
@@ -0,0 +1,278 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#import <XCTest/XCTest.h>
+
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "webrtc/system_wrappers/interface/tick_util.h"
+#include "PacketPacer.h"
+
+namespace {
+
+//The first two bytes of every test packet tag it.
+class RecordingCallback : public PacketPacer::Callback {
+public:
+    RecordingCallback() : bytes(0) {}
+
+    virtual void TimeToSendPackets(const PacedPacket* const* packets,
+                                   int count) {
+        batch_sizes.push_back(count);
+        for (int i = 0; i < count; i++) {
+            tags.push_back(packets[i]->data[0] << 8 | packets[i]->data[1]);
+            bytes += packets[i]->length;
+        }
+    }
+
+    std::vector<int> batch_sizes;
+    std::vector<int> tags;
+    size_t bytes;
+};
+
+class CountingCallback : public PacketPacer::Callback {
+public:
+    CountingCallback() : packets(0) {}
+
+    virtual void TimeToSendPackets(const PacedPacket* const* /*packets*/,
+                                   int count) {
+        packets += count;
+    }
+
+    uint64_t packets;
+};
+
+bool InsertTagged(PacketPacer* pacer, PacketPacer::Priority priority, int tag,
+                  size_t length, int64_t now_ms) {
+    uint8_t data[PacedPacket::kMaxPacketSize + 1];
+    memset(data, 0, length);
+    data[0] = static_cast<uint8_t>(tag >> 8);
+    data[1] = static_cast<uint8_t>(tag);
+    return pacer->InsertPacket(priority, data, length, now_ms);
+}
+
+struct SimulationResult {
+    PacketPacerStatistics stats;
+    int64_t wall_us;
+};
+
+enum { kVideoPacketSize = 1200 };
+enum { kAudioPacketSize = 100 };
+enum { kProcessIntervalMs = 5 };
+
+//|seconds| of 30fps video at |bitrate_kbps|, every frame inserted as one
+//burst, and 50 audio packets a second, with Process() on the 5ms cadence
+//VOIPEngine's timer uses.
+SimulationResult Simulate(int bitrate_kbps, int seconds) {
+    CountingCallback callback;
+    PacketPacer pacer(&callback, bitrate_kbps, 1024);
+    uint8_t data[kVideoPacketSize];
+    memset(data, 0, sizeof(data));
+    int frame_bytes = bitrate_kbps * 1000 / 8 / 30;
+
+    int64_t start = webrtc::TickTime::MicrosecondTimestamp();
+    for (int64_t now_ms = 0; now_ms < seconds * 1000;
+         now_ms += kProcessIntervalMs) {
+        if (now_ms % 20 == 0) {
+            pacer.InsertPacket(PacketPacer::kHighPriority, data,
+                               kAudioPacketSize, now_ms);
+        }
+        //Frame starts, 1000/30 ms apart.
+        if (now_ms * 30 / 1000 != (now_ms - kProcessIntervalMs) * 30 / 1000 ||
+            now_ms == 0) {
+            for (int left = frame_bytes; left > 0; left -= kVideoPacketSize) {
+                size_t length = left < kVideoPacketSize ? left : kVideoPacketSize;
+                pacer.InsertPacket(PacketPacer::kNormalPriority, data, length,
+                                   now_ms);
+            }
+        }
+        pacer.Process(now_ms);
+    }
+
+    SimulationResult result;
+    result.wall_us = webrtc::TickTime::MicrosecondTimestamp() - start;
+    result.stats = pacer.GetStatistics();
+    return result;
+}
+
+}  // namespace
+
+@interface PacketPacerTests : XCTestCase
+@end
+
+@implementation PacketPacerTests
+
+- (void)testReleasesByPriorityThenOrder {
+    RecordingCallback callback;
+    PacketPacer pacer(&callback, 1000, 16);
+    XCTAssertTrue(InsertTagged(&pacer, PacketPacer::kLowPriority, 1, 100, 0));
+    XCTAssertTrue(InsertTagged(&pacer, PacketPacer::kNormalPriority, 2, 100, 0));
+    XCTAssertTrue(InsertTagged(&pacer, PacketPacer::kHighPriority, 3, 100, 0));
+    XCTAssertTrue(InsertTagged(&pacer, PacketPacer::kNormalPriority, 4, 100, 0));
+    XCTAssertEqual(pacer.QueueSizeBytes(), 400u);
+
+    //No budget yet, only audio goes.
+    XCTAssertEqual(pacer.Process(0), 1);
+    XCTAssertEqual(pacer.Process(5), 3);
+    static const int kExpected[] = { 3, 2, 4, 1 };
+    XCTAssertEqual(callback.tags.size(), 4u);
+    for (size_t i = 0; i < callback.tags.size(); i++) {
+        XCTAssertEqual(callback.tags[i], kExpected[i]);
+    }
+    XCTAssertEqual(callback.batch_sizes.size(), 2u);
+    XCTAssertEqual(pacer.QueueSizeBytes(), 0u);
+}
+
+- (void)testPacesAtMultipleOfTarget {
+    RecordingCallback callback;
+    PacketPacer pacer(&callback, 1000, 1024);
+    for (int i = 0; i < 1000; i++) {
+        XCTAssertTrue(InsertTagged(&pacer, PacketPacer::kNormalPriority, i,
+                                   1000, 0));
+    }
+    XCTAssertEqual(pacer.ExpectedQueueTimeMs(), 1000 * 1000 * 8 / 2500);
+    for (int64_t now_ms = 0; now_ms <= 1000; now_ms += 5) {
+        pacer.Process(now_ms);
+    }
+    //2.5 times 1000 kbps for one second, give or take the packet that runs
+    //into debt.
+    int expected = 2500 * 1000 / 8;
+    XCTAssertTrue(callback.bytes >= static_cast<size_t>(expected - 1000) &&
+                  callback.bytes <= static_cast<size_t>(expected + 1000),
+                  @"sent %d bytes", static_cast<int>(callback.bytes));
+    for (size_t i = 1; i < callback.tags.size(); i++) {
+        XCTAssertEqual(callback.tags[i], callback.tags[i - 1] + 1);
+    }
+}
+
+- (void)testIdleBudgetIsNotCarriedOver {
+    RecordingCallback callback;
+    PacketPacer pacer(&callback, 1000, 64);
+    pacer.Process(0);
+    //A second without Process(), then a burst: at most 30ms of budget.
+    for (int i = 0; i < 20; i++) {
+        InsertTagged(&pacer, PacketPacer::kNormalPriority, i, 1000, 1000);
+    }
+    pacer.Process(1000);
+    XCTAssertTrue(callback.bytes <= 2500 * 30 / 8 + 1000);
+    XCTAssertEqual(callback.tags.size(), 10u);
+}
+
+- (void)testBatchesUpToMaxBatchSize {
+    RecordingCallback callback;
+    PacketPacer pacer(&callback, 1000, 128);
+    for (int i = 0; i < 100; i++) {
+        InsertTagged(&pacer, PacketPacer::kHighPriority, i, 200, 0);
+    }
+    XCTAssertEqual(pacer.Process(0), 100);
+    XCTAssertEqual(callback.batch_sizes.size(), 4u);
+    XCTAssertEqual(callback.batch_sizes[0],
+                   static_cast<int>(PacketPacer::kMaxBatchSize));
+    XCTAssertEqual(callback.batch_sizes[3],
+                   100 - 3 * PacketPacer::kMaxBatchSize);
+    XCTAssertEqual(pacer.GetStatistics().batches, 4u);
+}
+
+- (void)testOldPacketsSentRegardless {
+    RecordingCallback callback;
+    PacketPacer pacer(&callback, 0, 16);
+    pacer.SetMaxQueueLengthMs(100);
+    InsertTagged(&pacer, PacketPacer::kNormalPriority, 1, 500, 0);
+    InsertTagged(&pacer, PacketPacer::kLowPriority, 2, 500, 50);
+    XCTAssertEqual(pacer.Process(0), 0);
+    XCTAssertEqual(pacer.Process(99), 0);
+    XCTAssertEqual(pacer.Process(100), 1);
+    XCTAssertEqual(pacer.Process(150), 1);
+    PacketPacerStatistics stats = pacer.GetStatistics();
+    XCTAssertEqual(stats.max_queue_time_ms, 100);
+    XCTAssertEqual(stats.total_queue_time_ms, 200);
+}
+
+- (void)testDropsWhenFull {
+    RecordingCallback callback;
+    PacketPacer pacer(&callback, 1000, 4);
+    for (int i = 0; i < 4; i++) {
+        XCTAssertTrue(InsertTagged(&pacer, PacketPacer::kNormalPriority, i,
+                                   100, 0));
+    }
+    XCTAssertFalse(InsertTagged(&pacer, PacketPacer::kHighPriority, 4, 100, 0));
+    XCTAssertEqual(pacer.GetStatistics().packets_dropped, 1u);
+    pacer.Process(0);
+    pacer.Process(5);
+    XCTAssertEqual(callback.tags.size(), 4u);
+    XCTAssertFalse(InsertTagged(&pacer, PacketPacer::kHighPriority, 5,
+                                PacedPacket::kMaxPacketSize + 1, 5));
+    XCTAssertEqual(pacer.GetStatistics().packets_dropped, 2u);
+}
+
+- (void)testConcurrentInsertKeepsPerThreadOrder {
+    static const int kThreads = 4;
+    static const int kPacketsPerThread = 5000;
+    RecordingCallback callback;
+    PacketPacer pacer(&callback, 1000, 256);
+    PacketPacer* p = &pacer;
+    std::atomic<int> done(0);
+    std::vector<std::thread> producers;
+    for (int t = 0; t < kThreads; t++) {
+        producers.push_back(std::thread([=, &done] {
+            for (int i = 0; i < kPacketsPerThread; i++) {
+                while (!InsertTagged(p, PacketPacer::kHighPriority,
+                                     t * kPacketsPerThread + i, 20, 0)) {
+                    std::this_thread::yield();
+                }
+            }
+            done++;
+        }));
+    }
+    while (done.load() < kThreads || pacer.QueueSizeBytes() > 0) {
+        pacer.Process(0);
+    }
+    for (int t = 0; t < kThreads; t++) {
+        producers[t].join();
+    }
+
+    XCTAssertEqual(callback.tags.size(),
+                   static_cast<size_t>(kThreads * kPacketsPerThread));
+    std::vector<int> next(kThreads, 0);
+    bool in_order = true;
+    for (size_t i = 0; i < callback.tags.size(); i++) {
+        int t = callback.tags[i] / kPacketsPerThread;
+        in_order = in_order && callback.tags[i] % kPacketsPerThread == next[t];
+        next[t]++;
+    }
+    XCTAssertTrue(in_order);
+}
+
+//Queueing delay and the CPU the pacer takes at 2-50 Mbps, ten simulated
+//seconds per rate.
+- (void)testBenchmarkSimulation {
+    static const int kBitratesKbps[] = { 2000, 5000, 10000, 20000, 50000 };
+    static const int kSeconds = 10;
+    for (int i = 0; i < 5; i++) {
+        SimulationResult r = Simulate(kBitratesKbps[i], kSeconds);
+        double cpu_percent = r.wall_us / (kSeconds * 1e6) * 100;
+        NSLog(@"pacer %d Mbps: %llu packets in %llu batches, queue delay mean "
+              "%.1f ms max %lld ms, dropped %llu, cpu %.3f%%, %.0f ns per packet",
+              kBitratesKbps[i] / 1000, r.stats.packets_sent, r.stats.batches,
+              r.stats.packets_sent > 0 ?
+                  1.0 * r.stats.total_queue_time_ms / r.stats.packets_sent : 0.0,
+              r.stats.max_queue_time_ms, r.stats.packets_dropped, cpu_percent,
+              r.stats.packets_sent > 0 ?
+                  r.wall_us * 1000.0 / r.stats.packets_sent : 0.0);
+        //At 2.5 times the target a frame leaves well within the next one.
+        XCTAssertTrue(r.stats.max_queue_time_ms < 1000 / 30);
+        XCTAssertEqual(r.stats.packets_dropped, 0u);
+    }
+
+    [self measureBlock:^{
+        Simulate(20000, 2);
+    }];
+}
+
+@end
@@ -0,0 +1,223 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#import <XCTest/XCTest.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "webrtc/system_wrappers/interface/tick_util.h"
+#include "ReceiveStatistics.h"
+
+namespace {
+
+enum { kClockRateHz = 90000 };
+enum { kMaxBlocks = 31 };
+
+ReceivedRtpPacket MakePacket(uint32_t ssrc, uint16_t sequence_number,
+                             uint32_t timestamp) {
+    ReceivedRtpPacket packet;
+    packet.ssrc = ssrc;
+    packet.sequence_number = sequence_number;
+    packet.timestamp = timestamp;
+    packet.clock_rate_hz = kClockRateHz;
+    packet.header_length = 12;
+    packet.payload_length = 1000;
+    packet.padding_length = 0;
+    return packet;
+}
+
+//One packet for each of |count| streams from |first_ssrc| on.
+void ReceiveOnEach(ReceiveStatistics* statistics, uint32_t first_ssrc,
+                   int count, uint16_t sequence_number, int64_t now_ms) {
+    for (int i = 0; i < count; i++) {
+        statistics->IncomingPacket(
+            MakePacket(first_ssrc + i, sequence_number,
+                       static_cast<uint32_t>(now_ms * 90)), now_ms);
+    }
+}
+
+//Packets/s of |threads| receiving threads spread over |ssrcs| streams, one
+//more thread building reports every 10ms as the RTCP sender would.
+double ReceiveRate(int threads, int ssrcs, int packets_per_thread) {
+    ReceiveStatistics statistics;
+    std::atomic<bool> done(false);
+    std::thread reporter([&] {
+        RtcpReportBlock blocks[kMaxBlocks];
+        while (!done.load(std::memory_order_relaxed)) {
+            statistics.GetReportBlocks(blocks, kMaxBlocks, 0);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    });
+
+    int64_t start = webrtc::TickTime::MicrosecondTimestamp();
+    std::vector<std::thread> receivers;
+    for (int t = 0; t < threads; t++) {
+        receivers.push_back(std::thread([=, &statistics] {
+            for (int k = 0; k < packets_per_thread; k++) {
+                int stream = (k + t * 7) % ssrcs;
+                uint16_t sequence_number = static_cast<uint16_t>(k / ssrcs);
+                statistics.IncomingPacket(
+                    MakePacket(0x1000 + stream, sequence_number,
+                               sequence_number * 3000), 0);
+            }
+        }));
+    }
+    for (int t = 0; t < threads; t++) {
+        receivers[t].join();
+    }
+    int64_t elapsed = webrtc::TickTime::MicrosecondTimestamp() - start;
+    done.store(true);
+    reporter.join();
+    return threads * static_cast<double>(packets_per_thread) * 1000000 /
+           (elapsed > 0 ? elapsed : 1);
+}
+
+}  // namespace
+
+@interface ReceiveStatisticsTests : XCTestCase
+@end
+
+@implementation ReceiveStatisticsTests
+
+- (void)testReportsLoss {
+    ReceiveStatistics statistics;
+    //10 of 100 packets lost, the last 10 across the wrap.
+    for (int i = 0; i < 100; i++) {
+        if (i % 10 != 5) {
+            uint16_t sequence_number = static_cast<uint16_t>(65500 + i);
+            statistics.IncomingPacket(
+                MakePacket(1234, sequence_number, i * 3000), i * 33);
+        }
+    }
+    RtcpReportBlock blocks[kMaxBlocks];
+    XCTAssertEqual(statistics.GetReportBlocks(blocks, kMaxBlocks, 3300), 1);
+    XCTAssertEqual(blocks[0].ssrc, 1234u);
+    XCTAssertEqual(blocks[0].cumulative_lost, 10u);
+    XCTAssertEqual(blocks[0].fraction_lost, 10 * 256 / 100);
+    XCTAssertEqual(blocks[0].extended_highest_sequence_number,
+                   65536u + 65599 - 65536);
+
+    StreamDataCounters counters;
+    statistics.GetStatistician(1234)->GetDataCounters(&counters);
+    XCTAssertEqual(counters.packets, 90u);
+    XCTAssertEqual(counters.bytes, 90u * 1012);
+
+    //Idle streams are left out.
+    XCTAssertEqual(statistics.GetReportBlocks(
+        blocks, kMaxBlocks, 3300 + ReceiveStatistics::kStreamTimeoutMs + 1),
+        0);
+}
+
+- (void)testEvictsIdleStreamsWhenFull {
+    ReceiveStatistics statistics;
+    ReceiveOnEach(&statistics, 1, ReceiveStatistics::kMaxStreams, 0, 0);
+    XCTAssertEqual(statistics.num_streams(),
+                   static_cast<int>(ReceiveStatistics::kMaxStreams));
+
+    //Half the streams stay active, the others go idle.
+    int64_t now_ms = 0;
+    for (; now_ms <= ReceiveStatistics::kStreamTimeoutMs + 1000;
+         now_ms += 1000) {
+        ReceiveOnEach(&statistics, 1, ReceiveStatistics::kMaxStreams / 2,
+                      static_cast<uint16_t>(now_ms / 1000 + 1), now_ms);
+    }
+    ReceiveOnEach(&statistics, 100000, 1, 0, now_ms);
+    XCTAssertEqual(statistics.num_streams(),
+                   ReceiveStatistics::kMaxStreams / 2 + 1);
+    XCTAssertTrue(statistics.GetStatistician(100000) != NULL);
+    XCTAssertTrue(statistics.GetStatistician(1) != NULL);
+    XCTAssertTrue(statistics.GetStatistician(
+        ReceiveStatistics::kMaxStreams / 2) != NULL);
+    XCTAssertTrue(statistics.GetStatistician(
+        ReceiveStatistics::kMaxStreams / 2 + 1) == NULL);
+    XCTAssertTrue(statistics.GetStatistician(
+        ReceiveStatistics::kMaxStreams) == NULL);
+
+    //The active streams keep their state through the eviction.
+    StreamDataCounters counters;
+    statistics.GetStatistician(1)->GetDataCounters(&counters);
+    XCTAssertEqual(counters.packets,
+                   static_cast<uint32_t>(now_ms / 1000 + 1));
+
+    //Evicted entries are reused, the table fills up to kMaxStreams again.
+    ReceiveOnEach(&statistics, 200000, ReceiveStatistics::kMaxStreams, 0,
+                  now_ms);
+    XCTAssertEqual(statistics.num_streams(),
+                   static_cast<int>(ReceiveStatistics::kMaxStreams));
+    XCTAssertTrue(statistics.GetStatistician(200000) != NULL);
+    XCTAssertTrue(statistics.GetStatistician(1) != NULL);
+}
+
+- (void)testDropsNewStreamsWhileAllActive {
+    ReceiveStatistics statistics;
+    ReceiveOnEach(&statistics, 1, ReceiveStatistics::kMaxStreams, 0, 0);
+    ReceiveOnEach(&statistics, 5000, 10, 0, 1000);
+    XCTAssertEqual(statistics.num_streams(),
+                   static_cast<int>(ReceiveStatistics::kMaxStreams));
+    XCTAssertTrue(statistics.GetStatistician(5000) == NULL);
+
+    //Counted once the old streams have gone idle.
+    ReceiveOnEach(&statistics, 5000, 10, 1,
+                  ReceiveStatistics::kStreamTimeoutMs + 1);
+    XCTAssertTrue(statistics.GetStatistician(5000) != NULL);
+    XCTAssertEqual(statistics.num_streams(), 10);
+}
+
+- (void)testChurnKeepsLookupsWorking {
+    //Streams come and go for long enough that every entry is removed and
+    //reused many times.
+    ReceiveStatistics statistics;
+    uint32_t seed = 1;
+    for (int round = 0; round < 40; round++) {
+        int64_t now_ms = round * (ReceiveStatistics::kStreamTimeoutMs + 1);
+        seed = seed * 1103515245 + 12345;
+        uint32_t first_ssrc = seed;
+        int count = ReceiveStatistics::kMaxStreams / 2 + (seed >> 24);
+        ReceiveOnEach(&statistics, first_ssrc, count, 0, now_ms);
+        for (int i = 0; i < count; i++) {
+            StreamStatistician* statistician =
+                statistics.GetStatistician(first_ssrc + i);
+            XCTAssertTrue(statistician != NULL);
+            if (statistician != NULL) {
+                XCTAssertEqual(statistician->ssrc(), first_ssrc + i);
+            }
+        }
+        XCTAssertLessThanOrEqual(statistics.num_streams(),
+                                 static_cast<int>(
+                                     ReceiveStatistics::kMaxStreams));
+    }
+}
+
+//Receiving threads and a reporting thread on 1 to 1000 streams, from all
+//threads on one stream to every thread on its own streams.
+- (void)testBenchmarkThreads {
+    static const int kSsrcs[] = { 1, 10, 100, 1000 };
+    static const int kThreads[] = { 1, 2, 4 };
+    static const int kPacketsPerThread = 200000;
+    for (int s = 0; s < 4; s++) {
+        for (int t = 0; t < 3; t++) {
+            double best = 0;
+            for (int round = 0; round < 3; round++) {
+                double rate = ReceiveRate(kThreads[t], kSsrcs[s],
+                                          kPacketsPerThread);
+                if (rate > best) {
+                    best = rate;
+                }
+            }
+            NSLog(@"receive statistics, %d ssrcs, %d threads: %.0f packets/s",
+                  kSsrcs[s], kThreads[t], best);
+        }
+    }
+
+    [self measureBlock:^{
+        ReceiveRate(4, 100, kPacketsPerThread);
+    }];
+}
+
+@end
@@ -0,0 +1,240 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#import <XCTest/XCTest.h>
+
+#include <math.h>
+#include <string.h>
+#include <vector>
+#include "webrtc/common_audio/resampler/push_sinc_resampler.h"
+#include "BenchmarkUtil.h"
+#include "ResamplerCache.h"
+
+static const int kBlocks = 20;
+
+//Two tones per channel so every channel carries different samples.
+static void MakeTone(int rate_hz, int frames, int num_channels,
+                     std::vector<int16_t>* samples) {
+    samples->resize(frames * num_channels);
+    for (int i = 0; i < frames; i++) {
+        for (int ch = 0; ch < num_channels; ch++) {
+            double t = i * 1.0 / rate_hz;
+            double v = 8000 * sin(2 * M_PI * (440 + 220 * ch) * t) +
+                       3000 * sin(2 * M_PI * 1000 * t);
+            (*samples)[i * num_channels + ch] = static_cast<int16_t>(v);
+        }
+    }
+}
+
+static void ResampleMono(CachedPushResampler* resampler,
+                         const std::vector<int16_t>& source,
+                         std::vector<int16_t>* destination) {
+    int source_frames = resampler->source_frames();
+    int destination_frames = resampler->destination_frames();
+    int blocks = static_cast<int>(source.size()) / source_frames;
+    destination->resize(blocks * destination_frames);
+    for (int b = 0; b < blocks; b++) {
+        resampler->Resample(&source[b * source_frames], source_frames,
+                            &(*destination)[b * destination_frames],
+                            destination_frames);
+    }
+}
+
+@interface ResamplerCacheTests : XCTestCase
+@end
+
+@implementation ResamplerCacheTests
+
+- (void)setUp {
+    [super setUp];
+    ResamplerCache::Instance()->Clear();
+}
+
+- (void)testAcquireReusesReleasedResampler {
+    ResamplerCache* cache = ResamplerCache::Instance();
+    int hits = cache->hits();
+    int misses = cache->misses();
+
+    CachedPushResampler* first = cache->Acquire(480, 160);
+    XCTAssertEqual(cache->misses(), misses + 1);
+    cache->Release(first);
+
+    CachedPushResampler* second = cache->Acquire(480, 160);
+    XCTAssertTrue(second == first);
+    XCTAssertEqual(cache->hits(), hits + 1);
+
+    //Another ratio never gets the idle 48 to 16 kHz instance.
+    CachedPushResampler* other = cache->Acquire(160, 480);
+    XCTAssertTrue(other != first);
+    XCTAssertEqual(other->source_frames(), 160);
+    XCTAssertEqual(other->destination_frames(), 480);
+    cache->Release(other);
+    cache->Release(second);
+}
+
+- (void)testMatchesPushSincResampler {
+    static const int kRates[] = { 8000, 16000, 32000, 48000 };
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            if (i == j) {
+                continue;
+            }
+            int source_frames = kRates[i] / 100;
+            int destination_frames = kRates[j] / 100;
+            std::vector<int16_t> source;
+            MakeTone(kRates[i], source_frames * kBlocks, 1, &source);
+
+            webrtc::PushSincResampler reference(source_frames,
+                                                destination_frames);
+            std::vector<int16_t> expected(destination_frames * kBlocks);
+            for (int b = 0; b < kBlocks; b++) {
+                reference.Resample(&source[b * source_frames], source_frames,
+                                   &expected[b * destination_frames],
+                                   destination_frames);
+            }
+
+            ScopedPushResampler resampler(source_frames, destination_frames);
+            std::vector<int16_t> actual;
+            ResampleMono(resampler.get(), source, &actual);
+            XCTAssertTrue(actual == expected, @"%d to %d Hz",
+                          kRates[i], kRates[j]);
+        }
+    }
+}
+
+- (void)testReleasedResamplerStartsOver {
+    std::vector<int16_t> source;
+    MakeTone(48000, 480 * kBlocks, 1, &source);
+
+    ResamplerCache* cache = ResamplerCache::Instance();
+    CachedPushResampler* resampler = cache->Acquire(480, 160);
+    std::vector<int16_t> first;
+    ResampleMono(resampler, source, &first);
+    cache->Release(resampler);
+
+    //A reused instance has no history of the previous owner's audio.
+    resampler = cache->Acquire(480, 160);
+    std::vector<int16_t> second;
+    ResampleMono(resampler, source, &second);
+    cache->Release(resampler);
+    XCTAssertTrue(first == second);
+}
+
+- (void)testInterleavedMatchesPerChannel {
+    static const int kChannels[] = { 1, 2, 6 };
+    for (int c = 0; c < 3; c++) {
+        int num_channels = kChannels[c];
+        std::vector<int16_t> source;
+        MakeTone(48000, 480 * kBlocks, num_channels, &source);
+
+        InterleavedResampler interleaved(48000, 16000, num_channels);
+        std::vector<int16_t> actual(160 * num_channels * kBlocks);
+        for (int b = 0; b < kBlocks; b++) {
+            int written = interleaved.Resample(
+                &source[b * 480 * num_channels], 480 * num_channels,
+                &actual[b * 160 * num_channels], 160 * num_channels);
+            XCTAssertEqual(written, 160 * num_channels);
+        }
+
+        for (int ch = 0; ch < num_channels; ch++) {
+            std::vector<int16_t> mono(480 * kBlocks);
+            for (size_t i = 0; i < mono.size(); i++) {
+                mono[i] = source[i * num_channels + ch];
+            }
+            webrtc::PushSincResampler reference(480, 160);
+            std::vector<int16_t> expected(160 * kBlocks);
+            for (int b = 0; b < kBlocks; b++) {
+                reference.Resample(&mono[b * 480], 480, &expected[b * 160],
+                                   160);
+            }
+            for (int i = 0; i < 160 * kBlocks; i++) {
+                if (actual[i * num_channels + ch] != expected[i]) {
+                    XCTFail(@"%d channels, channel %d differs at %d",
+                            num_channels, ch, i);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+- (void)testInterleavedRejectsWrongSizes {
+    InterleavedResampler resampler(32000, 48000, 2);
+    std::vector<int16_t> source(320 * 2);
+    std::vector<int16_t> destination(480 * 2);
+    XCTAssertEqual(resampler.Resample(&source[0], 320, &destination[0],
+                                      480 * 2), -1);
+    XCTAssertEqual(resampler.Resample(&source[0], 320 * 2, &destination[0],
+                                      480), -1);
+
+    //Equal rates copy through.
+    InterleavedResampler same(16000, 16000, 2);
+    MakeTone(16000, 160, 2, &source);
+    XCTAssertEqual(same.Resample(&source[0], 320, &destination[0], 320), 320);
+    XCTAssertTrue(memcmp(&source[0], &destination[0], 320 * 2) == 0);
+}
+
+//What a participant joining the room pays for its resampler.
+- (void)testBenchmarkJoin {
+    ResamplerCache* cache = ResamplerCache::Instance();
+    static const int kRates[] = { 8000, 16000, 32000, 48000 };
+    cache->Prewarm(kRates, 4, 4);
+
+    double constructed = MeasureNsPerCall(5, 100, ^{
+        delete new CachedPushResampler(480, 160);
+    });
+    double cached = MeasureNsPerCall(5, 100, ^{
+        cache->Release(cache->Acquire(480, 160));
+    });
+    NSLog(@"resampler join 48 to 16 kHz: constructed %.0f ns, cached %.0f ns",
+          constructed, cached);
+
+    [self measureBlock:^{
+        for (int i = 0; i < 1000; i++) {
+            cache->Release(cache->Acquire(480, 160));
+        }
+    }];
+}
+
+- (void)testBenchmarkInterleaved {
+    static const int kRates[] = { 8000, 16000, 32000, 48000 };
+    for (int i = 0; i < 4; i++) {
+        for (int num_channels = 1; num_channels <= 2; num_channels++) {
+            int source_frames = kRates[i] / 100;
+            std::vector<int16_t> source;
+            MakeTone(kRates[i], source_frames, num_channels, &source);
+            std::vector<int16_t> destination(480 * num_channels);
+            int16_t* dst = &destination[0];
+            const int16_t* src = &source[0];
+            int length = source_frames * num_channels;
+
+            InterleavedResampler resampler(kRates[i], 48000, num_channels);
+            InterleavedResampler* r = &resampler;
+            double ns = MeasureNsPerCall(5, 200, ^{
+                r->Resample(src, length, dst, 480 * num_channels);
+            });
+            NSLog(@"interleaved resample %d Hz to 48 kHz, %d channels: "
+                  "%.0f ns per 10 ms", kRates[i], num_channels, ns);
+        }
+    }
+
+    std::vector<int16_t> source;
+    MakeTone(16000, 160, 2, &source);
+    std::vector<int16_t> destination(480 * 2);
+    const int16_t* src = &source[0];
+    int16_t* dst = &destination[0];
+    InterleavedResampler resampler(16000, 48000, 2);
+    InterleavedResampler* r = &resampler;
+    [self measureBlock:^{
+        for (int i = 0; i < 1000; i++) {
+            r->Resample(src, 320, dst, 960);
+        }
+    }];
+}
+
+@end
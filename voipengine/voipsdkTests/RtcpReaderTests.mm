@@ -0,0 +1,530 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#import <XCTest/XCTest.h>
+
+#include <string.h>
+#include <vector>
+#include "webrtc/modules/rtp_rtcp/source/rtcp_utility.h"
+#include "BenchmarkUtil.h"
+#include "RtcpReader.h"
+#include "RtcpWriter.h"
+
+using namespace webrtc::RTCPUtility;
+
+namespace {
+
+//Park-Miller as in LossGenerator, the fuzz runs are reproducible.
+class Random {
+public:
+    explicit Random(uint32_t seed) : state_(seed % 2147483647 + 1) {}
+
+    uint32_t Next() {
+        state_ = static_cast<uint32_t>(
+            (static_cast<uint64_t>(state_) * 48271) % 2147483647);
+        return state_;
+    }
+
+    //In [0, n).
+    int Uniform(int n) { return static_cast<int>(Next() % n); }
+
+    uint32_t Next32() { return (Next() << 16) ^ Next(); }
+
+private:
+    uint32_t state_;
+};
+
+RtcpReportBlock RandomReportBlock(Random* random) {
+    RtcpReportBlock block;
+    block.ssrc = random->Next32();
+    block.fraction_lost = static_cast<uint8_t>(random->Next());
+    block.cumulative_lost = random->Next32() & 0xffffff;
+    block.extended_highest_sequence_number = random->Next32();
+    block.jitter = random->Next32();
+    block.last_sr = random->Next32();
+    block.delay_since_last_sr = random->Next32();
+    return block;
+}
+
+//A valid compound packet: an SR or RR, then up to six feedback blocks.
+size_t BuildRandomPacket(Random* random, uint8_t* buffer, size_t capacity) {
+    RtcpWriter writer(buffer, capacity);
+    uint32_t ssrc = random->Next32();
+    RtcpReportBlock blocks[3];
+    int count = random->Uniform(4);
+    for (int i = 0; i < count; i++) {
+        blocks[i] = RandomReportBlock(random);
+    }
+    if (random->Uniform(2)) {
+        writer.AddSenderReport(ssrc, random->Next32(), random->Next32(),
+                               random->Next32(), random->Next32(),
+                               random->Next32(), blocks, count);
+    } else {
+        writer.AddReceiverReport(ssrc, blocks, count);
+    }
+
+    int feedback = random->Uniform(7);
+    for (int i = 0; i < feedback; i++) {
+        uint32_t media_ssrc = random->Next32();
+        switch (random->Uniform(6)) {
+            case 0: {
+                char cname[32];
+                int length = 1 + random->Uniform(30);
+                for (int c = 0; c < length; c++) {
+                    cname[c] = static_cast<char>('a' + random->Uniform(26));
+                }
+                cname[length] = 0;
+                writer.AddSdesCname(ssrc, cname);
+                break;
+            }
+            case 1: {
+                uint16_t nacks[60];
+                int n = 1 + random->Uniform(60);
+                uint16_t seq = static_cast<uint16_t>(random->Next());
+                for (int k = 0; k < n; k++) {
+                    nacks[k] = seq;
+                    seq += 1 + random->Uniform(20);
+                }
+                writer.AddNack(ssrc, media_ssrc, nacks, n);
+                break;
+            }
+            case 2:
+                writer.AddPli(ssrc, media_ssrc);
+                break;
+            case 3:
+                writer.AddFir(ssrc, media_ssrc,
+                              static_cast<uint8_t>(random->Next()));
+                break;
+            case 4: {
+                uint32_t targets[4];
+                int n = random->Uniform(5);
+                for (int k = 0; k < n; k++) {
+                    targets[k] = random->Next32();
+                }
+                writer.AddRemb(ssrc, random->Next32() >> random->Uniform(32),
+                               targets, n);
+                break;
+            }
+            default:
+                writer.AddBye(ssrc);
+                break;
+        }
+    }
+    return writer.length();
+}
+
+uint32_t ReadUint32(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) |
+           p[3];
+}
+
+//The events as one flat list of numbers, so the reader and RTCPParserV2
+//can be compared as a whole.
+std::vector<uint32_t> Summarize(const RtcpReader& reader) {
+    std::vector<uint32_t> s;
+    for (int i = 0; i < reader.num_events(); i++) {
+        const RtcpEvent& e = reader.event(i);
+        s.push_back(e.type);
+        switch (e.type) {
+            case kRtcpSenderReport:
+                s.push_back(e.sender_ssrc);
+                s.push_back(e.sender_report.ntp_seconds);
+                s.push_back(e.sender_report.ntp_fraction);
+                s.push_back(e.sender_report.rtp_timestamp);
+                s.push_back(e.sender_report.packet_count);
+                s.push_back(e.sender_report.octet_count);
+                break;
+            case kRtcpReportBlock:
+                s.push_back(e.report_block.ssrc);
+                s.push_back(e.report_block.fraction_lost);
+                s.push_back(e.report_block.cumulative_lost);
+                s.push_back(e.report_block.extended_highest_sequence_number);
+                s.push_back(e.report_block.jitter);
+                s.push_back(e.report_block.last_sr);
+                s.push_back(e.report_block.delay_since_last_sr);
+                break;
+            case kRtcpCname:
+                s.push_back(e.sender_ssrc);
+                s.insert(s.end(), e.raw.data, e.raw.data + e.raw.length);
+                break;
+            case kRtcpNack:
+                s.push_back(e.sender_ssrc);
+                s.push_back(e.media_ssrc);
+                s.insert(s.end(), reader.nack_list() + e.nack.first,
+                         reader.nack_list() + e.nack.first + e.nack.count);
+                break;
+            case kRtcpFir:
+                s.push_back(e.sender_ssrc);
+                s.push_back(e.media_ssrc);
+                s.push_back(e.fir.command_seq);
+                break;
+            case kRtcpRemb:
+                s.push_back(e.sender_ssrc);
+                s.push_back(e.remb.bitrate_bps);
+                for (int k = 0; k < e.remb.ssrc_count; k++) {
+                    s.push_back(ReadUint32(e.remb.ssrcs + 4 * k));
+                }
+                break;
+            default:
+                s.push_back(e.sender_ssrc);
+                s.push_back(e.media_ssrc);
+                break;
+        }
+    }
+    return s;
+}
+
+std::vector<uint32_t> SummarizeReference(const uint8_t* packet,
+                                         size_t length) {
+    std::vector<uint32_t> s;
+    RTCPParserV2 parser(packet, length, true);
+    uint32_t sender_ssrc = 0;
+    for (RTCPPacketTypes type = parser.Begin(); type != kRtcpNotValidCode;
+         type = parser.Iterate()) {
+        const RTCPPacket& p = parser.Packet();
+        switch (type) {
+            case kRtcpSrCode:
+                s.push_back(kRtcpSenderReport);
+                s.push_back(p.SR.SenderSSRC);
+                s.push_back(p.SR.NTPMostSignificant);
+                s.push_back(p.SR.NTPLeastSignificant);
+                s.push_back(p.SR.RTPTimestamp);
+                s.push_back(p.SR.SenderPacketCount);
+                s.push_back(p.SR.SenderOctetCount);
+                break;
+            case kRtcpRrCode:
+                s.push_back(kRtcpReceiverReport);
+                s.push_back(p.RR.SenderSSRC);
+                s.push_back(0);
+                break;
+            case kRtcpReportBlockItemCode:
+                s.push_back(kRtcpReportBlock);
+                s.push_back(p.ReportBlockItem.SSRC);
+                s.push_back(p.ReportBlockItem.FractionLost);
+                s.push_back(p.ReportBlockItem.CumulativeNumOfPacketsLost);
+                s.push_back(p.ReportBlockItem.ExtendedHighestSequenceNumber);
+                s.push_back(p.ReportBlockItem.Jitter);
+                s.push_back(p.ReportBlockItem.LastSR);
+                s.push_back(p.ReportBlockItem.DelayLastSR);
+                break;
+            case kRtcpSdesChunkCode:
+                s.push_back(kRtcpCname);
+                s.push_back(p.CName.SenderSSRC);
+                s.insert(s.end(), p.CName.CName,
+                         p.CName.CName + strlen(p.CName.CName));
+                break;
+            case kRtcpByeCode:
+                s.push_back(kRtcpBye);
+                s.push_back(p.BYE.SenderSSRC);
+                s.push_back(0);
+                break;
+            case kRtcpRtpfbNackCode:
+                s.push_back(kRtcpNack);
+                s.push_back(p.NACK.SenderSSRC);
+                s.push_back(p.NACK.MediaSSRC);
+                break;
+            case kRtcpRtpfbNackItemCode:
+                s.push_back(p.NACKItem.PacketID);
+                for (int i = 0; i < 16; i++) {
+                    if (p.NACKItem.BitMask & (1 << i)) {
+                        s.push_back(static_cast<uint16_t>(
+                            p.NACKItem.PacketID + 1 + i));
+                    }
+                }
+                break;
+            case kRtcpPsfbPliCode:
+                s.push_back(kRtcpPli);
+                s.push_back(p.PLI.SenderSSRC);
+                s.push_back(p.PLI.MediaSSRC);
+                break;
+            case kRtcpPsfbFirCode:
+                sender_ssrc = p.FIR.SenderSSRC;
+                break;
+            case kRtcpPsfbFirItemCode:
+                s.push_back(kRtcpFir);
+                s.push_back(sender_ssrc);
+                s.push_back(p.FIRItem.SSRC);
+                s.push_back(p.FIRItem.CommandSequenceNumber);
+                break;
+            case kRtcpPsfbAppCode:
+                sender_ssrc = p.PSFBAPP.SenderSSRC;
+                break;
+            case kRtcpPsfbRembItemCode:
+                s.push_back(kRtcpRemb);
+                s.push_back(sender_ssrc);
+                s.push_back(p.REMBItem.BitRate);
+                s.insert(s.end(), p.REMBItem.SSRCs,
+                         p.REMBItem.SSRCs + p.REMBItem.NumberOfSSRCs);
+                break;
+            default:
+                break;
+        }
+    }
+    return s;
+}
+
+//Everything an event points at lies inside the parsed packet.
+bool EventsInBounds(const RtcpReader& reader, const uint8_t* packet,
+                    size_t length) {
+    const uint8_t* end = packet + length;
+    int nack_end = 0;
+    for (int i = 0; i < reader.num_events(); i++) {
+        const RtcpEvent& e = reader.event(i);
+        if (e.type == kRtcpNack) {
+            if (e.nack.first != nack_end || e.nack.count < 0 ||
+                e.nack.first + e.nack.count >
+                    RtcpReader::kMaxNackSequenceNumbers) {
+                return false;
+            }
+            nack_end = e.nack.first + e.nack.count;
+        } else if (e.type == kRtcpCname || e.type == kRtcpTransportFeedback) {
+            if (e.raw.data < packet || e.raw.data + e.raw.length > end) {
+                return false;
+            }
+        } else if (e.type == kRtcpRemb) {
+            if (e.remb.ssrcs < packet ||
+                e.remb.ssrcs + 4 * e.remb.ssrc_count > end) {
+                return false;
+            }
+        }
+    }
+    return reader.num_events() <= RtcpReader::kMaxEvents;
+}
+
+//Flips bits, overwrites bytes, rewrites a length field or truncates.
+void Mutate(Random* random, std::vector<uint8_t>* packet) {
+    int mutations = 1 + random->Uniform(4);
+    for (int m = 0; m < mutations && !packet->empty(); m++) {
+        size_t at = random->Uniform(static_cast<int>(packet->size()));
+        switch (random->Uniform(4)) {
+            case 0:
+                (*packet)[at] ^= 1 << random->Uniform(8);
+                break;
+            case 1:
+                (*packet)[at] = static_cast<uint8_t>(random->Next());
+                break;
+            case 2:
+                //The low length byte of the block header at a 32 bit offset.
+                at = (at & ~static_cast<size_t>(3)) + 3;
+                if (at < packet->size()) {
+                    (*packet)[at] = static_cast<uint8_t>(random->Next());
+                }
+                break;
+            default:
+                packet->resize(at);
+                break;
+        }
+    }
+}
+
+//An RR and a NACK of 100 losses, the heaviest feedback a receiver sends
+//every 100ms on a lossy call.
+size_t BuildNackPacket(uint8_t* buffer, size_t capacity) {
+    RtcpWriter writer(buffer, capacity);
+    Random random(7);
+    RtcpReportBlock block = RandomReportBlock(&random);
+    writer.AddReceiverReport(1, &block, 1);
+    writer.AddSdesCname(1, "voip");
+    uint16_t nacks[100];
+    uint16_t seq = 65000;
+    for (int i = 0; i < 100; i++) {
+        nacks[i] = seq;
+        seq += 1 + random.Uniform(4);
+    }
+    writer.AddNack(1, 2, nacks, 100);
+    uint32_t ssrc = 2;
+    writer.AddRemb(1, 800000, &ssrc, 1);
+    return writer.length();
+}
+
+}  // namespace
+
+@interface RtcpReaderTests : XCTestCase
+@end
+
+@implementation RtcpReaderTests
+
+- (void)testMatchesRtcpParserOnRandomPackets {
+    Random random(1);
+    uint8_t buffer[1500];
+    for (int i = 0; i < 2000; i++) {
+        size_t length = BuildRandomPacket(&random, buffer, sizeof(buffer));
+        RtcpReader reader;
+        XCTAssertTrue(reader.Parse(buffer, length), @"packet %d", i);
+        XCTAssertTrue(Summarize(reader) == SummarizeReference(buffer, length),
+                      @"packet %d", i);
+    }
+}
+
+- (void)testRejectsMalformedBlocks {
+    uint8_t buffer[256];
+    RtcpWriter writer(buffer, sizeof(buffer));
+    RtcpReportBlock block = { 2, 0, 0, 0, 0, 0, 0 };
+    writer.AddReceiverReport(1, &block, 1);
+    size_t rr_length = writer.length();
+    RtcpReader reader;
+    XCTAssertTrue(reader.Parse(buffer, rr_length));
+
+    //Shorter than the length field says.
+    XCTAssertFalse(reader.Parse(buffer, rr_length - 4));
+    //Not RTP version 2.
+    buffer[0] ^= 0xc0;
+    XCTAssertFalse(reader.Parse(buffer, rr_length));
+    buffer[0] ^= 0xc0;
+    //More report blocks than the block holds.
+    buffer[0] += 1;
+    XCTAssertFalse(reader.Parse(buffer, rr_length));
+    buffer[0] -= 1;
+    //Padding larger than the block.
+    buffer[0] |= 0x20;
+    buffer[rr_length - 1] = 200;
+    XCTAssertFalse(reader.Parse(buffer, rr_length));
+    buffer[0] &= ~0x20;
+
+    //A CNAME running past its block.
+    size_t sdes = rr_length;
+    writer.AddSdesCname(1, "voip");
+    buffer[sdes + 9] = 60;
+    XCTAssertFalse(reader.Parse(buffer, writer.length()));
+    buffer[sdes + 9] = 4;
+    XCTAssertTrue(reader.Parse(buffer, writer.length()));
+
+    //A REMB with more targets than it carries.
+    size_t remb = writer.length();
+    uint32_t ssrc = 2;
+    writer.AddRemb(1, 300000, &ssrc, 1);
+    buffer[remb + 16] = 2;
+    XCTAssertFalse(reader.Parse(buffer, writer.length()));
+    //The events before the bad block are kept.
+    XCTAssertEqual(reader.num_events(), 3);
+}
+
+- (void)testNackStorageLimit {
+    //Every item a full mask, 17 sequence numbers each.
+    std::vector<uint16_t> nacks;
+    for (int i = 0; i < 17 * 70; i++) {
+        nacks.push_back(static_cast<uint16_t>(i));
+    }
+    uint8_t buffer[1500];
+    RtcpWriter writer(buffer, sizeof(buffer));
+    XCTAssertEqual(writer.AddNack(1, 2, &nacks[0],
+                                  static_cast<int>(nacks.size())),
+                   static_cast<int>(nacks.size()));
+    RtcpReader reader;
+    XCTAssertFalse(reader.Parse(buffer, writer.length()));
+    XCTAssertEqual(reader.num_events(), 1);
+    int count = reader.event(0).nack.count;
+    XCTAssertEqual(count, RtcpReader::kMaxNackSequenceNumbers / 17 * 17);
+    for (int i = 0; i < count; i++) {
+        XCTAssertEqual(reader.nack_list()[i], nacks[i]);
+    }
+}
+
+- (void)testEventLimit {
+    uint8_t buffer[1500];
+    RtcpWriter writer(buffer, sizeof(buffer));
+    for (int i = 0; i < RtcpReader::kMaxEvents + 1; i++) {
+        XCTAssertTrue(writer.AddPli(1, i));
+    }
+    RtcpReader reader;
+    XCTAssertFalse(reader.Parse(buffer, writer.length()));
+    XCTAssertEqual(reader.num_events(), static_cast<int>(RtcpReader::kMaxEvents));
+}
+
+//Mutated valid packets and random bytes. Each copy is exactly as large as
+//the packet, so an address sanitizer build catches any read past it.
+- (void)testFuzz {
+    Random random(2);
+    uint8_t buffer[1500];
+    RtcpReader reader;
+    int accepted = 0;
+    for (int i = 0; i < 20000; i++) {
+        std::vector<uint8_t> packet;
+        if (i % 2 == 0) {
+            size_t length = BuildRandomPacket(&random, buffer, sizeof(buffer));
+            packet.assign(buffer, buffer + length);
+            Mutate(&random, &packet);
+        } else {
+            packet.resize(random.Uniform(256));
+            for (size_t k = 0; k < packet.size(); k++) {
+                packet[k] = static_cast<uint8_t>(random.Next());
+            }
+            //Mostly version 2 with a known packet type, or nothing gets
+            //past the first header.
+            if (packet.size() >= 2) {
+                packet[0] = 0x80 | (packet[0] & 0x3f);
+                packet[1] = static_cast<uint8_t>(200 + random.Uniform(7));
+            }
+        }
+        std::vector<uint8_t> copy(packet);
+        const uint8_t* data = copy.empty() ? NULL : &copy[0];
+        if (reader.Parse(data, copy.size())) {
+            accepted++;
+        }
+        XCTAssertTrue(EventsInBounds(reader, data, copy.size()), @"case %d", i);
+        XCTAssertTrue(copy == packet);
+    }
+    NSLog(@"rtcp reader fuzz: %d of 20000 accepted", accepted);
+}
+
+//Parse and walk every event and NACKed sequence number, as RTCPReceiver
+//does with RTCPParserV2.
+- (void)testBenchmarkParse {
+    uint8_t buffer[1500];
+    size_t length = BuildNackPacket(buffer, sizeof(buffer));
+    const uint8_t* packet = buffer;
+    uint32_t sum = 0;
+    uint32_t* s = &sum;
+
+    double webrtc_ns = MeasureNsPerCall(5, 10000, ^{
+        RTCPParserV2 parser(packet, length, true);
+        for (RTCPPacketTypes type = parser.Begin(); type != kRtcpNotValidCode;
+             type = parser.Iterate()) {
+            if (type == kRtcpRtpfbNackItemCode) {
+                uint16_t pid = parser.Packet().NACKItem.PacketID;
+                uint16_t bitmask = parser.Packet().NACKItem.BitMask;
+                *s += pid;
+                for (int i = 0; i < 16; i++) {
+                    if (bitmask & (1 << i)) {
+                        *s += static_cast<uint16_t>(pid + 1 + i);
+                    }
+                }
+            } else {
+                *s += type;
+            }
+        }
+    });
+    RtcpReader reader;
+    RtcpReader* r = &reader;
+    double reader_ns = MeasureNsPerCall(5, 10000, ^{
+        r->Parse(packet, length);
+        for (int i = 0; i < r->num_events(); i++) {
+            const RtcpEvent& event = r->event(i);
+            if (event.type == kRtcpNack) {
+                for (int k = 0; k < event.nack.count; k++) {
+                    *s += r->nack_list()[event.nack.first + k];
+                }
+            } else {
+                *s += event.type;
+            }
+        }
+    });
+    NSLog(@"rtcp parse, %zu bytes with 100 NACKs: RTCPParserV2 %.0f ns "
+          "(%.1f Mpackets/s), RtcpReader %.0f ns (%.1f Mpackets/s), sum %u",
+          length, webrtc_ns, 1000 / webrtc_ns, reader_ns, 1000 / reader_ns,
+          sum);
+    XCTAssertTrue(Summarize(reader) == SummarizeReference(packet, length));
+
+    [self measureBlock:^{
+        for (int i = 0; i < 100000; i++) {
+            r->Parse(packet, length);
+        }
+    }];
+}
+
+@end
@@ -0,0 +1,300 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#import <XCTest/XCTest.h>
+
+#include <string.h>
+#include <string>
+#include <vector>
+#include "webrtc/modules/rtp_rtcp/source/rtcp_packet.h"
+#include "webrtc/modules/rtp_rtcp/source/rtcp_utility.h"
+#include "BenchmarkUtil.h"
+#include "RtcpReader.h"
+#include "RtcpWriter.h"
+
+using webrtc::RTCPUtility::RTCPParserV2;
+
+namespace {
+
+enum { kSenderSsrc = 0x11111111 };
+enum { kMediaSsrc = 0x22222222 };
+
+RtcpReportBlock MakeReportBlock(uint32_t ssrc) {
+    RtcpReportBlock block;
+    block.ssrc = ssrc;
+    block.fraction_lost = 25;
+    block.cumulative_lost = 0x123456;
+    block.extended_highest_sequence_number = 0x00017000;
+    block.jitter = 320;
+    block.last_sr = 0xabcd1234;
+    block.delay_since_last_sr = 6553;
+    return block;
+}
+
+bool SameReportBlock(const RtcpReportBlock& a, const RtcpReportBlock& b) {
+    return a.ssrc == b.ssrc && a.fraction_lost == b.fraction_lost &&
+           a.cumulative_lost == b.cumulative_lost &&
+           a.extended_highest_sequence_number ==
+               b.extended_highest_sequence_number &&
+           a.jitter == b.jitter && a.last_sr == b.last_sr &&
+           a.delay_since_last_sr == b.delay_since_last_sr;
+}
+
+//The NACKed sequence numbers RTCPParserV2 reads, expanded the way
+//RTCPReceiver does.
+std::vector<uint16_t> ReferenceNackList(const uint8_t* packet, size_t length) {
+    std::vector<uint16_t> list;
+    RTCPParserV2 parser(packet, length, true);
+    for (webrtc::RTCPUtility::RTCPPacketTypes type = parser.Begin();
+         type != webrtc::RTCPUtility::kRtcpNotValidCode;
+         type = parser.Iterate()) {
+        if (type != webrtc::RTCPUtility::kRtcpRtpfbNackItemCode) {
+            continue;
+        }
+        uint16_t pid = parser.Packet().NACKItem.PacketID;
+        uint16_t bitmask = parser.Packet().NACKItem.BitMask;
+        list.push_back(pid);
+        for (int i = 0; i < 16; i++) {
+            if (bitmask & (1 << i)) {
+                list.push_back(static_cast<uint16_t>(pid + 1 + i));
+            }
+        }
+    }
+    return list;
+}
+
+std::vector<uint16_t> ReaderNackList(const RtcpReader& reader) {
+    std::vector<uint16_t> list;
+    for (int i = 0; i < reader.num_events(); i++) {
+        const RtcpEvent& event = reader.event(i);
+        if (event.type == kRtcpNack) {
+            list.insert(list.end(), reader.nack_list() + event.nack.first,
+                        reader.nack_list() + event.nack.first +
+                            event.nack.count);
+        }
+    }
+    return list;
+}
+
+//The 30 losses of a 5% lossy second of video, in bursts.
+void MakeNackList(uint16_t first, std::vector<uint16_t>* list) {
+    uint16_t seq = first;
+    for (int burst = 0; burst < 10; burst++) {
+        for (int i = 0; i < 3; i++) {
+            list->push_back(seq++);
+        }
+        seq += 27;
+    }
+}
+
+}  // namespace
+
+@interface RtcpWriterTests : XCTestCase
+@end
+
+@implementation RtcpWriterTests
+
+- (void)testCompoundRoundTrip {
+    uint8_t buffer[1500];
+    RtcpWriter writer(buffer, sizeof(buffer));
+    RtcpReportBlock blocks[2] = { MakeReportBlock(kMediaSsrc),
+                                  MakeReportBlock(kMediaSsrc + 1) };
+    XCTAssertTrue(writer.AddSenderReport(kSenderSsrc, 3600, 0x80000000, 90000,
+                                         100, 120000, blocks, 2));
+    XCTAssertTrue(writer.AddSdesCname(kSenderSsrc, "voip"));
+    static const uint16_t kNacks[] = { 100, 101, 105, 116, 117, 200 };
+    XCTAssertEqual(writer.AddNack(kSenderSsrc, kMediaSsrc, kNacks, 6), 6);
+    XCTAssertTrue(writer.AddPli(kSenderSsrc, kMediaSsrc));
+    XCTAssertTrue(writer.AddFir(kSenderSsrc, kMediaSsrc, 7));
+    uint32_t remb_ssrc = kMediaSsrc;
+    XCTAssertTrue(writer.AddRemb(kSenderSsrc, 1500000, &remb_ssrc, 1));
+    XCTAssertTrue(writer.AddBye(kSenderSsrc));
+    XCTAssertEqual(writer.length() % 4, 0u);
+
+    RtcpReader reader;
+    XCTAssertTrue(reader.Parse(buffer, writer.length()));
+    XCTAssertEqual(reader.num_events(), 9);
+    const RtcpEvent& sr = reader.event(0);
+    XCTAssertEqual(sr.type, kRtcpSenderReport);
+    XCTAssertEqual(sr.sender_ssrc, static_cast<uint32_t>(kSenderSsrc));
+    XCTAssertEqual(sr.sender_report.ntp_seconds, 3600u);
+    XCTAssertEqual(sr.sender_report.ntp_fraction, 0x80000000u);
+    XCTAssertEqual(sr.sender_report.rtp_timestamp, 90000u);
+    XCTAssertEqual(sr.sender_report.packet_count, 100u);
+    XCTAssertEqual(sr.sender_report.octet_count, 120000u);
+    XCTAssertTrue(SameReportBlock(reader.event(1).report_block, blocks[0]));
+    XCTAssertTrue(SameReportBlock(reader.event(2).report_block, blocks[1]));
+    XCTAssertEqual(reader.event(3).type, kRtcpCname);
+    XCTAssertEqual(reader.event(3).raw.length, 4u);
+    XCTAssertTrue(memcmp(reader.event(3).raw.data, "voip", 4) == 0);
+    XCTAssertEqual(reader.event(4).type, kRtcpNack);
+    XCTAssertEqual(reader.event(5).type, kRtcpPli);
+    XCTAssertEqual(reader.event(6).type, kRtcpFir);
+    XCTAssertEqual(reader.event(6).media_ssrc, static_cast<uint32_t>(kMediaSsrc));
+    XCTAssertEqual(reader.event(6).fir.command_seq, 7);
+    XCTAssertEqual(reader.event(7).type, kRtcpRemb);
+    XCTAssertEqual(reader.event(7).remb.bitrate_bps, 1500000u);
+    XCTAssertEqual(reader.event(8).type, kRtcpBye);
+
+    std::vector<uint16_t> expected(kNacks, kNacks + 6);
+    XCTAssertTrue(ReaderNackList(reader) == expected);
+    XCTAssertTrue(ReferenceNackList(buffer, writer.length()) == expected);
+}
+
+- (void)testNackPackingAcrossWrap {
+    static const uint16_t kNacks[] = { 65530, 65534, 65535, 0, 10, 11, 40 };
+    uint8_t buffer[64];
+    RtcpWriter writer(buffer, sizeof(buffer));
+    XCTAssertEqual(writer.AddNack(kSenderSsrc, kMediaSsrc, kNacks, 7), 7);
+    //65530 covers up to 10, then 11 and 40 need items of their own.
+    XCTAssertEqual(writer.length(), 12u + 3 * 4);
+    std::vector<uint16_t> expected(kNacks, kNacks + 7);
+    XCTAssertTrue(ReferenceNackList(buffer, writer.length()) == expected);
+
+    //Room for two items, the rest is left for the next packet.
+    RtcpWriter small(buffer, 12 + 2 * 4);
+    XCTAssertEqual(small.AddNack(kSenderSsrc, kMediaSsrc, kNacks, 7), 6);
+    expected.pop_back();
+    RtcpReader reader;
+    XCTAssertTrue(reader.Parse(buffer, small.length()));
+    XCTAssertTrue(ReaderNackList(reader) == expected);
+}
+
+- (void)testFullBufferKeepsPacketValid {
+    uint8_t buffer[64];
+    memset(buffer, 0xee, sizeof(buffer));
+    RtcpWriter writer(buffer, 60);
+    RtcpReportBlock block = MakeReportBlock(kMediaSsrc);
+    XCTAssertTrue(writer.AddReceiverReport(kSenderSsrc, &block, 1));
+    XCTAssertTrue(writer.AddSdesCname(kSenderSsrc, "voip"));
+    XCTAssertEqual(writer.length(), 48u);
+
+    uint32_t ssrc = kMediaSsrc;
+    XCTAssertFalse(writer.AddRemb(kSenderSsrc, 300000, &ssrc, 1));
+    XCTAssertFalse(writer.AddFir(kSenderSsrc, kMediaSsrc, 1));
+    uint16_t seq = 1;
+    XCTAssertEqual(writer.AddNack(kSenderSsrc, kMediaSsrc, &seq, 1), 0);
+    XCTAssertEqual(writer.length(), 48u);
+    XCTAssertTrue(writer.AddPli(kSenderSsrc, kMediaSsrc));
+    XCTAssertEqual(writer.remaining(), 0u);
+    XCTAssertFalse(writer.AddBye(kSenderSsrc));
+    //Nothing written past the capacity.
+    XCTAssertEqual(buffer[60], 0xee);
+
+    RtcpReader reader;
+    XCTAssertTrue(reader.Parse(buffer, writer.length()));
+    XCTAssertEqual(reader.num_events(), 4);
+    XCTAssertEqual(reader.event(3).type, kRtcpPli);
+}
+
+- (void)testRejectsOversizedBlocks {
+    uint8_t buffer[1500];
+    RtcpWriter writer(buffer, sizeof(buffer));
+    std::vector<RtcpReportBlock> blocks(RtcpWriter::kMaxReportBlocks + 1,
+                                        MakeReportBlock(kMediaSsrc));
+    XCTAssertFalse(writer.AddReceiverReport(kSenderSsrc, &blocks[0],
+                                            RtcpWriter::kMaxReportBlocks + 1));
+    XCTAssertTrue(writer.AddReceiverReport(kSenderSsrc, &blocks[0],
+                                           RtcpWriter::kMaxReportBlocks));
+    std::string cname(RtcpWriter::kMaxCnameLength + 1, 'a');
+    XCTAssertFalse(writer.AddSdesCname(kSenderSsrc, cname.c_str()));
+    cname.resize(RtcpWriter::kMaxCnameLength);
+    XCTAssertTrue(writer.AddSdesCname(kSenderSsrc, cname.c_str()));
+
+    RtcpReader reader;
+    XCTAssertTrue(reader.Parse(buffer, writer.length()));
+    XCTAssertEqual(reader.num_events(), 1 + RtcpWriter::kMaxReportBlocks + 1);
+    XCTAssertEqual(reader.event(reader.num_events() - 1).raw.length,
+                   static_cast<size_t>(RtcpWriter::kMaxCnameLength));
+}
+
+- (void)testRembMantissaAndExponent {
+    static const uint32_t kBitrates[] = {
+        0, 1, 262143, 262144, 300001, 1500000, 50000000, 0xffffffff
+    };
+    for (int i = 0; i < 8; i++) {
+        uint8_t buffer[64];
+        RtcpWriter writer(buffer, sizeof(buffer));
+        XCTAssertTrue(writer.AddRemb(kSenderSsrc, kBitrates[i], NULL, 0));
+        RtcpReader reader;
+        XCTAssertTrue(reader.Parse(buffer, writer.length()));
+        XCTAssertEqual(reader.num_events(), 1);
+        //Truncated to 18 significant bits, never rounded up.
+        uint32_t bitrate = reader.event(0).remb.bitrate_bps;
+        XCTAssertTrue(bitrate <= kBitrates[i], @"%u", kBitrates[i]);
+        XCTAssertTrue(kBitrates[i] - bitrate <= kBitrates[i] / (1 << 17),
+                      @"%u read as %u", kBitrates[i], bitrate);
+    }
+}
+
+//A receiver's feedback packet, report, CNAME, 30 NACKs and REMB, built per
+//call as RTCPSender does with rtcp::RtcpPacket and with RtcpWriter.
+- (void)testBenchmarkBuild {
+    std::vector<uint16_t> nacks;
+    MakeNackList(65500, &nacks);
+    const uint16_t* nack_list = &nacks[0];
+    int nack_count = static_cast<int>(nacks.size());
+    RtcpReportBlock report = MakeReportBlock(kMediaSsrc);
+    const RtcpReportBlock* r = &report;
+    uint8_t buffer[1500];
+    uint8_t* b = buffer;
+    size_t webrtc_length = 0;
+    size_t* wl = &webrtc_length;
+    size_t writer_length = 0;
+    size_t* rl = &writer_length;
+
+    double webrtc_ns = MeasureNsPerCall(5, 10000, ^{
+        webrtc::rtcp::ReportBlock block;
+        block.To(r->ssrc);
+        block.WithFractionLost(r->fraction_lost);
+        block.WithCumulativeLost(r->cumulative_lost);
+        block.WithExtHighestSeqNum(r->extended_highest_sequence_number);
+        block.WithJitter(r->jitter);
+        block.WithLastSr(r->last_sr);
+        block.WithDelayLastSr(r->delay_since_last_sr);
+        webrtc::rtcp::ReceiverReport rr;
+        rr.From(kSenderSsrc);
+        rr.WithReportBlock(&block);
+        webrtc::rtcp::Sdes sdes;
+        sdes.WithCName(kSenderSsrc, "voip");
+        webrtc::rtcp::Nack nack;
+        nack.From(kSenderSsrc);
+        nack.To(kMediaSsrc);
+        nack.WithList(nack_list, nack_count);
+        webrtc::rtcp::Remb remb;
+        remb.From(kSenderSsrc);
+        remb.AppliesTo(kMediaSsrc);
+        remb.WithBitrateBps(1500000);
+        rr.Append(&sdes);
+        rr.Append(&nack);
+        rr.Append(&remb);
+        rr.Build(b, wl, 1500);
+    });
+    double writer_ns = MeasureNsPerCall(5, 10000, ^{
+        RtcpWriter writer(b, 1500);
+        writer.AddReceiverReport(kSenderSsrc, r, 1);
+        writer.AddSdesCname(kSenderSsrc, "voip");
+        writer.AddNack(kSenderSsrc, kMediaSsrc, nack_list, nack_count);
+        uint32_t ssrc = kMediaSsrc;
+        writer.AddRemb(kSenderSsrc, 1500000, &ssrc, 1);
+        *rl = writer.length();
+    });
+    NSLog(@"rtcp build, %zu bytes: rtcp::RtcpPacket %.0f ns, RtcpWriter "
+          "%.0f ns", writer_length, webrtc_ns, writer_ns);
+    XCTAssertEqual(writer_length, webrtc_length);
+
+    [self measureBlock:^{
+        for (int i = 0; i < 100000; i++) {
+            RtcpWriter writer(b, 1500);
+            writer.AddReceiverReport(kSenderSsrc, r, 1);
+            writer.AddNack(kSenderSsrc, kMediaSsrc, nack_list, nack_count);
+        }
+    }];
+}
+
+@end
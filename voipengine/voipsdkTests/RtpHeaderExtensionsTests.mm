@@ -0,0 +1,382 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#import <XCTest/XCTest.h>
+
+#include <string.h>
+#include <vector>
+#include "webrtc/modules/rtp_rtcp/source/rtp_header_extension.h"
+#include "webrtc/modules/rtp_rtcp/source/rtp_utility.h"
+#include "BenchmarkUtil.h"
+#include "RtpHeaderExtensions.h"
+
+namespace {
+
+enum { kToffsetId = 2 };
+enum { kAudioLevelId = 3 };
+enum { kAbsSendTimeId = 4 };
+enum { kTransportSequenceNumberId = 5 };
+//Used by nothing, its elements are skipped.
+enum { kUnknownId = 9 };
+
+uint32_t NextRandom(uint32_t* seed) {
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+void RegisterAll(RtpExtensionMap* map) {
+    map->Register(kRtpExtensionTransmissionTimeOffset, kToffsetId);
+    map->Register(kRtpExtensionAudioLevel, kAudioLevelId);
+    map->Register(kRtpExtensionAbsoluteSendTime, kAbsSendTimeId);
+    map->Register(kRtpExtensionTransportSequenceNumber,
+                  kTransportSequenceNumberId);
+}
+
+//webrtc's map knows no transport sequence number, its id stays unknown.
+void RegisterAll(webrtc::RtpHeaderExtensionMap* map) {
+    map->Register(webrtc::kRtpExtensionTransmissionTimeOffset, kToffsetId);
+    map->Register(webrtc::kRtpExtensionAudioLevel, kAudioLevelId);
+    map->Register(webrtc::kRtpExtensionAbsoluteSendTime, kAbsSendTimeId);
+}
+
+struct ExtensionValues {
+    bool has_toffset;
+    int32_t toffset;
+    bool has_audio_level;
+    uint8_t audio_level;
+    bool has_abs_send_time;
+    uint32_t abs_send_time;
+    bool has_transport_sequence_number;
+    uint16_t transport_sequence_number;
+};
+
+void AppendElement(uint8_t id, const uint8_t* value, int size,
+                   std::vector<uint8_t>* packet) {
+    packet->push_back(static_cast<uint8_t>((id << 4) | (size - 1)));
+    packet->insert(packet->end(), value, value + size);
+}
+
+//A valid packet with random CSRCs, a random subset of the extensions in
+//random order, padding between elements and an unknown element.
+std::vector<uint8_t> BuildRandomPacket(uint32_t* seed,
+                                       ExtensionValues* values) {
+    std::vector<uint8_t> packet(12, 0);
+    int csrcs = NextRandom(seed) % 4;
+    packet[0] = static_cast<uint8_t>(0x80 | 0x10 | csrcs);
+    packet[1] = 96;
+    for (int i = 2; i < 12 + 4 * csrcs; i++) {
+        if (i >= 12) {
+            packet.push_back(0);
+        }
+        packet[i] = static_cast<uint8_t>(NextRandom(seed));
+    }
+    size_t extension_start = packet.size();
+    packet.push_back(0xbe);
+    packet.push_back(0xde);
+    packet.push_back(0);
+    packet.push_back(0);
+
+    memset(values, 0, sizeof(*values));
+    int order[5] = { 0, 1, 2, 3, 4 };
+    for (int i = 4; i > 0; i--) {
+        int j = NextRandom(seed) % (i + 1);
+        int t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+    for (int i = 0; i < 5; i++) {
+        if (NextRandom(seed) % 3 == 0) {
+            continue;
+        }
+        uint8_t value[4];
+        switch (order[i]) {
+            case 0:
+                values->has_toffset = true;
+                values->toffset = static_cast<int32_t>(NextRandom(seed) %
+                                                       0x1000000) - 0x800000;
+                TransmissionTimeOffset::Write(value, values->toffset);
+                AppendElement(kToffsetId, value, 3, &packet);
+                break;
+            case 1:
+                values->has_audio_level = true;
+                values->audio_level = static_cast<uint8_t>(NextRandom(seed));
+                AppendElement(kAudioLevelId, &values->audio_level, 1, &packet);
+                break;
+            case 2:
+                values->has_abs_send_time = true;
+                values->abs_send_time = NextRandom(seed) & 0xffffff;
+                AbsoluteSendTime::Write(value, values->abs_send_time);
+                AppendElement(kAbsSendTimeId, value, 3, &packet);
+                break;
+            case 3:
+                values->has_transport_sequence_number = true;
+                values->transport_sequence_number =
+                    static_cast<uint16_t>(NextRandom(seed));
+                TransportSequenceNumber::Write(
+                    value, values->transport_sequence_number);
+                AppendElement(kTransportSequenceNumberId, value, 2, &packet);
+                break;
+            default: {
+                int size = 1 + NextRandom(seed) % 4;
+                for (int k = 0; k < size; k++) {
+                    value[k] = static_cast<uint8_t>(NextRandom(seed));
+                }
+                AppendElement(kUnknownId, value, size, &packet);
+                break;
+            }
+        }
+        int padding = NextRandom(seed) % 3;
+        packet.insert(packet.end(), padding, 0);
+    }
+    while ((packet.size() - extension_start) % 4 != 0) {
+        packet.push_back(0);
+    }
+    size_t words = (packet.size() - extension_start - 4) / 4;
+    packet[extension_start + 2] = static_cast<uint8_t>(words >> 8);
+    packet[extension_start + 3] = static_cast<uint8_t>(words);
+    packet.insert(packet.end(), NextRandom(seed) % 100, 0x55);
+    return packet;
+}
+
+//Has() and Get() of every extension, which reads the value at its offset.
+bool ValuesMatch(const RtpPacketExtensions& extensions,
+                 const ExtensionValues& values) {
+    int32_t toffset = 0;
+    uint8_t audio_level = 0;
+    uint32_t abs_send_time = 0;
+    uint16_t transport_sequence_number = 0;
+    return extensions.Get<TransmissionTimeOffset>(&toffset) ==
+               values.has_toffset &&
+           toffset == values.toffset &&
+           extensions.Get<AudioLevel>(&audio_level) ==
+               values.has_audio_level &&
+           audio_level == values.audio_level &&
+           extensions.Get<AbsoluteSendTime>(&abs_send_time) ==
+               values.has_abs_send_time &&
+           abs_send_time == values.abs_send_time &&
+           extensions.Get<TransportSequenceNumber>(
+               &transport_sequence_number) ==
+               values.has_transport_sequence_number &&
+           transport_sequence_number == values.transport_sequence_number;
+}
+
+bool HasAny(const RtpPacketExtensions& extensions) {
+    return extensions.Has<TransmissionTimeOffset>() ||
+           extensions.Has<AudioLevel>() ||
+           extensions.Has<AbsoluteSendTime>() ||
+           extensions.Has<TransportSequenceNumber>();
+}
+
+}  // namespace
+
+@interface RtpHeaderExtensionsTests : XCTestCase
+@end
+
+@implementation RtpHeaderExtensionsTests
+
+- (void)testTransmissionTimeOffsetSignExtends {
+    static const int32_t kValues[] = {
+        0, 1, -1, 90000, -90000, 0x7fffff, -0x800000
+    };
+    for (int i = 0; i < 7; i++) {
+        uint8_t bytes[3];
+        TransmissionTimeOffset::Write(bytes, kValues[i]);
+        XCTAssertEqual(TransmissionTimeOffset::Read(bytes), kValues[i]);
+    }
+    uint8_t negative[3] = { 0xff, 0xff, 0xfe };
+    XCTAssertEqual(TransmissionTimeOffset::Read(negative), -2);
+}
+
+- (void)testMapRegistration {
+    RtpExtensionMap map;
+    XCTAssertFalse(map.Register(kRtpExtensionAudioLevel, 0));
+    XCTAssertFalse(map.Register(kRtpExtensionAudioLevel, 15));
+    XCTAssertTrue(map.Register(kRtpExtensionAudioLevel, 3));
+    XCTAssertFalse(map.Register(kRtpExtensionAbsoluteSendTime, 3));
+    XCTAssertTrue(map.Register(kRtpExtensionAudioLevel, 4));
+    XCTAssertEqual(map.GetType(3), kRtpExtensionNumberOfExtensions);
+    XCTAssertEqual(map.GetType(4), kRtpExtensionAudioLevel);
+    map.Deregister(kRtpExtensionAudioLevel);
+    XCTAssertEqual(map.GetId(kRtpExtensionAudioLevel), 0);
+}
+
+- (void)testUpdateInPlace {
+    RtpExtensionMap map;
+    RegisterAll(&map);
+    uint32_t seed = 3;
+    ExtensionValues values;
+    std::vector<uint8_t> packet;
+    do {
+        packet = BuildRandomPacket(&seed, &values);
+    } while (!values.has_abs_send_time || values.has_transport_sequence_number);
+
+    RtpPacketExtensions extensions;
+    XCTAssertTrue(extensions.Parse(map, &packet[0], packet.size()));
+    XCTAssertTrue(extensions.Update<AbsoluteSendTime>(&packet[0], 0x123456));
+    XCTAssertFalse(extensions.Update<TransportSequenceNumber>(&packet[0], 7));
+
+    RtpPacketExtensions reparsed;
+    XCTAssertTrue(reparsed.Parse(map, &packet[0], packet.size()));
+    values.abs_send_time = 0x123456;
+    XCTAssertTrue(ValuesMatch(reparsed, values));
+    XCTAssertEqual(AbsoluteSendTime::FromMs(1000), 1u << 18);
+}
+
+- (void)testFailedParseClearsExtensions {
+    RtpExtensionMap map;
+    RegisterAll(&map);
+    uint8_t packet[24] = { 0x90, 96, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1,
+                           0xbe, 0xde, 0, 2 };
+    uint8_t value[3];
+    AbsoluteSendTime::Write(value, 1000);
+    packet[16] = (kAbsSendTimeId << 4) | 2;
+    memcpy(packet + 17, value, 3);
+
+    RtpPacketExtensions extensions;
+    XCTAssertTrue(extensions.Parse(map, packet, sizeof(packet)));
+    XCTAssertTrue(extensions.Has<AbsoluteSendTime>());
+    XCTAssertEqual(extensions.header_length(), 24u);
+
+    //An audio level claiming 16 bytes, past the extension.
+    packet[20] = (kAudioLevelId << 4) | 15;
+    XCTAssertFalse(extensions.Parse(map, packet, sizeof(packet)));
+    XCTAssertFalse(HasAny(extensions));
+    XCTAssertEqual(extensions.header_length(), 0u);
+}
+
+- (void)testMatchesRtpHeaderParser {
+    RtpExtensionMap map;
+    RegisterAll(&map);
+    webrtc::RtpHeaderExtensionMap webrtc_map;
+    RegisterAll(&webrtc_map);
+    uint32_t seed = 1;
+    for (int i = 0; i < 5000; i++) {
+        ExtensionValues values;
+        std::vector<uint8_t> packet = BuildRandomPacket(&seed, &values);
+        RtpPacketExtensions extensions;
+        XCTAssertTrue(extensions.Parse(map, &packet[0], packet.size()));
+        XCTAssertTrue(ValuesMatch(extensions, values), @"packet %d", i);
+
+        webrtc::RTPHeader header;
+        webrtc::RtpUtility::RtpHeaderParser parser(&packet[0], packet.size());
+        XCTAssertTrue(parser.Parse(header, &webrtc_map));
+        XCTAssertEqual(extensions.header_length(), header.headerLength);
+        const webrtc::RTPHeaderExtension& e = header.extension;
+        XCTAssertEqual(e.hasTransmissionTimeOffset, values.has_toffset);
+        XCTAssertEqual(e.transmissionTimeOffset, values.toffset);
+        XCTAssertEqual(e.hasAudioLevel, values.has_audio_level);
+        XCTAssertEqual(e.audioLevel, values.audio_level);
+        XCTAssertEqual(e.hasAbsoluteSendTime, values.has_abs_send_time);
+        XCTAssertEqual(e.absoluteSendTime, values.abs_send_time);
+    }
+}
+
+//Mutated valid packets and random headers, each parsed from an exactly
+//sized copy so an address sanitizer build catches reads past the end.
+- (void)testFuzz {
+    RtpExtensionMap map;
+    RegisterAll(&map);
+    uint32_t seed = 2;
+    int accepted = 0;
+    for (int i = 0; i < 20000; i++) {
+        ExtensionValues values;
+        std::vector<uint8_t> packet = BuildRandomPacket(&seed, &values);
+        if (i % 2 == 0) {
+            int mutations = 1 + NextRandom(&seed) % 4;
+            for (int m = 0; m < mutations; m++) {
+                size_t at = NextRandom(&seed) % packet.size();
+                packet[at] ^= 1 << (NextRandom(&seed) % 8);
+            }
+            if (NextRandom(&seed) % 4 == 0) {
+                packet.resize(NextRandom(&seed) % packet.size());
+            }
+        } else {
+            packet.resize(NextRandom(&seed) % 64);
+            for (size_t k = 0; k < packet.size(); k++) {
+                packet[k] = static_cast<uint8_t>(NextRandom(&seed));
+            }
+            if (!packet.empty()) {
+                packet[0] = static_cast<uint8_t>(0x90 | (packet[0] & 0x0f));
+            }
+        }
+
+        std::vector<uint8_t> copy(packet);
+        RtpPacketExtensions extensions;
+        bool ok = extensions.Parse(map, copy.empty() ? NULL : &copy[0],
+                                   copy.size());
+        if (ok) {
+            accepted++;
+            XCTAssertTrue(extensions.header_length() <= copy.size());
+            //Reads every recorded value.
+            ValuesMatch(extensions, values);
+        } else {
+            XCTAssertFalse(HasAny(extensions), @"case %d", i);
+        }
+    }
+    NSLog(@"rtp header extensions fuzz: %d of 20000 accepted", accepted);
+}
+
+//A video packet with a CSRC, transmission offset, absolute send time and
+//an audio level: parse and read, and the send time update done per
+//packet by the pacer, against RtpHeaderParser with its std::map lookups.
+- (void)testBenchmarkParseAndUpdate {
+    RtpExtensionMap map;
+    RegisterAll(&map);
+    webrtc::RtpHeaderExtensionMap webrtc_map;
+    RegisterAll(&webrtc_map);
+    uint32_t seed = 5;
+    ExtensionValues values;
+    std::vector<uint8_t> buffer;
+    do {
+        buffer = BuildRandomPacket(&seed, &values);
+    } while (!values.has_toffset || !values.has_abs_send_time ||
+             !values.has_audio_level);
+    uint8_t* packet = &buffer[0];
+    size_t length = buffer.size();
+    const RtpExtensionMap* m = &map;
+    webrtc::RtpHeaderExtensionMap* wm = &webrtc_map;
+    uint32_t sum = 0;
+    uint32_t* s = &sum;
+
+    double webrtc_ns = MeasureNsPerCall(5, 100000, ^{
+        webrtc::RTPHeader header;
+        webrtc::RtpUtility::RtpHeaderParser parser(packet, length);
+        parser.Parse(header, wm);
+        *s += header.extension.absoluteSendTime +
+              header.extension.transmissionTimeOffset;
+    });
+    double parse_ns = MeasureNsPerCall(5, 100000, ^{
+        RtpPacketExtensions extensions;
+        extensions.Parse(*m, packet, length);
+        uint32_t abs_send_time = 0;
+        int32_t toffset = 0;
+        extensions.Get<AbsoluteSendTime>(&abs_send_time);
+        extensions.Get<TransmissionTimeOffset>(&toffset);
+        *s += abs_send_time + toffset;
+    });
+    RtpPacketExtensions extensions;
+    extensions.Parse(map, packet, length);
+    const RtpPacketExtensions* e = &extensions;
+    double update_ns = MeasureNsPerCall(5, 100000, ^{
+        e->Update<AbsoluteSendTime>(packet, *s & 0xffffff);
+        (*s)++;
+    });
+    NSLog(@"rtp header parse: RtpHeaderParser %.1f ns, RtpPacketExtensions "
+          "%.1f ns, abs send time update %.1f ns (%u)", webrtc_ns, parse_ns,
+          update_ns, sum);
+
+    [self measureBlock:^{
+        for (int i = 0; i < 1000000; i++) {
+            RtpPacketExtensions extensions;
+            extensions.Parse(*m, packet, length);
+            extensions.Update<AbsoluteSendTime>(packet, i & 0xffffff);
+        }
+    }];
+}
+
+@end
@@ -0,0 +1,218 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#import <XCTest/XCTest.h>
+
+#include <string.h>
+#include <algorithm>
+#include "webrtc/modules/rtp_rtcp/source/rtp_packet_history.h"
+#include "webrtc/system_wrappers/interface/clock.h"
+#include "BenchmarkUtil.h"
+#include "RtpPacketHistory.h"
+
+namespace {
+
+enum { kPacketLength = 1200 };
+
+//An RTP header with |sequence_number|, the payload filled with its low
+//byte so a wrong slot shows in the copy.
+void MakePacket(uint16_t sequence_number, size_t length, uint8_t* packet) {
+    memset(packet, sequence_number & 0xff, length);
+    packet[0] = 0x80;
+    packet[1] = 96;
+    packet[2] = static_cast<uint8_t>(sequence_number >> 8);
+    packet[3] = static_cast<uint8_t>(sequence_number);
+}
+
+bool Put(RtpPacketHistory* history, uint16_t sequence_number, size_t length,
+         int64_t capture_time_ms) {
+    uint8_t packet[RtpPacketHistory::kMaxPacketLength];
+    MakePacket(sequence_number, length, packet);
+    return history->PutRtpPacket(packet, length, capture_time_ms);
+}
+
+bool GetMatches(RtpPacketHistory* history, uint16_t sequence_number,
+                size_t length) {
+    uint8_t expected[RtpPacketHistory::kMaxPacketLength];
+    MakePacket(sequence_number, length, expected);
+    uint8_t buffer[RtpPacketHistory::kMaxPacketLength];
+    size_t buffer_length = sizeof(buffer);
+    int64_t capture_time_ms = 0;
+    return history->GetPacketAndSetSendTime(sequence_number, 0, 0, buffer,
+                                            &buffer_length,
+                                            &capture_time_ms) &&
+           buffer_length == length && memcmp(buffer, expected, length) == 0;
+}
+
+}  // namespace
+
+@interface RtpPacketHistoryTests : XCTestCase
+@end
+
+@implementation RtpPacketHistoryTests
+
+- (void)testCapacityIsPowerOfTwo {
+    XCTAssertEqual(RtpPacketHistory(0, kPacketLength).capacity(), 1);
+    XCTAssertEqual(RtpPacketHistory(600, kPacketLength).capacity(), 1024);
+    XCTAssertEqual(RtpPacketHistory(1024, kPacketLength).capacity(), 1024);
+    XCTAssertEqual(RtpPacketHistory(9600, kPacketLength).capacity(),
+                   static_cast<int>(RtpPacketHistory::kMaxCapacity));
+    XCTAssertEqual(RtpPacketHistory(16, 5000).max_packet_length(),
+                   static_cast<size_t>(RtpPacketHistory::kMaxPacketLength));
+}
+
+- (void)testStoresAndRetransmits {
+    RtpPacketHistory history(16, kPacketLength);
+    XCTAssertTrue(Put(&history, 100, 500, 1000));
+    XCTAssertFalse(Put(&history, 101, kPacketLength + 1, 1000));
+    XCTAssertFalse(history.HasRtpPacket(101));
+    history.SetSent(100, 2000);
+
+    uint8_t buffer[kPacketLength];
+    size_t length = sizeof(buffer);
+    int64_t capture_time_ms = 0;
+    //Sent 50ms ago, a NACK within the 100ms RTT is not served again.
+    XCTAssertFalse(history.GetPacketAndSetSendTime(100, 100, 2050, buffer,
+                                                   &length, &capture_time_ms));
+    XCTAssertTrue(history.GetPacketAndSetSendTime(100, 100, 2100, buffer,
+                                                  &length, &capture_time_ms));
+    XCTAssertEqual(length, 500u);
+    XCTAssertEqual(capture_time_ms, 1000);
+    XCTAssertFalse(history.GetPacketAndSetSendTime(100, 100, 2150, buffer,
+                                                   &length, &capture_time_ms));
+
+    //Too small a buffer.
+    length = 100;
+    XCTAssertFalse(history.GetPacketAndSetSendTime(100, 0, 3000, buffer,
+                                                   &length, NULL));
+    history.Clear();
+    XCTAssertFalse(history.HasRtpPacket(100));
+}
+
+- (void)testReplacesOldestAcrossWrap {
+    RtpPacketHistory history(16, kPacketLength);
+    for (int i = 0; i < 16; i++) {
+        XCTAssertTrue(Put(&history, static_cast<uint16_t>(65530 + i), 100, i));
+    }
+    for (int i = 0; i < 16; i++) {
+        XCTAssertTrue(GetMatches(&history, static_cast<uint16_t>(65530 + i),
+                                 100), @"%d", i);
+    }
+    XCTAssertTrue(Put(&history, 10, 100, 16));
+    XCTAssertFalse(history.HasRtpPacket(65530));
+    XCTAssertTrue(GetMatches(&history, 10, 100));
+    //Its slot holds a newer packet.
+    XCTAssertFalse(Put(&history, 65530, 100, 17));
+    XCTAssertTrue(GetMatches(&history, 65531, 100));
+}
+
+- (void)testSlotNotReusedForSameLowBits {
+    //Packets of another stream are not stored here, slot 5 keeps sequence
+    //number 5 while the sequence numbers go round once.
+    RtpPacketHistory history(1024, kPacketLength);
+    XCTAssertTrue(Put(&history, 5, 100, 0));
+    for (int seq = 6; seq <= 65536 + 10; seq++) {
+        if ((seq & 1023) != 5) {
+            Put(&history, static_cast<uint16_t>(seq), 100, seq);
+        }
+    }
+    XCTAssertFalse(history.HasRtpPacket(5));
+    XCTAssertTrue(history.HasRtpPacket(10));
+}
+
+- (void)testBestFittingPacket {
+    RtpPacketHistory history(64, kPacketLength);
+    uint8_t buffer[kPacketLength];
+    size_t length = sizeof(buffer);
+    XCTAssertFalse(history.GetBestFittingPacket(300, buffer, &length));
+    static const int kLengths[] = { 100, 250, 900, 1200, 320 };
+    for (int i = 0; i < 5; i++) {
+        Put(&history, static_cast<uint16_t>(i), kLengths[i], i);
+    }
+    XCTAssertTrue(history.GetBestFittingPacket(300, buffer, &length));
+    XCTAssertEqual(length, 320u);
+    //Only what fits the buffer.
+    length = 1000;
+    XCTAssertTrue(history.GetBestFittingPacket(1200, buffer, &length));
+    XCTAssertEqual(length, 900u);
+}
+
+//NACK lookups of packets within the history of 600 and 9600 packets, as
+//ModuleRtpRtcpImpl's 600 default and webrtc's kMaxHistoryCapacity, against
+//webrtc::RTPPacketHistory.
+- (void)testBenchmarkLookup {
+    static const int kCapacities[] = { 600, 9600 };
+    static const int kLookups = 4096;
+    uint8_t packet[kPacketLength];
+    uint8_t* p = packet;
+    for (int c = 0; c < 2; c++) {
+        int capacity = kCapacities[c];
+        RtpPacketHistory history(capacity, kPacketLength);
+        webrtc::SimulatedClock clock(0);
+        webrtc::RTPPacketHistory webrtc_history(&clock);
+        webrtc_history.SetStorePacketsStatus(true,
+                                             static_cast<uint16_t>(capacity));
+        //Three times round the history, so it is full and has wrapped.
+        uint16_t newest = 0;
+        for (int i = 0; i < 3 * capacity; i++) {
+            newest = static_cast<uint16_t>(60000 + i);
+            MakePacket(newest, kPacketLength, packet);
+            history.PutRtpPacket(packet, kPacketLength, i);
+            webrtc_history.PutRTPPacket(packet, kPacketLength, kPacketLength,
+                                        i, webrtc::kAllowRetransmission);
+        }
+        //Spread over what both keep, 8192 of the 9600, mostly recent ones
+        //as NACKs usually are.
+        int window = std::min(capacity, history.capacity());
+        uint16_t lookups[kLookups];
+        uint32_t seed = 1;
+        for (int i = 0; i < kLookups; i++) {
+            seed = seed * 1103515245 + 12345;
+            int age = (seed >> 8) % window;
+            lookups[i] = static_cast<uint16_t>(newest - age * age / window);
+        }
+        const uint16_t* l = lookups;
+        RtpPacketHistory* h = &history;
+        webrtc::RTPPacketHistory* w = &webrtc_history;
+        int found = 0;
+        int* f = &found;
+
+        double webrtc_ns = MeasureNsPerCall(5, kLookups, ^{
+            size_t length = kPacketLength;
+            int64_t stored_time_ms;
+            *f += w->GetPacketAndSetSendTime(l[*f % kLookups], 0, true, p,
+                                             &length, &stored_time_ms);
+        });
+        XCTAssertEqual(found, 5 * kLookups);
+        found = 0;
+        double history_ns = MeasureNsPerCall(5, kLookups, ^{
+            size_t length = kPacketLength;
+            int64_t capture_time_ms;
+            *f += h->GetPacketAndSetSendTime(l[*f % kLookups], 0, 0, p,
+                                             &length, &capture_time_ms);
+        });
+        XCTAssertEqual(found, 5 * kLookups);
+        NSLog(@"packet history lookup, %d packets (%d slots): "
+              "RTPPacketHistory %.0f ns, RtpPacketHistory %.0f ns",
+              capacity, history.capacity(), webrtc_ns, history_ns);
+    }
+
+    RtpPacketHistory history(600, kPacketLength);
+    RtpPacketHistory* h = &history;
+    [self measureBlock:^{
+        for (int i = 0; i < 100000; i++) {
+            MakePacket(static_cast<uint16_t>(i), kPacketLength, p);
+            h->PutRtpPacket(p, kPacketLength, i);
+            size_t length = kPacketLength;
+            h->GetPacketAndSetSendTime(static_cast<uint16_t>(i - 300), 0, i,
+                                       p, &length, NULL);
+        }
+    }];
+}
+
+@end
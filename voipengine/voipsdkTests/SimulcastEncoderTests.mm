@@ -0,0 +1,315 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#import <XCTest/XCTest.h>
+
+#include <string.h>
+#include <sys/resource.h>
+#include <atomic>
+#include <vector>
+#include "webrtc/system_wrappers/interface/critical_section_wrapper.h"
+#include "webrtc/system_wrappers/interface/tick_util.h"
+#include "SimulcastEncoder.h"
+
+namespace {
+
+enum { kMaxPayloadSize = 1200 };
+enum { kNumStreams = 3 };
+enum { kSourceFrames = 8 };
+
+webrtc::SimulcastStream MakeStream(int width, int height, int min_kbps,
+                                   int target_kbps, int max_kbps) {
+    webrtc::SimulcastStream stream;
+    memset(&stream, 0, sizeof(stream));
+    stream.width = width;
+    stream.height = height;
+    stream.numberOfTemporalLayers = 1;
+    stream.minBitrate = min_kbps;
+    stream.targetBitrate = target_kbps;
+    stream.maxBitrate = max_kbps;
+    return stream;
+}
+
+//180p, 360p and 720p, as webrtc configures three simulcast streams.
+void MakeStreams(webrtc::SimulcastStream* streams) {
+    streams[0] = MakeStream(320, 180, 50, 150, 200);
+    streams[1] = MakeStream(640, 360, 150, 500, 700);
+    streams[2] = MakeStream(1280, 720, 600, 1200, 2500);
+}
+
+//Counts the frames of each stream and whether each was a key frame, and
+//reads the statistics on every packet as a stats overlay would.
+class RecordingSink : public SimulcastEncoder::PacketSink {
+public:
+    RecordingSink()
+    : encoder(NULL), crit_(webrtc::CriticalSectionWrapper::
+                           CreateCriticalSection()),
+      stats_reads(0) {}
+
+    virtual void OnSimulcastPacket(int stream, const VP8Packet& packet) {
+        if (encoder) {
+            encoder->GetStatistics();
+            stats_reads++;
+        }
+        webrtc::CriticalSectionScoped cs(crit_.get());
+        if (packet.marker_bit) {
+            key_frames[stream].push_back(packet.key_frame);
+        }
+    }
+
+    std::vector<bool> Frames(int stream) {
+        webrtc::CriticalSectionScoped cs(crit_.get());
+        return key_frames[stream];
+    }
+
+    SimulcastEncoder* encoder;
+
+private:
+    webrtc::scoped_ptr<webrtc::CriticalSectionWrapper> crit_;
+    std::vector<bool> key_frames[kNumStreams];
+
+public:
+    std::atomic<int> stats_reads;
+};
+
+class NullSink : public SimulcastEncoder::PacketSink,
+                 public VP8PartitionEncoder::PacketSink {
+public:
+    virtual void OnSimulcastPacket(int /*stream*/,
+                                   const VP8Packet& /*packet*/) {}
+    virtual void OnVP8Packet(const VP8Packet& /*packet*/) {}
+};
+
+void MakeSourceFrames(I420BufferPool* pool, int width, int height,
+                      std::vector<webrtc::scoped_refptr<I420Buffer> >* frames) {
+    uint32_t seed = 1;
+    for (int f = 0; f < kSourceFrames; f++) {
+        webrtc::scoped_refptr<I420Buffer> frame =
+            pool->CreateBuffer(width, height);
+        uint8_t* y = frame->MutableData(webrtc::kYPlane);
+        for (int row = 0; row < height; row++) {
+            for (int col = 0; col < width; col++) {
+                seed = seed * 1103515245 + 12345;
+                y[row * frame->stride(webrtc::kYPlane) + col] =
+                    static_cast<uint8_t>(col + row * 2 + f * 4 +
+                                         ((seed >> 16) & 7));
+            }
+        }
+        int half_height = (height + 1) / 2;
+        memset(frame->MutableData(webrtc::kUPlane), 120,
+               frame->stride(webrtc::kUPlane) * half_height);
+        memset(frame->MutableData(webrtc::kVPlane), 136,
+               frame->stride(webrtc::kVPlane) * half_height);
+        frames->push_back(frame);
+    }
+}
+
+int64_t CpuTimeUs() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000LL +
+           usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+struct CpuResult {
+    double cpu_ms_per_frame;
+    double wall_ms_per_frame;
+    double scale_ms_per_frame;
+};
+
+//The three streams through SimulcastEncoder, the smaller ones scaled from
+//the pyramid.
+CpuResult EncodeSimulcast(const std::vector<webrtc::scoped_refptr<I420Buffer> >&
+                              source, I420BufferPool* pool, int frames) {
+    webrtc::SimulcastStream streams[kNumStreams];
+    MakeStreams(streams);
+    NullSink sink;
+    SimulcastEncoder encoder(&sink, pool);
+    encoder.Init(streams, kNumStreams, 30, kMaxPayloadSize);
+
+    int64_t cpu_start = CpuTimeUs();
+    int64_t start = webrtc::TickTime::MicrosecondTimestamp();
+    for (int i = 0; i < frames; i++) {
+        encoder.EncodeFrame(source[i % kSourceFrames],
+                            webrtc::TickTime::MillisecondTimestamp(), i == 0);
+        encoder.Flush();
+    }
+    CpuResult result;
+    result.wall_ms_per_frame =
+        (webrtc::TickTime::MicrosecondTimestamp() - start) / 1000.0 / frames;
+    result.cpu_ms_per_frame = (CpuTimeUs() - cpu_start) / 1000.0 / frames;
+    result.scale_ms_per_frame =
+        encoder.GetStatistics().sum_scale_time_us / 1000.0 / frames;
+    return result;
+}
+
+//The same streams from three independent encoders, each scaled from the
+//capture as VPMSimpleSpatialResampler does for every consumer.
+CpuResult EncodeSeparately(const std::vector<webrtc::scoped_refptr<I420Buffer> >&
+                               source, I420BufferPool* pool, int frames) {
+    webrtc::SimulcastStream streams[kNumStreams];
+    MakeStreams(streams);
+    NullSink sink;
+    webrtc::scoped_ptr<VP8PartitionEncoder> encoders[kNumStreams];
+    for (int s = 0; s < kNumStreams; s++) {
+        VP8EncoderSettings settings;
+        settings.width = streams[s].width;
+        settings.height = streams[s].height;
+        settings.start_bitrate_kbps = streams[s].targetBitrate;
+        settings.max_framerate = 30;
+        settings.threads = 0;
+        settings.max_payload_size = kMaxPayloadSize;
+        encoders[s].reset(new VP8PartitionEncoder(&sink));
+        encoders[s]->Init(settings);
+    }
+
+    int64_t scale_us = 0;
+    int64_t cpu_start = CpuTimeUs();
+    int64_t start = webrtc::TickTime::MicrosecondTimestamp();
+    for (int i = 0; i < frames; i++) {
+        const webrtc::scoped_refptr<I420Buffer>& frame = source[i % kSourceFrames];
+        int64_t now_ms = webrtc::TickTime::MillisecondTimestamp();
+        for (int s = 0; s < kNumStreams; s++) {
+            webrtc::scoped_refptr<I420Buffer> level = frame;
+            if (s < kNumStreams - 1) {
+                int64_t scale_start = webrtc::TickTime::MicrosecondTimestamp();
+                level = pool->CreateBuffer(streams[s].width, streams[s].height);
+                ScaleI420Buffer(*frame, level.get());
+                scale_us += webrtc::TickTime::MicrosecondTimestamp() -
+                            scale_start;
+            }
+            encoders[s]->EncodeFrame(level, now_ms, i == 0);
+        }
+        for (int s = 0; s < kNumStreams; s++) {
+            encoders[s]->Flush();
+        }
+    }
+    CpuResult result;
+    result.wall_ms_per_frame =
+        (webrtc::TickTime::MicrosecondTimestamp() - start) / 1000.0 / frames;
+    result.cpu_ms_per_frame = (CpuTimeUs() - cpu_start) / 1000.0 / frames;
+    result.scale_ms_per_frame = scale_us / 1000.0 / frames;
+    return result;
+}
+
+}  // namespace
+
+@interface SimulcastEncoderTests : XCTestCase
+@end
+
+@implementation SimulcastEncoderTests
+
+- (void)testAllocatesBitrate {
+    webrtc::SimulcastStream streams[kNumStreams];
+    MakeStreams(streams);
+    uint32_t bitrates[kNumStreams];
+
+    //The lowest stream is sent even below its minimum.
+    SimulcastEncoder::AllocateBitrate(streams, kNumStreams, 30, bitrates);
+    XCTAssertEqual(bitrates[0], 30u);
+    XCTAssertEqual(bitrates[1], 0u);
+    XCTAssertEqual(bitrates[2], 0u);
+
+    //The middle stream gets what is left over the lowest one's target.
+    SimulcastEncoder::AllocateBitrate(streams, kNumStreams, 400, bitrates);
+    XCTAssertEqual(bitrates[0], 150u);
+    XCTAssertEqual(bitrates[1], 250u);
+    XCTAssertEqual(bitrates[2], 0u);
+
+    //The highest stream gets the rest up to its maximum.
+    SimulcastEncoder::AllocateBitrate(streams, kNumStreams, 2000, bitrates);
+    XCTAssertEqual(bitrates[0], 150u);
+    XCTAssertEqual(bitrates[1], 500u);
+    XCTAssertEqual(bitrates[2], 1350u);
+    SimulcastEncoder::AllocateBitrate(streams, kNumStreams, 10000, bitrates);
+    XCTAssertEqual(bitrates[2], 2500u);
+}
+
+- (void)testResumedStreamStartsWithKeyFrame {
+    I420BufferPool pool;
+    std::vector<webrtc::scoped_refptr<I420Buffer> > source;
+    MakeSourceFrames(&pool, 1280, 720, &source);
+    webrtc::SimulcastStream streams[kNumStreams];
+    MakeStreams(streams);
+    RecordingSink sink;
+    SimulcastEncoder encoder(&sink, &pool);
+    XCTAssertTrue(encoder.Init(streams, kNumStreams, 30, kMaxPayloadSize));
+
+    for (int i = 0; i < 12; i++) {
+        if (i == 4) {
+            encoder.OnNetworkChanged(100000, 0, 50);
+        } else if (i == 8) {
+            encoder.OnNetworkChanged(3000000, 0, 50);
+        }
+        encoder.EncodeFrame(source[i % kSourceFrames], i * 33, false);
+        encoder.Flush();
+    }
+    std::vector<bool> low = sink.Frames(0);
+    std::vector<bool> high = sink.Frames(2);
+    XCTAssertEqual(low.size(), 12u);
+    //Paused for frames 4 to 7.
+    XCTAssertEqual(high.size(), 8u);
+    XCTAssertTrue(low[0]);
+    XCTAssertFalse(low[8]);
+    XCTAssertTrue(high[0]);
+    XCTAssertTrue(high[4]);
+    XCTAssertFalse(high[5]);
+    SimulcastStatistics stats = encoder.GetStatistics();
+    XCTAssertEqual(stats.frames, 12u);
+    XCTAssertEqual(stats.target_bitrate_kbps[2], 2350u);
+}
+
+//The sink reads the statistics, which takes the encoder's lock, while
+//Flush waits for the queues.
+- (void)testSinkMayCallBackDuringFlush {
+    I420BufferPool pool;
+    std::vector<webrtc::scoped_refptr<I420Buffer> > source;
+    MakeSourceFrames(&pool, 1280, 720, &source);
+    webrtc::SimulcastStream streams[kNumStreams];
+    MakeStreams(streams);
+    RecordingSink sink;
+    SimulcastEncoder encoder(&sink, &pool);
+    sink.encoder = &encoder;
+    XCTAssertTrue(encoder.Init(streams, kNumStreams, 30, kMaxPayloadSize));
+    for (int i = 0; i < 20; i++) {
+        encoder.EncodeFrame(source[i % kSourceFrames], i * 33, false);
+        if (i % 5 == 4) {
+            encoder.Flush();
+        }
+    }
+    encoder.Flush();
+    encoder.Release();
+    XCTAssertGreaterThan(sink.stats_reads.load(), 0);
+}
+
+//CPU and wall time per captured frame for 180p, 360p and 720p, through
+//the scaling pyramid and from independent encoders that each scale the
+//capture.
+- (void)testBenchmarkCpu {
+    static const int kFrames = 60;
+    I420BufferPool pool;
+    std::vector<webrtc::scoped_refptr<I420Buffer> > source;
+    MakeSourceFrames(&pool, 1280, 720, &source);
+
+    CpuResult simulcast = EncodeSimulcast(source, &pool, kFrames);
+    CpuResult separate = EncodeSeparately(source, &pool, kFrames);
+    NSLog(@"simulcast 180p+360p+720p: %.2f ms cpu/frame, %.2f ms wall/frame, "
+          "scaling %.2f ms/frame", simulcast.cpu_ms_per_frame,
+          simulcast.wall_ms_per_frame, simulcast.scale_ms_per_frame);
+    NSLog(@"separate encoders 180p+360p+720p: %.2f ms cpu/frame, %.2f ms "
+          "wall/frame, scaling %.2f ms/frame", separate.cpu_ms_per_frame,
+          separate.wall_ms_per_frame, separate.scale_ms_per_frame);
+
+    std::vector<webrtc::scoped_refptr<I420Buffer> >* s = &source;
+    I420BufferPool* p = &pool;
+    [self measureBlock:^{
+        EncodeSimulcast(*s, p, 30);
+    }];
+}
+
+@end
@@ -0,0 +1,261 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#import <XCTest/XCTest.h>
+
+#include <string.h>
+#include <vector>
+#include "webrtc/system_wrappers/interface/tick_util.h"
+#include "I420BufferPool.h"
+#include "VP8PartitionEncoder.h"
+
+namespace {
+
+enum { kMaxPayloadSize = 1200 };
+enum { kSourceFrames = 8 };
+
+struct FrameRecord {
+    uint32_t timestamp;
+    uint16_t picture_id;
+    bool key_frame;
+    int partitions;
+    int packets;
+    size_t bytes;
+};
+
+//Checks the VP8 payload descriptors of every packet as it arrives, on the
+//encoder queue, and sums up each frame. Read after VP8PartitionEncoder::Flush.
+class CheckingSink : public VP8PartitionEncoder::PacketSink {
+public:
+    CheckingSink() : errors(0), in_frame_(false), last_partition_(-1) {}
+
+    virtual void OnVP8Packet(const VP8Packet& packet) {
+        const uint8_t* p = packet.payload;
+        if (packet.payload_length > kMaxPayloadSize ||
+            packet.payload_length <= VP8PartitionEncoder::kPayloadDescriptorSize ||
+            (p[0] & 0x80) == 0 || p[1] != 0x80 || (p[2] & 0x80) == 0 ||
+            (p[0] & 0x07) != (packet.partition > 7 ? 7 : packet.partition)) {
+            errors++;
+        }
+        uint16_t picture_id = static_cast<uint16_t>((p[2] & 0x7f) << 8 | p[3]);
+        bool start = (p[0] & 0x10) != 0;
+        if (!in_frame_) {
+            FrameRecord frame = { packet.timestamp, picture_id,
+                                  packet.key_frame, 0, 0, 0 };
+            frames.push_back(frame);
+            in_frame_ = true;
+            last_partition_ = -1;
+        }
+        FrameRecord& frame = frames.back();
+        if (packet.timestamp != frame.timestamp ||
+            picture_id != frame.picture_id ||
+            packet.key_frame != frame.key_frame ||
+            packet.partition < last_partition_ ||
+            start != (packet.partition != last_partition_)) {
+            errors++;
+        }
+        if (start) {
+            frame.partitions++;
+        }
+        last_partition_ = packet.partition;
+        frame.packets++;
+        frame.bytes += packet.payload_length -
+                       VP8PartitionEncoder::kPayloadDescriptorSize;
+        in_frame_ = !packet.marker_bit;
+    }
+
+    std::vector<FrameRecord> frames;
+    int errors;
+
+private:
+    bool in_frame_;
+    int last_partition_;
+};
+
+//A moving gradient with noise, so the encoder has motion and texture.
+void MakeSourceFrames(I420BufferPool* pool, int width, int height,
+                      std::vector<webrtc::scoped_refptr<I420Buffer> >* frames) {
+    uint32_t seed = 1;
+    for (int f = 0; f < kSourceFrames; f++) {
+        webrtc::scoped_refptr<I420Buffer> frame =
+            pool->CreateBuffer(width, height);
+        uint8_t* y = frame->MutableData(webrtc::kYPlane);
+        for (int row = 0; row < height; row++) {
+            for (int col = 0; col < width; col++) {
+                seed = seed * 1103515245 + 12345;
+                y[row * frame->stride(webrtc::kYPlane) + col] =
+                    static_cast<uint8_t>(col + row * 2 + f * 4 +
+                                         ((seed >> 16) & 7));
+            }
+        }
+        int half_height = (height + 1) / 2;
+        memset(frame->MutableData(webrtc::kUPlane), 120,
+               frame->stride(webrtc::kUPlane) * half_height);
+        memset(frame->MutableData(webrtc::kVPlane), 136,
+               frame->stride(webrtc::kVPlane) * half_height);
+        frames->push_back(frame);
+    }
+}
+
+VP8EncoderSettings MakeSettings(int width, int height, int threads) {
+    VP8EncoderSettings settings;
+    settings.width = width;
+    settings.height = height;
+    settings.start_bitrate_kbps = width >= 1280 ? 1500 : 600;
+    settings.max_framerate = 30;
+    settings.threads = threads;
+    settings.max_payload_size = kMaxPayloadSize;
+    return settings;
+}
+
+struct EncodeResult {
+    double ms_per_frame;
+    double capture_to_first_packet_ms;
+    double packets_per_frame;
+};
+
+//Encodes |frames| frames one at a time, waiting for each, so none is
+//replaced.
+EncodeResult EncodeFrames(int width, int height, int threads, int frames) {
+    I420BufferPool pool;
+    std::vector<webrtc::scoped_refptr<I420Buffer> > source;
+    MakeSourceFrames(&pool, width, height, &source);
+    CheckingSink sink;
+    VP8PartitionEncoder encoder(&sink);
+    encoder.Init(MakeSettings(width, height, threads));
+
+    int64_t start = webrtc::TickTime::MicrosecondTimestamp();
+    for (int i = 0; i < frames; i++) {
+        encoder.EncodeFrame(source[i % kSourceFrames],
+                            webrtc::TickTime::MillisecondTimestamp(), i == 0);
+        encoder.Flush();
+    }
+    int64_t elapsed = webrtc::TickTime::MicrosecondTimestamp() - start;
+    VP8EncoderStatistics stats = encoder.GetStatistics();
+    EncodeResult result;
+    result.ms_per_frame = elapsed / 1000.0 / frames;
+    result.capture_to_first_packet_ms =
+        stats.frames_encoded > 0 ?
+        static_cast<double>(stats.sum_capture_to_first_packet_ms) /
+        stats.frames_encoded : 0;
+    result.packets_per_frame =
+        stats.frames_encoded > 0 ?
+        static_cast<double>(stats.packets) / stats.frames_encoded : 0;
+    return result;
+}
+
+}  // namespace
+
+@interface VP8PartitionEncoderTests : XCTestCase
+@end
+
+@implementation VP8PartitionEncoderTests
+
+- (void)testNumberOfThreads {
+    VP8EncoderSettings settings = MakeSettings(1280, 720, 0);
+    XCTAssertEqual(VP8PartitionEncoder::NumberOfThreads(settings, 2), 2);
+    XCTAssertEqual(VP8PartitionEncoder::NumberOfThreads(settings, 16),
+                   static_cast<int>(VP8PartitionEncoder::kMaxThreads));
+    settings = MakeSettings(160, 120, 0);
+    XCTAssertEqual(VP8PartitionEncoder::NumberOfThreads(settings, 4), 1);
+    settings = MakeSettings(160, 120, 3);
+    XCTAssertEqual(VP8PartitionEncoder::NumberOfThreads(settings, 1), 3);
+}
+
+- (void)testRejectsBadSettings {
+    CheckingSink sink;
+    VP8PartitionEncoder encoder(&sink);
+    XCTAssertFalse(encoder.Init(MakeSettings(0, 720, 1)));
+    VP8EncoderSettings settings = MakeSettings(640, 360, 1);
+    settings.max_payload_size = VP8PartitionEncoder::kPayloadDescriptorSize;
+    XCTAssertFalse(encoder.Init(settings));
+}
+
+- (void)testPacketizesEveryPartition {
+    static const int kThreads[] = { 1, 2, 4 };
+    for (int t = 0; t < 3; t++) {
+        I420BufferPool pool;
+        std::vector<webrtc::scoped_refptr<I420Buffer> > source;
+        MakeSourceFrames(&pool, 640, 360, &source);
+        CheckingSink sink;
+        VP8PartitionEncoder encoder(&sink);
+        XCTAssertTrue(encoder.Init(MakeSettings(640, 360, kThreads[t])));
+        for (int i = 0; i < 20; i++) {
+            encoder.EncodeFrame(source[i % kSourceFrames], i * 33, i == 10);
+            encoder.Flush();
+        }
+        VP8EncoderStatistics stats = encoder.GetStatistics();
+        XCTAssertEqual(stats.threads, kThreads[t]);
+        XCTAssertEqual(stats.token_partitions, kThreads[t]);
+        XCTAssertEqual(sink.errors, 0);
+        XCTAssertEqual(sink.frames.size(), stats.frames_encoded);
+        XCTAssertGreaterThan(stats.frames_encoded, 0u);
+
+        uint64_t packets = 0;
+        for (size_t i = 0; i < sink.frames.size(); i++) {
+            const FrameRecord& frame = sink.frames[i];
+            //The first partition and one per token partition.
+            XCTAssertEqual(frame.partitions, stats.token_partitions + 1);
+            if (i > 0) {
+                XCTAssertEqual(frame.picture_id,
+                               (sink.frames[i - 1].picture_id + 1) & 0x7fff);
+            }
+            packets += frame.packets;
+        }
+        XCTAssertEqual(packets, stats.packets);
+        XCTAssertTrue(sink.frames[0].key_frame);
+        //The requested key frame, unless the rate control dropped frames.
+        if (stats.frames_dropped == 0) {
+            XCTAssertTrue(sink.frames[10].key_frame);
+            XCTAssertEqual(sink.frames[10].timestamp, 10u * 33 * 90);
+        }
+    }
+}
+
+- (void)testFollowsResolutionChange {
+    I420BufferPool pool;
+    std::vector<webrtc::scoped_refptr<I420Buffer> > large;
+    std::vector<webrtc::scoped_refptr<I420Buffer> > small;
+    MakeSourceFrames(&pool, 640, 360, &large);
+    MakeSourceFrames(&pool, 320, 180, &small);
+    CheckingSink sink;
+    VP8PartitionEncoder encoder(&sink);
+    XCTAssertTrue(encoder.Init(MakeSettings(640, 360, 2)));
+    for (int i = 0; i < 6; i++) {
+        encoder.EncodeFrame(i < 3 ? large[i] : small[i], i * 33, false);
+        encoder.Flush();
+    }
+    XCTAssertEqual(sink.errors, 0);
+    XCTAssertEqual(sink.frames.size(), 6u);
+    XCTAssertTrue(sink.frames[3].key_frame);
+    XCTAssertFalse(sink.frames[4].key_frame);
+}
+
+//Encode time per frame at 360p and 720p over 1 to 8 encoder threads, each
+//frame encoded before the next is queued.
+- (void)testBenchmarkThreads {
+    static const int kSizes[][2] = { { 640, 360 }, { 1280, 720 } };
+    for (int s = 0; s < 2; s++) {
+        for (int threads = 1; threads <= VP8PartitionEncoder::kMaxThreads;
+             threads *= 2) {
+            EncodeResult result = EncodeFrames(kSizes[s][0], kSizes[s][1],
+                                               threads, 60);
+            NSLog(@"vp8 %dx%d, %d threads: %.2f ms/frame, capture to first "
+                  "packet %.2f ms, %.1f packets/frame",
+                  kSizes[s][0], kSizes[s][1], threads, result.ms_per_frame,
+                  result.capture_to_first_packet_ms,
+                  result.packets_per_frame);
+        }
+    }
+
+    [self measureBlock:^{
+        EncodeFrames(1280, 720, 0, 30);
+    }];
+}
+
+@end
@@ -0,0 +1,834 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#import <XCTest/XCTest.h>
+
+#include <string.h>
+#include <map>
+#include <set>
+#include <vector>
+#include "chromium/src/third_party/libvpx/source/libvpx/vpx/vpx_encoder.h"
+#include "chromium/src/third_party/libvpx/source/libvpx/vpx/vp8cx.h"
+#include "webrtc/modules/video_coding/codecs/interface/video_error_codes.h"
+#include "webrtc/system_wrappers/interface/scoped_ptr.h"
+#include "webrtc/system_wrappers/interface/tick_util.h"
+#include "webrtc/video_decoder.h"
+#include "LossGenerator.h"
+#include "VP8SelectiveForwarder.h"
+
+namespace {
+
+enum { kFrameRate = 30 };
+enum { kRtpHeaderSize = 12 };
+enum { kDescriptorSize = 6 };
+enum { kMaxPayloadSize = 1000 };
+enum { kPayloadType = 100 };
+enum { kTestReceivers = 4 };
+//Frames from one sync frame of the upper layers to the next.
+enum { kSyncInterval = 16 };
+
+//0-2-1-2, as DefaultTemporalLayers with three layers.
+static const int kLayerPattern[4] = { 0, 2, 1, 2 };
+
+struct SourcePacket {
+    std::vector<uint8_t> data;
+    uint16_t sequence_number;
+};
+
+struct SourceFrame {
+    uint32_t timestamp;
+    int temporal_idx;
+    bool key_frame;
+    std::vector<uint8_t> data;
+};
+
+//A VP8 stream with three temporal layers, encoded by libvpx and packetized
+//with picture ID, TL0PICIDX and TID. The base layer references and updates
+//the last frame, layer 1 references last and golden and updates golden,
+//layer 2 references both and updates nothing. Every kSyncInterval frames,
+//and after a key frame, layers 1 and 2 reference the base layer only and
+//are sent as sync frames. Error resilient mode keeps the entropy contexts
+//of dropped frames out of the decoder.
+class LayeredSource {
+public:
+    LayeredSource(int width, int height, uint16_t first_sequence_number)
+    : width_(width), height_(height), image_(NULL), initialized_(false),
+      frame_(0), key_frame_requested_(false), golden_is_base_(false),
+      sequence_number_(first_sequence_number), picture_id_(0),
+      tl0_pic_idx_(0) {}
+
+    ~LayeredSource() {
+        if (initialized_) {
+            vpx_codec_destroy(&encoder_);
+        }
+        if (image_) {
+            vpx_img_free(image_);
+        }
+    }
+
+    bool Init(int bitrate_kbps) {
+        vpx_codec_enc_cfg_t config;
+        if (vpx_codec_enc_config_default(vpx_codec_vp8_cx(), &config, 0)) {
+            return false;
+        }
+        config.g_w = width_;
+        config.g_h = height_;
+        config.g_timebase.num = 1;
+        config.g_timebase.den = kFrameRate;
+        config.g_threads = 1;
+        config.g_lag_in_frames = 0;
+        config.g_error_resilient = VPX_ERROR_RESILIENT_DEFAULT;
+        config.rc_end_usage = VPX_CBR;
+        config.rc_target_bitrate = bitrate_kbps;
+        config.rc_dropframe_thresh = 0;
+        config.kf_mode = VPX_KF_DISABLED;
+        config.ts_number_layers = 3;
+        config.ts_periodicity = 4;
+        config.ts_rate_decimator[0] = 4;
+        config.ts_rate_decimator[1] = 2;
+        config.ts_rate_decimator[2] = 1;
+        //Cumulative, 40% 60% 100% as DefaultTemporalLayers.
+        config.ts_target_bitrate[0] = bitrate_kbps * 4 / 10;
+        config.ts_target_bitrate[1] = bitrate_kbps * 6 / 10;
+        config.ts_target_bitrate[2] = bitrate_kbps;
+        for (int i = 0; i < 4; i++) {
+            config.ts_layer_id[i] = kLayerPattern[i];
+        }
+        if (vpx_codec_enc_init(&encoder_, vpx_codec_vp8_cx(), &config, 0)) {
+            return false;
+        }
+        initialized_ = true;
+        vpx_codec_control(&encoder_, VP8E_SET_CPUUSED, -6);
+        image_ = vpx_img_alloc(NULL, VPX_IMG_FMT_I420, width_, height_, 16);
+        return image_ != NULL;
+    }
+
+    //The key frame is encoded at the next frame of the base layer.
+    void RequestKeyFrame() { key_frame_requested_ = true; }
+
+    //Encodes the next frame and appends its packets.
+    void EncodeFrame(std::vector<SourcePacket>* packets) {
+        int temporal_idx = kLayerPattern[frame_ % 4];
+        bool key_frame = frame_ == 0 ||
+                         (key_frame_requested_ && temporal_idx == 0);
+        bool sync = false;
+        vpx_enc_frame_flags_t flags;
+        if (key_frame) {
+            flags = VPX_EFLAG_FORCE_KF;
+            key_frame_requested_ = false;
+            golden_is_base_ = true;
+        } else if (temporal_idx == 0) {
+            flags = VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_REF_ARF |
+                    VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_UPD_ARF;
+        } else {
+            sync = golden_is_base_ || frame_ % kSyncInterval == 1 ||
+                   frame_ % kSyncInterval == 2;
+            flags = VP8_EFLAG_NO_REF_ARF | VP8_EFLAG_NO_UPD_LAST |
+                    VP8_EFLAG_NO_UPD_ARF;
+            if (temporal_idx == 2) {
+                flags |= VP8_EFLAG_NO_UPD_GF;
+            }
+            if (sync && !golden_is_base_) {
+                flags |= VP8_EFLAG_NO_REF_GF;
+            }
+            if (temporal_idx == 1) {
+                golden_is_base_ = false;
+            }
+        }
+        FillImage();
+
+        SourceFrame frame;
+        frame.timestamp = static_cast<uint32_t>(frame_) * 90000 / kFrameRate;
+        frame.temporal_idx = temporal_idx;
+        frame.key_frame = false;
+        vpx_codec_encode(&encoder_, image_, frame_, 1, flags, VPX_DL_REALTIME);
+        vpx_codec_iter_t iter = NULL;
+        const vpx_codec_cx_pkt_t* pkt;
+        while ((pkt = vpx_codec_get_cx_data(&encoder_, &iter)) != NULL) {
+            if (pkt->kind != VPX_CODEC_CX_FRAME_PKT) {
+                continue;
+            }
+            const uint8_t* data = static_cast<const uint8_t*>(pkt->data.frame.buf);
+            frame.data.insert(frame.data.end(), data, data + pkt->data.frame.sz);
+            frame.key_frame = (pkt->data.frame.flags & VPX_FRAME_IS_KEY) != 0;
+        }
+        frame_++;
+        if (frame.data.empty()) {
+            return;
+        }
+        picture_id_ = (picture_id_ + 1) & 0x7FFF;
+        if (temporal_idx == 0) {
+            tl0_pic_idx_++;
+        }
+        Packetize(frame, sync, packets);
+        frames.push_back(frame);
+    }
+
+    std::vector<SourceFrame> frames;
+
+private:
+    //A moving gradient with noise.
+    void FillImage() {
+        uint32_t seed = frame_ + 1;
+        for (int row = 0; row < height_; row++) {
+            uint8_t* y = image_->planes[VPX_PLANE_Y] +
+                         row * image_->stride[VPX_PLANE_Y];
+            for (int col = 0; col < width_; col++) {
+                seed = seed * 1103515245 + 12345;
+                y[col] = static_cast<uint8_t>(col + row * 2 + frame_ * 3 +
+                                              ((seed >> 16) & 7));
+            }
+        }
+        for (int row = 0; row < (height_ + 1) / 2; row++) {
+            memset(image_->planes[VPX_PLANE_U] +
+                   row * image_->stride[VPX_PLANE_U], 110 + frame_ % 16,
+                   (width_ + 1) / 2);
+            memset(image_->planes[VPX_PLANE_V] +
+                   row * image_->stride[VPX_PLANE_V], 140, (width_ + 1) / 2);
+        }
+    }
+
+    void Packetize(const SourceFrame& frame, bool sync,
+                   std::vector<SourcePacket>* packets) {
+        size_t count = (frame.data.size() + kMaxPayloadSize - 1) /
+                       kMaxPayloadSize;
+        size_t offset = 0;
+        for (size_t i = 0; i < count; i++) {
+            size_t length = (frame.data.size() - offset) / (count - i);
+            SourcePacket packet;
+            packet.sequence_number = sequence_number_++;
+            packet.data.resize(kRtpHeaderSize + kDescriptorSize + length);
+            uint8_t* p = &packet.data[0];
+            p[0] = 0x80;
+            p[1] = kPayloadType | (i == count - 1 ? 0x80 : 0);
+            p[2] = static_cast<uint8_t>(packet.sequence_number >> 8);
+            p[3] = static_cast<uint8_t>(packet.sequence_number);
+            p[4] = static_cast<uint8_t>(frame.timestamp >> 24);
+            p[5] = static_cast<uint8_t>(frame.timestamp >> 16);
+            p[6] = static_cast<uint8_t>(frame.timestamp >> 8);
+            p[7] = static_cast<uint8_t>(frame.timestamp);
+            p[8] = 0x12;
+            p[9] = 0x34;
+            p[10] = 0x56;
+            p[11] = 0x78;
+            p += kRtpHeaderSize;
+            //X, N for the frames nothing references, S on the first packet.
+            p[0] = 0x80 | (frame.temporal_idx == 2 ? 0x20 : 0) |
+                   (i == 0 ? 0x10 : 0);
+            //I, L and T.
+            p[1] = 0xE0;
+            p[2] = static_cast<uint8_t>(0x80 | picture_id_ >> 8);
+            p[3] = static_cast<uint8_t>(picture_id_);
+            p[4] = tl0_pic_idx_;
+            p[5] = static_cast<uint8_t>(frame.temporal_idx << 6 |
+                                        (sync ? 0x20 : 0));
+            memcpy(p + kDescriptorSize, &frame.data[offset], length);
+            offset += length;
+            packets->push_back(packet);
+        }
+    }
+
+    int width_;
+    int height_;
+    vpx_codec_ctx_t encoder_;
+    vpx_image_t* image_;
+    bool initialized_;
+    int frame_;
+    bool key_frame_requested_;
+    //The golden frame is the last key frame.
+    bool golden_is_base_;
+    uint16_t sequence_number_;
+    int picture_id_;
+    uint8_t tl0_pic_idx_;
+};
+
+//What every receiver got, in the order it was sent.
+class RecordingSender : public VP8SelectiveForwarder::Sender {
+public:
+    virtual void ForwardPacket(int receiver, const uint8_t* packet,
+                               size_t length) {
+        packets[receiver].push_back(
+            std::vector<uint8_t>(packet, packet + length));
+    }
+
+    std::vector<std::vector<uint8_t> > packets[kTestReceivers];
+};
+
+class CountingSender : public VP8SelectiveForwarder::Sender {
+public:
+    CountingSender() : packets(0) {}
+
+    virtual void ForwardPacket(int /*receiver*/, const uint8_t* /*packet*/,
+                               size_t /*length*/) {
+        packets++;
+    }
+
+    uint64_t packets;
+};
+
+uint16_t SequenceNumber(const std::vector<uint8_t>& packet) {
+    return static_cast<uint16_t>(packet[2] << 8 | packet[3]);
+}
+
+uint32_t Timestamp(const std::vector<uint8_t>& packet) {
+    return static_cast<uint32_t>(packet[4]) << 24 | packet[5] << 16 |
+           packet[6] << 8 | packet[7];
+}
+
+//The incoming sequence number of a forwarded packet, found by its payload.
+uint16_t SourceSequenceNumber(const std::vector<SourcePacket>& packets,
+                              const std::vector<uint8_t>& forwarded) {
+    for (size_t i = 0; i < packets.size(); i++) {
+        const std::vector<uint8_t>& data = packets[i].data;
+        if (data.size() == forwarded.size() &&
+            Timestamp(data) == Timestamp(forwarded) &&
+            memcmp(&data[kRtpHeaderSize], &forwarded[kRtpHeaderSize],
+                   data.size() - kRtpHeaderSize) == 0) {
+            return packets[i].sequence_number;
+        }
+    }
+    return 0;
+}
+
+struct ReceivedFrame {
+    uint32_t timestamp;
+    bool complete;
+    std::vector<uint8_t> data;
+};
+
+//Reassembles the frames of a forwarded stream as the receiver's jitter
+//buffer would, by timestamp and sequence number, ignoring duplicates.
+std::vector<ReceivedFrame> AssembleFrames(
+    const std::vector<std::vector<uint8_t> >& packets) {
+    std::map<uint32_t, std::map<int64_t, const std::vector<uint8_t>*> > frames;
+    int64_t unwrapped = 0;
+    for (size_t i = 0; i < packets.size(); i++) {
+        if (i > 0) {
+            unwrapped += static_cast<int16_t>(SequenceNumber(packets[i]) -
+                                              SequenceNumber(packets[i - 1]));
+        }
+        frames[Timestamp(packets[i])][unwrapped] = &packets[i];
+    }
+    std::vector<ReceivedFrame> result;
+    std::map<uint32_t, std::map<int64_t, const std::vector<uint8_t>*> >::
+        const_iterator it;
+    for (it = frames.begin(); it != frames.end(); ++it) {
+        ReceivedFrame frame;
+        frame.timestamp = it->first;
+        const std::map<int64_t, const std::vector<uint8_t>*>& parts = it->second;
+        const std::vector<uint8_t>& first = *parts.begin()->second;
+        const std::vector<uint8_t>& last = *parts.rbegin()->second;
+        frame.complete =
+            (first[kRtpHeaderSize] & 0x10) != 0 && (last[1] & 0x80) != 0 &&
+            parts.rbegin()->first - parts.begin()->first + 1 ==
+                static_cast<int64_t>(parts.size());
+        std::map<int64_t, const std::vector<uint8_t>*>::const_iterator part;
+        for (part = parts.begin(); part != parts.end(); ++part) {
+            const std::vector<uint8_t>& packet = *part->second;
+            webrtc::RTPVideoHeaderVP8 vp8;
+            int descriptor_length = ParseVP8PayloadDescriptor(
+                &packet[kRtpHeaderSize], packet.size() - kRtpHeaderSize, &vp8);
+            frame.data.insert(frame.data.end(),
+                              packet.begin() + kRtpHeaderSize + descriptor_length,
+                              packet.end());
+        }
+        result.push_back(frame);
+    }
+    return result;
+}
+
+//Decodes through webrtc's VP8 decoder and keeps a hash of every picture.
+class HashingDecoder : public webrtc::DecodedImageCallback {
+public:
+    HashingDecoder(int width, int height)
+    : decoder_(webrtc::VideoDecoder::Create(webrtc::VideoDecoder::kVp8)) {
+        webrtc::VideoCodec codec;
+        memset(&codec, 0, sizeof(codec));
+        codec.codecType = webrtc::kVideoCodecVP8;
+        codec.width = width;
+        codec.height = height;
+        decoder_->InitDecode(&codec, 1);
+        decoder_->RegisterDecodeCompleteCallback(this);
+    }
+
+    ~HashingDecoder() {
+        decoder_->Release();
+    }
+
+    int Decode(uint32_t timestamp, const std::vector<uint8_t>& data) {
+        webrtc::EncodedImage image(const_cast<uint8_t*>(&data[0]), data.size(),
+                                   data.size());
+        image._timeStamp = timestamp;
+        //The inverted P bit of the frame header.
+        image._frameType = (data[0] & 0x01) == 0 ? webrtc::kKeyFrame :
+                                                   webrtc::kDeltaFrame;
+        image._completeFrame = true;
+        return decoder_->Decode(image, false, NULL);
+    }
+
+    virtual int32_t Decoded(webrtc::I420VideoFrame& frame) {
+        uint32_t hash = 2166136261u;
+        static const webrtc::PlaneType kPlanes[3] = {
+            webrtc::kYPlane, webrtc::kUPlane, webrtc::kVPlane };
+        for (int i = 0; i < 3; i++) {
+            int width = i == 0 ? frame.width() : (frame.width() + 1) / 2;
+            int height = i == 0 ? frame.height() : (frame.height() + 1) / 2;
+            const uint8_t* plane = frame.buffer(kPlanes[i]);
+            for (int row = 0; row < height; row++) {
+                const uint8_t* p = plane + row * frame.stride(kPlanes[i]);
+                for (int col = 0; col < width; col++) {
+                    hash = (hash ^ p[col]) * 16777619u;
+                }
+            }
+        }
+        hashes[frame.timestamp()] = hash;
+        return 0;
+    }
+
+    std::map<uint32_t, uint32_t> hashes;
+
+private:
+    webrtc::scoped_ptr<webrtc::VideoDecoder> decoder_;
+};
+
+struct ReceiverCheck {
+    int frames;
+    int frames_per_layer[3];
+    int incomplete;
+    int decode_errors;
+    //Decoded to a different picture than the full stream gives.
+    int mismatches;
+    bool starts_with_key_frame;
+};
+
+//Decodes what |receiver| got and compares every picture with the one the
+//complete stream decodes to, which differs if a frame it references was
+//dropped.
+ReceiverCheck CheckReceiver(const LayeredSource& source,
+                            const std::map<uint32_t, uint32_t>& reference,
+                            const std::vector<std::vector<uint8_t> >& packets,
+                            int width, int height) {
+    std::map<uint32_t, int> layers;
+    for (size_t i = 0; i < source.frames.size(); i++) {
+        layers[source.frames[i].timestamp] = source.frames[i].temporal_idx;
+    }
+    ReceiverCheck check;
+    memset(&check, 0, sizeof(check));
+    std::vector<ReceivedFrame> frames = AssembleFrames(packets);
+    HashingDecoder decoder(width, height);
+    for (size_t i = 0; i < frames.size(); i++) {
+        const ReceivedFrame& frame = frames[i];
+        if (!frame.complete) {
+            check.incomplete++;
+            continue;
+        }
+        if (check.frames == 0) {
+            check.starts_with_key_frame = (frame.data[0] & 0x01) == 0;
+        }
+        check.frames++;
+        check.frames_per_layer[layers[frame.timestamp]]++;
+        if (decoder.Decode(frame.timestamp, frame.data) !=
+            WEBRTC_VIDEO_CODEC_OK) {
+            check.decode_errors++;
+            continue;
+        }
+        std::map<uint32_t, uint32_t>::const_iterator expected =
+            reference.find(frame.timestamp);
+        std::map<uint32_t, uint32_t>::const_iterator decoded =
+            decoder.hashes.find(frame.timestamp);
+        if (expected == reference.end() || decoded == decoder.hashes.end() ||
+            expected->second != decoded->second) {
+            check.mismatches++;
+        }
+    }
+    return check;
+}
+
+std::map<uint32_t, uint32_t> DecodeSource(const LayeredSource& source,
+                                          int width, int height) {
+    HashingDecoder decoder(width, height);
+    for (size_t i = 0; i < source.frames.size(); i++) {
+        decoder.Decode(source.frames[i].timestamp, source.frames[i].data);
+    }
+    return decoder.hashes;
+}
+
+//Counts the sequence numbers a receiver skipped, with no loss there are
+//none.
+int SequenceGaps(const std::vector<std::vector<uint8_t> >& packets) {
+    int gaps = 0;
+    for (size_t i = 1; i < packets.size(); i++) {
+        if (SequenceNumber(packets[i]) !=
+            static_cast<uint16_t>(SequenceNumber(packets[i - 1]) + 1)) {
+            gaps++;
+        }
+    }
+    return gaps;
+}
+
+int64_t FrameTimeMs(int frame) {
+    return frame * 1000 / kFrameRate;
+}
+
+//The receiver's bitrate for the base layer and layer 1 and half of layer 2.
+uint32_t TwoLayerBitrate(const VP8ForwarderStatistics& stats) {
+    uint64_t bps = stats.layer_bitrate_bps[0] + stats.layer_bitrate_bps[1] +
+                   stats.layer_bitrate_bps[2] / 2;
+    return static_cast<uint32_t>(bps * 100 / 90);
+}
+
+//Forwarder input per second for |receivers| receivers, a third of them on
+//each number of layers.
+double ForwardRate(const std::vector<SourcePacket>& packets,
+                   uint32_t two_layer_bps, int receivers, uint64_t* forwarded) {
+    CountingSender sender;
+    VP8SelectiveForwarder forwarder(&sender);
+    for (int r = 0; r < receivers; r++) {
+        forwarder.AddReceiver(r);
+        uint32_t bitrates[3] = { 10000000, two_layer_bps, 1 };
+        forwarder.SetReceiverBitrate(r, bitrates[r % 3]);
+    }
+    int64_t start = webrtc::TickTime::MicrosecondTimestamp();
+    for (size_t i = 0; i < packets.size(); i++) {
+        const SourcePacket& packet = packets[i];
+        forwarder.IncomingPacket(&packet.data[0], packet.data.size(),
+                                 Timestamp(packet.data) / 90);
+    }
+    int64_t elapsed = webrtc::TickTime::MicrosecondTimestamp() - start;
+    *forwarded = sender.packets;
+    return packets.size() * 1000000.0 / (elapsed > 0 ? elapsed : 1);
+}
+
+}  // namespace
+
+@interface VP8SelectiveForwarderTests : XCTestCase
+@end
+
+@implementation VP8SelectiveForwarderTests
+
+- (void)testParsesPayloadDescriptor {
+    //X, S, partition 0; I, L, T, K; 15 bit picture ID 0x1234; TL0PICIDX 7;
+    //TID 2, Y, KEYIDX 5.
+    const uint8_t descriptor[] = { 0x90, 0xF0, 0x92, 0x34, 0x07, 0xA5, 0x00 };
+    webrtc::RTPVideoHeaderVP8 vp8;
+    XCTAssertEqual(ParseVP8PayloadDescriptor(descriptor, sizeof(descriptor),
+                                             &vp8), 6);
+    XCTAssertTrue(vp8.beginningOfPartition);
+    XCTAssertEqual(vp8.partitionId, 0);
+    XCTAssertEqual(vp8.pictureId, 0x1234);
+    XCTAssertEqual(vp8.tl0PicIdx, 7);
+    XCTAssertEqual(vp8.temporalIdx, 2);
+    XCTAssertTrue(vp8.layerSync);
+    XCTAssertEqual(vp8.keyIdx, 5);
+
+    //No payload after the descriptor, or the descriptor cut short.
+    XCTAssertEqual(ParseVP8PayloadDescriptor(descriptor, 6, &vp8), -1);
+    XCTAssertEqual(ParseVP8PayloadDescriptor(descriptor, 3, &vp8), -1);
+    const uint8_t plain[] = { 0x10, 0x00 };
+    XCTAssertEqual(ParseVP8PayloadDescriptor(plain, sizeof(plain), &vp8), 1);
+    XCTAssertEqual(vp8.temporalIdx, webrtc::kNoTemporalIdx);
+}
+
+//Three receivers get all layers, two and the base layer. What each gets
+//decodes to the same pictures as the full stream, with no gap in its
+//sequence numbers.
+- (void)testForwardedLayersDecode {
+    static const int kWidth = 320;
+    static const int kHeight = 240;
+    static const int kFrames = 300;
+    LayeredSource source(kWidth, kHeight, 65000);
+    XCTAssertTrue(source.Init(400));
+    RecordingSender sender;
+    VP8SelectiveForwarder forwarder(&sender);
+    for (int r = 0; r < 3; r++) {
+        XCTAssertTrue(forwarder.AddReceiver(r));
+    }
+    XCTAssertTrue(forwarder.TakeKeyFrameRequest());
+
+    std::vector<SourcePacket> packets;
+    for (int f = 0; f < kFrames; f++) {
+        //Once the layer rates are known.
+        if (f == kFrameRate * 3 / 2) {
+            VP8ForwarderStatistics stats = forwarder.GetStatistics();
+            XCTAssertGreaterThan(stats.layer_bitrate_bps[2], 0u);
+            forwarder.SetReceiverBitrate(0, 10000000);
+            forwarder.SetReceiverBitrate(1, TwoLayerBitrate(stats));
+            forwarder.SetReceiverBitrate(2, 1);
+        }
+        size_t first = packets.size();
+        source.EncodeFrame(&packets);
+        for (size_t i = first; i < packets.size(); i++) {
+            XCTAssertTrue(forwarder.IncomingPacket(
+                &packets[i].data[0], packets[i].data.size(), FrameTimeMs(f)));
+        }
+    }
+    XCTAssertEqual(forwarder.ReceiverLayer(0), 2);
+    XCTAssertEqual(forwarder.ReceiverLayer(2), 0);
+
+    std::map<uint32_t, uint32_t> reference =
+        DecodeSource(source, kWidth, kHeight);
+    XCTAssertEqual(reference.size(), source.frames.size());
+    ReceiverCheck checks[3];
+    for (int r = 0; r < 3; r++) {
+        checks[r] = CheckReceiver(source, reference, sender.packets[r],
+                                  kWidth, kHeight);
+        XCTAssertEqual(SequenceGaps(sender.packets[r]), 0, @"receiver %d", r);
+        XCTAssertTrue(checks[r].starts_with_key_frame, @"receiver %d", r);
+        XCTAssertEqual(checks[r].incomplete, 0, @"receiver %d", r);
+        XCTAssertEqual(checks[r].decode_errors, 0, @"receiver %d", r);
+        XCTAssertEqual(checks[r].mismatches, 0, @"receiver %d", r);
+        NSLog(@"receiver %d: %d frames, per layer %d %d %d", r,
+              checks[r].frames, checks[r].frames_per_layer[0],
+              checks[r].frames_per_layer[1], checks[r].frames_per_layer[2]);
+    }
+    //Every base layer frame reaches every receiver.
+    for (int r = 0; r < 3; r++) {
+        XCTAssertEqual(checks[r].frames_per_layer[0], kFrames / 4);
+    }
+    //Layer 2 reaches the first receiver from its first sync frame on.
+    XCTAssertGreaterThanOrEqual(checks[0].frames_per_layer[2],
+                                kFrames / 2 - kSyncInterval);
+    XCTAssertGreaterThan(checks[0].frames, checks[1].frames);
+    XCTAssertGreaterThan(checks[1].frames, checks[2].frames);
+    //Once the rates are known, the last one only gets the base layer.
+    int upper = checks[2].frames_per_layer[1] + checks[2].frames_per_layer[2];
+    XCTAssertLessThan(upper, kFrameRate * 3 / 2);
+}
+
+//A receiver drops to the base layer and comes back one layer at a time,
+//and another joins later, starting with the key frame it asked for.
+- (void)testSwitchesLayers {
+    static const int kWidth = 320;
+    static const int kHeight = 240;
+    static const int kFrames = 300;
+    LayeredSource source(kWidth, kHeight, 1000);
+    XCTAssertTrue(source.Init(400));
+    RecordingSender sender;
+    VP8SelectiveForwarder forwarder(&sender);
+    forwarder.AddReceiver(0);
+    forwarder.SetReceiverBitrate(0, 10000000);
+    forwarder.TakeKeyFrameRequest();
+
+    std::vector<SourcePacket> packets;
+    int layers[5] = { -1, -1, -1, -1, -1 };
+    for (int f = 0; f < kFrames; f++) {
+        if (f == 90) {
+            layers[0] = forwarder.ReceiverLayer(0);
+            forwarder.SetReceiverBitrate(0, 1);
+        } else if (f == 150) {
+            layers[1] = forwarder.ReceiverLayer(0);
+            forwarder.SetReceiverBitrate(0, 10000000);
+        } else if (f == 170) {
+            //Up to layer 1 at its sync frame 162, to layer 2 at 177.
+            layers[2] = forwarder.ReceiverLayer(0);
+        } else if (f == 180) {
+            layers[3] = forwarder.ReceiverLayer(0);
+        } else if (f == 210) {
+            XCTAssertTrue(forwarder.AddReceiver(1));
+            forwarder.SetReceiverBitrate(1, 10000000);
+        }
+        if (forwarder.TakeKeyFrameRequest()) {
+            source.RequestKeyFrame();
+        }
+        size_t first = packets.size();
+        source.EncodeFrame(&packets);
+        for (size_t i = first; i < packets.size(); i++) {
+            forwarder.IncomingPacket(&packets[i].data[0],
+                                     packets[i].data.size(), FrameTimeMs(f));
+        }
+    }
+    layers[4] = forwarder.ReceiverLayer(0);
+    XCTAssertEqual(layers[0], 2);
+    XCTAssertEqual(layers[1], 0);
+    XCTAssertEqual(layers[2], 1);
+    XCTAssertEqual(layers[3], 2);
+    XCTAssertEqual(layers[4], 2);
+    XCTAssertEqual(forwarder.ReceiverLayer(1), 2);
+
+    std::map<uint32_t, uint32_t> reference =
+        DecodeSource(source, kWidth, kHeight);
+    for (int r = 0; r < 2; r++) {
+        ReceiverCheck check = CheckReceiver(source, reference,
+                                            sender.packets[r], kWidth, kHeight);
+        XCTAssertEqual(SequenceGaps(sender.packets[r]), 0, @"receiver %d", r);
+        XCTAssertTrue(check.starts_with_key_frame, @"receiver %d", r);
+        XCTAssertEqual(check.incomplete, 0, @"receiver %d", r);
+        XCTAssertEqual(check.decode_errors, 0, @"receiver %d", r);
+        XCTAssertEqual(check.mismatches, 0, @"receiver %d", r);
+    }
+    //The joining receiver starts at the key frame, encoded at the next
+    //frame of the base layer.
+    XCTAssertEqual(Timestamp(sender.packets[1][0]),
+                   static_cast<uint32_t>(212 * 90000 / kFrameRate));
+}
+
+//Packets lost before the forwarder are NACKed by the receivers in their
+//own sequence numbers, translated back and retransmitted. Every frame
+//forwarded is completed and decodes as in the full stream.
+- (void)testTranslatesNacks {
+    static const int kWidth = 320;
+    static const int kHeight = 240;
+    static const int kFrames = 300;
+    LayeredSource source(kWidth, kHeight, 65300);
+    XCTAssertTrue(source.Init(400));
+    RecordingSender sender;
+    VP8SelectiveForwarder forwarder(&sender);
+    forwarder.AddReceiver(0);
+    forwarder.AddReceiver(1);
+    forwarder.SetReceiverBitrate(0, 10000000);
+    forwarder.SetReceiverBitrate(1, 1);
+    forwarder.TakeKeyFrameRequest();
+
+    LossGenerator loss(7);
+    std::map<uint16_t, const SourcePacket*> lost;
+    std::set<uint16_t> retransmitted;
+    std::vector<SourcePacket> packets;
+    //Never reallocated, |lost| points into it.
+    packets.reserve(kFrames * 20);
+    int nacked = 0;
+    //NACKed packets that were not lost, by receiver.
+    std::vector<uint16_t> not_lost[2];
+    //Newest sequence number of each receiver and how far it was scanned.
+    uint16_t newest[2] = { 0, 0 };
+    size_t scanned[2] = { 0, 0 };
+    for (int f = 0; f < kFrames; f++) {
+        size_t first = packets.size();
+        source.EncodeFrame(&packets);
+        for (size_t i = first; i < packets.size(); i++) {
+            //Never the key frame, the receivers start there.
+            if (f > 0 && loss.Lost(0.05f)) {
+                lost[packets[i].sequence_number] = &packets[i];
+                continue;
+            }
+            forwarder.IncomingPacket(&packets[i].data[0],
+                                     packets[i].data.size(), FrameTimeMs(f));
+        }
+
+        for (int r = 0; r < 2; r++) {
+            //The receiver NACKs what it skipped.
+            std::vector<uint16_t> nacks;
+            const std::vector<std::vector<uint8_t> >& got = sender.packets[r];
+            for (size_t i = scanned[r]; i < got.size(); i++) {
+                uint16_t sequence_number = SequenceNumber(got[i]);
+                uint16_t step = sequence_number - newest[r];
+                if (i == 0 || (step > 0 && step < 0x8000)) {
+                    for (uint16_t k = 1; i > 0 && k < step; k++) {
+                        nacks.push_back(newest[r] + k);
+                    }
+                    newest[r] = sequence_number;
+                }
+            }
+            scanned[r] = got.size();
+            if (nacks.empty()) {
+                continue;
+            }
+            std::vector<uint16_t> translated(nacks.size());
+            int count = forwarder.TranslateNack(r, &nacks[0],
+                                                static_cast<int>(nacks.size()),
+                                                &translated[0]);
+            XCTAssertEqual(count, static_cast<int>(nacks.size()));
+            for (int i = 0; i < count; i++) {
+                nacked++;
+                std::map<uint16_t, const SourcePacket*>::const_iterator it =
+                    lost.find(translated[i]);
+                if (it == lost.end()) {
+                    not_lost[r].push_back(translated[i]);
+                    continue;
+                }
+                //One retransmission serves both receivers.
+                if (retransmitted.insert(translated[i]).second) {
+                    forwarder.IncomingPacket(&it->second->data[0],
+                                             it->second->data.size(),
+                                             FrameTimeMs(f));
+                }
+            }
+        }
+    }
+    XCTAssertGreaterThan(lost.size(), 10u);
+    XCTAssertGreaterThan(nacked, 0);
+    //A NACK that was not of a lost packet must be of one dropped for the
+    //receiver, in a run of dropped frames the forwarder could not cut out
+    //because the packet at one end of it was lost. Never of one it got.
+    int dropped_nacks = 0;
+    for (int r = 0; r < 2; r++) {
+        std::set<uint16_t> forwarded;
+        for (size_t i = 0; i < sender.packets[r].size(); i++) {
+            forwarded.insert(SourceSequenceNumber(packets,
+                                                  sender.packets[r][i]));
+        }
+        for (size_t i = 0; i < not_lost[r].size(); i++) {
+            XCTAssertEqual(forwarded.count(not_lost[r][i]), 0u,
+                           @"receiver %d, %d", r, not_lost[r][i]);
+        }
+        dropped_nacks += static_cast<int>(not_lost[r].size());
+    }
+    XCTAssertLessThan(dropped_nacks, nacked / 4);
+
+    std::map<uint32_t, uint32_t> reference =
+        DecodeSource(source, kWidth, kHeight);
+    for (int r = 0; r < 2; r++) {
+        ReceiverCheck check = CheckReceiver(source, reference,
+                                            sender.packets[r], kWidth, kHeight);
+        //Only a frame lost at its end, in the last frames, is left.
+        XCTAssertLessThanOrEqual(check.incomplete, 1, @"receiver %d", r);
+        XCTAssertEqual(check.decode_errors, 0, @"receiver %d", r);
+        XCTAssertEqual(check.mismatches, 0, @"receiver %d", r);
+        XCTAssertGreaterThanOrEqual(check.frames_per_layer[0],
+                                    kFrames / 4 - 1, @"receiver %d", r);
+        NSLog(@"receiver %d with loss: %d frames, %d incomplete", r,
+              check.frames, check.incomplete);
+    }
+    NSLog(@"%d packets lost, %d NACKed, %d of them of dropped frames",
+          static_cast<int>(lost.size()), nacked, dropped_nacks);
+}
+
+//Packets/s through the forwarder for a 640x360 stream of three layers,
+//with 1 to 32 receivers spread over the layers.
+- (void)testBenchmarkPacketsPerSecond {
+    static const int kWidth = 640;
+    static const int kHeight = 360;
+    LayeredSource source(kWidth, kHeight, 0);
+    XCTAssertTrue(source.Init(800));
+    std::vector<SourcePacket> packets;
+    for (int f = 0; f < 300; f++) {
+        source.EncodeFrame(&packets);
+    }
+    CountingSender sender;
+    VP8SelectiveForwarder probe(&sender);
+    for (size_t i = 0; i < packets.size(); i++) {
+        probe.IncomingPacket(&packets[i].data[0], packets[i].data.size(),
+                             Timestamp(packets[i].data) / 90);
+    }
+    uint32_t two_layer_bps = TwoLayerBitrate(probe.GetStatistics());
+
+    static const int kReceivers[] = { 1, 4, 16, 32 };
+    for (int n = 0; n < 4; n++) {
+        uint64_t forwarded = 0;
+        double best = 0;
+        for (int round = 0; round < 3; round++) {
+            double rate = ForwardRate(packets, two_layer_bps, kReceivers[n],
+                                      &forwarded);
+            if (rate > best) {
+                best = rate;
+            }
+        }
+        NSLog(@"vp8 forwarder, %d receivers: %.0f packets/s in, %.0f "
+              "forwarded/s, %.1f forwarded per packet",
+              kReceivers[n], best,
+              best * forwarded / packets.size(),
+              static_cast<double>(forwarded) / packets.size());
+    }
+
+    std::vector<SourcePacket>* p = &packets;
+    [self measureBlock:^{
+        uint64_t forwarded;
+        ForwardRate(*p, two_layer_bps, 16, &forwarded);
+    }];
+}
+
+@end
@@ -0,0 +1,360 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#import <XCTest/XCTest.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "libyuv/rotate.h"
+#include "libyuv/scale.h"
+#include "BenchmarkUtil.h"
+#include "VideoFrameOps.h"
+
+namespace {
+
+typedef std::vector<uint8_t> Plane;
+
+void Fill(Plane* plane, uint32_t* seed) {
+    for (size_t i = 0; i < plane->size(); i++) {
+        *seed = *seed * 1103515245 + 12345;
+        (*plane)[i] = static_cast<uint8_t>(*seed >> 16);
+    }
+}
+
+//The reference scaler, written out per pixel after libyuv's ScalePlane
+//with kFilterBox.
+int Blend(int a, int b, int f) {
+    return (a * (256 - f) + b * f + 128) >> 8;
+}
+
+void RefSlope(int src_size, int dst_size, int* start, int* delta) {
+    if (dst_size <= src_size) {
+        *delta = static_cast<int>((static_cast<int64_t>(src_size) << 16) /
+                                  dst_size);
+        *start = (*delta >> 1) - 32768;
+    } else {
+        *delta = static_cast<int>(((static_cast<int64_t>(src_size) << 16) -
+                                   0x00010001) / (dst_size - 1));
+        *start = 0;
+    }
+}
+
+void RefCols(const uint8_t* src, int src_width, uint8_t* dst, int dst_width,
+             int x, int dx) {
+    for (int j = 0; j < dst_width; j++, x += dx) {
+        int xi = x >> 16;
+        int a = src[xi];
+        int b = xi < src_width - 1 ? src[xi + 1] : a;
+        dst[j] = static_cast<uint8_t>(a + ((((x >> 9) & 0x7F) * (b - a)) >> 7));
+    }
+}
+
+void RefBox(const uint8_t* src, int src_width, int src_height, uint8_t* dst,
+            int dst_width, int dst_height) {
+    int dx = static_cast<int>((static_cast<int64_t>(src_width) << 16) /
+                              dst_width);
+    int dy = static_cast<int>((static_cast<int64_t>(src_height) << 16) /
+                              dst_height);
+    for (int j = 0; j < dst_height; j++) {
+        int y0 = static_cast<int>((static_cast<int64_t>(j) * dy) >> 16);
+        int y1 = static_cast<int>((static_cast<int64_t>(j + 1) * dy) >> 16);
+        y1 = std::max(y0 + 1, std::min(y1, src_height));
+        for (int i = 0; i < dst_width; i++) {
+            int x0 = static_cast<int>((static_cast<int64_t>(i) * dx) >> 16);
+            int x1 = std::min(static_cast<int>(
+                (static_cast<int64_t>(i + 1) * dx) >> 16), src_width);
+            int64_t sum = 0;
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    sum += src[y * src_width + x];
+                }
+            }
+            int64_t area = static_cast<int64_t>(x1 - x0) * (y1 - y0);
+            int64_t scale = 65536 / area;
+            dst[j * dst_width + i] = static_cast<uint8_t>(
+                scale ? (sum * scale) >> 16 : sum / area);
+        }
+    }
+}
+
+void RefScale(const uint8_t* src, int src_width, int src_height,
+              uint8_t* dst, int dst_width, int dst_height) {
+    if (dst_width == src_width && dst_height == src_height) {
+        memcpy(dst, src, src_width * src_height);
+        return;
+    }
+    if (dst_width * 2 == src_width && dst_height * 2 == src_height) {
+        for (int y = 0; y < dst_height; y++) {
+            for (int x = 0; x < dst_width; x++) {
+                const uint8_t* s = src + 2 * y * src_width + 2 * x;
+                dst[y * dst_width + x] = static_cast<uint8_t>(
+                    (s[0] + s[1] + s[src_width] + s[src_width + 1] + 2) >> 2);
+            }
+        }
+        return;
+    }
+    if (dst_width * 4 == src_width && dst_height * 4 == src_height) {
+        for (int y = 0; y < dst_height; y++) {
+            for (int x = 0; x < dst_width; x++) {
+                int sum = 0;
+                for (int i = 0; i < 16; i++) {
+                    sum += src[(4 * y + i / 4) * src_width + 4 * x + i % 4];
+                }
+                dst[y * dst_width + x] = static_cast<uint8_t>((sum + 8) >> 4);
+            }
+        }
+        return;
+    }
+    if (dst_height * 2 < src_height && dst_width < src_width) {
+        RefBox(src, src_width, src_height, dst, dst_width, dst_height);
+        return;
+    }
+    int x0, dx, y0, dy;
+    RefSlope(src_width, dst_width, &x0, &dx);
+    RefSlope(src_height, dst_height, &y0, &dy);
+    Plane a(std::max(src_width, dst_width));
+    Plane b(std::max(src_width, dst_width));
+    for (int j = 0; j < dst_height; j++) {
+        int y = std::min(y0 + j * dy, (src_height - 1) << 16);
+        int yi = y >> 16;
+        int f = (y >> 8) & 0xFF;
+        const uint8_t* s = src + yi * src_width;
+        uint8_t* d = dst + j * dst_width;
+        if (dst_height > src_height) {
+            //Horizontal first, as ScalePlaneBilinearUp.
+            RefCols(s, src_width, &a[0], dst_width, x0, dx);
+            if (f != 0) {
+                RefCols(s + src_width, src_width, &b[0], dst_width, x0, dx);
+            }
+            for (int i = 0; i < dst_width; i++) {
+                d[i] = static_cast<uint8_t>(f != 0 ? Blend(a[i], b[i], f) : a[i]);
+            }
+        } else {
+            for (int i = 0; i < src_width; i++) {
+                a[i] = static_cast<uint8_t>(
+                    f != 0 ? Blend(s[i], s[i + src_width], f) : s[i]);
+            }
+            RefCols(&a[0], src_width, d, dst_width, x0, dx);
+        }
+    }
+}
+
+//Clockwise, |width| x |height| of the source.
+void RefRotate(const uint8_t* src, int width, int height, uint8_t* dst) {
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            dst[x * height + height - 1 - y] = src[y * width + x];
+        }
+    }
+}
+
+//|dst_width| and |dst_height| after the rotation.
+void RefScaleRotate(const Plane& src, int src_width, int src_height,
+                    Plane* dst, int dst_width, int dst_height, bool rotate) {
+    dst->resize(dst_width * dst_height);
+    if (!rotate) {
+        RefScale(&src[0], src_width, src_height, &(*dst)[0],
+                 dst_width, dst_height);
+        return;
+    }
+    Plane scaled(dst_width * dst_height);
+    RefScale(&src[0], src_width, src_height, &scaled[0], dst_height, dst_width);
+    RefRotate(&scaled[0], dst_height, dst_width, &(*dst)[0]);
+}
+
+}  // namespace
+
+@interface VideoFrameOpsTests : XCTestCase
+@end
+
+@implementation VideoFrameOpsTests
+
+- (void)testRotatePlane90 {
+    static const int kSizes[][2] = { { 1, 1 }, { 7, 3 }, { 16, 8 },
+                                     { 33, 17 }, { 640, 360 } };
+    uint32_t seed = 1;
+    for (int k = 0; k < 5; k++) {
+        int width = kSizes[k][0];
+        int height = kSizes[k][1];
+        Plane src(width * height);
+        Fill(&src, &seed);
+        Plane expected(width * height);
+        RefRotate(&src[0], width, height, &expected[0]);
+        //A stride wider than the picture.
+        int dst_stride = height + 5;
+        Plane dst(dst_stride * width, 0xEE);
+        VideoFrameOps::RotatePlane90(&src[0], width, &dst[0], dst_stride,
+                                     width, height);
+        for (int y = 0; y < width; y++) {
+            XCTAssertEqual(memcmp(&dst[y * dst_stride],
+                                  &expected[y * height], height), 0,
+                           @"%dx%d row %d", width, height, y);
+            XCTAssertEqual(dst[y * dst_stride + height], 0xEE);
+        }
+    }
+}
+
+//I420, NV12 and NV21 input, turned and not, for every filter.
+- (void)testScaleRotateMatchesReference {
+    static const int kSizes[][4] = {
+        { 64, 48, 64, 48 }, { 64, 48, 32, 24 }, { 64, 48, 16, 12 },
+        { 65, 49, 33, 25 }, { 64, 48, 48, 36 }, { 64, 48, 24, 18 },
+        { 37, 29, 11, 7 }, { 101, 77, 40, 30 }, { 64, 48, 64, 20 },
+        { 64, 48, 100, 20 }, { 64, 48, 20, 40 }, { 64, 48, 80, 60 },
+        { 33, 17, 70, 41 }, { 17, 9, 3, 2 }, { 8, 8, 1, 1 },
+        { 1280, 720, 320, 240 }, { 1280, 720, 240, 320 },
+    };
+    uint32_t seed = 1;
+    for (size_t k = 0; k < sizeof(kSizes) / sizeof(kSizes[0]); k++) {
+        for (int rotation = 0; rotation <= 90; rotation += 90) {
+            int width = kSizes[k][0];
+            int height = kSizes[k][1];
+            int dst_width = kSizes[k][2];
+            int dst_height = kSizes[k][3];
+            int chroma_width = (width + 1) / 2;
+            int chroma_height = (height + 1) / 2;
+            int dst_chroma_width = (dst_width + 1) / 2;
+            int dst_chroma_height = (dst_height + 1) / 2;
+            Plane y(width * height);
+            Plane u(chroma_width * chroma_height);
+            Plane v(chroma_width * chroma_height);
+            Fill(&y, &seed);
+            Fill(&u, &seed);
+            Fill(&v, &seed);
+            Plane uv(2 * u.size());
+            for (size_t i = 0; i < u.size(); i++) {
+                uv[2 * i] = u[i];
+                uv[2 * i + 1] = v[i];
+            }
+            Plane expected_y;
+            Plane expected_u;
+            Plane expected_v;
+            RefScaleRotate(y, width, height, &expected_y, dst_width,
+                           dst_height, rotation == 90);
+            RefScaleRotate(u, chroma_width, chroma_height, &expected_u,
+                           dst_chroma_width, dst_chroma_height, rotation == 90);
+            RefScaleRotate(v, chroma_width, chroma_height, &expected_v,
+                           dst_chroma_width, dst_chroma_height, rotation == 90);
+
+            //I420, NV12, and NV21 read from the same plane with U and V
+            //trading places.
+            for (int format = 0; format < 3; format++) {
+                Plane dst_y(dst_width * dst_height, 0xEE);
+                Plane dst_u(dst_chroma_width * dst_chroma_height, 0xEE);
+                Plane dst_v(dst_chroma_width * dst_chroma_height, 0xEE);
+                bool ok;
+                if (format == 0) {
+                    ok = VideoFrameOps::ScaleRotateToI420(
+                        &y[0], width, &u[0], chroma_width, &v[0], chroma_width,
+                        1, width, height, &dst_y[0], dst_width,
+                        &dst_u[0], dst_chroma_width, &dst_v[0], dst_chroma_width,
+                        dst_width, dst_height, rotation);
+                } else {
+                    bool nv21 = format == 2;
+                    ok = VideoFrameOps::ScaleRotateToI420(
+                        &y[0], width, &uv[nv21 ? 1 : 0], 2 * chroma_width,
+                        &uv[nv21 ? 0 : 1], 2 * chroma_width, 2, width, height,
+                        &dst_y[0], dst_width,
+                        nv21 ? &dst_v[0] : &dst_u[0], dst_chroma_width,
+                        nv21 ? &dst_u[0] : &dst_v[0], dst_chroma_width,
+                        dst_width, dst_height, rotation);
+                }
+                XCTAssertTrue(ok);
+                XCTAssertTrue(dst_y == expected_y, @"%dx%d to %dx%d, %d "
+                              "degrees, format %d", width, height, dst_width,
+                              dst_height, rotation, format);
+                XCTAssertTrue(dst_u == expected_u);
+                XCTAssertTrue(dst_v == expected_v);
+            }
+        }
+    }
+}
+
+- (void)testRejectsUnsupportedInput {
+    Plane src(64 * 48 * 3 / 2);
+    Plane dst(64 * 48 * 3 / 2);
+    uint8_t* d = &dst[0];
+    XCTAssertFalse(VideoFrameOps::ScaleRotateToI420(
+        &src[0], 64, &src[3072], 32, &src[3840], 32, 1, 64, 48,
+        d, 48, d + 3072, 24, d + 3840, 24, 48, 64, 180));
+    //Pixel stride 2 with U and V in different planes.
+    XCTAssertFalse(VideoFrameOps::ScaleRotateToI420(
+        &src[0], 64, &src[3072], 64, &src[3072 + 8], 64, 2, 64, 48,
+        d, 32, d + 3072, 16, d + 3840, 16, 32, 24, 0));
+}
+
+//The kernels against libyuv, per plane at 360p, 720p and 1080p: a 90
+//degree rotation, and scaling by 1/2, 3/4 and 1/3 as the simulcast
+//pyramid, the scheduler's eighths and the capture stage do.
+- (void)testBenchmarkAgainstLibyuv {
+    static const int kSizes[][2] = { { 640, 360 }, { 1280, 720 },
+                                     { 1920, 1080 } };
+    static const int kScales[][2] = { { 1, 2 }, { 3, 4 }, { 1, 3 } };
+    uint32_t seed = 1;
+    for (int s = 0; s < 3; s++) {
+        int width = kSizes[s][0];
+        int height = kSizes[s][1];
+        Plane src(width * height);
+        Fill(&src, &seed);
+        Plane dst(width * height);
+        const uint8_t* sp = &src[0];
+        uint8_t* dp = &dst[0];
+
+        double ops_ns = MeasureNsPerCall(3, 20, ^{
+            VideoFrameOps::RotatePlane90(sp, width, dp, height, width, height);
+        });
+        double libyuv_ns = MeasureNsPerCall(3, 20, ^{
+            libyuv::RotatePlane90(sp, width, dp, height, width, height);
+        });
+        NSLog(@"rotate %dx%d: VideoFrameOps %.0f ns, libyuv %.0f ns",
+              width, height, ops_ns, libyuv_ns);
+
+        //An I420 frame, the chroma planes after the luma plane.
+        Plane frame(width * height * 3 / 2);
+        Fill(&frame, &seed);
+        const uint8_t* fy = &frame[0];
+        const uint8_t* fu = fy + width * height;
+        const uint8_t* fv = fu + width * height / 4;
+        for (int k = 0; k < 3; k++) {
+            int dst_width = width * kScales[k][0] / kScales[k][1];
+            int dst_height = height * kScales[k][0] / kScales[k][1];
+            uint8_t* du = dp + dst_width * dst_height;
+            uint8_t* dv = du + dst_width * dst_height / 4;
+            ops_ns = MeasureNsPerCall(3, 20, ^{
+                VideoFrameOps::ScaleRotateToI420(
+                    fy, width, fu, width / 2, fv, width / 2, 1,
+                    width, height, dp, dst_width, du, dst_width / 2,
+                    dv, dst_width / 2, dst_width, dst_height, 0);
+            });
+            libyuv_ns = MeasureNsPerCall(3, 20, ^{
+                libyuv::I420Scale(fy, width, fu, width / 2, fv, width / 2,
+                                  width, height, dp, dst_width,
+                                  du, dst_width / 2, dv, dst_width / 2,
+                                  dst_width, dst_height, libyuv::kFilterBox);
+            });
+            NSLog(@"scale I420 %dx%d to %dx%d: VideoFrameOps %.0f ns, libyuv "
+                  "kFilterBox %.0f ns", width, height, dst_width, dst_height,
+                  ops_ns, libyuv_ns);
+        }
+    }
+
+    Plane src(1280 * 720);
+    Fill(&src, &seed);
+    Plane dst(1280 * 720);
+    const uint8_t* sp = &src[0];
+    uint8_t* dp = &dst[0];
+    [self measureBlock:^{
+        for (int i = 0; i < 30; i++) {
+            VideoFrameOps::RotatePlane90(sp, 1280, dp, 720, 1280, 720);
+        }
+    }];
+}
+
+@end
@@ -0,0 +1,447 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#import <XCTest/XCTest.h>
+
+#include <string.h>
+#include <map>
+#include <vector>
+#include "BenchmarkUtil.h"
+#include "LossGenerator.h"
+#include "VideoJitterBuffer.h"
+
+namespace {
+
+enum { kFrameBufferSize = 64 * VideoJitterBuffer::kMaxPayloadSize };
+
+//Every payload starts with the frame number and the packet's index in the
+//frame, so an extracted frame shows packets of the wrong frame or order.
+struct SentPacket {
+    int frame;
+    int index;
+    uint32_t timestamp;
+    bool first_packet;
+    bool marker_bit;
+    bool key_frame;
+    size_t length;
+};
+
+void FillPayload(const SentPacket& sent, uint16_t sequence_number,
+                 uint8_t* payload) {
+    memset(payload, sequence_number & 0xff, sent.length);
+    payload[0] = static_cast<uint8_t>(sent.frame >> 8);
+    payload[1] = static_cast<uint8_t>(sent.frame);
+    payload[2] = static_cast<uint8_t>(sent.index);
+}
+
+JitterInsertResult Insert(VideoJitterBuffer* buffer, uint16_t sequence_number,
+                          const SentPacket& sent, int64_t now_ms) {
+    uint8_t payload[VideoJitterBuffer::kMaxPayloadSize + 1];
+    FillPayload(sent, sequence_number, payload);
+    JitterPacket packet;
+    packet.sequence_number = sequence_number;
+    packet.timestamp = sent.timestamp;
+    packet.first_packet = sent.first_packet;
+    packet.marker_bit = sent.marker_bit;
+    packet.key_frame = sent.key_frame;
+    packet.payload = payload;
+    packet.payload_length = sent.length;
+    return buffer->InsertPacket(packet, now_ms);
+}
+
+//Packet |index| of |count| of frame |frame|.
+SentPacket MakeSent(int frame, int index, int count, bool key_frame,
+                    size_t length) {
+    SentPacket sent;
+    sent.frame = frame;
+    sent.index = index;
+    sent.timestamp = 0xffff0000u + frame * 3000;
+    sent.first_packet = index == 0;
+    sent.marker_bit = index == count - 1;
+    sent.key_frame = key_frame;
+    sent.length = length;
+    return sent;
+}
+
+//Whether |data| is frame |frame| of |count| packets in order.
+bool IsFrame(const uint8_t* data, int length, int frame, int count,
+             size_t packet_length) {
+    if (length != static_cast<int>(count * packet_length)) {
+        return false;
+    }
+    for (int i = 0; i < count; i++) {
+        const uint8_t* payload = data + i * packet_length;
+        if ((payload[0] << 8 | payload[1]) != frame || payload[2] != i) {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct ReplayResult {
+    int frames_sent;
+    int frames_extracted;
+    int frames_corrupt;
+    int key_frame_requests;
+    int retransmissions;
+    JitterBufferStatistics stats;
+};
+
+struct Arrival {
+    int64_t time_ms;
+    uint16_t sequence_number;
+    SentPacket sent;
+};
+
+//30fps video over a path of 20ms one way delay that loses |loss_rate| of
+//the packets and of their retransmissions. The receiver sends NACKs every
+//10ms, again for a sequence number after 100ms, and extracts every frame
+//as soon as it is decodable. Key frames are 40 packets, delta frames 1 to
+//5, sequence numbers and timestamps wrap on the way. The packets in the
+//order they were inserted go to |arrivals| when it is not NULL.
+ReplayResult ReplayLossyTrace(float loss_rate, int frames,
+                              std::vector<Arrival>* arrivals) {
+    VideoJitterBuffer buffer;
+    LossGenerator loss(17);
+    std::vector<SentPacket> sent(65536);
+    std::vector<int64_t> last_nack_ms(65536, -1000);
+    std::multimap<int64_t, uint16_t> network;
+    std::vector<uint8_t> frame_data(kFrameBufferSize);
+    uint16_t sequence_number = 65000;
+    uint32_t seed = 1;
+    bool key_frame_requested = false;
+    ReplayResult result;
+    memset(&result, 0, sizeof(result));
+
+    int64_t end_ms = frames * 33 + 1000;
+    for (int64_t now_ms = 0; now_ms < end_ms; now_ms++) {
+        if (now_ms % 33 == 0 && result.frames_sent < frames) {
+            int frame = result.frames_sent++;
+            bool key_frame = frame == 0 || key_frame_requested;
+            key_frame_requested = false;
+            seed = seed * 1103515245 + 12345;
+            int count = key_frame ? 40 : 1 + (seed >> 16) % 5;
+            for (int i = 0; i < count; i++) {
+                seed = seed * 1103515245 + 12345;
+                size_t length = 200 + (seed >> 16) % 1000;
+                sent[sequence_number] =
+                    MakeSent(frame, i, count, key_frame, length);
+                if (!loss.Lost(loss_rate)) {
+                    network.insert(std::make_pair(now_ms + 20,
+                                                  sequence_number));
+                }
+                sequence_number++;
+            }
+        }
+
+        while (!network.empty() && network.begin()->first <= now_ms) {
+            uint16_t arrived = network.begin()->second;
+            network.erase(network.begin());
+            Insert(&buffer, arrived, sent[arrived], now_ms);
+            if (arrivals) {
+                Arrival arrival = { now_ms, arrived, sent[arrived] };
+                arrivals->push_back(arrival);
+            }
+        }
+
+        if (now_ms % 10 == 0) {
+            uint16_t nacks[VideoJitterBuffer::kMaxPackets];
+            int count = buffer.GetNackList(nacks,
+                                           VideoJitterBuffer::kMaxPackets);
+            for (int i = 0; i < count; i++) {
+                if (now_ms - last_nack_ms[nacks[i]] < 100) {
+                    continue;
+                }
+                last_nack_ms[nacks[i]] = now_ms;
+                result.retransmissions++;
+                //The NACK's way there and the packet's way back.
+                if (!loss.Lost(loss_rate)) {
+                    network.insert(std::make_pair(now_ms + 40, nacks[i]));
+                }
+            }
+        }
+
+        JitterFrameInfo info;
+        int length;
+        while ((length = buffer.ExtractFrame(&frame_data[0],
+                                             frame_data.size(), &info,
+                                             now_ms)) >= 0) {
+            result.frames_extracted++;
+            const SentPacket& first = sent[info.first_sequence_number];
+            int count = static_cast<uint16_t>(info.last_sequence_number -
+                                              info.first_sequence_number) + 1;
+            size_t expected = 0;
+            bool same_frame = true;
+            for (int i = 0; i < count; i++) {
+                const SentPacket& packet =
+                    sent[static_cast<uint16_t>(info.first_sequence_number + i)];
+                expected += packet.length;
+                same_frame &= packet.frame == first.frame && packet.index == i;
+            }
+            const uint8_t* payload = &frame_data[0];
+            for (int i = 0; same_frame && i < count; i++) {
+                const SentPacket& packet =
+                    sent[static_cast<uint16_t>(info.first_sequence_number + i)];
+                same_frame = (payload[0] << 8 | payload[1]) == first.frame &&
+                             payload[2] == i;
+                payload += packet.length;
+            }
+            if (!same_frame || length != static_cast<int>(expected) ||
+                info.timestamp != first.timestamp) {
+                result.frames_corrupt++;
+            }
+        }
+        if (buffer.TakeKeyFrameRequest()) {
+            key_frame_requested = true;
+            result.key_frame_requests++;
+        }
+    }
+    result.stats = buffer.GetStatistics();
+    return result;
+}
+
+//Inserts |arrivals| into |buffer| from a flush on, extracting after every
+//packet. Returns the frames extracted.
+int ReplayArrivals(VideoJitterBuffer* buffer, const Arrival* arrivals,
+                   int count, uint8_t* frame_data) {
+    static uint8_t payload[VideoJitterBuffer::kMaxPayloadSize];
+    buffer->Flush();
+    int frames = 0;
+    for (int i = 0; i < count; i++) {
+        const SentPacket& sent = arrivals[i].sent;
+        JitterPacket packet;
+        packet.sequence_number = arrivals[i].sequence_number;
+        packet.timestamp = sent.timestamp;
+        packet.first_packet = sent.first_packet;
+        packet.marker_bit = sent.marker_bit;
+        packet.key_frame = sent.key_frame;
+        packet.payload = payload;
+        packet.payload_length = sent.length;
+        buffer->InsertPacket(packet, arrivals[i].time_ms);
+        JitterFrameInfo info;
+        while (buffer->ExtractFrame(frame_data, kFrameBufferSize, &info,
+                                    arrivals[i].time_ms) >= 0) {
+            frames++;
+        }
+    }
+    return frames;
+}
+
+}  // namespace
+
+@interface VideoJitterBufferTests : XCTestCase
+@end
+
+@implementation VideoJitterBufferTests
+
+- (void)testAssemblesFrameFromReorderedPackets {
+    VideoJitterBuffer buffer;
+    static const int kOrder[] = { 2, 0, 3, 1 };
+    for (int i = 0; i < 4; i++) {
+        JitterInsertResult result =
+            Insert(&buffer, static_cast<uint16_t>(65534 + kOrder[i]),
+                   MakeSent(0, kOrder[i], 4, true, 500), i);
+        XCTAssertEqual(result, i < 3 ? kJitterIncompleteFrame
+                                     : kJitterCompleteFrame);
+    }
+    JitterFrameInfo info;
+    XCTAssertTrue(buffer.NextCompleteFrame(&info));
+    XCTAssertEqual(info.length, 2000u);
+
+    uint8_t data[kFrameBufferSize];
+    XCTAssertEqual(buffer.ExtractFrame(data, 1999, &info, 10), -1);
+    int length = buffer.ExtractFrame(data, sizeof(data), &info, 10);
+    XCTAssertTrue(IsFrame(data, length, 0, 4, 500));
+    XCTAssertTrue(info.key_frame);
+    XCTAssertEqual(info.first_sequence_number, 65534);
+    XCTAssertEqual(info.last_sequence_number, 1);
+    XCTAssertEqual(info.first_packet_time_ms, 0);
+    XCTAssertEqual(info.complete_time_ms, 3);
+    XCTAssertFalse(buffer.NextCompleteFrame(&info));
+}
+
+- (void)testRejectsDuplicateAndOldPackets {
+    VideoJitterBuffer buffer;
+    XCTAssertEqual(Insert(&buffer, 10, MakeSent(0, 0, 2, true, 100), 0),
+                   kJitterIncompleteFrame);
+    XCTAssertEqual(Insert(&buffer, 10, MakeSent(0, 0, 2, true, 100), 0),
+                   kJitterDuplicatePacket);
+    XCTAssertEqual(Insert(&buffer, 11, MakeSent(0, 1, 2, true, 100), 0),
+                   kJitterCompleteFrame);
+    uint8_t data[kFrameBufferSize];
+    JitterFrameInfo info;
+    XCTAssertEqual(buffer.ExtractFrame(data, sizeof(data), &info, 0), 200);
+    XCTAssertEqual(Insert(&buffer, 11, MakeSent(0, 1, 2, true, 100), 0),
+                   kJitterOldPacket);
+    XCTAssertEqual(Insert(&buffer, 12, MakeSent(1, 0, 1, false,
+                                                VideoJitterBuffer::
+                                                    kMaxPayloadSize + 1), 0),
+                   kJitterPacketError);
+
+    JitterBufferStatistics stats = buffer.GetStatistics();
+    XCTAssertEqual(stats.packets, 4u);
+    XCTAssertEqual(stats.duplicate_packets, 1u);
+    XCTAssertEqual(stats.old_packets, 1u);
+    XCTAssertEqual(stats.frames_extracted, 1u);
+}
+
+- (void)testNackListAcrossWrap {
+    VideoJitterBuffer buffer;
+    XCTAssertEqual(Insert(&buffer, 65530, MakeSent(0, 0, 1, true, 100), 0),
+                   kJitterCompleteFrame);
+    uint8_t data[kFrameBufferSize];
+    JitterFrameInfo info;
+    XCTAssertEqual(buffer.ExtractFrame(data, sizeof(data), &info, 0), 100);
+
+    //65531-65533 and 2-69 are lost, the list spans two words of the
+    //bitset on each side of the wrap.
+    for (int i = 0; i < 4; i++) {
+        Insert(&buffer, static_cast<uint16_t>(65534 + i),
+               MakeSent(1, 3 + i, 80, false, 100), 0);
+    }
+    Insert(&buffer, 70, MakeSent(1, 79, 80, false, 100), 0);
+    uint16_t nacks[VideoJitterBuffer::kMaxPackets];
+    int count = buffer.GetNackList(nacks, VideoJitterBuffer::kMaxPackets);
+    XCTAssertEqual(count, 3 + 68);
+    XCTAssertEqual(nacks[0], 65531);
+    XCTAssertEqual(nacks[2], 65533);
+    XCTAssertEqual(nacks[3], 2);
+    XCTAssertEqual(nacks[count - 1], 70 - 1);
+    XCTAssertEqual(buffer.GetNackList(nacks, 5), 5);
+    XCTAssertEqual(nacks[4], 3);
+}
+
+- (void)testKeyFrameSkipsUndecodableFrames {
+    VideoJitterBuffer buffer;
+    uint8_t data[kFrameBufferSize];
+    JitterFrameInfo info;
+    Insert(&buffer, 100, MakeSent(0, 0, 1, true, 100), 0);
+    XCTAssertEqual(buffer.ExtractFrame(data, sizeof(data), &info, 0), 100);
+
+    //Frame 1 loses its first packet, frame 2 is complete but depends on
+    //it, frame 3 is a key frame.
+    Insert(&buffer, 102, MakeSent(1, 1, 2, false, 100), 10);
+    Insert(&buffer, 103, MakeSent(2, 0, 1, false, 100), 20);
+    XCTAssertEqual(buffer.ExtractFrame(data, sizeof(data), &info, 20), -1);
+    Insert(&buffer, 104, MakeSent(3, 0, 2, true, 100), 30);
+    Insert(&buffer, 105, MakeSent(3, 1, 2, true, 100), 30);
+    int length = buffer.ExtractFrame(data, sizeof(data), &info, 30);
+    XCTAssertTrue(IsFrame(data, length, 3, 2, 100));
+    XCTAssertEqual(buffer.GetStatistics().frames_dropped, 2u);
+    //The late packet of the skipped frame is old now.
+    XCTAssertEqual(Insert(&buffer, 101, MakeSent(1, 0, 2, false, 100), 40),
+                   kJitterOldPacket);
+    uint16_t nacks[16];
+    XCTAssertEqual(buffer.GetNackList(nacks, 16), 0);
+}
+
+- (void)testRequestsKeyFrameWhenStalled {
+    VideoJitterBuffer buffer;
+    uint8_t data[kFrameBufferSize];
+    JitterFrameInfo info;
+    Insert(&buffer, 100, MakeSent(0, 0, 1, true, 100), 0);
+    buffer.ExtractFrame(data, sizeof(data), &info, 0);
+
+    //101 never comes, 102 is a complete frame waiting behind it.
+    Insert(&buffer, 102, MakeSent(2, 0, 1, false, 100), 100);
+    int64_t complete_ms = 100;
+    buffer.ExtractFrame(data, sizeof(data), &info,
+                        complete_ms + VideoJitterBuffer::kMaxNackWaitMs - 1);
+    XCTAssertFalse(buffer.TakeKeyFrameRequest());
+    buffer.ExtractFrame(data, sizeof(data), &info,
+                        complete_ms + VideoJitterBuffer::kMaxNackWaitMs);
+    XCTAssertTrue(buffer.TakeKeyFrameRequest());
+    XCTAssertFalse(buffer.TakeKeyFrameRequest());
+
+    //Requested again only after kMaxHoldMs without a key frame.
+    int64_t requested_ms = complete_ms + VideoJitterBuffer::kMaxNackWaitMs;
+    buffer.ExtractFrame(data, sizeof(data), &info,
+                        requested_ms + VideoJitterBuffer::kMaxHoldMs - 1);
+    XCTAssertFalse(buffer.TakeKeyFrameRequest());
+    buffer.ExtractFrame(data, sizeof(data), &info,
+                        requested_ms + VideoJitterBuffer::kMaxHoldMs);
+    XCTAssertTrue(buffer.TakeKeyFrameRequest());
+}
+
+- (void)testFlushesWhenRingOverflows {
+    VideoJitterBuffer buffer;
+    uint8_t data[kFrameBufferSize];
+    JitterFrameInfo info;
+    Insert(&buffer, 100, MakeSent(0, 0, 1, true, 100), 0);
+    buffer.ExtractFrame(data, sizeof(data), &info, 0);
+    Insert(&buffer, 102, MakeSent(1, 1, 2, false, 100), 10);
+
+    //A packet kMaxPackets ahead of the last extracted frame.
+    XCTAssertEqual(Insert(&buffer, 100 + VideoJitterBuffer::kMaxPackets + 1,
+                          MakeSent(2, 0, 1, false, 100), 20),
+                   kJitterFlushed);
+    XCTAssertTrue(buffer.TakeKeyFrameRequest());
+    XCTAssertEqual(buffer.GetStatistics().flushes, 1u);
+    //After the flush the next key frame starts the stream again.
+    Insert(&buffer, 2000, MakeSent(3, 0, 1, true, 100), 30);
+    int length = buffer.ExtractFrame(data, sizeof(data), &info, 30);
+    XCTAssertTrue(IsFrame(data, length, 3, 1, 100));
+}
+
+- (void)testReplayLossyTrace {
+    static const float kLossRates[] = { 0, 0.02f, 0.05f, 0.1f };
+    for (int i = 0; i < 4; i++) {
+        ReplayResult result = ReplayLossyTrace(kLossRates[i], 3000, NULL);
+        NSLog(@"replay %.0f%% loss: %d of %d frames, %llu dropped, "
+              "%d key frame requests, %d NACKed",
+              kLossRates[i] * 100, result.frames_extracted,
+              result.frames_sent,
+              static_cast<unsigned long long>(result.stats.frames_dropped),
+              result.key_frame_requests, result.retransmissions);
+        XCTAssertEqual(result.frames_corrupt, 0);
+        XCTAssertEqual(result.stats.flushes, 0u);
+        if (kLossRates[i] == 0) {
+            XCTAssertEqual(result.frames_extracted, result.frames_sent);
+            XCTAssertEqual(result.key_frame_requests, 0);
+        } else {
+            //NACK repairs the rest within kMaxNackWaitMs. Only a lost
+            //first packet of the first key frame is not known to be
+            //missing, that waits for the key frame request.
+            XCTAssertGreaterThanOrEqual(result.frames_extracted,
+                                        result.frames_sent * 99 / 100);
+        }
+    }
+}
+
+//Inserting the recorded arrivals of the lossy traces and extracting the
+//frames as they complete, per packet.
+- (void)testBenchmarkReplay {
+    static const float kLossRates[] = { 0, 0.02f, 0.05f, 0.1f };
+    VideoJitterBuffer buffer;
+    VideoJitterBuffer* b = &buffer;
+    std::vector<uint8_t> frame_data(kFrameBufferSize);
+    uint8_t* f = &frame_data[0];
+    for (int i = 0; i < 4; i++) {
+        std::vector<Arrival> arrivals;
+        ReplayLossyTrace(kLossRates[i], 3000, &arrivals);
+        const Arrival* a = &arrivals[0];
+        int count = static_cast<int>(arrivals.size());
+        double ns = MeasureNsPerCall(5, 1, ^{
+            ReplayArrivals(b, a, count, f);
+        }) / count;
+        NSLog(@"replay %.0f%% loss, %d packets: %.0f ns per packet",
+              kLossRates[i] * 100, count, ns);
+    }
+
+    std::vector<Arrival> arrivals;
+    ReplayLossyTrace(0.05f, 3000, &arrivals);
+    const Arrival* a = &arrivals[0];
+    int count = static_cast<int>(arrivals.size());
+    [self measureBlock:^{
+        for (int i = 0; i < 10; i++) {
+            ReplayArrivals(b, a, count, f);
+        }
+    }];
+}
+
+@end
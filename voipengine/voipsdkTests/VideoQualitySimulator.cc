@@ -0,0 +1,485 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include "VideoQualitySimulator.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <dispatch/dispatch.h>
+#include "chromium/src/third_party/libvpx/source/libvpx/vpx/vpx_decoder.h"
+#include "chromium/src/third_party/libvpx/source/libvpx/vpx/vp8dx.h"
+#include "libyuv/compare.h"
+#include "libyuv/scale.h"
+#include "webrtc/system_wrappers/interface/tick_util.h"
+#include "I420BufferPool.h"
+#include "LossGenerator.h"
+#include "VideoJitterBuffer.h"
+#include "VP8PartitionEncoder.h"
+
+//Same as webrtc::kPerfectPSNR.
+static const double kPerfectPsnr = 48.0;
+static const int kMaxNacks = 256;
+
+namespace {
+
+struct SentPacket {
+    uint16_t sequence_number;
+    uint32_t timestamp;
+    bool first_packet;
+    bool marker_bit;
+    bool key_frame;
+    int retransmissions;
+    size_t length;
+    uint8_t payload[VideoJitterBuffer::kMaxPayloadSize];
+};
+
+//Numbers the packets and keeps them for retransmission, indexed like the
+//jitter buffer's ring.
+class PacketHistory : public VP8PartitionEncoder::PacketSink {
+public:
+    PacketHistory()
+    : packets_(VideoJitterBuffer::kMaxPackets),
+      next_sequence_number_(0),
+      frame_packets_(0) {
+    }
+
+    //The receiver gets the partition data without the payload descriptor.
+    virtual void OnVP8Packet(const VP8Packet& packet) {
+        size_t header = VP8PartitionEncoder::kPayloadDescriptorSize;
+        if (packet.payload_length <= header ||
+            packet.payload_length - header > VideoJitterBuffer::kMaxPayloadSize) {
+            return;
+        }
+        SentPacket& sent = packets_[next_sequence_number_ &
+                                    (VideoJitterBuffer::kMaxPackets - 1)];
+        sent.sequence_number = next_sequence_number_;
+        sent.timestamp = packet.timestamp;
+        //S bit of the first partition.
+        sent.first_packet = packet.partition == 0 &&
+                            (packet.payload[0] & 0x10) != 0;
+        sent.marker_bit = packet.marker_bit;
+        sent.key_frame = packet.key_frame;
+        sent.retransmissions = 0;
+        sent.length = packet.payload_length - header;
+        memcpy(sent.payload, packet.payload + header, sent.length);
+        next_sequence_number_++;
+        frame_packets_++;
+    }
+
+    //Packets of the last frame are the |frame_packets| before next().
+    void BeginFrame() { frame_packets_ = 0; }
+    int frame_packets() const { return frame_packets_; }
+    uint16_t next() const { return next_sequence_number_; }
+
+    //NULL once the slot was reused.
+    SentPacket* Find(uint16_t sequence_number) {
+        SentPacket& sent = packets_[sequence_number &
+                                    (VideoJitterBuffer::kMaxPackets - 1)];
+        return sent.sequence_number == sequence_number ? &sent : NULL;
+    }
+
+private:
+    std::vector<SentPacket> packets_;
+    uint16_t next_sequence_number_;
+    int frame_packets_;
+};
+
+struct FrameRecord {
+    uint32_t timestamp;
+    int64_t capture_time_ms;
+    int encode_time_us;
+};
+
+bool RecordBefore(const FrameRecord& record, uint32_t timestamp) {
+    return record.timestamp < timestamp;
+}
+
+struct RunAllContext {
+    const VideoQualityScenario* scenarios;
+    VideoQualityScenarioResult* results;
+};
+
+void RunScenario(void* context, size_t index) {
+    RunAllContext* all = static_cast<RunAllContext*>(context);
+    VideoQualitySimulator::Run(all->scenarios[index], &all->results[index]);
+}
+
+//Frame |index| of |clip| scaled into |dst|.
+void LoadClipFrame(const VideoClip& clip, int index, I420Buffer* dst) {
+    int chroma_width = (clip.width + 1) / 2;
+    int chroma_height = (clip.height + 1) / 2;
+    size_t y_size = static_cast<size_t>(clip.width) * clip.height;
+    size_t uv_size = static_cast<size_t>(chroma_width) * chroma_height;
+    const uint8_t* src = clip.data + (y_size + 2 * uv_size) * index;
+    const uint8_t* planes[] = {src, src + y_size, src + y_size + uv_size};
+    for (int i = 0; i < webrtc::kNumOfPlanes; i++) {
+        int src_width = i == 0 ? clip.width : chroma_width;
+        int src_height = i == 0 ? clip.height : chroma_height;
+        int dst_width = i == 0 ? dst->width() : (dst->width() + 1) / 2;
+        int dst_height = i == 0 ? dst->height() : (dst->height() + 1) / 2;
+        libyuv::ScalePlane(planes[i], src_width, src_width, src_height,
+                           dst->MutableData(I420Buffer::kPlanes[i]),
+                           dst->stride(I420Buffer::kPlanes[i]),
+                           dst_width, dst_height, libyuv::kFilterBox);
+    }
+}
+
+void CopyImage(const vpx_image_t& image, I420Buffer* dst) {
+    for (int i = 0; i < webrtc::kNumOfPlanes; i++) {
+        int width = i == 0 ? dst->width() : (dst->width() + 1) / 2;
+        int height = i == 0 ? dst->height() : (dst->height() + 1) / 2;
+        const uint8_t* src = image.planes[i];
+        uint8_t* out = dst->MutableData(I420Buffer::kPlanes[i]);
+        for (int y = 0; y < height; y++) {
+            memcpy(out, src, width);
+            src += image.stride[i];
+            out += dst->stride(I420Buffer::kPlanes[i]);
+        }
+    }
+}
+
+void Transmit(const SentPacket& sent, int64_t arrival_ms, float loss_rate,
+              LossGenerator* loss, VideoJitterBuffer* jitter,
+              VideoQualityScenarioResult* result) {
+    result->packets_sent++;
+    if (loss->Lost(loss_rate)) {
+        result->packets_lost++;
+        return;
+    }
+    JitterPacket packet;
+    packet.sequence_number = sent.sequence_number;
+    packet.timestamp = sent.timestamp;
+    packet.first_packet = sent.first_packet;
+    packet.marker_bit = sent.marker_bit;
+    packet.key_frame = sent.key_frame;
+    packet.payload = sent.payload;
+    packet.payload_length = sent.length;
+    jitter->InsertPacket(packet, arrival_ms);
+}
+
+int Percentile(const std::vector<int>& sorted, int percent) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = std::min(sorted.size() - 1, sorted.size() * percent / 100);
+    return sorted[index];
+}
+
+}  // namespace
+
+void VideoQualitySimulator::Run(const VideoQualityScenario& scenario,
+                                VideoQualityScenarioResult* result) {
+    memset(result, 0, sizeof(*result));
+    const VideoClip* clip = scenario.clip;
+    result->name = clip ? clip->name : NULL;
+    result->width = scenario.width;
+    result->height = scenario.height;
+    result->bitrate_kbps = scenario.bitrate_kbps;
+    result->loss_rate = scenario.loss_rate;
+    result->frames = scenario.frames;
+    if (clip == NULL || clip->data == NULL || clip->frames <= 0 ||
+        clip->width <= 0 || clip->height <= 0 || scenario.width <= 0 ||
+        scenario.height <= 0 || scenario.frames <= 0 ||
+        scenario.framerate <= 0 || scenario.bitrate_kbps <= 0) {
+        return;
+    }
+
+    I420BufferPool pool;
+    PacketHistory history;
+    VP8PartitionEncoder encoder(&history);
+    VP8EncoderSettings settings;
+    settings.width = scenario.width;
+    settings.height = scenario.height;
+    settings.start_bitrate_kbps = scenario.bitrate_kbps;
+    settings.max_framerate = scenario.framerate;
+    //One thread per scenario, RunAll spreads the scenarios over the cores.
+    settings.threads = 1;
+    settings.max_payload_size = VP8PartitionEncoder::kDefaultMaxPayloadSize;
+    if (!encoder.Init(settings)) {
+        return;
+    }
+    vpx_codec_ctx_t decoder;
+    vpx_codec_dec_cfg_t config;
+    config.threads = 1;
+    config.w = scenario.width;
+    config.h = scenario.height;
+    if (vpx_codec_dec_init(&decoder, vpx_codec_vp8_dx(), &config, 0)) {
+        encoder.Release();
+        return;
+    }
+
+    VideoJitterBuffer jitter;
+    LossGenerator loss(scenario.seed);
+    std::vector<uint8_t> encoded(static_cast<size_t>(VideoJitterBuffer::kMaxPackets) *
+                                 VideoJitterBuffer::kMaxPayloadSize);
+    std::vector<FrameRecord> records;
+    std::vector<int> latencies;
+    webrtc::scoped_refptr<I420Buffer> shown =
+        pool.CreateBuffer(scenario.width, scenario.height);
+    bool has_shown = false;
+    bool key_frame_request = false;
+    //Until the first frame is decoded NACK can't tell what is missing, and
+    //a lost retransmission of a key frame goes unnoticed, so like the
+    //receiver's key frame timeout, a stall longer than the retransmissions
+    //can take asks for a key frame.
+    int64_t key_frame_timeout_ms = scenario.rtt_ms * (kMaxRetransmissions + 1) +
+                                   1000 / scenario.framerate;
+    int64_t last_progress_ms = 0;
+    int64_t encode_time_us = 0;
+    int64_t decode_time_us = 0;
+    uint64_t bytes_sent = 0;
+    int scored = 0;
+    double psnr_sum = 0;
+    double ssim_sum = 0;
+    uint16_t nacks[kMaxNacks];
+
+    for (int i = 0; i < scenario.frames; i++) {
+        int64_t capture_time_ms = static_cast<int64_t>(i) * 1000 /
+                                  scenario.framerate;
+        webrtc::scoped_refptr<I420Buffer> frame =
+            pool.CreateBuffer(scenario.width, scenario.height);
+        LoadClipFrame(*clip, i % clip->frames, frame.get());
+
+        //Flush makes the encoder synchronous, nothing is replaced.
+        if (key_frame_request) {
+            result->key_frame_requests++;
+        }
+        history.BeginFrame();
+        int64_t start_us = webrtc::TickTime::MicrosecondTimestamp();
+        encoder.EncodeFrame(frame, capture_time_ms, i == 0 || key_frame_request);
+        encoder.Flush();
+        int encode_us = static_cast<int>(
+            webrtc::TickTime::MicrosecondTimestamp() - start_us);
+        encode_time_us += encode_us;
+        key_frame_request = false;
+
+        uint16_t first = static_cast<uint16_t>(history.next() -
+                                               history.frame_packets());
+        if (history.frame_packets() > 0) {
+            FrameRecord record;
+            record.timestamp = static_cast<uint32_t>(
+                capture_time_ms * VP8PartitionEncoder::kRtpClockRateKhz);
+            record.capture_time_ms = capture_time_ms;
+            record.encode_time_us = encode_us;
+            records.push_back(record);
+        }
+        for (int j = 0; j < history.frame_packets(); j++) {
+            SentPacket* sent = history.Find(static_cast<uint16_t>(first + j));
+            bytes_sent += sent->length;
+            Transmit(*sent, capture_time_ms + scenario.rtt_ms / 2,
+                     scenario.loss_rate, &loss, &jitter, result);
+        }
+
+        //One NACK round, answered a round trip after the first try.
+        int count = jitter.GetNackList(nacks, kMaxNacks);
+        for (int j = 0; j < count; j++) {
+            SentPacket* sent = history.Find(nacks[j]);
+            if (sent == NULL || sent->retransmissions > kMaxRetransmissions) {
+                continue;
+            }
+            if (sent->retransmissions == kMaxRetransmissions) {
+                //Given up, only a key frame can repair it.
+                sent->retransmissions++;
+                key_frame_request = true;
+                continue;
+            }
+            sent->retransmissions++;
+            result->packets_retransmitted++;
+            Transmit(*sent, capture_time_ms + scenario.rtt_ms * 3 / 2,
+                     scenario.loss_rate, &loss, &jitter, result);
+        }
+
+        bool decoded = false;
+        JitterFrameInfo info;
+        int length;
+        while ((length = jitter.ExtractFrame(&encoded[0], encoded.size(), &info,
+                                             capture_time_ms +
+                                             scenario.rtt_ms * 3 / 2)) >= 0) {
+            start_us = webrtc::TickTime::MicrosecondTimestamp();
+            if (vpx_codec_decode(&decoder, &encoded[0], length, NULL, 0)) {
+                result->decode_errors++;
+                key_frame_request = true;
+                continue;
+            }
+            vpx_codec_iter_t iter = NULL;
+            vpx_image_t* image = vpx_codec_get_frame(&decoder, &iter);
+            int decode_us = static_cast<int>(
+                webrtc::TickTime::MicrosecondTimestamp() - start_us);
+            decode_time_us += decode_us;
+            result->frames_decoded++;
+            if (image == NULL ||
+                static_cast<int>(image->d_w) != scenario.width ||
+                static_cast<int>(image->d_h) != scenario.height) {
+                continue;
+            }
+            CopyImage(*image, shown.get());
+            has_shown = true;
+            decoded = true;
+
+            std::vector<FrameRecord>::const_iterator it =
+                std::lower_bound(records.begin(), records.end(),
+                                 info.timestamp, RecordBefore);
+            if (it != records.end() && it->timestamp == info.timestamp) {
+                latencies.push_back(static_cast<int>(
+                    (info.complete_time_ms - it->capture_time_ms) * 1000 +
+                    it->encode_time_us + decode_us));
+            }
+        }
+        if (jitter.TakeKeyFrameRequest()) {
+            key_frame_request = true;
+        }
+        if (decoded) {
+            last_progress_ms = capture_time_ms;
+        } else if (capture_time_ms - last_progress_ms > key_frame_timeout_ms) {
+            key_frame_request = true;
+            last_progress_ms = capture_time_ms;
+        }
+
+        //The receiver shows the last decoded picture while frames are
+        //missing, as a renderer would.
+        if (!decoded) {
+            result->frames_frozen++;
+        }
+        if (!has_shown) {
+            continue;
+        }
+        const I420Buffer& a = *frame;
+        const I420Buffer& b = *shown;
+        double psnr = libyuv::I420Psnr(
+            a.data(webrtc::kYPlane), a.stride(webrtc::kYPlane),
+            a.data(webrtc::kUPlane), a.stride(webrtc::kUPlane),
+            a.data(webrtc::kVPlane), a.stride(webrtc::kVPlane),
+            b.data(webrtc::kYPlane), b.stride(webrtc::kYPlane),
+            b.data(webrtc::kUPlane), b.stride(webrtc::kUPlane),
+            b.data(webrtc::kVPlane), b.stride(webrtc::kVPlane),
+            scenario.width, scenario.height);
+        psnr = std::min(psnr, kPerfectPsnr);
+        double ssim = libyuv::I420Ssim(
+            a.data(webrtc::kYPlane), a.stride(webrtc::kYPlane),
+            a.data(webrtc::kUPlane), a.stride(webrtc::kUPlane),
+            a.data(webrtc::kVPlane), a.stride(webrtc::kVPlane),
+            b.data(webrtc::kYPlane), b.stride(webrtc::kYPlane),
+            b.data(webrtc::kUPlane), b.stride(webrtc::kUPlane),
+            b.data(webrtc::kVPlane), b.stride(webrtc::kVPlane),
+            scenario.width, scenario.height);
+        if (scored == 0 || psnr < result->psnr_min) {
+            result->psnr_min = psnr;
+        }
+        if (scored == 0 || ssim < result->ssim_min) {
+            result->ssim_min = ssim;
+        }
+        psnr_sum += psnr;
+        ssim_sum += ssim;
+        scored++;
+    }
+
+    VP8EncoderStatistics stats = encoder.GetStatistics();
+    encoder.Release();
+    vpx_codec_destroy(&decoder);
+
+    result->frames_encoded = stats.frames_encoded;
+    result->frames_dropped = stats.frames_dropped;
+    result->key_frames = stats.key_frames;
+    int64_t duration_ms = static_cast<int64_t>(scenario.frames) * 1000 /
+                          scenario.framerate;
+    if (duration_ms > 0) {
+        result->sent_bitrate_kbps = static_cast<int>(bytes_sent * 8 /
+                                                     duration_ms);
+    }
+    if (scored > 0) {
+        result->psnr_avg = psnr_sum / scored;
+        result->ssim_avg = ssim_sum / scored;
+    }
+    if (encode_time_us > 0) {
+        result->encode_fps = scenario.frames * 1000000.0 / encode_time_us;
+    }
+    if (decode_time_us > 0) {
+        result->decode_fps = result->frames_decoded * 1000000.0 /
+                             decode_time_us;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    result->latency_p50_us = Percentile(latencies, 50);
+    result->latency_p90_us = Percentile(latencies, 90);
+    result->latency_p99_us = Percentile(latencies, 99);
+    result->latency_max_us = latencies.empty() ? 0 : latencies.back();
+}
+
+void VideoQualitySimulator::RunAll(const VideoQualityScenario* scenarios,
+                                   int count,
+                                   VideoQualityScenarioResult* results) {
+    RunAllContext context;
+    context.scenarios = scenarios;
+    context.results = results;
+    dispatch_apply_f(count,
+                     dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+                     &context, RunScenario);
+}
+
+void VideoQualitySimulator::MakeMatrix(
+    const VideoQualityScenario& base, const VideoQualitySize* sizes,
+    int num_sizes, const int* bitrates_kbps, int num_bitrates,
+    const float* loss_rates, int num_loss_rates,
+    std::vector<VideoQualityScenario>* scenarios) {
+    for (int i = 0; i < num_sizes; i++) {
+        for (int j = 0; j < num_bitrates; j++) {
+            for (int k = 0; k < num_loss_rates; k++) {
+                VideoQualityScenario scenario = base;
+                scenario.width = sizes[i].width;
+                scenario.height = sizes[i].height;
+                scenario.bitrate_kbps = bitrates_kbps[j];
+                scenario.loss_rate = loss_rates[k];
+                scenarios->push_back(scenario);
+            }
+        }
+    }
+}
+
+int VideoQualitySimulator::FormatResult(
+    const VideoQualityScenarioResult& result, bool with_timing, char* buffer,
+    size_t capacity) {
+    char timing[192] = "";
+    if (with_timing) {
+        snprintf(timing, sizeof(timing),
+                 ",\"encode_fps\":%.1f,\"decode_fps\":%.1f,"
+                 "\"latency_p50_us\":%d,\"latency_p90_us\":%d,"
+                 "\"latency_p99_us\":%d,\"latency_max_us\":%d",
+                 result.encode_fps, result.decode_fps, result.latency_p50_us,
+                 result.latency_p90_us, result.latency_p99_us,
+                 result.latency_max_us);
+    }
+    return snprintf(buffer, capacity,
+                    "{\"name\":\"%s\",\"width\":%d,\"height\":%d,"
+                    "\"bitrate_kbps\":%d,\"loss_percent\":%.1f,"
+                    "\"frames\":%d,\"frames_encoded\":%llu,"
+                    "\"frames_dropped\":%llu,\"frames_decoded\":%llu,"
+                    "\"frames_frozen\":%llu,\"key_frames\":%llu,"
+                    "\"key_frame_requests\":%llu,\"decode_errors\":%llu,"
+                    "\"packets_sent\":%llu,\"packets_lost\":%llu,"
+                    "\"packets_retransmitted\":%llu,"
+                    "\"sent_bitrate_kbps\":%d,\"psnr_avg\":%.3f,"
+                    "\"psnr_min\":%.3f,\"ssim_avg\":%.5f,"
+                    "\"ssim_min\":%.5f%s}\n",
+                    result.name ? result.name : "", result.width,
+                    result.height, result.bitrate_kbps,
+                    result.loss_rate * 100.0, result.frames,
+                    static_cast<unsigned long long>(result.frames_encoded),
+                    static_cast<unsigned long long>(result.frames_dropped),
+                    static_cast<unsigned long long>(result.frames_decoded),
+                    static_cast<unsigned long long>(result.frames_frozen),
+                    static_cast<unsigned long long>(result.key_frames),
+                    static_cast<unsigned long long>(result.key_frame_requests),
+                    static_cast<unsigned long long>(result.decode_errors),
+                    static_cast<unsigned long long>(result.packets_sent),
+                    static_cast<unsigned long long>(result.packets_lost),
+                    static_cast<unsigned long long>(
+                        result.packets_retransmitted),
+                    result.sent_bitrate_kbps, result.psnr_avg,
+                    result.psnr_min, result.ssim_avg, result.ssim_min,
+                    timing);
+}
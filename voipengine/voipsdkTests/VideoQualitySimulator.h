@@ -0,0 +1,122 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#ifndef VOIP_VIDEO_QUALITY_SIMULATOR_H
+#define VOIP_VIDEO_QUALITY_SIMULATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+//Raw I420 frames back to back, e.g. a .yuv test sequence read into memory.
+struct VideoClip {
+    const char* name;
+    const uint8_t* data;
+    int width;
+    int height;
+    int frames;
+};
+
+struct VideoQualityScenario {
+    const VideoClip* clip;
+    //The clip is scaled to this size, even sizes keep the chroma exact.
+    int width;
+    int height;
+    //Frames sent, the clip loops when it is shorter.
+    int frames;
+    int framerate;
+    int bitrate_kbps;
+    //0 to 1, of every transmission including retransmissions.
+    float loss_rate;
+    int rtt_ms;
+    //Seeds the loss pattern, equal seeds give equal runs.
+    uint32_t seed;
+};
+
+struct VideoQualitySize {
+    int width;
+    int height;
+};
+
+struct VideoQualityScenarioResult {
+    const char* name;
+    int width;
+    int height;
+    int bitrate_kbps;
+    float loss_rate;
+    int frames;
+    uint64_t frames_encoded;
+    //Dropped by the encoder's rate control.
+    uint64_t frames_dropped;
+    uint64_t frames_decoded;
+    //Captured frames for which nothing new was shown.
+    uint64_t frames_frozen;
+    uint64_t key_frames;
+    uint64_t key_frame_requests;
+    uint64_t decode_errors;
+    uint64_t packets_sent;
+    uint64_t packets_lost;
+    uint64_t packets_retransmitted;
+    int sent_bitrate_kbps;
+    //Of the shown frame against each captured one, PSNR capped at 48 dB
+    //like webrtc::I420PSNR.
+    double psnr_avg;
+    double psnr_min;
+    double ssim_avg;
+    double ssim_min;
+    double encode_fps;
+    double decode_fps;
+    //Capture to decoded picture: the simulated network time until the
+    //frame completed plus the measured encode and decode time.
+    int latency_p50_us;
+    int latency_p90_us;
+    int latency_p99_us;
+    int latency_max_us;
+};
+
+//Runs clips through the send and receive video path and scores the result.
+//
+//webrtc's frame_analyzer only compares two .yuv files, and VideoProcessor
+//drives a VideoEncoder and VideoDecoder through a PacketManipulator that
+//drops packets from the encoded frame, with neither a jitter buffer nor
+//retransmissions, and both are test tools outside the library. Here each
+//frame goes through VP8PartitionEncoder, a link with random loss and one
+//NACK round per frame interval, VideoJitterBuffer and the libvpx decoder,
+//and the shown picture is scored against the captured one with libyuv's
+//PSNR and SSIM, as frame_analyzer does. The receiver asks for a key frame
+//when a packet stays lost after kMaxRetransmissions, when the jitter buffer
+//needs one or when nothing was decoded for longer than the retransmissions
+//can take.
+//
+//The encoder runs one thread at a fixed speed, so everything except the
+//timing fields is deterministic and can be diffed across builds.
+class VideoQualitySimulator {
+public:
+    enum { kMaxRetransmissions = 3 };
+
+    static void Run(const VideoQualityScenario& scenario,
+                    VideoQualityScenarioResult* result);
+    //Scenarios run in parallel, one per core.
+    static void RunAll(const VideoQualityScenario* scenarios, int count,
+                       VideoQualityScenarioResult* results);
+
+    //Every size, bitrate and loss rate combined with |base|, sizes vary
+    //slowest.
+    static void MakeMatrix(const VideoQualityScenario& base,
+                           const VideoQualitySize* sizes, int num_sizes,
+                           const int* bitrates_kbps, int num_bitrates,
+                           const float* loss_rates, int num_loss_rates,
+                           std::vector<VideoQualityScenario>* scenarios);
+
+    //One JSON object per line, no timing fields when |with_timing| is
+    //false so the output diffs exactly.
+    static int FormatResult(const VideoQualityScenarioResult& result,
+                            bool with_timing, char* buffer, size_t capacity);
+};
+
+#endif
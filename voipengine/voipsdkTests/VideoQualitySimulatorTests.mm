@@ -0,0 +1,356 @@
+/*
+ Copyright (c) 2014-2015, GoBelieve
+ All rights reserved.
+
+ This source code is licensed under the BSD-style license found in the
+ LICENSE file in the root directory of this source tree. An additional grant
+ of patent rights can be found in the PATENTS file in the same directory.
+ */
+#import <XCTest/XCTest.h>
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "webrtc/system_wrappers/interface/tick_util.h"
+#include "VideoQualitySimulator.h"
+
+namespace {
+
+//A clip is read up to this many frames, the scenarios loop it.
+enum { kMaxClipFrames = 150 };
+enum { kFrames = 90 };
+enum { kFramerate = 30 };
+
+//A clip directory given in the environment is used instead of the clips
+//in the test bundle.
+const char kClipDirVariable[] = "VIDEO_QUALITY_CLIPS";
+//Where the results go, the temporary directory otherwise.
+const char kResultsVariable[] = "VIDEO_QUALITY_RESULTS";
+const char kResultsFile[] = "video_quality_results.json";
+
+struct ClipData {
+    std::string name;
+    int width;
+    int height;
+    int frames;
+    std::vector<uint8_t> data;
+};
+
+size_t FrameSize(int width, int height) {
+    return static_cast<size_t>(width) * height +
+           2 * static_cast<size_t>((width + 1) / 2) * ((height + 1) / 2);
+}
+
+//Clips are raw I420 named like webrtc's resources with the size last,
+//e.g. foreman_352x288.yuv.
+bool ParseClipName(const char* file, std::string* name, int* width,
+                   int* height) {
+    size_t length = strlen(file);
+    if (length < 4 || strcmp(file + length - 4, ".yuv") != 0) {
+        return false;
+    }
+    const char* size = strrchr(file, '_');
+    char end[8];
+    if (size == NULL ||
+        sscanf(size + 1, "%dx%d%7s", width, height, end) != 3 ||
+        strcmp(end, ".yuv") != 0 || *width <= 0 || *height <= 0) {
+        return false;
+    }
+    name->assign(file, size - file);
+    return true;
+}
+
+bool LoadClip(const std::string& dir, const char* file, ClipData* clip) {
+    if (!ParseClipName(file, &clip->name, &clip->width, &clip->height)) {
+        return false;
+    }
+    FILE* f = fopen((dir + "/" + file).c_str(), "rb");
+    if (f == NULL) {
+        return false;
+    }
+    size_t frame_size = FrameSize(clip->width, clip->height);
+    clip->data.resize(frame_size * kMaxClipFrames);
+    size_t read = fread(&clip->data[0], 1, clip->data.size(), f);
+    fclose(f);
+    clip->frames = static_cast<int>(read / frame_size);
+    clip->data.resize(frame_size * clip->frames);
+    return clip->frames > 0;
+}
+
+void LoadClips(const std::string& dir, std::vector<ClipData>* clips) {
+    DIR* d = opendir(dir.c_str());
+    if (d == NULL) {
+        return;
+    }
+    std::vector<std::string> files;
+    struct dirent* entry;
+    while ((entry = readdir(d)) != NULL) {
+        files.push_back(entry->d_name);
+    }
+    closedir(d);
+    //Same order on every run, the results are diffed line by line.
+    std::sort(files.begin(), files.end());
+    for (size_t i = 0; i < files.size(); i++) {
+        ClipData clip;
+        if (LoadClip(dir, files[i].c_str(), &clip)) {
+            clips->push_back(clip);
+        }
+    }
+}
+
+//A textured gradient panning under a moving square, for when no clip is
+//found. Seeded, so every run encodes the same pictures.
+void MakeSyntheticClip(int width, int height, int frames, ClipData* clip) {
+    clip->name = "synthetic";
+    clip->width = width;
+    clip->height = height;
+    clip->frames = frames;
+    size_t frame_size = FrameSize(width, height);
+    clip->data.resize(frame_size * frames);
+    int chroma_width = (width + 1) / 2;
+    int chroma_height = (height + 1) / 2;
+    uint32_t seed = 1;
+    for (int i = 0; i < frames; i++) {
+        uint8_t* y = &clip->data[frame_size * i];
+        int square_x = (i * 4) % width;
+        int square_y = height / 4;
+        for (int r = 0; r < height; r++) {
+            for (int c = 0; c < width; c++) {
+                seed = seed * 1103515245 + 12345;
+                bool inside = c >= square_x && c < square_x + height / 3 &&
+                              r >= square_y && r < square_y + height / 3;
+                int value = inside ? 220 : 16 + ((c + 2 * i + r / 2) & 127);
+                y[r * width + c] = static_cast<uint8_t>(
+                    value + ((seed >> 16) & 3));
+            }
+        }
+        uint8_t* u = y + width * height;
+        uint8_t* v = u + chroma_width * chroma_height;
+        for (int r = 0; r < chroma_height; r++) {
+            for (int c = 0; c < chroma_width; c++) {
+                u[r * chroma_width + c] = static_cast<uint8_t>(96 + (c + i) % 64);
+                v[r * chroma_width + c] = static_cast<uint8_t>(160 - r % 64);
+            }
+        }
+    }
+}
+
+VideoClip MakeVideoClip(const ClipData& data) {
+    VideoClip clip;
+    clip.name = data.name.c_str();
+    clip.data = &data.data[0];
+    clip.width = data.width;
+    clip.height = data.height;
+    clip.frames = data.frames;
+    return clip;
+}
+
+VideoQualityScenario MakeScenario(const VideoClip* clip, int width,
+                                  int height, int bitrate_kbps,
+                                  float loss_rate) {
+    VideoQualityScenario scenario;
+    scenario.clip = clip;
+    scenario.width = width;
+    scenario.height = height;
+    scenario.frames = kFrames;
+    scenario.framerate = kFramerate;
+    scenario.bitrate_kbps = bitrate_kbps;
+    scenario.loss_rate = loss_rate;
+    scenario.rtt_ms = 100;
+    scenario.seed = 1;
+    return scenario;
+}
+
+bool SameResult(const VideoQualityScenarioResult& a,
+                const VideoQualityScenarioResult& b) {
+    char line_a[1024];
+    char line_b[1024];
+    VideoQualitySimulator::FormatResult(a, false, line_a, sizeof(line_a));
+    VideoQualitySimulator::FormatResult(b, false, line_b, sizeof(line_b));
+    return strcmp(line_a, line_b) == 0;
+}
+
+//The results as a JSON array, one scenario per line.
+bool WriteResults(const std::string& path,
+                  const std::vector<VideoQualityScenarioResult>& results) {
+    FILE* f = fopen(path.c_str(), "w");
+    if (f == NULL) {
+        return false;
+    }
+    fputs("[\n", f);
+    char line[1024];
+    for (size_t i = 0; i < results.size(); i++) {
+        int n = VideoQualitySimulator::FormatResult(results[i], true, line,
+                                                    sizeof(line));
+        //Each line ends in a newline, the separator goes before it.
+        fprintf(f, "%.*s%s\n", n - 1, line,
+                i + 1 < results.size() ? "," : "");
+    }
+    fputs("]\n", f);
+    return fclose(f) == 0;
+}
+
+}  // namespace
+
+@interface VideoQualitySimulatorTests : XCTestCase
+@end
+
+@implementation VideoQualitySimulatorTests
+
+- (void)testParseClipName {
+    std::string name;
+    int width = 0;
+    int height = 0;
+    XCTAssertTrue(ParseClipName("foreman_352x288.yuv", &name, &width, &height));
+    XCTAssertTrue(name == "foreman");
+    XCTAssertEqual(width, 352);
+    XCTAssertEqual(height, 288);
+    XCTAssertTrue(ParseClipName("paris_cif_352x288.yuv", &name, &width,
+                                &height));
+    XCTAssertTrue(name == "paris_cif");
+    XCTAssertFalse(ParseClipName("foreman_cif.yuv", &name, &width, &height));
+    XCTAssertFalse(ParseClipName("foreman_352x288.y4m", &name, &width,
+                                 &height));
+    XCTAssertFalse(ParseClipName("foreman_352x288x.yuv", &name, &width,
+                                 &height));
+    XCTAssertFalse(ParseClipName("foreman_0x288.yuv", &name, &width, &height));
+}
+
+- (void)testRunIsDeterministic {
+    ClipData data;
+    MakeSyntheticClip(320, 180, 30, &data);
+    VideoClip clip = MakeVideoClip(data);
+    VideoQualityScenario scenarios[3];
+    for (int i = 0; i < 3; i++) {
+        scenarios[i] = MakeScenario(&clip, 320, 180, 500, 0.05f);
+    }
+    scenarios[2].seed = 2;
+    VideoQualityScenarioResult serial;
+    VideoQualitySimulator::Run(scenarios[0], &serial);
+    VideoQualityScenarioResult parallel[3];
+    VideoQualitySimulator::RunAll(scenarios, 3, parallel);
+    XCTAssertTrue(SameResult(serial, parallel[0]));
+    XCTAssertTrue(SameResult(serial, parallel[1]));
+    //Another loss pattern.
+    XCTAssertFalse(SameResult(serial, parallel[2]));
+}
+
+- (void)testLosslessLinkShowsEveryFrame {
+    ClipData data;
+    MakeSyntheticClip(320, 180, 30, &data);
+    VideoClip clip = MakeVideoClip(data);
+    VideoQualityScenarioResult result;
+    VideoQualitySimulator::Run(MakeScenario(&clip, 320, 180, 800, 0), &result);
+    XCTAssertEqual(result.packets_lost, 0u);
+    XCTAssertEqual(result.packets_retransmitted, 0u);
+    XCTAssertEqual(result.key_frame_requests, 0u);
+    XCTAssertEqual(result.key_frames, 1u);
+    XCTAssertEqual(result.decode_errors, 0u);
+    XCTAssertEqual(result.frames_decoded, result.frames_encoded);
+    XCTAssertTrue(result.psnr_avg > 30, @"%.2f dB", result.psnr_avg);
+    XCTAssertTrue(result.ssim_avg > 0.8, @"%.3f", result.ssim_avg);
+    XCTAssertTrue(result.latency_p50_us > 0);
+    XCTAssertTrue(result.latency_p50_us <= result.latency_max_us);
+}
+
+- (void)testLossIsRepaired {
+    ClipData data;
+    MakeSyntheticClip(320, 180, 30, &data);
+    VideoClip clip = MakeVideoClip(data);
+    VideoQualityScenarioResult result;
+    VideoQualitySimulator::Run(MakeScenario(&clip, 320, 180, 800, 0.05f),
+                               &result);
+    XCTAssertTrue(result.packets_lost > 0);
+    XCTAssertTrue(result.packets_retransmitted > 0);
+    XCTAssertTrue(result.frames_frozen < kFrames / 4, @"%llu frozen",
+                  static_cast<unsigned long long>(result.frames_frozen));
+    XCTAssertEqual(result.decode_errors, 0u);
+}
+
+- (void)testRejectsMissingClip {
+    VideoQualityScenarioResult result;
+    VideoQualitySimulator::Run(MakeScenario(NULL, 320, 180, 500, 0), &result);
+    XCTAssertEqual(result.frames_encoded, 0u);
+    XCTAssertEqual(result.packets_sent, 0u);
+}
+
+//Every clip found, or the synthetic one, at its own size and half of it
+//across bitrates and loss rates, in parallel. The results are written as
+//JSON to diff against another build, without the timing fields the lines
+//are deterministic.
+- (void)testBenchmarkMatrix {
+    std::vector<ClipData> data;
+    const char* dir = getenv(kClipDirVariable);
+    if (dir != NULL) {
+        LoadClips(dir, &data);
+    } else {
+        NSString* resources =
+            [[NSBundle bundleForClass:[self class]] resourcePath];
+        LoadClips([resources UTF8String], &data);
+    }
+    if (data.empty()) {
+        ClipData synthetic;
+        MakeSyntheticClip(640, 360, 60, &synthetic);
+        data.push_back(synthetic);
+    }
+    std::vector<VideoClip> clips;
+    for (size_t i = 0; i < data.size(); i++) {
+        clips.push_back(MakeVideoClip(data[i]));
+    }
+
+    static const int kBitrates[] = { 300, 800, 1500 };
+    static const float kLossRates[] = { 0, 0.02f, 0.05f };
+    std::vector<VideoQualityScenario> scenarios;
+    for (size_t i = 0; i < clips.size(); i++) {
+        //Even sizes keep the chroma exact.
+        VideoQualitySize sizes[] = {
+            { clips[i].width & ~1, clips[i].height & ~1 },
+            { (clips[i].width / 2) & ~1, (clips[i].height / 2) & ~1 },
+        };
+        VideoQualityScenario base = MakeScenario(&clips[i], 0, 0, 0, 0);
+        VideoQualitySimulator::MakeMatrix(base, sizes, 2, kBitrates, 3,
+                                          kLossRates, 3, &scenarios);
+    }
+    std::vector<VideoQualityScenarioResult> results(scenarios.size());
+
+    int64_t start = webrtc::TickTime::MicrosecondTimestamp();
+    VideoQualitySimulator::RunAll(&scenarios[0],
+                                  static_cast<int>(scenarios.size()),
+                                  &results[0]);
+    int64_t elapsed_us = webrtc::TickTime::MicrosecondTimestamp() - start;
+
+    //The lines end in a newline, NSLog adds its own.
+    char line[1024];
+    for (size_t i = 0; i < results.size(); i++) {
+        int n = VideoQualitySimulator::FormatResult(results[i], true, line,
+                                                    sizeof(line));
+        NSLog(@"%.*s", n - 1, line);
+        XCTAssertTrue(results[i].frames_encoded > 0);
+    }
+    NSLog(@"video quality simulator: %d scenarios of %d clips in %lld ms",
+          static_cast<int>(scenarios.size()), static_cast<int>(clips.size()),
+          static_cast<long long>(elapsed_us / 1000));
+
+    const char* results_path = getenv(kResultsVariable);
+    std::string path;
+    if (results_path != NULL) {
+        path = results_path;
+    } else {
+        path = std::string([NSTemporaryDirectory() UTF8String]) + "/" +
+               kResultsFile;
+    }
+    XCTAssertTrue(WriteResults(path, results), @"%s", path.c_str());
+    NSLog(@"video quality results: %s", path.c_str());
+
+    VideoQualityScenario* s = &scenarios[0];
+    VideoQualityScenarioResult* r = &results[0];
+    [self measureBlock:^{
+        VideoQualitySimulator::Run(*s, r);
+    }];
+}
+
+@end